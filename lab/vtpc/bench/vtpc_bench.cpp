@@ -0,0 +1,297 @@
+#include <sys/types.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "exception.hpp"
+#include "file.hpp"
+
+extern "C" {
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+// Runs the workloads over vt::file with the libc and the vtpc backends at
+// every file size, and for vtpc at every cache size, and prints one CSV row
+// per run: throughput over the whole run, final sync included, and the
+// latency percentiles of single operations.
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+constexpr size_t mib = 1024 * 1024;
+constexpr double zipf_theta = 0.99;
+constexpr uint64_t seed = 1;
+
+struct options {
+  std::string path = "/tmp/vtpc_bench";
+  size_t io_size = 4096;
+  size_t ops = 20000;
+  std::vector<size_t> file_mib = {8, 64};
+  std::vector<size_t> cache_blocks = {1024, 16384};
+  std::vector<std::string> workloads = {
+      "seq_read", "seq_write", "uniform_read", "zipf_read", "mix"
+  };
+  std::vector<std::string> backends = {"libc", "vtpc"};
+};
+
+// Zipfian ranks over [0, n), rank 0 the most popular, by the method of Gray
+// et al. ("Quickly generating billion-record synthetic databases") used by
+// YCSB.
+class zipf {
+public:
+  zipf(size_t n, double theta) : n_(n), theta_(theta) {
+    for (size_t i = 1; i <= n; ++i) {
+      zeta_n_ += 1.0 / std::pow(static_cast<double>(i), theta);
+    }
+    const double zeta_2 = 1.0 + (1.0 / std::pow(2.0, theta));
+    alpha_ = 1.0 / (1.0 - theta);
+    eta_ = (1.0 - std::pow(2.0 / static_cast<double>(n), 1.0 - theta)) /
+           (1.0 - (zeta_2 / zeta_n_));
+  }
+
+  template <class R>
+  auto operator()(R& random) -> size_t {
+    const double u = std::uniform_real_distribution<double>(0, 1)(random);
+    const double uz = u * zeta_n_;
+    if (uz < 1.0) {
+      return 0;
+    }
+    if (uz < 1.0 + std::pow(0.5, theta_)) {
+      return n_ > 1 ? 1 : 0;
+    }
+    const auto rank = static_cast<size_t>(
+        static_cast<double>(n_) * std::pow((eta_ * u) - eta_ + 1.0, alpha_)
+    );
+    return std::min(rank, n_ - 1);
+  }
+
+private:
+  size_t n_;
+  double theta_;
+  double zeta_n_ = 0;
+  double alpha_ = 0;
+  double eta_ = 0;
+};
+
+struct op {
+  size_t index;  // In units of the I/O size.
+  bool write;
+};
+
+// The offsets and kinds of the operations of a workload, drawn up front so
+// the random generators stay out of the measurement.
+auto plan(std::string_view workload, size_t slots, size_t ops)
+    -> std::vector<op> {
+  std::default_random_engine random(seed);  // NOLINT
+  std::uniform_int_distribution<size_t> uniform(0, slots - 1);
+  std::uniform_int_distribution<size_t> percent(0, 99);  // NOLINT
+  zipf skewed(slots, zipf_theta);
+
+  std::vector<op> plan(ops);
+  for (size_t i = 0; i < ops; ++i) {
+    if (workload == "seq_read") {
+      plan[i] = {.index = i % slots, .write = false};
+    } else if (workload == "seq_write") {
+      plan[i] = {.index = i % slots, .write = true};
+    } else if (workload == "uniform_read") {
+      plan[i] = {.index = uniform(random), .write = false};
+    } else if (workload == "zipf_read") {
+      plan[i] = {.index = skewed(random), .write = false};
+    } else if (workload == "mix") {
+      // 70% reads, 30% writes, both Zipfian.
+      plan[i] = {.index = skewed(random), .write = percent(random) >= 70};
+    } else {
+      throw vt::exception() << "unknown workload '" << workload << "'";
+    }
+  }
+  return plan;
+}
+
+void prepare(const options& opts, size_t file_mib) {
+  auto file = vt::file::open_libc(opts.path);
+  const std::string chunk(mib, 'x');
+  file->seek(0);
+  for (size_t i = 0; i < file_mib; ++i) {
+    file->write(chunk);
+  }
+  file->sync();
+}
+
+auto open(std::string_view backend, const options& opts, size_t cache_blocks)
+    -> std::unique_ptr<vt::file> {
+  if (backend == "libc") {
+    return vt::file::open_libc(opts.path);
+  }
+  if (backend != "vtpc") {
+    throw vt::exception() << "unknown backend '" << backend << "'";
+  }
+  vt::init_vtpc([&](vtpc_config& config) { config.capacity = cache_blocks; });
+  return vt::file::open_vtpc(opts.path);
+}
+
+auto percentile(const std::vector<uint64_t>& sorted, size_t permille)
+    -> uint64_t {
+  return sorted[std::min(sorted.size() - 1, sorted.size() * permille / 1000)];
+}
+
+void run(
+    const options& opts, std::string_view backend, std::string_view workload,
+    size_t file_mib, size_t cache_blocks
+) {
+  const size_t slots = file_mib * mib / opts.io_size;
+  const std::vector<op> ops = plan(workload, slots, opts.ops);
+  std::string buffer(opts.io_size, 'y');
+  std::vector<uint64_t> latencies;
+  latencies.reserve(ops.size());
+
+  auto file = open(backend, opts, cache_blocks);
+  const auto start = clock_type::now();
+  for (const op& op : ops) {
+    const auto before = clock_type::now();
+    file->seek(static_cast<off_t>(op.index * opts.io_size));
+    if (op.write) {
+      file->write(buffer.data(), buffer.size());
+    } else {
+      file->read(buffer.data(), buffer.size());
+    }
+    latencies.push_back(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            clock_type::now() - before
+        )
+            .count()
+    );
+  }
+  file->sync();
+  file.reset();
+  const double seconds =
+      std::chrono::duration<double>(clock_type::now() - start).count();
+
+  std::ranges::sort(latencies);
+  const double count = static_cast<double>(ops.size());
+  std::printf(
+      "%.*s,%.*s,%zu,%zu,%zu,%zu,%.6f,%.0f,%.2f,%llu,%llu,%llu,%llu\n",
+      static_cast<int>(backend.size()),
+      backend.data(),
+      static_cast<int>(workload.size()),
+      workload.data(),
+      file_mib,
+      backend == "vtpc" ? cache_blocks : 0,
+      opts.io_size,
+      ops.size(),
+      seconds,
+      count / seconds,
+      count * static_cast<double>(opts.io_size) / static_cast<double>(mib) /
+          seconds,
+      static_cast<unsigned long long>(percentile(latencies, 500)),  // NOLINT
+      static_cast<unsigned long long>(percentile(latencies, 990)),  // NOLINT
+      static_cast<unsigned long long>(percentile(latencies, 999)),  // NOLINT
+      static_cast<unsigned long long>(latencies.back())
+  );
+  std::fflush(stdout);
+}
+
+auto split(std::string_view text) -> std::vector<std::string> {
+  std::vector<std::string> parts;
+  while (!text.empty()) {
+    const size_t comma = text.find(',');
+    parts.emplace_back(text.substr(0, comma));
+    text = comma == std::string_view::npos ? "" : text.substr(comma + 1);
+  }
+  return parts;
+}
+
+auto split_sizes(std::string_view text) -> std::vector<size_t> {
+  std::vector<size_t> sizes;
+  for (const std::string& part : split(text)) {
+    char* end = nullptr;
+    const unsigned long long value = std::strtoull(part.c_str(), &end, 0);
+    if (*end != '\0' || value == 0) {
+      throw vt::exception() << "bad size '" << part << "'";
+    }
+    sizes.push_back(value);
+  }
+  return sizes;
+}
+
+auto parse(int argc, char** argv) -> options {
+  options opts;
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "f:s:c:w:b:n:i:")) != -1) {
+    switch (opt) {
+      case 'f':
+        opts.path = optarg;
+        break;
+      case 's':
+        opts.file_mib = split_sizes(optarg);
+        break;
+      case 'c':
+        opts.cache_blocks = split_sizes(optarg);
+        break;
+      case 'w':
+        opts.workloads = split(optarg);
+        break;
+      case 'b':
+        opts.backends = split(optarg);
+        break;
+      case 'n':
+        opts.ops = split_sizes(optarg).at(0);
+        break;
+      case 'i':
+        opts.io_size = split_sizes(optarg).at(0);
+        break;
+      default:
+        throw vt::exception()
+            << "usage: " << argv[0]  // NOLINT
+            << " [-f path] [-s file_mib,...] [-c cache_blocks,...]"
+               " [-w workload,...] [-b backend,...] [-n ops] [-i io_size]";
+    }
+  }
+  return opts;
+}
+
+}  // namespace
+
+auto main(int argc, char** argv) -> int try {
+  const options opts = parse(argc, argv);
+  std::printf(
+      "backend,workload,file_mib,cache_blocks,io_size,ops,seconds,ops_per_s,"
+      "mib_per_s,p50_ns,p99_ns,p999_ns,max_ns\n"
+  );
+  for (const size_t file_mib : opts.file_mib) {
+    if (file_mib * mib < opts.io_size) {
+      throw vt::exception() << "file of " << file_mib
+                            << " MiB is smaller than an operation";
+    }
+    prepare(opts, file_mib);
+    for (const std::string& backend : opts.backends) {
+      // The page cache of libc has no size to vary.
+      const std::vector<size_t> caches =
+          backend == "vtpc" ? opts.cache_blocks : std::vector<size_t>{0};
+      for (const size_t cache_blocks : caches) {
+        for (const std::string& workload : opts.workloads) {
+          run(opts, backend, workload, file_mib, cache_blocks);
+        }
+      }
+    }
+  }
+  (void)::unlink(opts.path.c_str());
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -1,30 +1,1196 @@
+#define _GNU_SOURCE
+
 #include "vtpc.h"
 
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "vtpc_internal.h"
+
+#define VTPC_DEFAULT_BLOCK_SIZE 4096
+#define VTPC_DEFAULT_CAPACITY 1024
+#define VTPC_DEFAULT_PRIVATE_CAPACITY 256
+#define VTPC_DEFAULT_POLICY "lru"
+#define VTPC_DEFAULT_HUGEPAGES "thp"
+#define VTPC_DEFAULT_READAHEAD 64
+#define VTPC_DEFAULT_SCAN 256
+#define VTPC_DEFAULT_BYPASS 256
+#define VTPC_DEFAULT_DIRTY_HIGH 20
+#define VTPC_DEFAULT_DIRTY_LOW 10
+#define VTPC_DEFAULT_DIRTY_EXPIRE_MS 1000
+#define VTPC_DEFAULT_PRESSURE_HIGH 10
+#define VTPC_DEFAULT_PRESSURE_PERIOD_MS 1000
+
+// The largest off_t, a signed type without a limit macro of its own.
+#define VTPC_OFF_MAX \
+  ((off_t)((UINTMAX_C(1) << ((sizeof(off_t) * CHAR_BIT) - 1)) - 1))
+
+// Descriptors live in chunks that are never moved or freed, so they are
+// looked up without `vtpc_mutex`.
+#define VTPC_FD_CHUNK 1024
+#define VTPC_FD_CHUNKS 1024
+
+// Calls that move the offset hold `lock` exclusively, positional ones share
+// it, so threads can read and write one descriptor at once.
+struct vtpc_fd {
+  pthread_rwlock_t lock;
+  struct vtpc_file* file;
+  off_t pos;
+  int mode;
+  // POSIX_FADV_NORMAL, _SEQUENTIAL, _RANDOM or _NOREUSE, set by vtpc_fadvise.
+  int advice;
+  // Positional reads race for the streams; the loser skips readahead.
+  pthread_mutex_t ra_lock;
+  struct vtpc_readahead ra;
+};
+
+pthread_mutex_t vtpc_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static _Atomic(struct vtpc_fd*) fd_chunks[VTPC_FD_CHUNKS];
+static struct vtpc_file* files;
+static uint64_t next_file_id = 1;
+static bool stats_at_exit;
+
+static const char* env_string(const char* name, const char* fallback) {
+  const char* value = getenv(name);  // NOLINT(concurrency-mt-unsafe)
+  return value == NULL || *value == '\0' ? fallback : value;
+}
+
+static size_t env_size(const char* name, size_t fallback) {
+  const char* value = getenv(name);  // NOLINT(concurrency-mt-unsafe)
+  if (value == NULL || *value == '\0') {
+    return fallback;
+  }
+  char* end = NULL;
+  const unsigned long long parsed = strtoull(value, &end, 0);
+  if (*end != '\0') {
+    return fallback;
+  }
+  return (size_t)parsed;
+}
+
+void vtpc_config_default(struct vtpc_config* config) {
+  config->block_size = env_size("VTPC_BLOCK_SIZE", VTPC_DEFAULT_BLOCK_SIZE);
+  config->shared = env_string("VTPC_SHARED", NULL);
+  // Behind a shared segment the private pool only holds the blocks the
+  // process is using, and the segment gets the default capacity.
+  config->capacity = env_size(
+      "VTPC_CAPACITY",
+      config->shared == NULL ? VTPC_DEFAULT_CAPACITY
+                             : VTPC_DEFAULT_PRIVATE_CAPACITY
+  );
+  config->shards = env_size("VTPC_SHARDS", 0);
+  config->policy = env_string("VTPC_POLICY", VTPC_DEFAULT_POLICY);
+  config->opt_fallback =
+      env_string("VTPC_OPT_FALLBACK", VTPC_DEFAULT_POLICY);
+  config->readahead = env_size("VTPC_READAHEAD", VTPC_DEFAULT_READAHEAD);
+  config->scan = env_size("VTPC_SCAN", VTPC_DEFAULT_SCAN);
+  config->bypass = env_size("VTPC_BYPASS", VTPC_DEFAULT_BYPASS);
+  config->admission = env_size("VTPC_ADMISSION", 0) != 0;
+  config->flusher = env_size("VTPC_FLUSHER", 0) != 0;
+  config->dirty_high = env_size("VTPC_DIRTY_HIGH", VTPC_DEFAULT_DIRTY_HIGH);
+  config->dirty_low = env_size("VTPC_DIRTY_LOW", VTPC_DEFAULT_DIRTY_LOW);
+  config->dirty_expire_ms =
+      env_size("VTPC_DIRTY_EXPIRE_MS", VTPC_DEFAULT_DIRTY_EXPIRE_MS);
+  config->stats = env_size("VTPC_STATS", 0) != 0;
+  config->mrc = env_size("VTPC_MRC", 0);
+  config->trace = env_string("VTPC_TRACE", NULL);
+  config->shared_capacity = env_size(
+      "VTPC_SHARED_CAPACITY", config->shared == NULL ? 0 : VTPC_DEFAULT_CAPACITY
+  );
+  config->io_depth = env_size("VTPC_IO_DEPTH", 0);
+  config->async_threads = env_size("VTPC_ASYNC_THREADS", 4);
+  config->hugepages = env_string("VTPC_HUGEPAGES", VTPC_DEFAULT_HUGEPAGES);
+  config->mlock = env_size("VTPC_MLOCK", 0) != 0;
+  config->min_capacity = env_size("VTPC_MIN_CAPACITY", 0);
+  config->pressure = env_string("VTPC_PRESSURE", NULL);
+  config->pressure_high =
+      env_size("VTPC_PRESSURE_HIGH", VTPC_DEFAULT_PRESSURE_HIGH);
+  config->pressure_period_ms =
+      env_size("VTPC_PRESSURE_PERIOD_MS", VTPC_DEFAULT_PRESSURE_PERIOD_MS);
+  config->warm = env_string("VTPC_WARM", NULL);
+}
+
+// Dirty blocks of files the program never closed are written back at exit,
+// like stdio buffers, before the statistics are printed. The asynchronous
+// requests are finished first, as their callbacks may open or close files.
+static void flush_all(void) {
+  vtpc_async_stop();
+  pthread_mutex_lock(&vtpc_mutex);
+  vtpc_elastic_stop();
+  vtpc_writeback_stop();
+  for (struct vtpc_file* file = files; file != NULL; file = file->next) {
+    vtpc_warm_cancel(file);
+    pthread_mutex_lock(&file->write_lock);
+    if (vtpc_flush_file(file) == 0) {
+      (void)vtpc_warm_record(file);
+    }
+    pthread_mutex_unlock(&file->write_lock);
+  }
+  vtpc_trace_stop();
+  if (stats_at_exit) {
+    (void)vtpc_stats_dump(STDERR_FILENO);
+  }
+  pthread_mutex_unlock(&vtpc_mutex);
+}
+
+static int cache_init(const struct vtpc_config* config) {
+  static bool registered = false;
+  if (!registered) {
+    if (atexit(flush_all) != 0) {
+      errno = ENOMEM;
+      return -1;
+    }
+    registered = true;
+  }
+  // The pool is replaced under the thread resizing it.
+  vtpc_elastic_stop();
+  if (vtpc_cache_init(config) == -1) {
+    return -1;
+  }
+  stats_at_exit = config->stats;
+  if (vtpc_mrc_start(config) == -1 || vtpc_trace_start(config) == -1 ||
+      vtpc_shared_start(config) == -1 || vtpc_async_start(config) == -1 ||
+      vtpc_warm_start(config) == -1 || vtpc_writeback_start(config) == -1) {
+    return -1;
+  }
+  return vtpc_elastic_start(config);
+}
+
+static int ensure_init(void) {
+  if (vtpc_cache_ready()) {
+    return 0;
+  }
+  struct vtpc_config config;
+  vtpc_config_default(&config);
+  return cache_init(&config);
+}
+
+int vtpc_init(const struct vtpc_config* config) {
+  // Prefetches in flight hold their files open, so they finish first.
+  vtpc_async_stop();
+  pthread_mutex_lock(&vtpc_mutex);
+  int result = -1;
+  if (files != NULL) {
+    errno = EBUSY;
+  } else {
+    result = cache_init(config);
+  }
+  pthread_mutex_unlock(&vtpc_mutex);
+  return result;
+}
+
+// Returns the descriptor locked, or NULL with errno set.
+static struct vtpc_fd* fd_lock(int fd, bool shared) {
+  struct vtpc_fd* chunk = NULL;
+  if (fd >= 0 && fd < VTPC_FD_CHUNK * VTPC_FD_CHUNKS) {
+    chunk = atomic_load_explicit(
+        &fd_chunks[fd / VTPC_FD_CHUNK], memory_order_acquire
+    );
+  }
+  if (chunk == NULL) {
+    errno = EBADF;
+    return NULL;
+  }
+  struct vtpc_fd* entry = &chunk[fd % VTPC_FD_CHUNK];
+  if (shared) {
+    pthread_rwlock_rdlock(&entry->lock);
+  } else {
+    pthread_rwlock_wrlock(&entry->lock);
+  }
+  if (entry->file == NULL) {
+    pthread_rwlock_unlock(&entry->lock);
+    errno = EBADF;
+    return NULL;
+  }
+  return entry;
+}
+
+static void fd_unlock(struct vtpc_fd* entry) {
+  pthread_rwlock_unlock(&entry->lock);
+}
+
+// Called with `vtpc_mutex` held.
+static struct vtpc_fd* fd_reserve(int fd) {
+  if (fd >= VTPC_FD_CHUNK * VTPC_FD_CHUNKS) {
+    errno = EMFILE;
+    return NULL;
+  }
+  _Atomic(struct vtpc_fd*)* slot = &fd_chunks[fd / VTPC_FD_CHUNK];
+  struct vtpc_fd* chunk = atomic_load_explicit(slot, memory_order_relaxed);
+  if (chunk == NULL) {
+    chunk = calloc(VTPC_FD_CHUNK, sizeof(struct vtpc_fd));
+    if (chunk == NULL) {
+      errno = ENOMEM;
+      return NULL;
+    }
+    for (size_t i = 0; i < VTPC_FD_CHUNK; ++i) {
+      pthread_rwlock_init(&chunk[i].lock, NULL);
+      pthread_mutex_init(&chunk[i].ra_lock, NULL);
+    }
+    atomic_store_explicit(slot, chunk, memory_order_release);
+  }
+  return &chunk[fd % VTPC_FD_CHUNK];
+}
+
+static int open_direct(const char* path, const struct stat* st) {
+  static const int modes[] = {O_RDWR, O_RDONLY, O_WRONLY};
+
+  int fd = -1;
+  for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]) && fd == -1; ++i) {
+    fd = open(path, modes[i] | O_DIRECT | O_CLOEXEC);
+    if (fd == -1 && errno == EINVAL) {
+      // The filesystem does not support O_DIRECT (e.g. tmpfs).
+      fd = open(path, modes[i] | O_CLOEXEC);
+    }
+    if (fd == -1 && errno != EACCES && errno != EROFS && errno != EPERM) {
+      return -1;
+    }
+  }
+  if (fd == -1) {
+    return -1;
+  }
+
+  struct stat direct;
+  if (fstat(fd, &direct) == -1 || direct.st_dev != st->st_dev ||
+      direct.st_ino != st->st_ino) {
+    close(fd);
+    errno = ESTALE;
+    return -1;
+  }
+  return fd;
+}
+
+static struct vtpc_file* file_get(const char* path, const struct stat* st) {
+  for (struct vtpc_file* file = files; file != NULL; file = file->next) {
+    if (file->dev == st->st_dev && file->ino == st->st_ino) {
+      file->refs++;
+      return file;
+    }
+  }
+
+  struct vtpc_file* file = calloc(1, sizeof(struct vtpc_file));
+  if (file == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  if (vtpc_cache_file_init(file) == -1) {
+    free(file);
+    return NULL;
+  }
+  file->fd = open_direct(path, st);
+  if (file->fd == -1) {
+    vtpc_cache_file_destroy(file);
+    free(file);
+    return NULL;
+  }
+  file->id = next_file_id++;
+  file->dev = st->st_dev;
+  file->ino = st->st_ino;
+  file->refs = 1;
+  atomic_init(&file->size, st->st_size);
+  atomic_init(&file->disk_size, st->st_size);
+  atomic_init(&file->resident, 0);
+  atomic_init(&file->reserve, 0);
+  atomic_init(&file->limit, 0);
+  pthread_mutex_init(&file->write_lock, NULL);
+  pthread_mutex_init(&file->blocks_lock, NULL);
+  file->next = files;
+  files = file;
+  return file;
+}
+
+static int file_put(struct vtpc_file* file) {
+  if (--file->refs > 0) {
+    return 0;
+  }
+  vtpc_warm_cancel(file);
+  vtpc_writeback_detach(file);
+  pthread_mutex_lock(&file->write_lock);
+  const int result = vtpc_flush_file(file);
+  const int err = errno;
+  if (result == 0) {
+    (void)vtpc_warm_record(file);
+  }
+  vtpc_cache_drop_file(file);
+  pthread_mutex_unlock(&file->write_lock);
+  close(file->fd);
+
+  struct vtpc_file** link = &files;
+  while (*link != file) {
+    link = &(*link)->next;
+  }
+  *link = file->next;
+  pthread_mutex_destroy(&file->write_lock);
+  pthread_mutex_destroy(&file->blocks_lock);
+  vtpc_cache_file_destroy(file);
+  free(file);
+  errno = err;
+  return result;
+}
+
+// The kernel has already truncated the file, but a writeback in flight may
+// have extended it again with stale data, so it is truncated once more after
+// the cached blocks past `length` are gone. The block cut in two is written
+// back first, as the part of it that is kept may be dirty.
+static int file_truncate(struct vtpc_file* file, off_t length) {
+  const size_t block_size = vtpc_cache_block_size();
+  const uint64_t first = (uint64_t)length / block_size;
+  vtpc_warm_cancel(file);
+  pthread_mutex_lock(&file->write_lock);
+  int result = 0;
+  if (first == 0) {
+    vtpc_cache_drop_file(file);
+  } else {
+    if ((uint64_t)length % block_size != 0) {
+      result = vtpc_flush_range(file, first, first);
+    }
+    vtpc_cache_drop_range(file, first, UINT64_MAX);
+  }
+  vtpc_writeback_wait(file);
+  if (ftruncate(file->fd, length) == -1 && errno != EBADF && errno != EINVAL) {
+    result = -1;
+  }
+  vtpc_shared_forget_range(file, first, UINT64_MAX);
+  atomic_store(&file->size, length);
+  atomic_store(&file->disk_size, length);
+  pthread_mutex_unlock(&file->write_lock);
+  return result;
+}
+
+static int open_locked(const char* path, int mode, int access) {
+  if (ensure_init() == -1) {
+    return -1;
+  }
+
+  const int fd = open(path, mode & ~O_DIRECT, access);
+  if (fd == -1) {
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return -1;
+  }
+  if (!S_ISREG(st.st_mode)) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+  struct vtpc_fd* entry = fd_reserve(fd);
+  if (entry == NULL) {
+    close(fd);
+    return -1;
+  }
+
+  struct vtpc_file* file = file_get(path, &st);
+  if (file == NULL) {
+    close(fd);
+    return -1;
+  }
+  if ((mode & O_TRUNC) != 0 && file_truncate(file, 0) == -1) {
+    const int err = errno;
+    file_put(file);
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  if (file->refs == 1 && (mode & O_TRUNC) == 0) {
+    vtpc_warm_load(file, &st);
+  }
+
+  pthread_rwlock_wrlock(&entry->lock);
+  entry->file = file;
+  entry->pos = 0;
+  entry->mode = mode;
+  entry->advice = POSIX_FADV_NORMAL;
+  memset(&entry->ra, 0, sizeof(entry->ra));
+  fd_unlock(entry);
+  return fd;
+}
+
 int vtpc_open(const char* path, int mode, int access) {
-  return open(path, mode, access);
+  pthread_mutex_lock(&vtpc_mutex);
+  const int fd = open_locked(path, mode, access);
+  pthread_mutex_unlock(&vtpc_mutex);
+  return fd;
 }
 
 int vtpc_close(int fd) {
-  return close(fd);
+  pthread_mutex_lock(&vtpc_mutex);
+  struct vtpc_fd* entry = fd_lock(fd, false);
+  if (entry == NULL) {
+    pthread_mutex_unlock(&vtpc_mutex);
+    return -1;
+  }
+  struct vtpc_file* file = entry->file;
+  entry->file = NULL;
+  fd_unlock(entry);
+
+  const int flushed = file_put(file);
+  const int err = errno;
+  const int closed = close(fd);
+  pthread_mutex_unlock(&vtpc_mutex);
+  if (closed == -1) {
+    return -1;
+  }
+  errno = err;
+  return flushed;
+}
+
+int vtpc_dup2(int oldfd, int newfd) {
+  pthread_mutex_lock(&vtpc_mutex);
+  struct vtpc_fd* entry = fd_lock(oldfd, false);
+  if (entry == NULL) {
+    pthread_mutex_unlock(&vtpc_mutex);
+    return -1;
+  }
+  struct vtpc_file* file = entry->file;
+  const off_t pos = entry->pos;
+  const int mode = entry->mode;
+  const int advice = entry->advice;
+  fd_unlock(entry);
+  if (oldfd == newfd) {
+    pthread_mutex_unlock(&vtpc_mutex);
+    return newfd;
+  }
+
+  struct vtpc_fd* target = fd_reserve(newfd);
+  if (target == NULL || dup2(oldfd, newfd) == -1) {
+    pthread_mutex_unlock(&vtpc_mutex);
+    return -1;
+  }
+  // dup2 has closed what `newfd` referred to; its file is released here and,
+  // like dup2, without reporting a failed flush.
+  pthread_rwlock_wrlock(&target->lock);
+  struct vtpc_file* replaced = target->file;
+  file->refs++;
+  target->file = file;
+  target->pos = pos;
+  target->mode = mode;
+  target->advice = advice;
+  memset(&target->ra, 0, sizeof(target->ra));
+  fd_unlock(target);
+  if (replaced != NULL) {
+    (void)file_put(replaced);
+  }
+  pthread_mutex_unlock(&vtpc_mutex);
+  return newfd;
+}
+
+void vtpc_iter_copy(
+    struct vtpc_iter* it, char* data, size_t count, bool out
+) {
+  while (count > 0) {
+    const size_t room = it->iov->iov_len - it->offset;
+    if (room == 0) {
+      ++it->iov;
+      it->offset = 0;
+      continue;
+    }
+    const size_t chunk = room < count ? room : count;
+    char* base = (char*)it->iov->iov_base + it->offset;
+    if (out) {
+      memcpy(base, data, chunk);
+    } else {
+      memcpy(data, base, chunk);
+    }
+    it->offset += chunk;
+    data += chunk;
+    count -= chunk;
+  }
+}
+
+// A request is split into the whole blocks it moves past the cache, if it
+// covers enough of them, and the partial blocks around them.
+struct vtpc_part {
+  off_t pos;
+  size_t count;
+  bool direct;
+};
+
+static size_t split(off_t pos, off_t end, struct vtpc_part parts[3]) {
+  const size_t block_size = vtpc_cache_block_size();
+  const size_t min = vtpc_cache_bypass_min();
+  const uint64_t first = ((uint64_t)pos + block_size - 1) / block_size;
+  const uint64_t last = (uint64_t)end / block_size;
+  if (min == 0 || last <= first || last - first < min) {
+    parts[0] = (struct vtpc_part){.pos = pos, .count = (size_t)(end - pos)};
+    return 1;
+  }
+  const off_t start = (off_t)(first * block_size);
+  const off_t stop = (off_t)(last * block_size);
+  size_t count = 0;
+  if (start > pos) {
+    parts[count++] =
+        (struct vtpc_part){.pos = pos, .count = (size_t)(start - pos)};
+  }
+  parts[count++] = (struct vtpc_part){
+      .pos = start, .count = (size_t)(stop - start), .direct = true
+  };
+  if (end > stop) {
+    parts[count++] =
+        (struct vtpc_part){.pos = stop, .count = (size_t)(end - stop)};
+  }
+  return count;
+}
+
+// Every block is copied with its shard locked, into as many buffers as it
+// covers. The range is within the file.
+static ssize_t read_cached(
+    struct vtpc_file* file,
+    struct vtpc_iter* it,
+    size_t count,
+    off_t pos,
+    enum vtpc_access access
+) {
+  const size_t block_size = vtpc_cache_block_size();
+  size_t done = 0;
+  while (done < count) {
+    const uint64_t index = (uint64_t)pos / block_size;
+    const size_t shift = (size_t)pos % block_size;
+    size_t chunk = block_size - shift;
+    if (chunk > count - done) {
+      chunk = count - done;
+    }
+
+    struct vtpc_block* block = vtpc_cache_get(file, index, access);
+    if (block == NULL) {
+      return done > 0 ? (ssize_t)done : -1;
+    }
+    vtpc_iter_copy(it, block->data + shift, chunk, true);
+    vtpc_block_unlock(block);
+    done += chunk;
+    pos += (off_t)chunk;
+  }
+  return (ssize_t)done;
+}
+
+// Falls back to the cache when the disk cannot be read directly.
+static ssize_t read_direct(
+    struct vtpc_file* file, struct vtpc_iter* it, size_t count, off_t pos
+) {
+  const struct vtpc_iter start = *it;
+  if (vtpc_bypass_read(file, it, count, pos) == 0) {
+    return (ssize_t)count;
+  }
+  *it = start;
+  return read_cached(file, it, count, pos, VTPC_ACCESS_READ);
+}
+
+// Needs no file lock: the size is read once, and the blocks are copied with
+// their shards locked or read directly under `write_lock`.
+static ssize_t file_read(
+    struct vtpc_fd* entry, const struct iovec* iov, size_t count, off_t pos
+) {
+  struct vtpc_file* file = entry->file;
+  const size_t block_size = vtpc_cache_block_size();
+  const off_t size = atomic_load(&file->size);
+  if (count == 0 || pos >= size) {
+    return 0;
+  }
+  const off_t end = size - pos < (off_t)count ? size : pos + (off_t)count;
+
+  struct vtpc_part parts[3];
+  const size_t part_count = split(pos, end, parts);
+  // Large requests bypassing the cache are left out of the streams. Reads
+  // advised sequential or not to be reused are kept off the policy, so their
+  // blocks are the first to go once they are behind the reader.
+  const int advice = entry->advice;
+  enum vtpc_access access =
+      advice == POSIX_FADV_SEQUENTIAL || advice == POSIX_FADV_NOREUSE
+          ? VTPC_ACCESS_SCAN
+          : VTPC_ACCESS_READ;
+  if (part_count == 1 && advice != POSIX_FADV_RANDOM &&
+      pthread_mutex_trylock(&entry->ra_lock) == 0) {
+    if (vtpc_readahead(
+            &entry->ra,
+            file,
+            (uint64_t)pos / block_size,
+            (uint64_t)(end - 1) / block_size,
+            advice == POSIX_FADV_SEQUENTIAL
+        )) {
+      access = VTPC_ACCESS_SCAN;
+    }
+    pthread_mutex_unlock(&entry->ra_lock);
+  }
+
+  struct vtpc_iter it = {.iov = iov, .offset = 0};
+  size_t done = 0;
+  for (size_t i = 0; i < part_count; ++i) {
+    const struct vtpc_part* part = &parts[i];
+    const ssize_t n =
+        part->direct ? read_direct(file, &it, part->count, part->pos)
+                     : read_cached(file, &it, part->count, part->pos, access);
+    if (n < 0) {
+      return done > 0 ? (ssize_t)done : -1;
+    }
+    done += (size_t)n;
+    if ((size_t)n < part->count) {
+      break;
+    }
+  }
+  return (ssize_t)done;
+}
+
+// Called with `write_lock` of the file held, like the two below.
+static ssize_t write_cached(
+    struct vtpc_file* file, struct vtpc_iter* it, size_t count, off_t pos
+) {
+  const size_t block_size = vtpc_cache_block_size();
+  size_t done = 0;
+  while (done < count) {
+    const uint64_t index = (uint64_t)pos / block_size;
+    const size_t shift = (size_t)pos % block_size;
+    size_t chunk = block_size - shift;
+    if (chunk > count - done) {
+      chunk = count - done;
+    }
+
+    struct vtpc_block* block = vtpc_cache_get(
+        file,
+        index,
+        chunk == block_size ? VTPC_ACCESS_OVERWRITE : VTPC_ACCESS_WRITE
+    );
+    if (block == NULL) {
+      break;
+    }
+    vtpc_iter_copy(it, block->data + shift, chunk, false);
+    vtpc_block_dirty(block);
+    vtpc_block_unlock(block);
+    if (pos + (off_t)chunk > atomic_load(&file->size)) {
+      atomic_store(&file->size, pos + (off_t)chunk);
+    }
+    done += chunk;
+    pos += (off_t)chunk;
+  }
+  return done > 0 ? (ssize_t)done : -1;
+}
+
+static ssize_t write_direct(
+    struct vtpc_file* file, struct vtpc_iter* it, size_t count, off_t pos
+) {
+  const struct vtpc_iter start = *it;
+  if (vtpc_bypass_write(file, it, count, pos) == -1) {
+    *it = start;
+    return write_cached(file, it, count, pos);
+  }
+  if (pos + (off_t)count > atomic_load(&file->size)) {
+    atomic_store(&file->size, pos + (off_t)count);
+  }
+  return (ssize_t)count;
+}
+
+static ssize_t file_write(
+    struct vtpc_file* file, const struct iovec* iov, size_t count, off_t pos
+) {
+  if (count == 0) {
+    return 0;
+  }
+  struct vtpc_part parts[3];
+  const size_t part_count = split(pos, pos + (off_t)count, parts);
+  struct vtpc_iter it = {.iov = iov, .offset = 0};
+  size_t done = 0;
+  for (size_t i = 0; i < part_count; ++i) {
+    const struct vtpc_part* part = &parts[i];
+    const ssize_t n = part->direct
+                          ? write_direct(file, &it, part->count, part->pos)
+                          : write_cached(file, &it, part->count, part->pos);
+    if (n < 0) {
+      return done > 0 ? (ssize_t)done : -1;
+    }
+    done += (size_t)n;
+    if ((size_t)n < part->count) {
+      break;
+    }
+  }
+  return (ssize_t)done;
+}
+
+// Reads at the offset of the descriptor and advances it, or at `pos`
+// leaving the offset alone.
+static ssize_t fd_read(
+    int fd, const struct iovec* iov, size_t count, bool positional, off_t pos
+) {
+  const uint64_t start = vtpc_now_ns();
+  struct vtpc_fd* entry = fd_lock(fd, positional);
+  if (entry == NULL) {
+    return -1;
+  }
+  ssize_t n = -1;
+  if (!positional) {
+    pos = entry->pos;
+  }
+  if ((entry->mode & O_ACCMODE) == O_WRONLY) {
+    errno = EBADF;
+  } else {
+    n = file_read(entry, iov, count, pos);
+  }
+  if (n > 0 && !positional) {
+    entry->pos += n;
+  }
+  const uint64_t id = entry->file->id;
+  fd_unlock(entry);
+  vtpc_stat_latency(VTPC_OP_READ, start);
+  if (n > 0) {
+    vtpc_trace(VTPC_TRACE_READ, fd, id, pos, (size_t)n);
+  }
+  return n;
+}
+
+// Like fd_read. Positional writes ignore O_APPEND.
+static ssize_t fd_write(
+    int fd, const struct iovec* iov, size_t count, bool positional, off_t pos
+) {
+  const uint64_t start = vtpc_now_ns();
+  struct vtpc_fd* entry = fd_lock(fd, positional);
+  if (entry == NULL) {
+    return -1;
+  }
+  if ((entry->mode & O_ACCMODE) == O_RDONLY) {
+    fd_unlock(entry);
+    errno = EBADF;
+    return -1;
+  }
+  struct vtpc_file* file = entry->file;
+  pthread_mutex_lock(&file->write_lock);
+  if (!positional) {
+    if ((entry->mode & O_APPEND) != 0) {
+      entry->pos = atomic_load(&file->size);
+    }
+    pos = entry->pos;
+  }
+  const ssize_t n = file_write(file, iov, count, pos);
+  pthread_mutex_unlock(&file->write_lock);
+  if (n > 0 && !positional) {
+    entry->pos += n;
+  }
+  const uint64_t id = file->id;
+  fd_unlock(entry);
+  vtpc_stat_latency(VTPC_OP_WRITE, start);
+  if (n > 0) {
+    vtpc_trace(VTPC_TRACE_WRITE, fd, id, pos, (size_t)n);
+  }
+  return n;
+}
+
+// Returns the total length of the buffers, or -1 with errno set.
+static ssize_t iov_count(const struct iovec* iov, int iovcnt) {
+  if (iovcnt < 0 || iovcnt > IOV_MAX) {
+    errno = EINVAL;
+    return -1;
+  }
+  size_t count = 0;
+  for (int i = 0; i < iovcnt; ++i) {
+    if (iov[i].iov_len > (size_t)SSIZE_MAX - count) {
+      errno = EINVAL;
+      return -1;
+    }
+    count += iov[i].iov_len;
+  }
+  return (ssize_t)count;
 }
 
 ssize_t vtpc_read(int fd, void* buf, size_t count) {
-  return read(fd, buf, count);
+  const struct iovec iov = {.iov_base = buf, .iov_len = count};
+  return fd_read(fd, &iov, count, false, 0);
 }
 
 ssize_t vtpc_write(int fd, const void* buf, size_t count) {
-  return write(fd, buf, count);
+  const struct iovec iov = {.iov_base = (void*)buf, .iov_len = count};
+  return fd_write(fd, &iov, count, false, 0);
+}
+
+ssize_t vtpc_pread(int fd, void* buf, size_t count, off_t offset) {
+  if (offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  const struct iovec iov = {.iov_base = buf, .iov_len = count};
+  return fd_read(fd, &iov, count, true, offset);
+}
+
+ssize_t vtpc_pwrite(int fd, const void* buf, size_t count, off_t offset) {
+  if (offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  const struct iovec iov = {.iov_base = (void*)buf, .iov_len = count};
+  return fd_write(fd, &iov, count, true, offset);
+}
+
+ssize_t vtpc_readv(int fd, const struct iovec* iov, int iovcnt) {
+  const ssize_t count = iov_count(iov, iovcnt);
+  if (count == -1) {
+    return -1;
+  }
+  return fd_read(fd, iov, (size_t)count, false, 0);
+}
+
+ssize_t vtpc_writev(int fd, const struct iovec* iov, int iovcnt) {
+  const ssize_t count = iov_count(iov, iovcnt);
+  if (count == -1) {
+    return -1;
+  }
+  return fd_write(fd, iov, (size_t)count, false, 0);
 }
 
 off_t vtpc_lseek(int fd, off_t offset, int whence) {
-  return lseek(fd, offset, whence);
+  struct vtpc_fd* entry = fd_lock(fd, false);
+  if (entry == NULL) {
+    return -1;
+  }
+
+  off_t base = -1;
+  switch (whence) {
+    case SEEK_SET:
+      base = 0;
+      break;
+    case SEEK_CUR:
+      base = entry->pos;
+      break;
+    case SEEK_END:
+      base = atomic_load(&entry->file->size);
+      break;
+    default:
+      break;
+  }
+  off_t result = -1;
+  if (base < 0 || offset < -base) {
+    errno = EINVAL;
+  } else if (offset > VTPC_OFF_MAX - base) {
+    errno = EOVERFLOW;
+  } else {
+    entry->pos = base + offset;
+    result = entry->pos;
+  }
+  fd_unlock(entry);
+  return result;
 }
 
 int vtpc_fsync(int fd) {
-  return fsync(fd);
+  const uint64_t start = vtpc_now_ns();
+  struct vtpc_fd* entry = fd_lock(fd, true);
+  if (entry == NULL) {
+    return -1;
+  }
+  struct vtpc_file* file = entry->file;
+  pthread_mutex_lock(&file->write_lock);
+  int result = vtpc_flush_file(file);
+  pthread_mutex_unlock(&file->write_lock);
+  if (result == 0) {
+    result = fsync(file->fd);
+  }
+  const uint64_t id = file->id;
+  fd_unlock(entry);
+  vtpc_stat_latency(VTPC_OP_FSYNC, start);
+  if (result == 0) {
+    vtpc_trace(VTPC_TRACE_FSYNC, fd, id, 0, 0);
+  }
+  return result;
+}
+
+int vtpc_ftruncate(int fd, off_t length) {
+  struct vtpc_fd* entry = fd_lock(fd, true);
+  if (entry == NULL) {
+    return -1;
+  }
+  int result = ftruncate(fd, length);
+  if (result == 0) {
+    result = file_truncate(entry->file, length);
+  }
+  fd_unlock(entry);
+  return result;
+}
+
+// Every dirty block is written back first, so the file on disk is the one
+// to allocate in, and its size is the one to take afterwards. The modes
+// that move or zero data drop the blocks from `offset` on.
+int vtpc_fallocate(int fd, int mode, off_t offset, off_t len) {
+  struct vtpc_fd* entry = fd_lock(fd, true);
+  if (entry == NULL) {
+    return -1;
+  }
+  struct vtpc_file* file = entry->file;
+  pthread_mutex_lock(&file->write_lock);
+  int result = vtpc_flush_file(file);
+  struct stat st;
+  if (result == 0) {
+    vtpc_writeback_wait(file);
+    result = fallocate(fd, mode, offset, len);
+  }
+  if (result == 0 && (mode & ~FALLOC_FL_KEEP_SIZE) != 0) {
+    const uint64_t first = (uint64_t)offset / vtpc_cache_block_size();
+    vtpc_cache_drop_range(file, first, UINT64_MAX);
+    vtpc_shared_forget_range(file, first, UINT64_MAX);
+  }
+  if (result == 0) {
+    result = fstat(fd, &st);
+  }
+  if (result == 0) {
+    atomic_store(&file->size, st.st_size);
+    atomic_store(&file->disk_size, st.st_size);
+  }
+  pthread_mutex_unlock(&file->write_lock);
+  fd_unlock(entry);
+  return result;
+}
+
+int vtpc_fstat(int fd, struct stat* st) {
+  struct vtpc_fd* entry = fd_lock(fd, true);
+  if (entry == NULL) {
+    return -1;
+  }
+  const int result = fstat(fd, st);
+  if (result == 0) {
+    st->st_size = atomic_load(&entry->file->size);
+  }
+  fd_unlock(entry);
+  return result;
+}
+
+int vtpc_file_prefetch(struct vtpc_file* file, off_t offset, size_t count) {
+  const off_t size = atomic_load(&file->size);
+  if (offset < size) {
+    const uint64_t block_size = vtpc_cache_block_size();
+    const uint64_t end = count == 0 || count > (uint64_t)(size - offset)
+                             ? (uint64_t)size
+                             : (uint64_t)offset + count;
+    const uint64_t first = (uint64_t)offset / block_size;
+    uint64_t blocks = (end + block_size - 1) / block_size - first;
+    if (blocks > vtpc_cache_active()) {
+      blocks = vtpc_cache_active();
+    }
+    vtpc_cache_prefetch(file, first, (size_t)blocks);
+  }
+  return 0;
+}
+
+void vtpc_file_release(struct vtpc_file** file) {
+  pthread_mutex_lock(&vtpc_mutex);
+  (void)file_put(*file);
+  *file = NULL;
+  pthread_mutex_unlock(&vtpc_mutex);
+}
+
+// Patterns apply to the descriptor and its reads, whatever the range. The
+// range of the others ends with the file when `len` is 0.
+int vtpc_fadvise(int fd, off_t offset, off_t len, int advice) {
+  if (offset < 0 || len < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  switch (advice) {
+    case POSIX_FADV_NORMAL:
+    case POSIX_FADV_SEQUENTIAL:
+    case POSIX_FADV_RANDOM:
+    case POSIX_FADV_NOREUSE: {
+      struct vtpc_fd* entry = fd_lock(fd, false);
+      if (entry == NULL) {
+        return -1;
+      }
+      entry->advice = advice;
+      memset(&entry->ra, 0, sizeof(entry->ra));
+      fd_unlock(entry);
+      return 0;
+    }
+    case POSIX_FADV_WILLNEED: {
+      // The request holds the file, so closing or reusing the descriptor
+      // meanwhile does not change what it reads.
+      pthread_mutex_lock(&vtpc_mutex);
+      struct vtpc_fd* entry = fd_lock(fd, true);
+      if (entry == NULL) {
+        pthread_mutex_unlock(&vtpc_mutex);
+        return -1;
+      }
+      struct vtpc_file* file = entry->file;
+      file->refs++;
+      fd_unlock(entry);
+      pthread_mutex_unlock(&vtpc_mutex);
+      if (vtpc_async_prefetch(file, offset, (size_t)len) == -1) {
+        const int err = errno;
+        vtpc_file_release(&file);
+        errno = err;
+        return -1;
+      }
+      return 0;
+    }
+    case POSIX_FADV_DONTNEED: {
+      struct vtpc_fd* entry = fd_lock(fd, true);
+      if (entry == NULL) {
+        return -1;
+      }
+      struct vtpc_file* file = entry->file;
+      const size_t block_size = vtpc_cache_block_size();
+      const uint64_t first = (uint64_t)offset / block_size;
+      const uint64_t last =
+          len == 0 ? UINT64_MAX
+                   : ((uint64_t)offset + (uint64_t)len - 1) / block_size;
+      pthread_mutex_lock(&file->write_lock);
+      const int result = vtpc_flush_range(file, first, last);
+      const int err = errno;
+      vtpc_cache_evict_range(file, first, last);
+      pthread_mutex_unlock(&file->write_lock);
+      fd_unlock(entry);
+      errno = err;
+      return result;
+    }
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+}
+
+int vtpc_set_partition(int fd, const struct vtpc_partition* partition) {
+  if (partition->limit != 0 && partition->reserve > partition->limit) {
+    errno = EINVAL;
+    return -1;
+  }
+  struct vtpc_fd* entry = fd_lock(fd, true);
+  if (entry == NULL) {
+    return -1;
+  }
+  atomic_store(&entry->file->reserve, partition->reserve);
+  vtpc_cache_limit(entry->file, partition->limit);
+  fd_unlock(entry);
+  return 0;
+}
+
+int vtpc_get_partition(int fd, struct vtpc_partition* partition) {
+  struct vtpc_fd* entry = fd_lock(fd, true);
+  if (entry == NULL) {
+    return -1;
+  }
+  partition->reserve = atomic_load(&entry->file->reserve);
+  partition->limit = atomic_load(&entry->file->limit);
+  partition->blocks = atomic_load(&entry->file->resident);
+  fd_unlock(entry);
+  return 0;
+}
+
+int vtpc_warm_save(int fd) {
+  struct vtpc_fd* entry = fd_lock(fd, true);
+  if (entry == NULL) {
+    return -1;
+  }
+  struct vtpc_file* file = entry->file;
+  pthread_mutex_lock(&file->write_lock);
+  int result = vtpc_flush_file(file);
+  if (result == 0) {
+    result = vtpc_warm_record(file);
+  }
+  pthread_mutex_unlock(&file->write_lock);
+  fd_unlock(entry);
+  return result;
+}
+
+int vtpc_pin(int fd, off_t offset, size_t len, vtpc_pin_t* pin) {
+  *pin = (vtpc_pin_t){.data = NULL, .len = 0, .block = NULL};
+  if (offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  struct vtpc_fd* entry = fd_lock(fd, true);
+  if (entry == NULL) {
+    return -1;
+  }
+  if ((entry->mode & O_ACCMODE) == O_WRONLY) {
+    fd_unlock(entry);
+    errno = EBADF;
+    return -1;
+  }
+  struct vtpc_file* file = entry->file;
+  const off_t size = atomic_load(&file->size);
+  if (offset >= size) {
+    fd_unlock(entry);
+    return 0;
+  }
+
+  const size_t block_size = vtpc_cache_block_size();
+  const uint64_t index = (uint64_t)offset / block_size;
+  const size_t shift = (size_t)offset % block_size;
+  struct vtpc_block* block = vtpc_cache_get(file, index, VTPC_ACCESS_READ);
+  if (block == NULL) {
+    fd_unlock(entry);
+    return -1;
+  }
+  vtpc_block_pin(block);
+  vtpc_block_unlock(block);
+  fd_unlock(entry);
+
+  size_t avail = block_size - shift;
+  if ((off_t)avail > size - offset) {
+    avail = (size_t)(size - offset);
+  }
+  *pin = (vtpc_pin_t){
+      .data = block->data + shift,
+      .len = len < avail ? len : avail,
+      .block = block,
+  };
+  return 0;
+}
+
+void vtpc_unpin(vtpc_pin_t* pin) {
+  if (pin->block != NULL) {
+    vtpc_block_unpin(pin->block);
+  }
+  *pin = (vtpc_pin_t){.data = NULL, .len = 0, .block = NULL};
+}
+
+static int hint_time(access_hint_t hint, uint64_t* next_use) {
+  if (hint.time.tv_sec < 0 || hint.time.tv_nsec < 0 ||
+      hint.time.tv_nsec >= (long)VTPC_NS_PER_SEC) {
+    errno = EINVAL;
+    return -1;
+  }
+  *next_use = ((uint64_t)hint.time.tv_sec * VTPC_NS_PER_SEC) +
+              (uint64_t)hint.time.tv_nsec;
+  switch (hint.kind) {
+    case VTPC_HINT_AT:
+      return 0;
+    case VTPC_HINT_AFTER: {
+      const uint64_t now = vtpc_now_ns();
+      *next_use = *next_use > UINT64_MAX - now ? UINT64_MAX : *next_use + now;
+      return 0;
+    }
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+}
+
+int vtpc_advice(int fd, off_t offset, size_t len, access_hint_t hint) {
+  uint64_t next_use = 0;
+  if (offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (hint_time(hint, &next_use) == -1) {
+    return -1;
+  }
+  struct vtpc_fd* entry = fd_lock(fd, true);
+  if (entry == NULL) {
+    return -1;
+  }
+  if (len > 0 && vtpc_cache_hints_enabled()) {
+    const size_t block_size = vtpc_cache_block_size();
+    const uint64_t first = (uint64_t)offset / block_size;
+    const uint64_t last = ((uint64_t)offset + len - 1) / block_size;
+    vtpc_cache_advise(entry->file, first, last, next_use);
+  }
+  fd_unlock(entry);
+  return 0;
 }
@@ -1,10 +1,313 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+
+struct vtpc_config {
+  size_t block_size;  // Bytes, power of two, at least 512.
+  size_t capacity;    // Number of blocks in the pool.
+  // Number of independently locked parts of the pool, a power of two; 0
+  // picks one from the number of CPUs.
+  size_t shards;
+  // Replacement policy: "lru", "clock", "2q", "arc", "lfu" or "opt".
+  const char* policy;
+  // Policy for the blocks "opt" has no access hint for.
+  const char* opt_fallback;
+  // Upper bound of the sequential readahead window in blocks, 0 disables.
+  size_t readahead;
+  // A sequential stream becomes a one-shot scan after this many blocks, and
+  // the blocks it reads are not admitted to the policy; 0 disables.
+  size_t scan;
+  // The whole blocks of a request covering at least this many of them move
+  // directly between the caller's buffers and the disk; 0 disables.
+  size_t bypass;
+  // TinyLFU admission: once the pool is full, a block read from disk enters
+  // the policy only if it was accessed more often lately than the victim,
+  // otherwise it is reclaimed first, like the blocks of a scan.
+  bool admission;
+  // Background writeback. The flusher thread cleans the oldest dirty blocks
+  // once `dirty_high` percent of the pool is dirty until at most `dirty_low`
+  // percent is left, and any block dirty for longer than `dirty_expire_ms`.
+  bool flusher;
+  size_t dirty_high;
+  size_t dirty_low;
+  size_t dirty_expire_ms;
+  // Prints the statistics to stderr at exit.
+  bool stats;
+  // Samples about one block in this many to estimate the miss ratio curve;
+  // 0 disables.
+  size_t mrc;
+  // Writes a binary trace of the accesses to this file, NULL disables.
+  const char* trace;
+  // Name of a POSIX shared memory segment ("/name") holding a second pool
+  // of clean blocks, shared by every process using the same name; NULL
+  // disables. The first process creates it with `shared_capacity` blocks, or
+  // `capacity` if 0, and the others must use the same block size. Clean
+  // blocks of the private pool are read again once another process writes
+  // them back, so the private pool can be small.
+  const char* shared;
+  size_t shared_capacity;
+  // Disk requests kept in flight by misses, readahead and write-back through
+  // an io_uring per thread, which also registers the pool; 0 or 1 uses
+  // synchronous calls, as does a kernel without io_uring.
+  size_t io_depth;
+  // Threads running the asynchronous requests, started with the first one;
+  // 0 runs them in the calling thread.
+  size_t async_threads;
+  // Pages backing the pool: "none", "thp" for transparent huge pages or
+  // "hugetlb" for reserved ones, each falling back to the previous. Pools
+  // smaller than a huge page use normal pages.
+  const char* hugepages;
+  // Locks the pool in memory, if the memlock limit allows.
+  bool mlock;
+  // Elastic sizing, between `min_capacity` and `capacity` blocks; 0 keeps
+  // the pool at `capacity`. Every `pressure_period_ms` the pool shrinks
+  // while the memory pressure, the "some avg10" percentage of the PSI file
+  // `pressure`, reaches `pressure_high`, or while the memory left to take is
+  // below what a step of growth would take, and grows while the pressure is
+  // under half of it and there is room. Without a file, the cgroup's
+  // memory.pressure is used, or else /proc/pressure/memory; the room is
+  // memory.max less memory.current beside the file if there is a limit, or
+  // else MemAvailable.
+  size_t min_capacity;
+  const char* pressure;
+  size_t pressure_high;
+  size_t pressure_period_ms;
+  // Directory of warm-start manifests, NULL to disable. Closing the last
+  // descriptor of a file records its resident blocks, hottest first, and
+  // opening it again while it is unchanged (same inode, size and mtime)
+  // loads them into free blocks in the background.
+  const char* warm;
+};
+
+// An asynchronous vtpc_pread or vtpc_pwrite, owned by the caller, with its
+// buffer, until it completes. On completion `result` and `error` are set,
+// then `callback` is called on a vtpc thread or, without one, the request is
+// queued for vtpc_aio_reap.
+struct vtpc_aio {
+  int fd;
+  void* buf;
+  size_t count;
+  off_t offset;
+  void (*callback)(struct vtpc_aio* aio);
+  void* data;      // For the caller.
+  ssize_t result;  // As returned by vtpc_pread or vtpc_pwrite.
+  int error;       // errno if `result` is -1.
+  // Private.
+  int op;
+  struct vtpc_aio* next;
+};
+
+// The share of the pool of a file. Other files do not evict its blocks
+// while it has `reserve` of them or fewer, unless nothing else is left, and
+// once it has `limit` of them (0 for no limit) it replaces its own least
+// recently used ones instead of taking others, overshooting by at most a
+// block per shard.
+struct vtpc_partition {
+  size_t reserve;
+  size_t limit;
+  size_t blocks;  // Resident, reported by vtpc_get_partition.
+};
+
+enum vtpc_hint_kind {
+  VTPC_HINT_AT,     // `time` is an absolute CLOCK_MONOTONIC time point.
+  VTPC_HINT_AFTER,  // `time` is an interval from now.
+};
+
+typedef struct {
+  enum vtpc_hint_kind kind;
+  struct timespec time;
+} access_hint_t;
+
+typedef struct {
+  const void* data;  // The pinned bytes, NULL past the end of the file.
+  size_t len;
+  void* block;
+} vtpc_pin_t;
+
+enum vtpc_op {
+  VTPC_OP_READ,   // vtpc_read, vtpc_pread and vtpc_readv.
+  VTPC_OP_WRITE,  // vtpc_write, vtpc_pwrite and vtpc_writev.
+  VTPC_OP_FSYNC,
+  VTPC_OP_MISS,  // Taking a block for a miss and loading it.
+  VTPC_OPS,
+};
+
+// Four buckets per power of two of nanoseconds: bucket `i` starts at `i` ns
+// below 4 and at (4 + i % 4) << (i / 4 - 1) ns from there on, so the
+// percentiles, the last latency of their bucket, are within 25%.
+#define VTPC_LATENCY_BUCKETS 252
+
+struct vtpc_latency {
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint64_t p50_ns;
+  uint64_t p99_ns;
+  uint64_t p999_ns;
+  uint64_t buckets[VTPC_LATENCY_BUCKETS];
+};
+
+// Points of the miss ratio curve, from an eighth of the capacity to eight
+// times it, doubling.
+#define VTPC_MRC_POINTS 7
+
+// Miss ratio curve of the workload for an LRU pool, estimated SHARDS-style
+// from the accesses of a spatial sample of the blocks. The reuse distance of
+// an access, the number of other blocks accessed since the last access of
+// its block, is laid out like the latencies; an LRU pool of `c` blocks
+// misses the cold accesses and those at distances of `c` and more.
+struct vtpc_mrc {
+  uint64_t rate;     // One block in `rate` is sampled, 0 if disabled.
+  uint64_t sampled;  // Accesses of the sampled blocks.
+  uint64_t cold;     // First accesses of sampled blocks.
+  uint64_t distances[VTPC_LATENCY_BUCKETS];  // Scaled to all blocks.
+  uint64_t blocks[VTPC_MRC_POINTS];
+  uint32_t miss_permille[VTPC_MRC_POINTS];  // With `blocks[i]` blocks.
+};
+
+enum vtpc_pool_backing {
+  VTPC_POOL_PAGES,
+  VTPC_POOL_THP,  // Advised; the kernel backs what it can.
+  VTPC_POOL_HUGETLB,
+};
+
+struct vtpc_stats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;   // Resident blocks reclaimed for other ones.
+  uint64_t writebacks;  // Dirty blocks written to disk.
+  // Of them, written by the thread evicting them rather than the flusher.
+  uint64_t foreground_writebacks;
+  uint64_t readahead_blocks;
+  uint64_t readahead_hits;
+  uint64_t readahead_wasted;  // Read ahead and reclaimed unused.
+  uint64_t disk_read_bytes;
+  uint64_t disk_write_bytes;
+  uint64_t shared_hits;  // Misses served by the shared segment.
+  uint64_t warm_blocks;  // Loaded from warm-start manifests.
+  uint64_t pool_bytes;   // Mapped for the pool and its block array.
+  uint64_t pool_blocks;  // In service, fewer than the capacity if shrunk.
+  // Of the blocks out of service, bytes the kernel did not get back.
+  uint64_t pool_retained_bytes;
+  uint32_t pool_backing;  // enum vtpc_pool_backing.
+  uint32_t pool_locked;
+  struct vtpc_latency latency[VTPC_OPS];
+  struct vtpc_mrc mrc;
+};
+
+enum vtpc_trace_op {
+  VTPC_TRACE_READ,
+  VTPC_TRACE_WRITE,
+  VTPC_TRACE_FSYNC,  // Covers the whole file: `offset` and `length` are 0.
+};
+
+// A trace is a sequence of these records in host byte order, one per call
+// that transferred data, in time order. Reads and writes record the range
+// transferred, not the one requested, so reads past the end are left out.
+struct vtpc_trace_record {
+  uint64_t time_ns;  // CLOCK_MONOTONIC.
+  uint64_t offset;
+  uint32_t length;
+  int32_t fd;
+  uint32_t file;  // Same for every descriptor of a file.
+  uint32_t op;    // enum vtpc_trace_op.
+};
+
+// Fills the defaults, overridden by the VTPC_* environment variables named
+// after the fields (VTPC_BLOCK_SIZE, VTPC_CAPACITY, ...).
+void vtpc_config_default(struct vtpc_config* config);
+
+// Allocates the block pool. Called implicitly with the default configuration
+// by the first vtpc_open. Fails with EBUSY while any file is open.
+int vtpc_init(const struct vtpc_config* config);
 
 int vtpc_open(const char* path, int mode, int access);
 int vtpc_close(int fd);
+// dup2 for a descriptor open through vtpc: `newfd` refers to the same cached
+// file, after closing whatever it referred to. The duplicate starts at the
+// offset of `oldfd` and moves on its own from then on.
+int vtpc_dup2(int oldfd, int newfd);
 ssize_t vtpc_read(int fd, void* buf, size_t count);
 ssize_t vtpc_write(int fd, const void* buf, size_t count);
 off_t vtpc_lseek(int fd, off_t offset, int whence);
 int vtpc_fsync(int fd);
+// ftruncate, fallocate and fstat for a descriptor open through vtpc, which
+// see the cached blocks and the size of the file with them. vtpc_fallocate
+// writes the dirty blocks back first.
+int vtpc_ftruncate(int fd, off_t length);
+int vtpc_fallocate(int fd, int mode, off_t offset, off_t len);
+int vtpc_fstat(int fd, struct stat* st);
+
+// Positional calls neither use nor move the offset of the descriptor, so
+// threads can share one; vtpc_pwrite ignores O_APPEND. Vectored calls fill
+// or drain the buffers in order in a single pass over the blocks.
+ssize_t vtpc_pread(int fd, void* buf, size_t count, off_t offset);
+ssize_t vtpc_pwrite(int fd, const void* buf, size_t count, off_t offset);
+ssize_t vtpc_readv(int fd, const struct iovec* iov, int iovcnt);
+ssize_t vtpc_writev(int fd, const struct iovec* iov, int iovcnt);
+
+// Submit a request and return without waiting for it. Requests are started
+// in order but may complete in any order, so overlapping writes must not be
+// in flight together. Fail with EAGAIN if no thread can be started.
+int vtpc_read_async(struct vtpc_aio* aio);
+int vtpc_write_async(struct vtpc_aio* aio);
+// Takes up to `max` completed requests without a callback, oldest first,
+// waiting for one if `wait` and any is in flight. Returns how many.
+size_t vtpc_aio_reap(struct vtpc_aio** done, size_t max, bool wait);
+// A descriptor that polls readable while completed requests wait to be
+// reaped, or -1 with errno set.
+int vtpc_aio_fd(void);
+
+// posix_fadvise for a descriptor open through vtpc, with the POSIX_FADV_*
+// advice of <fcntl.h>. SEQUENTIAL reads ahead from the first read with the
+// largest window and keeps the blocks read off the policy, so they are
+// evicted first once behind the reader; RANDOM turns readahead off; NOREUSE
+// keeps the blocks read off the policy, that is, admits them as scanned
+// rather than not at all; NORMAL undoes them. These apply to the reads of
+// the descriptor. WILLNEED reads the range into the cache in the
+// background, as an asynchronous request, at most a pool of it, and keeps
+// the file open until it is done, even if the descriptor is closed;
+// DONTNEED writes its dirty blocks back and evicts the blocks of the range
+// that are not busy or pinned. A `len` of 0 extends the range to the end
+// of the file.
+int vtpc_fadvise(int fd, off_t offset, off_t len, int advice);
+
+// Set the partition of the file open as `fd`, shared by all of its
+// descriptors and kept until the last one is closed. Setting fails with
+// EINVAL if the reservation exceeds the limit.
+int vtpc_set_partition(int fd, const struct vtpc_partition* partition);
+int vtpc_get_partition(int fd, struct vtpc_partition* partition);
+
+// Flushes the file and records its resident blocks in its warm-start
+// manifest now, without closing it. Fails with EINVAL without a manifest
+// directory.
+int vtpc_warm_save(int fd);
+
+// Pins the cache block holding `offset` and points `pin` into it, for up to
+// `len` bytes: fewer where the block or the file ends. The data stays valid
+// and unchanged until vtpc_unpin, as the block is not evicted and writes to
+// it wait, so a thread must not write a block it holds pinned. Pins are
+// released before the file is closed. Fails with ENOBUFS when the part of
+// the pool the block maps to is all pinned.
+int vtpc_pin(int fd, off_t offset, size_t len, vtpc_pin_t* pin);
+void vtpc_unpin(vtpc_pin_t* pin);
+
+// Tells the "opt" policy when the resident blocks covering
+// [offset, offset + len) will be accessed next. The next access of a block
+// consumes its hint. Other policies ignore hints.
+int vtpc_advice(int fd, off_t offset, size_t len, access_hint_t hint);
+
+// Sums the counters of all threads since the start or the last reset. Every
+// thread counts on its own, so the totals are exact once the threads are
+// quiet and a reset may lose the events in flight.
+void vtpc_stats(struct vtpc_stats* stats);
+void vtpc_stats_reset(void);
+// Writes the counters, latency summaries and the miss ratio curve as
+// "key=value" lines.
+int vtpc_stats_dump(int fd);
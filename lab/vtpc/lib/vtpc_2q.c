@@ -0,0 +1,98 @@
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "vtpc_policy.h"
+
+// Full 2Q (Johnson, Shasha): first-time blocks go through the A1in FIFO, and
+// only blocks referenced again after leaving it, while their keys are still
+// remembered in A1out, are promoted to the LRU-managed Am queue.
+enum { QUEUE_A1IN = 1, QUEUE_AM = 2 };
+
+struct twoq {
+  struct vtpc_policy base;
+  size_t kin;
+  struct vtpc_list a1in;
+  struct vtpc_list am;
+  struct vtpc_ghost a1out;
+};
+
+static struct vtpc_policy* twoq_create(
+    size_t capacity, const struct vtpc_config* config
+) {
+  (void)config;
+  struct twoq* twoq = calloc(1, sizeof(struct twoq));
+  if (twoq == NULL) {
+    return NULL;
+  }
+  if (vtpc_ghost_init(&twoq->a1out, capacity / 2) == -1) {
+    free(twoq);
+    return NULL;
+  }
+  twoq->base.ops = &vtpc_policy_2q;
+  twoq->kin = capacity / 4 == 0 ? 1 : capacity / 4;
+  vtpc_list_init(&twoq->a1in);
+  vtpc_list_init(&twoq->am);
+  return &twoq->base;
+}
+
+static void twoq_destroy(struct vtpc_policy* policy) {
+  struct twoq* twoq = (struct twoq*)policy;
+  vtpc_ghost_destroy(&twoq->a1out);
+  free(twoq);
+}
+
+static void twoq_insert(struct vtpc_policy* policy, struct vtpc_block* block) {
+  struct twoq* twoq = (struct twoq*)policy;
+  if (vtpc_ghost_take(&twoq->a1out, block->file->id, block->index)) {
+    block->queue = QUEUE_AM;
+    vtpc_list_push_front(&twoq->am, block);
+  } else {
+    block->queue = QUEUE_A1IN;
+    vtpc_list_push_front(&twoq->a1in, block);
+  }
+}
+
+static void twoq_access(struct vtpc_policy* policy, struct vtpc_block* block) {
+  struct twoq* twoq = (struct twoq*)policy;
+  if (block->queue == QUEUE_AM) {
+    vtpc_list_remove(&twoq->am, block);
+    vtpc_list_push_front(&twoq->am, block);
+  }
+}
+
+static void twoq_remove(struct vtpc_policy* policy, struct vtpc_block* block) {
+  struct twoq* twoq = (struct twoq*)policy;
+  vtpc_list_remove(block->queue == QUEUE_AM ? &twoq->am : &twoq->a1in, block);
+}
+
+static struct vtpc_block* twoq_victim(struct vtpc_policy* policy) {
+  struct twoq* twoq = (struct twoq*)policy;
+  if (twoq->a1in.size > twoq->kin || twoq->am.size == 0) {
+    return vtpc_list_back(&twoq->a1in);
+  }
+  return vtpc_list_back(&twoq->am);
+}
+
+static struct vtpc_block* twoq_evict(struct vtpc_policy* policy) {
+  struct twoq* twoq = (struct twoq*)policy;
+  struct vtpc_block* victim = twoq_victim(policy);
+  if (victim == NULL) {
+    return NULL;
+  }
+  twoq_remove(policy, victim);
+  if (victim->queue == QUEUE_A1IN) {
+    vtpc_ghost_push(&twoq->a1out, victim->file->id, victim->index);
+  }
+  return victim;
+}
+
+const struct vtpc_policy_ops vtpc_policy_2q = {
+    .name = "2q",
+    .create = twoq_create,
+    .destroy = twoq_destroy,
+    .insert = twoq_insert,
+    .access = twoq_access,
+    .remove = twoq_remove,
+    .evict = twoq_evict,
+    .victim = twoq_victim,
+};
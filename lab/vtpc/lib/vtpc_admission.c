@@ -0,0 +1,175 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vtpc_policy.h"
+
+// TinyLFU (Einziger, Friedman, Manes). A count-min sketch of 4-bit counters,
+// four rows of a power of two at least the capacity each, estimates how
+// often a key was accessed. The doorkeeper, a Bloom filter of two probes,
+// absorbs the first access of every key, so the many keys seen only once
+// never reach the sketch. Every `period` accesses all counters are halved
+// and the doorkeeper is cleared, so the estimates follow the recent history.
+// That is about two bytes per block for each of them.
+#define DEPTH 4
+#define COUNTERS_PER_WORD 16
+#define DOORKEEPER_BITS_PER_BLOCK 16
+#define PERIOD_PER_BLOCK 8
+#define COUNTER_MAX 15U
+
+static size_t pow2_at_least(size_t n) {
+  size_t size = 1;
+  while (size < n) {
+    size <<= 1U;
+  }
+  return size;
+}
+
+int vtpc_admission_init(struct vtpc_admission* admission, size_t capacity) {
+  memset(admission, 0, sizeof(*admission));
+  const size_t width = pow2_at_least(
+      capacity < COUNTERS_PER_WORD ? COUNTERS_PER_WORD : capacity
+  );
+  const size_t bits = pow2_at_least(capacity * DOORKEEPER_BITS_PER_BLOCK);
+  admission->sketch =
+      calloc(DEPTH * width / COUNTERS_PER_WORD, sizeof(uint64_t));
+  admission->doorkeeper = calloc((bits + 63) / 64, sizeof(uint64_t));
+  if (admission->sketch == NULL || admission->doorkeeper == NULL) {
+    vtpc_admission_destroy(admission);
+    return -1;
+  }
+  admission->width = width;
+  admission->bits = bits;
+  admission->period = capacity * PERIOD_PER_BLOCK;
+  return 0;
+}
+
+void vtpc_admission_destroy(struct vtpc_admission* admission) {
+  free(admission->sketch);
+  free(admission->doorkeeper);
+  memset(admission, 0, sizeof(*admission));
+}
+
+// Double hashing: row `row` uses `lo + row * hi`.
+struct probe {
+  uint64_t lo;
+  uint64_t hi;
+};
+
+static struct probe probe_of(uint64_t file, uint64_t index) {
+  const uint64_t hash = vtpc_hash_key(file, index);
+  return (struct probe){.lo = hash & UINT32_MAX, .hi = (hash >> 32U) | 1U};
+}
+
+static uint32_t counter_get(
+    const struct vtpc_admission* admission, size_t row, size_t column
+) {
+  const size_t slot = (row * admission->width) + column;
+  const uint64_t word = admission->sketch[slot / COUNTERS_PER_WORD];
+  return (uint32_t)(word >> (4 * (slot % COUNTERS_PER_WORD))) & 0xFU;
+}
+
+static void counter_inc(
+    struct vtpc_admission* admission, size_t row, size_t column
+) {
+  const size_t slot = (row * admission->width) + column;
+  admission->sketch[slot / COUNTERS_PER_WORD] +=
+      1ULL << (4 * (slot % COUNTERS_PER_WORD));
+}
+
+static size_t column_of(
+    const struct vtpc_admission* admission, struct probe probe, size_t row
+) {
+  return (size_t)(probe.lo + (row * probe.hi)) & (admission->width - 1);
+}
+
+static size_t sketch_estimate(
+    const struct vtpc_admission* admission, struct probe probe
+) {
+  uint32_t min = COUNTER_MAX;
+  for (size_t row = 0; row < DEPTH; ++row) {
+    const uint32_t count =
+        counter_get(admission, row, column_of(admission, probe, row));
+    if (count < min) {
+      min = count;
+    }
+  }
+  return min;
+}
+
+// The doorkeeper probes with the halves of the hash swapped, so its bits do
+// not line up with the first row of the sketch.
+static size_t bit_of(
+    const struct vtpc_admission* admission, struct probe probe, size_t i
+) {
+  return (size_t)(probe.hi + (i * probe.lo)) & (admission->bits - 1);
+}
+
+static bool doorkeeper_has(
+    const struct vtpc_admission* admission, struct probe probe
+) {
+  for (size_t i = 0; i < 2; ++i) {
+    const size_t bit = bit_of(admission, probe, i);
+    if ((admission->doorkeeper[bit / 64] & (1ULL << (bit % 64))) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void doorkeeper_add(
+    struct vtpc_admission* admission, struct probe probe
+) {
+  for (size_t i = 0; i < 2; ++i) {
+    const size_t bit = bit_of(admission, probe, i);
+    admission->doorkeeper[bit / 64] |= 1ULL << (bit % 64);
+  }
+}
+
+static void age(struct vtpc_admission* admission) {
+  const size_t words = DEPTH * admission->width / COUNTERS_PER_WORD;
+  for (size_t i = 0; i < words; ++i) {
+    admission->sketch[i] = (admission->sketch[i] >> 1U) &
+                           0x7777777777777777ULL;
+  }
+  memset(
+      admission->doorkeeper,
+      0,
+      ((admission->bits + 63) / 64) * sizeof(uint64_t)
+  );
+  admission->samples /= 2;
+}
+
+// Conservative update: only the counters at the minimum are incremented,
+// which keeps the overestimate of colliding keys down.
+void vtpc_admission_record(
+    struct vtpc_admission* admission, uint64_t file, uint64_t index
+) {
+  const struct probe probe = probe_of(file, index);
+  if (!doorkeeper_has(admission, probe)) {
+    doorkeeper_add(admission, probe);
+  } else {
+    const size_t min = sketch_estimate(admission, probe);
+    if (min < COUNTER_MAX) {
+      for (size_t row = 0; row < DEPTH; ++row) {
+        const size_t column = column_of(admission, probe, row);
+        if (counter_get(admission, row, column) == min) {
+          counter_inc(admission, row, column);
+        }
+      }
+    }
+  }
+  if (++admission->samples >= admission->period) {
+    age(admission);
+  }
+}
+
+size_t vtpc_admission_estimate(
+    const struct vtpc_admission* admission, uint64_t file, uint64_t index
+) {
+  const struct probe probe = probe_of(file, index);
+  return sketch_estimate(admission, probe) +
+         (doorkeeper_has(admission, probe) ? 1 : 0);
+}
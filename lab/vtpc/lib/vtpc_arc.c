@@ -0,0 +1,129 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "vtpc_policy.h"
+
+// ARC (Megiddo, Modha). T1 holds blocks seen once recently, T2 blocks seen
+// at least twice; B1 and B2 remember the keys evicted from each of them.
+// Ghost hits move the target size `p` of T1 towards the list that would have
+// kept the block. The cache evicts before it inserts, so the adaptation runs
+// on insertion rather than ahead of the replacement as in the paper.
+enum { QUEUE_T1 = 1, QUEUE_T2 = 2 };
+
+struct arc {
+  struct vtpc_policy base;
+  size_t capacity;
+  size_t p;
+  struct vtpc_list t1;
+  struct vtpc_list t2;
+  struct vtpc_ghost b1;
+  struct vtpc_ghost b2;
+};
+
+static struct vtpc_policy* arc_create(
+    size_t capacity, const struct vtpc_config* config
+) {
+  (void)config;
+  struct arc* arc = calloc(1, sizeof(struct arc));
+  if (arc == NULL) {
+    return NULL;
+  }
+  if (vtpc_ghost_init(&arc->b1, capacity) == -1) {
+    free(arc);
+    return NULL;
+  }
+  if (vtpc_ghost_init(&arc->b2, capacity) == -1) {
+    vtpc_ghost_destroy(&arc->b1);
+    free(arc);
+    return NULL;
+  }
+  arc->base.ops = &vtpc_policy_arc;
+  arc->capacity = capacity;
+  vtpc_list_init(&arc->t1);
+  vtpc_list_init(&arc->t2);
+  return &arc->base;
+}
+
+static void arc_destroy(struct vtpc_policy* policy) {
+  struct arc* arc = (struct arc*)policy;
+  vtpc_ghost_destroy(&arc->b1);
+  vtpc_ghost_destroy(&arc->b2);
+  free(arc);
+}
+
+static size_t ratio(size_t a, size_t b) {
+  return b == 0 || a / b == 0 ? 1 : a / b;
+}
+
+static void arc_insert(struct vtpc_policy* policy, struct vtpc_block* block) {
+  struct arc* arc = (struct arc*)policy;
+  const uint64_t file = block->file->id;
+
+  if (vtpc_ghost_take(&arc->b1, file, block->index)) {
+    const size_t delta = ratio(arc->b2.size, arc->b1.size + 1);
+    arc->p = arc->p + delta > arc->capacity ? arc->capacity : arc->p + delta;
+  } else if (vtpc_ghost_take(&arc->b2, file, block->index)) {
+    const size_t delta = ratio(arc->b1.size, arc->b2.size + 1);
+    arc->p = arc->p < delta ? 0 : arc->p - delta;
+  } else {
+    if (arc->t1.size + arc->b1.size >= arc->capacity) {
+      vtpc_ghost_pop(&arc->b1);
+    }
+    if (arc->t1.size + arc->t2.size + arc->b1.size + arc->b2.size >=
+        2 * arc->capacity) {
+      vtpc_ghost_pop(&arc->b2);
+    }
+    block->queue = QUEUE_T1;
+    vtpc_list_push_front(&arc->t1, block);
+    return;
+  }
+  block->queue = QUEUE_T2;
+  vtpc_list_push_front(&arc->t2, block);
+}
+
+static void arc_access(struct vtpc_policy* policy, struct vtpc_block* block) {
+  struct arc* arc = (struct arc*)policy;
+  vtpc_list_remove(block->queue == QUEUE_T1 ? &arc->t1 : &arc->t2, block);
+  block->queue = QUEUE_T2;
+  vtpc_list_push_front(&arc->t2, block);
+}
+
+static void arc_remove(struct vtpc_policy* policy, struct vtpc_block* block) {
+  struct arc* arc = (struct arc*)policy;
+  vtpc_list_remove(block->queue == QUEUE_T1 ? &arc->t1 : &arc->t2, block);
+}
+
+static struct vtpc_block* arc_victim(struct vtpc_policy* policy) {
+  struct arc* arc = (struct arc*)policy;
+  const bool from_t1 =
+      arc->t1.size > 0 && (arc->t1.size > arc->p || arc->t2.size == 0);
+  return vtpc_list_back(from_t1 ? &arc->t1 : &arc->t2);
+}
+
+static struct vtpc_block* arc_evict(struct vtpc_policy* policy) {
+  struct arc* arc = (struct arc*)policy;
+  struct vtpc_block* victim = arc_victim(policy);
+  if (victim == NULL) {
+    return NULL;
+  }
+  arc_remove(policy, victim);
+  vtpc_ghost_push(
+      victim->queue == QUEUE_T1 ? &arc->b1 : &arc->b2,
+      victim->file->id,
+      victim->index
+  );
+  return victim;
+}
+
+const struct vtpc_policy_ops vtpc_policy_arc = {
+    .name = "arc",
+    .create = arc_create,
+    .destroy = arc_destroy,
+    .insert = arc_insert,
+    .access = arc_access,
+    .remove = arc_remove,
+    .evict = arc_evict,
+    .victim = arc_victim,
+};
@@ -0,0 +1,132 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "vtpc_internal.h"
+
+// The pool and its block array live in one anonymous mapping. Huge pages
+// cut the TLB misses of hits spread over the pool: explicit ones come from
+// the reserved hugetlbfs pages, and transparent ones are advised on a range
+// aligned to them, which the kernel backs as it can. Either falls back to
+// the next option, so the backing is reported rather than required.
+#define VTPC_HUGE_PAGE (2UL << 20U)
+
+static size_t round_up(size_t size, size_t to) {
+  return (size + to - 1) / to * to;
+}
+
+int vtpc_arena_mode(const char* name) {
+  if (name == NULL || strcmp(name, "none") == 0) {
+    return VTPC_POOL_PAGES;
+  }
+  if (strcmp(name, "thp") == 0) {
+    return VTPC_POOL_THP;
+  }
+  if (strcmp(name, "hugetlb") == 0) {
+    return VTPC_POOL_HUGETLB;
+  }
+  errno = EINVAL;
+  return -1;
+}
+
+static void* map(size_t size, int flags) {
+  void* base = mmap(
+      NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags,
+      -1, 0
+  );
+  return base == MAP_FAILED ? NULL : base;
+}
+
+// Maps `size` bytes starting on a huge page boundary, trimming the slack.
+static void* map_aligned(size_t size) {
+  char* raw = map(size + VTPC_HUGE_PAGE, 0);
+  if (raw == NULL) {
+    return NULL;
+  }
+  char* base = (char*)round_up((uintptr_t)raw, VTPC_HUGE_PAGE);
+  if (base != raw) {
+    (void)munmap(raw, (size_t)(base - raw));
+  }
+  const size_t tail = VTPC_HUGE_PAGE - (size_t)(base - raw);
+  if (tail != 0) {
+    (void)munmap(base + size, tail);
+  }
+  return base;
+}
+
+int vtpc_arena_map(
+    struct vtpc_arena* arena, size_t size, const struct vtpc_config* config
+) {
+  const int mode = vtpc_arena_mode(config->hugepages);
+  if (mode == -1) {
+    return -1;
+  }
+  memset(arena, 0, sizeof(*arena));
+  // A pool smaller than a huge page would only waste the rest of it.
+  const bool huge = mode != VTPC_POOL_PAGES && size >= VTPC_HUGE_PAGE;
+  if (huge) {
+    size = round_up(size, VTPC_HUGE_PAGE);
+  }
+  if (huge && mode == VTPC_POOL_HUGETLB) {
+    arena->base = map(size, MAP_HUGETLB);
+    arena->backing = VTPC_POOL_HUGETLB;
+  }
+  if (arena->base == NULL && huge) {
+    arena->base = map_aligned(size);
+    arena->backing = VTPC_POOL_THP;
+    if (arena->base != NULL &&
+        madvise(arena->base, size, MADV_HUGEPAGE) != 0) {
+      arena->backing = VTPC_POOL_PAGES;
+    }
+  }
+  if (arena->base == NULL) {
+    arena->base = map(size, 0);
+    arena->backing = VTPC_POOL_PAGES;
+  }
+  if (arena->base == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+  arena->size = size;
+  // Without the privilege or the limit, the pool stays swappable and the
+  // statistics tell.
+  arena->locked = config->mlock && mlock(arena->base, size) == 0;
+  // Dropping part of a transparent huge page would split it. A private
+  // hugetlb mapping would fault released pages back in from the shared
+  // reserve without its reservation, and SIGBUS if it runs dry.
+  if (arena->backing == VTPC_POOL_THP) {
+    arena->run = VTPC_HUGE_PAGE;
+  } else if (arena->backing == VTPC_POOL_PAGES) {
+    const long page = sysconf(_SC_PAGESIZE);
+    arena->run = page > 0 ? (size_t)page : 0;
+  }
+  return 0;
+}
+
+int vtpc_arena_release(struct vtpc_arena* arena, void* addr, size_t size) {
+  if (arena->run == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (arena->locked && munlock(addr, size) == -1) {
+    return -1;
+  }
+  return madvise(addr, size, MADV_DONTNEED);
+}
+
+void vtpc_arena_restore(struct vtpc_arena* arena, void* addr, size_t size) {
+  if (arena->locked && mlock(addr, size) == -1) {
+    arena->locked = false;
+  }
+}
+
+void vtpc_arena_unmap(struct vtpc_arena* arena) {
+  if (arena->base != NULL) {
+    (void)munmap(arena->base, arena->size);
+  }
+  memset(arena, 0, sizeof(*arena));
+}
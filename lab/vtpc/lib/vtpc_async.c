@@ -0,0 +1,354 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "vtpc_internal.h"
+
+// Asynchronous requests are run by a few worker threads, started with the
+// first request, each with vtpc_pread or vtpc_pwrite, so a miss blocks a
+// worker rather than the caller. Requests without a callback are queued as
+// completed; the eventfd is readable exactly while that queue is not empty.
+#define VTPC_ASYNC_MAX_THREADS 64
+
+enum {
+  VTPC_AIO_READ,
+  VTPC_AIO_WRITE,
+  VTPC_AIO_PREFETCH,  // Of vtpc_fadvise, freed once done.
+};
+
+struct prefetch {
+  struct vtpc_aio aio;  // First, so that the request converts back.
+  struct vtpc_file* file;  // Held until the prefetch is done, then NULL.
+};
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t work;  // A request was submitted, or the workers stop.
+  pthread_cond_t done;  // A request was completed into the queue.
+  size_t threads;       // Configured.
+  size_t running;
+  pthread_t workers[VTPC_ASYNC_MAX_THREADS];
+  struct vtpc_aio* current[VTPC_ASYNC_MAX_THREADS];  // Run by each worker.
+  bool stopping;
+  struct vtpc_aio* head;  // Submitted, oldest first.
+  struct vtpc_aio* tail;
+  struct vtpc_aio* done_head;  // Completed without a callback.
+  struct vtpc_aio* done_tail;
+  size_t pending;  // Submitted without a callback and not reaped yet.
+  int event;
+  pthread_once_t once;
+} async = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+    .event = -1,
+    .once = PTHREAD_ONCE_INIT,
+};
+
+static void run(struct vtpc_aio* aio) {
+  switch (aio->op) {
+    case VTPC_AIO_READ:
+      aio->result = vtpc_pread(aio->fd, aio->buf, aio->count, aio->offset);
+      break;
+    case VTPC_AIO_WRITE:
+      aio->result = vtpc_pwrite(aio->fd, aio->buf, aio->count, aio->offset);
+      break;
+    default: {
+      struct prefetch* prefetch = (struct prefetch*)aio;
+      aio->result =
+          vtpc_file_prefetch(prefetch->file, aio->offset, aio->count);
+      vtpc_file_release(&prefetch->file);
+      break;
+    }
+  }
+  aio->error = aio->result < 0 ? errno : 0;
+}
+
+// Called with `async.lock` held.
+static void queue_done(struct vtpc_aio* aio) {
+  aio->next = NULL;
+  if (async.done_tail != NULL) {
+    async.done_tail->next = aio;
+  } else {
+    async.done_head = aio;
+    if (async.event != -1) {
+      const uint64_t one = 1;
+      (void)write(async.event, &one, sizeof(one));
+    }
+  }
+  async.done_tail = aio;
+  pthread_cond_broadcast(&async.done);
+}
+
+// The callback may submit more requests, so it is called unlocked.
+static void complete(struct vtpc_aio* aio) {
+  if (aio->callback != NULL) {
+    aio->callback(aio);
+    return;
+  }
+  pthread_mutex_lock(&async.lock);
+  queue_done(aio);
+  pthread_mutex_unlock(&async.lock);
+}
+
+// Called with `async.lock` held.
+static struct vtpc_aio* take(void) {
+  struct vtpc_aio* aio = async.head;
+  if (aio != NULL) {
+    async.head = aio->next;
+    if (async.head == NULL) {
+      async.tail = NULL;
+    }
+  }
+  return aio;
+}
+
+static void* worker_main(void* arg) {
+  const size_t id = (size_t)(uintptr_t)arg;
+  pthread_mutex_lock(&async.lock);
+  for (;;) {
+    struct vtpc_aio* aio = take();
+    if (aio == NULL) {
+      if (async.stopping) {
+        break;
+      }
+      pthread_cond_wait(&async.work, &async.lock);
+      continue;
+    }
+    async.current[id] = aio;
+    pthread_mutex_unlock(&async.lock);
+    run(aio);
+    pthread_mutex_lock(&async.lock);
+    async.current[id] = NULL;
+    pthread_mutex_unlock(&async.lock);
+    complete(aio);
+    pthread_mutex_lock(&async.lock);
+  }
+  pthread_mutex_unlock(&async.lock);
+  return NULL;
+}
+
+// Starts another worker until the configured number run. Called with
+// `async.lock` held; fails only if no worker runs at all.
+static int spawn(void) {
+  if (async.running >= async.threads) {
+    return 0;
+  }
+  const int err = pthread_create(
+      &async.workers[async.running], NULL, worker_main,
+      (void*)(uintptr_t)async.running
+  );
+  if (err == 0) {
+    async.running++;
+    return 0;
+  }
+  if (async.running > 0) {
+    return 0;
+  }
+  errno = err;
+  return -1;
+}
+
+static int submit(struct vtpc_aio* aio, int op) {
+  aio->op = op;
+  aio->next = NULL;
+  aio->result = 0;
+  aio->error = 0;
+  pthread_mutex_lock(&async.lock);
+  if (async.threads != 0 && spawn() == -1) {
+    pthread_mutex_unlock(&async.lock);
+    return -1;
+  }
+  if (aio->callback == NULL) {
+    async.pending++;
+  }
+  if (async.threads == 0) {
+    pthread_mutex_unlock(&async.lock);
+    run(aio);
+    complete(aio);
+    return 0;
+  }
+  if (async.tail != NULL) {
+    async.tail->next = aio;
+  } else {
+    async.head = aio;
+  }
+  async.tail = aio;
+  pthread_cond_signal(&async.work);
+  pthread_mutex_unlock(&async.lock);
+  return 0;
+}
+
+int vtpc_read_async(struct vtpc_aio* aio) {
+  return submit(aio, VTPC_AIO_READ);
+}
+
+int vtpc_write_async(struct vtpc_aio* aio) {
+  return submit(aio, VTPC_AIO_WRITE);
+}
+
+static void prefetched(struct vtpc_aio* aio) {
+  free(aio);
+}
+
+int vtpc_async_prefetch(struct vtpc_file* file, off_t offset, size_t count) {
+  struct prefetch* prefetch = calloc(1, sizeof(*prefetch));
+  if (prefetch == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+  prefetch->file = file;
+  prefetch->aio.fd = -1;
+  prefetch->aio.offset = offset;
+  prefetch->aio.count = count;
+  prefetch->aio.callback = prefetched;
+  if (submit(&prefetch->aio, VTPC_AIO_PREFETCH) == -1) {
+    free(prefetch);
+    return -1;
+  }
+  return 0;
+}
+
+size_t vtpc_aio_reap(struct vtpc_aio** done, size_t max, bool wait) {
+  pthread_mutex_lock(&async.lock);
+  while (wait && async.done_head == NULL && async.pending > 0) {
+    pthread_cond_wait(&async.done, &async.lock);
+  }
+  size_t count = 0;
+  while (count < max && async.done_head != NULL) {
+    struct vtpc_aio* aio = async.done_head;
+    async.done_head = aio->next;
+    done[count++] = aio;
+  }
+  if (async.done_head == NULL) {
+    async.done_tail = NULL;
+    if (async.event != -1) {
+      uint64_t value = 0;
+      (void)read(async.event, &value, sizeof(value));
+    }
+  }
+  async.pending -= count;
+  pthread_mutex_unlock(&async.lock);
+  return count;
+}
+
+int vtpc_aio_fd(void) {
+  pthread_mutex_lock(&async.lock);
+  if (async.event == -1) {
+    async.event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (async.event != -1 && async.done_head != NULL) {
+      const uint64_t one = 1;
+      (void)write(async.event, &one, sizeof(one));
+    }
+  }
+  const int fd = async.event;
+  pthread_mutex_unlock(&async.lock);
+  return fd;
+}
+
+// `vtpc_mutex` is held too, so that no prefetch is halfway through
+// releasing its file.
+static void before_fork(void) {
+  pthread_mutex_lock(&vtpc_mutex);
+  pthread_mutex_lock(&async.lock);
+}
+
+static void after_fork_parent(void) {
+  pthread_mutex_unlock(&async.lock);
+  pthread_mutex_unlock(&vtpc_mutex);
+}
+
+// A prefetch of the parent holds a reference on the file in the child as
+// well, so the child keeps it to be run, unless it is already done.
+static void keep(struct vtpc_aio* aio, struct vtpc_aio*** tail) {
+  if (aio->op != VTPC_AIO_PREFETCH) {
+    return;
+  }
+  if (((struct prefetch*)aio)->file == NULL) {
+    free(aio);
+    return;
+  }
+  aio->next = NULL;
+  **tail = aio;
+  *tail = &aio->next;
+  async.tail = aio;
+}
+
+// The workers of the parent do not exist in the child, which starts its own
+// with its next request, or runs what is left when it stops. The requests
+// of the caller are the parent's to run and reap, and its eventfd is shared
+// with the parent, so the child drops them.
+static void after_fork_child(void) {
+  struct vtpc_aio* queued = async.head;
+  struct vtpc_aio** tail = &async.head;
+  async.head = NULL;
+  async.tail = NULL;
+  for (size_t i = 0; i < async.running; ++i) {
+    if (async.current[i] != NULL) {
+      keep(async.current[i], &tail);
+      async.current[i] = NULL;
+    }
+  }
+  while (queued != NULL) {
+    struct vtpc_aio* next = queued->next;
+    keep(queued, &tail);
+    queued = next;
+  }
+  async.done_head = NULL;
+  async.done_tail = NULL;
+  async.pending = 0;
+  async.running = 0;
+  async.stopping = false;
+  if (async.event != -1) {
+    close(async.event);
+    async.event = -1;
+  }
+  pthread_mutex_init(&async.lock, NULL);
+  pthread_cond_init(&async.work, NULL);
+  pthread_cond_init(&async.done, NULL);
+  pthread_mutex_unlock(&vtpc_mutex);
+}
+
+static void register_fork(void) {
+  (void)pthread_atfork(before_fork, after_fork_parent, after_fork_child);
+}
+
+int vtpc_async_start(const struct vtpc_config* config) {
+  if (config->async_threads > VTPC_ASYNC_MAX_THREADS) {
+    errno = EINVAL;
+    return -1;
+  }
+  pthread_once(&async.once, register_fork);
+  pthread_mutex_lock(&async.lock);
+  async.threads = config->async_threads;
+  pthread_mutex_unlock(&async.lock);
+  return 0;
+}
+
+void vtpc_async_stop(void) {
+  pthread_mutex_lock(&async.lock);
+  async.stopping = true;
+  pthread_cond_broadcast(&async.work);
+  const size_t running = async.running;
+  pthread_mutex_unlock(&async.lock);
+  for (size_t i = 0; i < running; ++i) {
+    pthread_join(async.workers[i], NULL);
+  }
+  // Requests left without workers, as in a forked child, are run here.
+  pthread_mutex_lock(&async.lock);
+  for (struct vtpc_aio* aio = take(); aio != NULL; aio = take()) {
+    pthread_mutex_unlock(&async.lock);
+    run(aio);
+    complete(aio);
+    pthread_mutex_lock(&async.lock);
+  }
+  async.running = 0;
+  async.stopping = false;
+  pthread_mutex_unlock(&async.lock);
+}
@@ -0,0 +1,145 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "vtpc_internal.h"
+
+// Large requests skip the pool: copying them through it would evict the hot
+// set for data read once. The caller's buffer is used directly when O_DIRECT
+// accepts it, otherwise the data goes through a bounce buffer, which still
+// leaves the pool alone.
+#define VTPC_DIRECT_ALIGN 512
+#define VTPC_BOUNCE_SIZE (1U << 20U)
+
+// Zero-fills past the end of the file, as the range may cover blocks that
+// were never written back.
+static int read_full(int fd, char* buf, size_t count, off_t pos) {
+  size_t done = 0;
+  while (done < count) {
+    const ssize_t n = pread(fd, buf + done, count - done, pos + (off_t)done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return -1;
+    }
+    done += (size_t)n;
+    vtpc_stat_add(VTPC_STAT_DISK_READ_BYTES, (uint64_t)n);
+    // A short unaligned read is the end of the file, and O_DIRECT would
+    // reject the offset of a retry anyway.
+    if (n == 0 || (size_t)n % VTPC_DIRECT_ALIGN != 0) {
+      break;
+    }
+  }
+  memset(buf + done, 0, count - done);
+  return 0;
+}
+
+static int transfer(int fd, char* buf, size_t count, off_t pos, bool write) {
+  if (write) {
+    if (vtpc_pwrite_full(fd, buf, count, pos) == -1) {
+      return -1;
+    }
+    vtpc_stat_add(VTPC_STAT_DISK_WRITE_BYTES, count);
+    return 0;
+  }
+  return read_full(fd, buf, count, pos);
+}
+
+static int direct_io(
+    int fd, struct vtpc_iter* it, size_t count, off_t pos, bool write
+) {
+  while (it->offset == it->iov->iov_len) {
+    ++it->iov;
+    it->offset = 0;
+  }
+  char* base = (char*)it->iov->iov_base + it->offset;
+  if (it->iov->iov_len - it->offset >= count &&
+      (uintptr_t)base % VTPC_DIRECT_ALIGN == 0) {
+    if (transfer(fd, base, count, pos, write) == 0) {
+      it->offset += count;
+      return 0;
+    }
+    // The device wants a stricter alignment; retry through the bounce.
+    if (errno != EINVAL) {
+      return -1;
+    }
+  }
+
+  const size_t block_size = vtpc_cache_block_size();
+  size_t size = VTPC_BOUNCE_SIZE < block_size ? block_size : VTPC_BOUNCE_SIZE;
+  if (size > count) {
+    size = count;
+  }
+  void* bounce = NULL;
+  const int err = posix_memalign(&bounce, block_size, size);
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+  int result = 0;
+  for (size_t done = 0; done < count && result == 0;) {
+    const size_t chunk = count - done < size ? count - done : size;
+    if (write) {
+      vtpc_iter_copy(it, bounce, chunk, false);
+    }
+    result = transfer(fd, bounce, chunk, pos + (off_t)done, write);
+    if (!write && result == 0) {
+      vtpc_iter_copy(it, bounce, chunk, true);
+    }
+    done += chunk;
+  }
+  const int saved = errno;
+  free(bounce);
+  errno = saved;
+  return result;
+}
+
+// Holding `write_lock` keeps writers from dirtying the range between the
+// flush and the read.
+int vtpc_bypass_read(
+    struct vtpc_file* file, struct vtpc_iter* it, size_t count, off_t pos
+) {
+  const size_t block_size = vtpc_cache_block_size();
+  const uint64_t first = (uint64_t)pos / block_size;
+  const uint64_t last = first + (count / block_size) - 1;
+
+  pthread_mutex_lock(&file->write_lock);
+  int result = vtpc_flush_range(file, first, last);
+  if (result == 0) {
+    result = direct_io(file->fd, it, count, pos, false);
+  }
+  const int err = errno;
+  pthread_mutex_unlock(&file->write_lock);
+  errno = err;
+  return result;
+}
+
+// The blocks of the range are dropped before the write, so no older
+// writeback lands on top of it, and again after it, as readers may have
+// loaded the old data meanwhile. They cannot dirty them. Dropping them from
+// the shared segment before the write also keeps the reads in flight from
+// publishing the old data.
+int vtpc_bypass_write(
+    struct vtpc_file* file, struct vtpc_iter* it, size_t count, off_t pos
+) {
+  const size_t block_size = vtpc_cache_block_size();
+  const uint64_t first = (uint64_t)pos / block_size;
+  const uint64_t last = first + (count / block_size) - 1;
+
+  vtpc_cache_drop_range(file, first, last);
+  vtpc_shared_forget_range(file, first, last);
+  if (direct_io(file->fd, it, count, pos, true) == -1) {
+    return -1;
+  }
+  vtpc_writeback_written(file, pos + (off_t)count);
+  vtpc_cache_drop_range(file, first, last);
+  vtpc_shared_forget_range(file, first, last);
+  return 0;
+}
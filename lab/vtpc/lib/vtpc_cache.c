@@ -0,0 +1,1405 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vtpc_internal.h"
+#include "vtpc_policy.h"
+
+#define VTPC_MIN_BLOCK_SIZE 512
+#define VTPC_PREFETCH_BATCH 64
+// The automatic shard count leaves every shard at least this many blocks, so
+// that the per-shard policies stay close to a global one.
+#define VTPC_SHARD_MIN_BLOCKS 64
+#define VTPC_CACHE_LINE 64
+
+// The pool is split into shards by the hash of the block key. Each shard has
+// its own lock, index, free list and policy, so threads working on different
+// blocks rarely contend. A block always lives in the shard of its key.
+struct vtpc_shard {
+  alignas(VTPC_CACHE_LINE) pthread_mutex_t lock;
+  // Broadcast when a block of the shard finishes loading or writeback.
+  pthread_cond_t cond;
+  struct vtpc_block* blocks;
+  size_t capacity;
+  struct vtpc_block* free;
+  // Blocks out of service while the pool is shrunk, and how many are not.
+  struct vtpc_block* parked;
+  size_t active;
+  struct vtpc_block** buckets;
+  size_t bucket_mask;
+  struct vtpc_policy* policy;
+  struct vtpc_list prefetched;
+  struct vtpc_list scanned;  // Consumed first at the back.
+  uint64_t clock;            // Ticks on every access, for the block heat.
+  // Records every access when enabled, sketch NULL otherwise.
+  struct vtpc_admission admission;
+  struct vtpc_recent* files;  // Of the files with blocks in the shard.
+};
+
+struct vtpc_cache {
+  size_t block_size;
+  size_t capacity;
+  // Holds the pool, then the block array.
+  struct vtpc_arena arena;
+  char* pool;
+  struct vtpc_block* blocks;
+  struct vtpc_shard* shards;
+  _Atomic size_t active;  // Blocks in service, summed over the shards.
+  // Owned by the resizer: whether each block is parked, and the block using
+  // each buffer of the pool.
+  bool* parked;
+  struct vtpc_block** owners;
+  // Runs of buffers the arena releases together, 0 bytes if it does not,
+  // and which of them are released.
+  size_t run;
+  size_t runs;
+  bool* released;
+  _Atomic size_t released_bytes;
+  size_t shard_count;
+  size_t shard_mask;
+  size_t readahead_max;
+  size_t scan_min;
+  size_t bypass_min;
+  _Atomic size_t limited;  // Open files with a limit.
+};
+
+static struct vtpc_cache cache;
+
+static struct vtpc_shard* shard_of(uint64_t file, uint64_t index) {
+  const uint64_t hash = vtpc_hash_key(file, index);
+  return &cache.shards[(hash >> 32U) & cache.shard_mask];
+}
+
+static struct vtpc_block** bucket_of(
+    struct vtpc_shard* shard, uint64_t file, uint64_t index
+) {
+  return &shard->buckets[vtpc_hash_key(file, index) & shard->bucket_mask];
+}
+
+// The blocks of a file in a shard, in the order the cache would reclaim
+// them: unused prefetched blocks and those kept off the policy first, then
+// the least recently accessed, as LRU would. The other policies cannot be
+// restricted to a file, so a partition limit replaces its blocks by this
+// order, and in O(1) rather than by a walk over the whole file. The files
+// with blocks in a shard are linked to it, so that victims can be picked by
+// file without a walk over the shard either.
+struct vtpc_recent {
+  struct vtpc_block* newest;
+  struct vtpc_block* oldest;
+  size_t count;
+  struct vtpc_file* file;
+  struct vtpc_recent* prev;
+  struct vtpc_recent* next;
+};
+
+static struct vtpc_recent* recent_of(
+    struct vtpc_shard* shard, const struct vtpc_block* block
+) {
+  return &block->file->recent[shard - cache.shards];
+}
+
+static void recent_unlink(
+    struct vtpc_shard* shard, struct vtpc_recent* recent,
+    struct vtpc_block* block
+) {
+  if (block->recent_prev != NULL) {
+    block->recent_prev->recent_next = block->recent_next;
+  } else {
+    recent->newest = block->recent_next;
+  }
+  if (block->recent_next != NULL) {
+    block->recent_next->recent_prev = block->recent_prev;
+  } else {
+    recent->oldest = block->recent_prev;
+  }
+  if (--recent->count > 0) {
+    return;
+  }
+  *(recent->prev != NULL ? &recent->prev->next : &shard->files) = recent->next;
+  if (recent->next != NULL) {
+    recent->next->prev = recent->prev;
+  }
+}
+
+static void recent_push(
+    struct vtpc_shard* shard, struct vtpc_recent* recent,
+    struct vtpc_block* block, bool newest
+) {
+  if (recent->count == 0) {
+    recent->prev = NULL;
+    recent->next = shard->files;
+    if (shard->files != NULL) {
+      shard->files->prev = recent;
+    }
+    shard->files = recent;
+  }
+  if (newest) {
+    block->recent_prev = NULL;
+    block->recent_next = recent->newest;
+    *(recent->newest != NULL ? &recent->newest->recent_prev
+                             : &recent->oldest) = block;
+    recent->newest = block;
+  } else {
+    block->recent_next = NULL;
+    block->recent_prev = recent->oldest;
+    *(recent->oldest != NULL ? &recent->oldest->recent_next
+                             : &recent->newest) = block;
+    recent->oldest = block;
+  }
+  recent->count++;
+}
+
+// Moves a resident block to the end of its file's order.
+static void recent_move(
+    struct vtpc_shard* shard, struct vtpc_block* block, bool newest
+) {
+  struct vtpc_recent* recent = recent_of(shard, block);
+  recent_unlink(shard, recent, block);
+  recent_push(shard, recent, block, newest);
+}
+
+static void index_insert(struct vtpc_shard* shard, struct vtpc_block* block) {
+  struct vtpc_file* file = block->file;
+  struct vtpc_block** bucket = bucket_of(shard, file->id, block->index);
+  block->hash_next = *bucket;
+  *bucket = block;
+
+  pthread_mutex_lock(&file->blocks_lock);
+  block->file_prev = NULL;
+  block->file_next = file->blocks;
+  if (file->blocks != NULL) {
+    file->blocks->file_prev = block;
+  }
+  file->blocks = block;
+  pthread_mutex_unlock(&file->blocks_lock);
+  recent_push(shard, recent_of(shard, block), block, true);
+  atomic_fetch_add(&file->resident, 1);
+}
+
+static void index_remove(struct vtpc_shard* shard, struct vtpc_block* block) {
+  struct vtpc_file* file = block->file;
+  struct vtpc_block** link = bucket_of(shard, file->id, block->index);
+  while (*link != block) {
+    link = &(*link)->hash_next;
+  }
+  *link = block->hash_next;
+
+  pthread_mutex_lock(&file->blocks_lock);
+  if (block->file_prev != NULL) {
+    block->file_prev->file_next = block->file_next;
+  } else {
+    file->blocks = block->file_next;
+  }
+  if (block->file_next != NULL) {
+    block->file_next->file_prev = block->file_prev;
+  }
+  pthread_mutex_unlock(&file->blocks_lock);
+  recent_unlink(shard, recent_of(shard, block), block);
+  atomic_fetch_sub(&file->resident, 1);
+  block->file = NULL;
+}
+
+static struct vtpc_block* index_find(
+    struct vtpc_shard* shard, struct vtpc_file* file, uint64_t index
+) {
+  struct vtpc_block* block = *bucket_of(shard, file->id, index);
+  while (block != NULL && (block->file != file || block->index != index)) {
+    block = block->hash_next;
+  }
+  return block;
+}
+
+static void release(struct vtpc_shard* shard, struct vtpc_block* block) {
+  block->next = shard->free;
+  shard->free = block;
+}
+
+static bool shard_busy(struct vtpc_shard* shard) {
+  for (size_t i = 0; i < shard->capacity; ++i) {
+    if ((shard->blocks[i].flags &
+         (VTPC_BLOCK_LOADING | VTPC_BLOCK_WRITEBACK)) != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void detach(struct vtpc_shard* shard, struct vtpc_block* block);
+
+// Whether the eviction of the block would take its file below its
+// reservation, for blocks of other files.
+static bool reserved(
+    const struct vtpc_block* block, const struct vtpc_file* file
+) {
+  return block->file != file &&
+         atomic_load(&block->file->resident) <=
+             atomic_load(&block->file->reserve);
+}
+
+static bool over_limit(const struct vtpc_file* file) {
+  const size_t limit = atomic_load(&file->limit);
+  return limit != 0 && atomic_load(&file->resident) > limit;
+}
+
+// The first block of the file in the shard, in the order of its partition,
+// that can be evicted, or NULL. Only busy and pinned blocks are passed over.
+static struct vtpc_block* oldest_of(const struct vtpc_recent* recent) {
+  struct vtpc_block* victim = recent->oldest;
+  while (victim != NULL &&
+         (victim->pins != 0 ||
+          (victim->flags & (VTPC_BLOCK_LOADING | VTPC_BLOCK_WRITEBACK)) != 0)) {
+    victim = victim->recent_prev;
+  }
+  return victim;
+}
+
+// The oldest block of a file over its limit other than `file`, or NULL. The
+// files are only looked at while some have a limit.
+static struct vtpc_block* over_victim(
+    struct vtpc_shard* shard, const struct vtpc_file* file
+) {
+  if (atomic_load(&cache.limited) == 0) {
+    return NULL;
+  }
+  for (struct vtpc_recent* recent = shard->files; recent != NULL;
+       recent = recent->next) {
+    if (recent->file != file && over_limit(recent->file)) {
+      struct vtpc_block* victim = oldest_of(recent);
+      if (victim != NULL) {
+        return victim;
+      }
+    }
+  }
+  return NULL;
+}
+
+// Stands in for a victim of the policy down to its reservation: the least
+// recently accessed of the oldest blocks of the files in the shard that are
+// not, or NULL.
+static struct vtpc_block* spare_victim(
+    struct vtpc_shard* shard, const struct vtpc_file* file
+) {
+  struct vtpc_block* spare = NULL;
+  for (struct vtpc_recent* recent = shard->files; recent != NULL;
+       recent = recent->next) {
+    struct vtpc_block* victim = oldest_of(recent);
+    if (victim != NULL && !reserved(victim, file) &&
+        (spare == NULL || victim->touched < spare->touched)) {
+      spare = victim;
+    }
+  }
+  return spare;
+}
+
+static void take(struct vtpc_shard* shard, struct vtpc_block* victim) {
+  if ((victim->flags & VTPC_BLOCK_PREFETCHED) != 0) {
+    vtpc_stat_add(VTPC_STAT_READAHEAD_WASTED, 1);
+  }
+  detach(shard, victim);
+}
+
+// Takes a block for `file` (NULL when the pool shrinks). A file at its limit
+// replaces one of its own blocks in the shard, if it has one there, so it
+// overshoots by at most a block per shard. Otherwise blocks of scans and unused
+// prefetched blocks are reclaimed first, so neither can push the hot set out,
+// then the blocks other files hold over their limits, before the policy is
+// asked for a victim. Victims under writeback or pinned are put back into the
+// policy. A victim of a file down to its reservation is left where it is, and
+// the oldest block of a file that is not replaces it, unless nothing else is
+// left. Fails with EAGAIN when every block is only busy loading or being
+// written for now, and with ENOBUFS when the rest are pinned, as pins may be
+// held indefinitely.
+static struct vtpc_block* acquire(
+    struct vtpc_shard* shard, struct vtpc_file* file
+) {
+  struct vtpc_block* block = NULL;
+  const size_t limit = file == NULL ? 0 : atomic_load(&file->limit);
+  if (limit != 0 && atomic_load(&file->resident) >= limit) {
+    block = oldest_of(&file->recent[shard - cache.shards]);
+    if (block != NULL) {
+      take(shard, block);
+    }
+  }
+  if (block == NULL && (block = shard->free) != NULL) {
+    shard->free = block->next;
+    return block;
+  }
+
+  // Neither list holds dirty blocks: writing a block admits it first.
+  if (block != NULL) {
+    // Taken from the file itself.
+  } else if ((block = vtpc_list_back(&shard->scanned)) != NULL) {
+    vtpc_list_remove(&shard->scanned, block);
+    block->flags &= ~(uint32_t)VTPC_BLOCK_SCANNED;
+  } else if ((block = vtpc_list_back(&shard->prefetched)) != NULL) {
+    vtpc_list_remove(&shard->prefetched, block);
+    block->flags &= ~(uint32_t)VTPC_BLOCK_PREFETCHED;
+    vtpc_stat_add(VTPC_STAT_READAHEAD_WASTED, 1);
+  } else if ((block = over_victim(shard, file)) != NULL) {
+    take(shard, block);
+  } else {
+    struct vtpc_block* busy = NULL;
+    for (;;) {
+      block = shard->policy->ops->victim(shard->policy);
+      if (block == NULL) {
+        break;
+      }
+      if ((block->flags & VTPC_BLOCK_WRITEBACK) != 0 || block->pins != 0) {
+        block = shard->policy->ops->evict(shard->policy);
+        block->next = busy;
+        busy = block;
+        continue;
+      }
+      struct vtpc_block* spare =
+          reserved(block, file) ? spare_victim(shard, file) : NULL;
+      if (spare != NULL) {
+        take(shard, spare);
+        block = spare;
+      } else {
+        // Reservations beyond the pool give way.
+        block = shard->policy->ops->evict(shard->policy);
+      }
+      break;
+    }
+    while (busy != NULL) {
+      struct vtpc_block* next = busy->next;
+      shard->policy->ops->insert(shard->policy, busy);
+      busy = next;
+    }
+  }
+  if (block == NULL) {
+    errno = shard_busy(shard) ? EAGAIN : ENOBUFS;
+    return NULL;
+  }
+  if ((block->flags & VTPC_BLOCK_DIRTY) != 0 &&
+      vtpc_writeback_block(block) == -1) {
+    shard->policy->ops->insert(shard->policy, block);
+    return NULL;
+  }
+  index_remove(shard, block);
+  vtpc_stat_add(VTPC_STAT_EVICTIONS, 1);
+  return block;
+}
+
+static void detach(struct vtpc_shard* shard, struct vtpc_block* block) {
+  if ((block->flags & VTPC_BLOCK_PREFETCHED) != 0) {
+    vtpc_list_remove(&shard->prefetched, block);
+    block->flags &= ~(uint32_t)VTPC_BLOCK_PREFETCHED;
+  } else if ((block->flags & VTPC_BLOCK_SCANNED) != 0) {
+    vtpc_list_remove(&shard->scanned, block);
+    block->flags &= ~(uint32_t)VTPC_BLOCK_SCANNED;
+  } else {
+    shard->policy->ops->remove(shard->policy, block);
+  }
+}
+
+static void cache_free(void) {
+  for (size_t i = 0; i < cache.shard_count; ++i) {
+    struct vtpc_shard* shard = &cache.shards[i];
+    if (shard->policy != NULL) {
+      shard->policy->ops->destroy(shard->policy);
+    }
+    vtpc_admission_destroy(&shard->admission);
+    free(shard->buckets);
+    pthread_cond_destroy(&shard->cond);
+    pthread_mutex_destroy(&shard->lock);
+  }
+  free(cache.shards);
+  free(cache.parked);
+  free(cache.owners);
+  free(cache.released);
+  vtpc_arena_unmap(&cache.arena);
+  memset(&cache, 0, sizeof(cache));
+}
+
+static size_t shards_auto(size_t capacity) {
+  const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  const size_t limit = cpus > 0 ? 4 * (size_t)cpus : 1;
+  size_t shards = 1;
+  while (shards < limit && 2 * shards * VTPC_SHARD_MIN_BLOCKS <= capacity) {
+    shards <<= 1U;
+  }
+  return shards;
+}
+
+static int shard_init(
+    struct vtpc_shard* shard,
+    const struct vtpc_policy_ops* policy,
+    const struct vtpc_config* config
+) {
+  pthread_mutex_init(&shard->lock, NULL);
+  pthread_cond_init(&shard->cond, NULL);
+  vtpc_list_init(&shard->prefetched);
+  vtpc_list_init(&shard->scanned);
+
+  size_t buckets = 1;
+  while (buckets < 2 * shard->capacity) {
+    buckets <<= 1U;
+  }
+  shard->buckets = calloc(buckets, sizeof(struct vtpc_block*));
+  shard->policy = policy->create(shard->capacity, config);
+  if (shard->buckets == NULL || shard->policy == NULL) {
+    return -1;
+  }
+  if (config->admission &&
+      vtpc_admission_init(&shard->admission, shard->capacity) == -1) {
+    return -1;
+  }
+  shard->bucket_mask = buckets - 1;
+  shard->active = shard->capacity;
+
+  const uint32_t id = (uint32_t)(shard - cache.shards);
+  for (size_t i = shard->capacity; i > 0; --i) {
+    struct vtpc_block* block = &shard->blocks[i - 1];
+    const size_t slot = (size_t)(block - cache.blocks);
+    block->data = cache.pool + (cache.block_size * slot);
+    block->shard = id;
+    release(shard, block);
+  }
+  return 0;
+}
+
+int vtpc_cache_init(const struct vtpc_config* config) {
+  const size_t block_size = config->block_size;
+  if (block_size < VTPC_MIN_BLOCK_SIZE ||
+      (block_size & (block_size - 1)) != 0 || config->capacity == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  const size_t shards =
+      config->shards == 0 ? shards_auto(config->capacity) : config->shards;
+  if ((shards & (shards - 1)) != 0 || shards > config->capacity) {
+    errno = EINVAL;
+    return -1;
+  }
+  const struct vtpc_policy_ops* policy = vtpc_policy_find(config->policy);
+  if (policy == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (vtpc_arena_mode(config->hugepages) == -1) {
+    return -1;
+  }
+
+  cache_free();
+
+  // The block array starts on a cache line past the pool, whose blocks are
+  // aligned by the mapping.
+  const size_t pool_size = block_size * config->capacity;
+  const size_t blocks_offset =
+      (pool_size + VTPC_CACHE_LINE - 1) / VTPC_CACHE_LINE * VTPC_CACHE_LINE;
+  if (vtpc_arena_map(
+          &cache.arena,
+          blocks_offset + (config->capacity * sizeof(struct vtpc_block)),
+          config
+      ) == -1) {
+    return -1;
+  }
+  cache.pool = cache.arena.base;
+  cache.blocks = (struct vtpc_block*)(cache.pool + blocks_offset);
+  void* array = NULL;
+  const int err = posix_memalign(
+      &array, VTPC_CACHE_LINE, shards * sizeof(struct vtpc_shard)
+  );
+  if (err != 0) {
+    cache_free();
+    errno = err;
+    return -1;
+  }
+  memset(array, 0, shards * sizeof(struct vtpc_shard));
+  cache.shards = array;
+
+  cache.block_size = block_size;
+  cache.capacity = config->capacity;
+  struct vtpc_block* blocks = cache.blocks;
+  for (size_t i = 0; i < shards; ++i) {
+    struct vtpc_shard* shard = &cache.shards[i];
+    shard->blocks = blocks;
+    shard->capacity =
+        (config->capacity / shards) + (i < config->capacity % shards ? 1 : 0);
+    blocks += shard->capacity;
+    cache.shard_count = i + 1;
+    if (shard_init(shard, policy, config) == -1) {
+      cache_free();
+      errno = ENOMEM;
+      return -1;
+    }
+  }
+  cache.shard_mask = shards - 1;
+  atomic_store(&cache.active, config->capacity);
+  if (cache.arena.run != 0) {
+    cache.run = cache.arena.run > block_size ? cache.arena.run : block_size;
+    cache.runs = pool_size / cache.run;
+  }
+  cache.parked = calloc(config->capacity, sizeof(bool));
+  cache.owners = calloc(config->capacity, sizeof(struct vtpc_block*));
+  cache.released = calloc(cache.runs == 0 ? 1 : cache.runs, sizeof(bool));
+  if (cache.parked == NULL || cache.owners == NULL || cache.released == NULL) {
+    cache_free();
+    errno = ENOMEM;
+    return -1;
+  }
+  for (size_t i = 0; i < config->capacity; ++i) {
+    cache.owners[i] = &cache.blocks[i];
+  }
+  // Leave most of the pool to the policy even while a window is in flight.
+  cache.readahead_max = config->readahead;
+  if (cache.readahead_max > config->capacity / 4) {
+    cache.readahead_max = config->capacity / 4;
+  }
+  // A stream longer than half the pool would not survive to its next pass,
+  // and a request larger than the pool would evict all of it.
+  cache.scan_min = config->scan;
+  if (cache.scan_min > config->capacity / 2) {
+    cache.scan_min = config->capacity / 2 == 0 ? 1 : config->capacity / 2;
+  }
+  cache.bypass_min = config->bypass;
+  if (cache.bypass_min > config->capacity) {
+    cache.bypass_min = config->capacity;
+  }
+  return vtpc_io_start(config, cache.pool, pool_size);
+}
+
+bool vtpc_cache_ready(void) {
+  return cache.pool != NULL;
+}
+
+// Blocks leave service the way misses reclaim them, so clean ones go first:
+// free blocks, then those of scans and unused prefetched ones, then the
+// victims of the policy, written back if dirty.
+static void park(struct vtpc_shard* shard, size_t target) {
+  while (shard->active > target) {
+    struct vtpc_block* block = acquire(shard, NULL);
+    if (block == NULL) {
+      return;
+    }
+    block->next = shard->parked;
+    shard->parked = block;
+    shard->active--;
+    cache.parked[block - cache.blocks] = true;
+  }
+}
+
+// Takes the run holding the buffer back from the kernel before it is used.
+static void restore(const char* data) {
+  if (cache.runs == 0) {
+    return;
+  }
+  const size_t run = (size_t)(data - cache.pool) / cache.run;
+  if (run < cache.runs && cache.released[run]) {
+    vtpc_arena_restore(&cache.arena, cache.pool + (run * cache.run), cache.run);
+    cache.released[run] = false;
+    atomic_fetch_sub(&cache.released_bytes, cache.run);
+  }
+}
+
+static void unpark(struct vtpc_shard* shard, size_t target) {
+  while (shard->active < target && shard->parked != NULL) {
+    struct vtpc_block* block = shard->parked;
+    shard->parked = block->next;
+    cache.parked[block - cache.blocks] = false;
+    restore(block->data);
+    release(shard, block);
+    shard->active++;
+  }
+}
+
+// Parked blocks are picked by the policy all over the pool, while the arena
+// releases memory in aligned runs, huge pages for THP. So the blocks in
+// service using the top `parked` buffers swap theirs for those of parked
+// blocks below, copying their data, and the runs left wholly to parked
+// blocks go back to the kernel. Busy and pinned blocks stay where they are,
+// and so does the memory of the runs they are in.
+static void compact(size_t parked) {
+  if (cache.runs == 0) {
+    return;
+  }
+  const size_t first = cache.capacity - parked;
+  size_t spare = 0;
+  for (size_t slot = first; slot < cache.capacity; ++slot) {
+    struct vtpc_block* block = cache.owners[slot];
+    if (cache.parked[block - cache.blocks]) {
+      continue;
+    }
+    while (spare < first && !cache.parked[cache.owners[spare] - cache.blocks]) {
+      spare++;
+    }
+    if (spare == first) {
+      break;
+    }
+    struct vtpc_block* other = cache.owners[spare];
+    struct vtpc_shard* shard = &cache.shards[block->shard];
+    pthread_mutex_lock(&shard->lock);
+    const bool idle =
+        block->pins == 0 &&
+        (block->flags & (VTPC_BLOCK_LOADING | VTPC_BLOCK_WRITEBACK)) == 0;
+    if (idle) {
+      restore(other->data);
+      if (block->file != NULL) {
+        memcpy(other->data, block->data, cache.block_size);
+      }
+      char* data = block->data;
+      block->data = other->data;
+      other->data = data;
+      cache.owners[spare] = block;
+      cache.owners[slot] = other;
+      spare++;
+    }
+    pthread_mutex_unlock(&shard->lock);
+  }
+
+  const size_t per_run = cache.run / cache.block_size;
+  for (size_t run = first / per_run; run < cache.runs; ++run) {
+    bool idle = !cache.released[run];
+    for (size_t i = run * per_run; idle && i < (run + 1) * per_run; ++i) {
+      idle = cache.parked[cache.owners[i] - cache.blocks];
+    }
+    if (!idle) {
+      continue;
+    }
+    vtpc_io_released(true);
+    if (vtpc_arena_release(
+            &cache.arena, cache.pool + (run * cache.run), cache.run
+        ) == 0) {
+      cache.released[run] = true;
+      atomic_fetch_add(&cache.released_bytes, cache.run);
+    }
+  }
+  vtpc_io_released(atomic_load(&cache.released_bytes) != 0);
+}
+
+size_t vtpc_cache_resize(size_t capacity) {
+  if (capacity > cache.capacity) {
+    capacity = cache.capacity;
+  }
+  size_t active = 0;
+  for (size_t i = 0; i < cache.shard_count; ++i) {
+    struct vtpc_shard* shard = &cache.shards[i];
+    size_t target = capacity * shard->capacity / cache.capacity;
+    if (target == 0) {
+      target = 1;
+    }
+    pthread_mutex_lock(&shard->lock);
+    if (shard->active > target) {
+      park(shard, target);
+    } else {
+      unpark(shard, target);
+    }
+    active += shard->active;
+    pthread_mutex_unlock(&shard->lock);
+  }
+  // Published first, so that the released bytes never exceed the parked.
+  atomic_store(&cache.active, active);
+  compact(cache.capacity - active);
+  return active;
+}
+
+bool vtpc_cache_compacted(void) {
+  if (cache.runs == 0) {
+    return true;
+  }
+  const size_t per_run = cache.run / cache.block_size;
+  const size_t used = (atomic_load(&cache.active) + per_run - 1) / per_run;
+  const size_t spare = cache.runs > used ? cache.runs - used : 0;
+  return atomic_load(&cache.released_bytes) >= spare * cache.run;
+}
+
+size_t vtpc_cache_active(void) {
+  return atomic_load(&cache.active);
+}
+
+void vtpc_cache_pool_stats(struct vtpc_stats* stats) {
+  stats->pool_blocks = atomic_load(&cache.active);
+  stats->pool_retained_bytes =
+      ((cache.capacity - stats->pool_blocks) * cache.block_size) -
+      atomic_load(&cache.released_bytes);
+  stats->pool_bytes = cache.arena.size;
+  stats->pool_backing = cache.arena.backing;
+  stats->pool_locked = cache.arena.locked ? 1 : 0;
+}
+
+size_t vtpc_cache_block_size(void) {
+  return cache.block_size;
+}
+
+// Keeps a block read by a scan or refused by the admission filter off the
+// policy, to be reclaimed first.
+static void scanned(struct vtpc_shard* shard, struct vtpc_block* block) {
+  block->flags |= VTPC_BLOCK_SCANNED;
+  vtpc_list_push_back(&shard->scanned, block);
+  recent_move(shard, block, false);
+}
+
+// Once the pool is full, the admission filter lets a block read into the
+// policy only if it was accessed more often lately than the victim it would
+// displace. Writes always enter it, as dirty blocks are kept on the policy.
+static bool kept_off(
+    struct vtpc_shard* shard, struct vtpc_block* block, enum vtpc_access access
+) {
+  if (access == VTPC_ACCESS_SCAN) {
+    return true;
+  }
+  if (access != VTPC_ACCESS_READ || shard->admission.sketch == NULL ||
+      shard->free != NULL) {
+    return false;
+  }
+  struct vtpc_block* victim = shard->policy->ops->victim(shard->policy);
+  return victim != NULL &&
+         vtpc_admission_estimate(
+             &shard->admission, block->file->id, block->index
+         ) <= vtpc_admission_estimate(
+                  &shard->admission, victim->file->id, victim->index
+              );
+}
+
+static void admit(
+    struct vtpc_shard* shard, struct vtpc_block* block, enum vtpc_access access
+) {
+  if (kept_off(shard, block, access)) {
+    scanned(shard, block);
+  } else {
+    shard->policy->ops->insert(shard->policy, block);
+  }
+}
+
+static void touch(
+    struct vtpc_shard* shard, struct vtpc_block* block, enum vtpc_access access
+) {
+  if (access != VTPC_ACCESS_SCAN && block->heat < UINT32_MAX) {
+    block->heat++;
+  }
+  block->touched = ++shard->clock;
+}
+
+// A scan leaves the blocks of the policy where they are. Any other access
+// admits a block read ahead or kept off the policy, unless the filter keeps
+// it off again.
+static void hit(
+    struct vtpc_shard* shard, struct vtpc_block* block, enum vtpc_access access
+) {
+  touch(shard, block, access);
+  if ((block->flags & VTPC_BLOCK_PREFETCHED) != 0) {
+    detach(shard, block);
+    vtpc_stat_add(VTPC_STAT_READAHEAD_HITS, 1);
+    admit(shard, block, access);
+  } else if ((block->flags & VTPC_BLOCK_SCANNED) != 0) {
+    if (!kept_off(shard, block, access)) {
+      detach(shard, block);
+      shard->policy->ops->insert(shard->policy, block);
+    }
+  } else if (access != VTPC_ACCESS_SCAN) {
+    shard->policy->ops->access(shard->policy, block);
+  }
+  if (access != VTPC_ACCESS_SCAN &&
+      (block->flags & (VTPC_BLOCK_PREFETCHED | VTPC_BLOCK_SCANNED)) == 0) {
+    recent_move(shard, block, true);
+  }
+}
+
+// A miss is read with the shard unlocked; the block stays indexed as
+// loading, so a concurrent miss on it waits instead of reading it twice.
+static struct vtpc_block* load(
+    struct vtpc_shard* shard,
+    struct vtpc_file* file,
+    uint64_t index,
+    enum vtpc_access access
+) {
+  const uint64_t start = vtpc_now_ns();
+  struct vtpc_block* block = acquire(shard, file);
+  if (block == NULL) {
+    return NULL;
+  }
+  vtpc_stat_add(VTPC_STAT_MISSES, 1);
+  block->file = file;
+  block->index = index;
+  block->next_use = VTPC_NEVER;
+  block->heat = 0;
+  block->version = vtpc_shared_version(file, index);
+  touch(shard, block, access);
+
+  const off_t offset = (off_t)(index * cache.block_size);
+  if (access == VTPC_ACCESS_OVERWRITE) {
+    // Writers of the file are serialized, so nobody sees the old content.
+  } else if (offset >= atomic_load(&file->disk_size)) {
+    memset(block->data, 0, cache.block_size);
+  } else {
+    block->flags |= VTPC_BLOCK_LOADING;
+    index_insert(shard, block);
+    pthread_mutex_unlock(&shard->lock);
+    uint64_t epoch = 0;
+    ssize_t n = (ssize_t)cache.block_size;
+    int err = 0;
+    if (vtpc_shared_get(file, index, block->data, &epoch)) {
+      vtpc_stat_add(VTPC_STAT_SHARED_HITS, 1);
+    } else {
+      struct iovec iov = {.iov_base = block->data, .iov_len = cache.block_size};
+      struct vtpc_io op = {
+          .fd = file->fd, .offset = offset, .iov = &iov, .iovcnt = 1
+      };
+      vtpc_io_run(&op, 1);
+      n = op.result;
+      err = op.error;
+      if (n >= 0) {
+        memset(block->data + n, 0, cache.block_size - (size_t)n);
+        vtpc_stat_add(VTPC_STAT_DISK_READ_BYTES, (uint64_t)n);
+        vtpc_shared_put(file, index, block->data, epoch);
+      }
+    }
+    pthread_mutex_lock(&shard->lock);
+    block->flags &= ~(uint32_t)VTPC_BLOCK_LOADING;
+    pthread_cond_broadcast(&shard->cond);
+    if (n < 0) {
+      index_remove(shard, block);
+      release(shard, block);
+      errno = err;
+      return NULL;
+    }
+    admit(shard, block, access);
+    vtpc_stat_latency(VTPC_OP_MISS, start);
+    return block;
+  }
+  index_insert(shard, block);
+  admit(shard, block, access);
+  vtpc_stat_latency(VTPC_OP_MISS, start);
+  return block;
+}
+
+static void drop(struct vtpc_shard* shard, struct vtpc_block* block);
+
+// Another process wrote the block back since it was read. A dirty copy or
+// one in use keeps the data of this process.
+static bool stale(const struct vtpc_block* block) {
+  return (block->flags & (VTPC_BLOCK_DIRTY | VTPC_BLOCK_WRITEBACK)) == 0 &&
+         block->pins == 0 &&
+         block->version != vtpc_shared_version(block->file, block->index);
+}
+
+struct vtpc_block* vtpc_cache_get(
+    struct vtpc_file* file, uint64_t index, enum vtpc_access access
+) {
+  const bool read = access == VTPC_ACCESS_READ || access == VTPC_ACCESS_SCAN;
+  const uint32_t busy =
+      read ? VTPC_BLOCK_LOADING : VTPC_BLOCK_LOADING | VTPC_BLOCK_WRITEBACK;
+  struct vtpc_shard* shard = shard_of(file->id, index);
+  pthread_mutex_lock(&shard->lock);
+  if (shard->admission.sketch != NULL) {
+    vtpc_admission_record(&shard->admission, file->id, index);
+  }
+  vtpc_mrc_record(file->id, index);
+  for (;;) {
+    struct vtpc_block* block = index_find(shard, file, index);
+    if (block != NULL && (block->flags & busy) == 0 &&
+        (read || block->pins == 0)) {
+      if (stale(block)) {
+        drop(shard, block);
+        continue;
+      }
+      hit(shard, block, access);
+      vtpc_stat_add(VTPC_STAT_HITS, 1);
+      return block;
+    }
+    if (block == NULL) {
+      block = load(shard, file, index, access);
+      if (block != NULL) {
+        return block;
+      }
+      if (errno != EAGAIN) {
+        break;
+      }
+    }
+    pthread_cond_wait(&shard->cond, &shard->lock);
+  }
+  pthread_mutex_unlock(&shard->lock);
+  return NULL;
+}
+
+void vtpc_block_lock(struct vtpc_block* block) {
+  pthread_mutex_lock(&cache.shards[block->shard].lock);
+}
+
+void vtpc_block_unlock(struct vtpc_block* block) {
+  pthread_mutex_unlock(&cache.shards[block->shard].lock);
+}
+
+void vtpc_block_wake(struct vtpc_block* block) {
+  pthread_cond_broadcast(&cache.shards[block->shard].cond);
+}
+
+void vtpc_block_pin(struct vtpc_block* block) {
+  block->pins++;
+}
+
+void vtpc_block_unpin(struct vtpc_block* block) {
+  struct vtpc_shard* shard = &cache.shards[block->shard];
+  pthread_mutex_lock(&shard->lock);
+  if (--block->pins == 0) {
+    pthread_cond_broadcast(&shard->cond);
+  }
+  pthread_mutex_unlock(&shard->lock);
+}
+
+// Waits until the block is not busy or pinned and returns whether it still
+// belongs to the file. Called with the shard locked.
+static bool drop_wait(
+    struct vtpc_shard* shard, struct vtpc_block* block, struct vtpc_file* file
+) {
+  while (block->file == file &&
+         ((block->flags & (VTPC_BLOCK_LOADING | VTPC_BLOCK_WRITEBACK)) != 0 ||
+          block->pins != 0)) {
+    pthread_cond_wait(&shard->cond, &shard->lock);
+  }
+  return block->file == file;
+}
+
+static void drop(struct vtpc_shard* shard, struct vtpc_block* block) {
+  if ((block->flags & VTPC_BLOCK_DIRTY) != 0) {
+    vtpc_block_clean(block);
+  }
+  detach(shard, block);
+  index_remove(shard, block);
+  release(shard, block);
+}
+
+// The block list of the file is locked after the shards, so every block is
+// looked up under its list lock and then revalidated under its shard lock.
+void vtpc_cache_drop_file(struct vtpc_file* file) {
+  for (;;) {
+    pthread_mutex_lock(&file->blocks_lock);
+    struct vtpc_block* block = file->blocks;
+    pthread_mutex_unlock(&file->blocks_lock);
+    if (block == NULL) {
+      return;
+    }
+
+    struct vtpc_shard* shard = &cache.shards[block->shard];
+    pthread_mutex_lock(&shard->lock);
+    if (drop_wait(shard, block, file)) {
+      drop(shard, block);
+    }
+    pthread_mutex_unlock(&shard->lock);
+  }
+}
+
+void vtpc_cache_limit(struct vtpc_file* file, size_t limit) {
+  const size_t before = atomic_exchange(&file->limit, limit);
+  if (before == 0 && limit != 0) {
+    atomic_fetch_add(&cache.limited, 1);
+  } else if (before != 0 && limit == 0) {
+    atomic_fetch_sub(&cache.limited, 1);
+  }
+  const size_t resident = atomic_load(&file->resident);
+  if (limit == 0 || resident <= limit) {
+    return;
+  }
+  for (size_t i = 0; i < cache.shard_count; ++i) {
+    struct vtpc_shard* shard = &cache.shards[i];
+    struct vtpc_recent* recent = &file->recent[i];
+    pthread_mutex_lock(&shard->lock);
+    const size_t keep = recent->count * limit / resident;
+    struct vtpc_block* block = recent->oldest;
+    while (block != NULL && recent->count > keep) {
+      struct vtpc_block* next = block->recent_prev;
+      if (block->pins == 0 &&
+          (block->flags & (VTPC_BLOCK_LOADING | VTPC_BLOCK_WRITEBACK)) == 0 &&
+          ((block->flags & VTPC_BLOCK_DIRTY) == 0 ||
+           vtpc_writeback_block(block) == 0)) {
+        drop(shard, block);
+        vtpc_stat_add(VTPC_STAT_EVICTIONS, 1);
+      }
+      block = next;
+    }
+    pthread_mutex_unlock(&shard->lock);
+  }
+}
+
+int vtpc_cache_file_init(struct vtpc_file* file) {
+  file->recent = calloc(cache.shard_count, sizeof(struct vtpc_recent));
+  if (file->recent == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+  for (size_t i = 0; i < cache.shard_count; ++i) {
+    file->recent[i].file = file;
+  }
+  return 0;
+}
+
+void vtpc_cache_file_destroy(struct vtpc_file* file) {
+  if (atomic_load(&file->limit) != 0) {
+    atomic_fetch_sub(&cache.limited, 1);
+  }
+  free(file->recent);
+  file->recent = NULL;
+}
+
+// Waits for the block like drop_wait or, if `idle`, only takes it when it is
+// clean and neither busy nor pinned.
+static bool drop_ready(
+    struct vtpc_shard* shard,
+    struct vtpc_block* block,
+    struct vtpc_file* file,
+    bool idle
+) {
+  if (!idle) {
+    return drop_wait(shard, block, file);
+  }
+  const uint32_t busy =
+      VTPC_BLOCK_LOADING | VTPC_BLOCK_WRITEBACK | VTPC_BLOCK_DIRTY;
+  return block->file == file && block->pins == 0 && (block->flags & busy) == 0;
+}
+
+static void drop_range(
+    struct vtpc_file* file, uint64_t first, uint64_t last, bool idle
+) {
+  if (last - first >= cache.capacity) {
+    for (size_t i = 0; i < cache.shard_count; ++i) {
+      struct vtpc_shard* shard = &cache.shards[i];
+      pthread_mutex_lock(&shard->lock);
+      for (size_t j = 0; j < shard->capacity; ++j) {
+        struct vtpc_block* block = &shard->blocks[j];
+        if (block->file == file && block->index >= first &&
+            block->index <= last && drop_ready(shard, block, file, idle) &&
+            block->index >= first && block->index <= last) {
+          drop(shard, block);
+        }
+      }
+      pthread_mutex_unlock(&shard->lock);
+    }
+    return;
+  }
+  for (uint64_t index = first; index <= last; ++index) {
+    struct vtpc_shard* shard = shard_of(file->id, index);
+    pthread_mutex_lock(&shard->lock);
+    struct vtpc_block* block = index_find(shard, file, index);
+    if (block != NULL && drop_ready(shard, block, file, idle) &&
+        block->index == index) {
+      drop(shard, block);
+    }
+    pthread_mutex_unlock(&shard->lock);
+  }
+}
+
+void vtpc_cache_drop_range(
+    struct vtpc_file* file, uint64_t first, uint64_t last
+) {
+  drop_range(file, first, last, false);
+}
+
+void vtpc_cache_evict_range(
+    struct vtpc_file* file, uint64_t first, uint64_t last
+) {
+  drop_range(file, first, last, true);
+}
+
+bool vtpc_cache_hints_enabled(void) {
+  return cache.shards != NULL && cache.shards[0].policy->ops->update != NULL;
+}
+
+static void advise(
+    struct vtpc_shard* shard, struct vtpc_block* block, uint64_t next_use
+) {
+  const uint32_t off_policy =
+      VTPC_BLOCK_PREFETCHED | VTPC_BLOCK_SCANNED | VTPC_BLOCK_LOADING;
+  if ((block->flags & off_policy) == 0) {
+    block->next_use = next_use;
+    shard->policy->ops->update(shard->policy, block);
+  }
+}
+
+void vtpc_cache_advise(
+    struct vtpc_file* file, uint64_t first, uint64_t last, uint64_t next_use
+) {
+  if (next_use == VTPC_NEVER) {
+    next_use--;
+  }
+  if (last - first >= cache.capacity) {
+    for (size_t i = 0; i < cache.shard_count; ++i) {
+      struct vtpc_shard* shard = &cache.shards[i];
+      pthread_mutex_lock(&shard->lock);
+      for (size_t j = 0; j < shard->capacity; ++j) {
+        struct vtpc_block* block = &shard->blocks[j];
+        if (block->file == file && block->index >= first &&
+            block->index <= last) {
+          advise(shard, block, next_use);
+        }
+      }
+      pthread_mutex_unlock(&shard->lock);
+    }
+    return;
+  }
+  for (uint64_t index = first; index <= last; ++index) {
+    struct vtpc_shard* shard = shard_of(file->id, index);
+    pthread_mutex_lock(&shard->lock);
+    struct vtpc_block* block = index_find(shard, file, index);
+    if (block != NULL) {
+      advise(shard, block, next_use);
+    }
+    pthread_mutex_unlock(&shard->lock);
+  }
+}
+
+size_t vtpc_cache_readahead_max(void) {
+  return cache.readahead_max;
+}
+
+size_t vtpc_cache_scan_min(void) {
+  return cache.scan_min;
+}
+
+size_t vtpc_cache_bypass_min(void) {
+  return cache.bypass_min;
+}
+
+// Runs of missing blocks, already indexed as loading, read together.
+struct prefetch {
+  size_t count;
+  size_t runs;
+  struct vtpc_block* blocks[VTPC_PREFETCH_BATCH];
+  uint64_t first[VTPC_PREFETCH_BATCH];  // Index of the first block of a run.
+  size_t start[VTPC_PREFETCH_BATCH + 1];  // Position of a run in `blocks`.
+};
+
+// Reads every run with a single preadv, all of them in flight at once,
+// unless the shared segment holds all of its blocks.
+static void prefetch_batch(struct vtpc_file* file, struct prefetch* batch) {
+  struct iovec iov[VTPC_PREFETCH_BATCH];
+  uint64_t epochs[VTPC_PREFETCH_BATCH];
+  bool shared[VTPC_PREFETCH_BATCH];
+  struct vtpc_io ops[VTPC_PREFETCH_BATCH];
+  size_t disk_runs[VTPC_PREFETCH_BATCH];
+  size_t count = 0;
+  batch->start[batch->runs] = batch->count;
+  for (size_t r = 0; r < batch->runs; ++r) {
+    bool from_disk = false;
+    for (size_t i = batch->start[r]; i < batch->start[r + 1]; ++i) {
+      const uint64_t index = batch->first[r] + (i - batch->start[r]);
+      iov[i].iov_base = batch->blocks[i]->data;
+      iov[i].iov_len = cache.block_size;
+      batch->blocks[i]->version = vtpc_shared_version(file, index);
+      shared[i] =
+          vtpc_shared_get(file, index, batch->blocks[i]->data, &epochs[i]);
+      from_disk = from_disk || !shared[i];
+    }
+    if (from_disk) {
+      disk_runs[count] = r;
+      ops[count++] = (struct vtpc_io){
+          .fd = file->fd,
+          .offset = (off_t)(batch->first[r] * cache.block_size),
+          .iov = &iov[batch->start[r]],
+          .iovcnt = (int)(batch->start[r + 1] - batch->start[r]),
+      };
+    }
+  }
+  vtpc_io_run(ops, count);
+
+  for (size_t r = 0, op = 0; r < batch->runs; ++r) {
+    const size_t len = batch->start[r + 1] - batch->start[r];
+    ssize_t n = (ssize_t)(len * cache.block_size);
+    const bool from_disk = op < count && disk_runs[op] == r;
+    if (from_disk) {
+      n = ops[op++].result;
+      vtpc_stat_add(VTPC_STAT_DISK_READ_BYTES, n < 0 ? 0 : (uint64_t)n);
+    } else {
+      vtpc_stat_add(VTPC_STAT_SHARED_HITS, len);
+    }
+
+    size_t loaded = n < 0 ? 0 : (size_t)n;
+    for (size_t i = batch->start[r]; i < batch->start[r + 1]; ++i) {
+      struct vtpc_block* block = batch->blocks[i];
+      struct vtpc_shard* shard = &cache.shards[block->shard];
+      const size_t valid =
+          loaded < cache.block_size ? loaded : cache.block_size;
+      memset(block->data + valid, 0, cache.block_size - valid);
+      loaded -= valid;
+      if (n >= 0 && !shared[i]) {
+        vtpc_shared_put(file, block->index, block->data, epochs[i]);
+      }
+
+      pthread_mutex_lock(&shard->lock);
+      block->flags &= ~(uint32_t)VTPC_BLOCK_LOADING;
+      if (n < 0) {
+        index_remove(shard, block);
+        release(shard, block);
+      } else {
+        block->flags |= VTPC_BLOCK_PREFETCHED;
+        vtpc_list_push_front(&shard->prefetched, block);
+        recent_move(shard, block, false);
+        vtpc_stat_add(VTPC_STAT_READAHEAD_BLOCKS, 1);
+      }
+      pthread_cond_broadcast(&shard->cond);
+      pthread_mutex_unlock(&shard->lock);
+    }
+  }
+  batch->count = 0;
+  batch->runs = 0;
+}
+
+// Takes a block for a missing key and indexes it as loading, with `heat`
+// carried over from an earlier run. Returns NULL when the block is resident
+// or no block can be taken; a `spare` block is only taken from the free list,
+// so that it evicts nothing.
+static struct vtpc_block* prefetch_take(
+    struct vtpc_file* file,
+    uint64_t index,
+    uint32_t heat,
+    bool spare,
+    bool* resident
+) {
+  struct vtpc_shard* shard = shard_of(file->id, index);
+  pthread_mutex_lock(&shard->lock);
+  struct vtpc_block* block = NULL;
+  *resident = index_find(shard, file, index) != NULL;
+  if (!*resident && (!spare || shard->free != NULL)) {
+    block = acquire(shard, file);
+  }
+  if (block != NULL) {
+    block->file = file;
+    block->index = index;
+    block->next_use = VTPC_NEVER;
+    block->heat = heat;
+    block->touched = 0;
+    block->flags |= VTPC_BLOCK_LOADING;
+    index_insert(shard, block);
+  }
+  pthread_mutex_unlock(&shard->lock);
+  return block;
+}
+
+// Adds a block taken for `index` to the batch, reading the batch once it is
+// full. Returns false if no block could be taken.
+static bool prefetch_add(
+    struct vtpc_file* file,
+    struct prefetch* batch,
+    uint64_t index,
+    struct vtpc_block* block
+) {
+  if (block == NULL) {
+    return false;
+  }
+  const size_t last = batch->runs - 1;
+  if (batch->runs == 0 ||
+      batch->first[last] + (batch->count - batch->start[last]) != index) {
+    batch->first[batch->runs] = index;
+    batch->start[batch->runs++] = batch->count;
+  }
+  batch->blocks[batch->count++] = block;
+  if (batch->count == VTPC_PREFETCH_BATCH) {
+    prefetch_batch(file, batch);
+  }
+  return true;
+}
+
+static uint64_t disk_blocks(struct vtpc_file* file) {
+  return ((uint64_t)atomic_load(&file->disk_size) + cache.block_size - 1) /
+         cache.block_size;
+}
+
+void vtpc_cache_prefetch(struct vtpc_file* file, uint64_t first, size_t count) {
+  uint64_t end = first + count;
+  if (end > disk_blocks(file)) {
+    end = disk_blocks(file);
+  }
+
+  struct prefetch batch;
+  batch.count = 0;
+  batch.runs = 0;
+  for (uint64_t index = first; index < end; ++index) {
+    bool resident = false;
+    struct vtpc_block* block = prefetch_take(file, index, 0, false, &resident);
+    if (!prefetch_add(file, &batch, index, block) && !resident) {
+      break;
+    }
+  }
+  if (batch.count > 0) {
+    prefetch_batch(file, &batch);
+  }
+}
+
+size_t vtpc_cache_prefetch_blocks(
+    struct vtpc_file* file, const struct vtpc_heat* blocks, size_t count
+) {
+  const uint64_t end = disk_blocks(file);
+  struct prefetch batch;
+  batch.count = 0;
+  batch.runs = 0;
+  size_t taken = 0;
+  for (size_t i = 0; i < count && blocks[i].index < end; ++i) {
+    bool resident = false;
+    struct vtpc_block* block =
+        prefetch_take(file, blocks[i].index, blocks[i].heat, true, &resident);
+    taken += prefetch_add(file, &batch, blocks[i].index, block) ? 1 : 0;
+  }
+  if (batch.count > 0) {
+    prefetch_batch(file, &batch);
+  }
+  return taken;
+}
+
+size_t vtpc_cache_resident(
+    struct vtpc_file* file, struct vtpc_heat* out, size_t max
+) {
+  size_t count = 0;
+  for (size_t i = 0; i < cache.shard_count && count < max; ++i) {
+    struct vtpc_shard* shard = &cache.shards[i];
+    pthread_mutex_lock(&shard->lock);
+    for (size_t j = 0; j < shard->capacity && count < max; ++j) {
+      const struct vtpc_block* block = &shard->blocks[j];
+      if (block->file == file && block->heat > 0 &&
+          (block->flags & VTPC_BLOCK_LOADING) == 0) {
+        out[count++] = (struct vtpc_heat){
+            .index = block->index,
+            .heat = block->heat,
+            .touched = block->touched,
+        };
+      }
+    }
+    pthread_mutex_unlock(&shard->lock);
+  }
+  return count;
+}
+
+uint64_t vtpc_now_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((uint64_t)now.tv_sec * VTPC_NS_PER_SEC) + (uint64_t)now.tv_nsec;
+}
+
+// A short read of a regular file means EOF, and O_DIRECT would reject the
+// unaligned offset of a retry anyway, so only EINTR is retried.
+ssize_t vtpc_pread_full(int fd, void* buf, size_t count, off_t offset) {
+  for (;;) {
+    const ssize_t n = pread(fd, buf, count, offset);
+    if (n >= 0 || errno != EINTR) {
+      return n;
+    }
+  }
+}
+
+ssize_t vtpc_pwrite_full(int fd, const void* buf, size_t count, off_t offset) {
+  size_t total = 0;
+  while (total < count) {
+    const ssize_t n = pwrite(
+        fd, (const char*)buf + total, count - total, offset + (off_t)total
+    );
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return -1;
+    }
+    total += (size_t)n;
+  }
+  return (ssize_t)total;
+}
@@ -0,0 +1,96 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "vtpc_policy.h"
+
+// Blocks form a ring; new blocks are placed right behind the hand, so they
+// are the last to be inspected.
+struct clock {
+  struct vtpc_policy base;
+  struct vtpc_block* hand;
+};
+
+static struct vtpc_policy* clock_create(
+    size_t capacity, const struct vtpc_config* config
+) {
+  (void)config;
+  (void)capacity;
+  struct clock* clock = calloc(1, sizeof(struct clock));
+  if (clock == NULL) {
+    return NULL;
+  }
+  clock->base.ops = &vtpc_policy_clock;
+  return &clock->base;
+}
+
+static void clock_destroy(struct vtpc_policy* policy) {
+  free(policy);
+}
+
+static void clock_insert(struct vtpc_policy* policy, struct vtpc_block* block) {
+  struct clock* clock = (struct clock*)policy;
+  block->referenced = false;
+  if (clock->hand == NULL) {
+    block->prev = block;
+    block->next = block;
+    clock->hand = block;
+    return;
+  }
+  block->next = clock->hand;
+  block->prev = clock->hand->prev;
+  clock->hand->prev->next = block;
+  clock->hand->prev = block;
+}
+
+static void clock_access(struct vtpc_policy* policy, struct vtpc_block* block) {
+  (void)policy;
+  block->referenced = true;
+}
+
+static void clock_remove(struct vtpc_policy* policy, struct vtpc_block* block) {
+  struct clock* clock = (struct clock*)policy;
+  if (block->next == block) {
+    clock->hand = NULL;
+  } else {
+    if (clock->hand == block) {
+      clock->hand = block->next;
+    }
+    block->prev->next = block->next;
+    block->next->prev = block->prev;
+  }
+  block->prev = NULL;
+  block->next = NULL;
+}
+
+// Sweeps the hand to the victim, which `evict` would do next anyway.
+static struct vtpc_block* clock_victim(struct vtpc_policy* policy) {
+  struct clock* clock = (struct clock*)policy;
+  if (clock->hand == NULL) {
+    return NULL;
+  }
+  while (clock->hand->referenced) {
+    clock->hand->referenced = false;
+    clock->hand = clock->hand->next;
+  }
+  return clock->hand;
+}
+
+static struct vtpc_block* clock_evict(struct vtpc_policy* policy) {
+  struct vtpc_block* victim = clock_victim(policy);
+  if (victim != NULL) {
+    clock_remove(policy, victim);
+  }
+  return victim;
+}
+
+const struct vtpc_policy_ops vtpc_policy_clock = {
+    .name = "clock",
+    .create = clock_create,
+    .destroy = clock_destroy,
+    .insert = clock_insert,
+    .access = clock_access,
+    .remove = clock_remove,
+    .evict = clock_evict,
+    .victim = clock_victim,
+};
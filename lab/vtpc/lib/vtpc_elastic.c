@@ -0,0 +1,317 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vtpc_internal.h"
+
+// The pool grows by a sixteenth of the capacity at a time, and shrinks by a
+// quarter of what is in service, so it backs off faster than it takes.
+#define VTPC_ELASTIC_GROW_STEPS 16
+#define VTPC_ELASTIC_SHRINK_SHARE 4
+// Growing needs room for this many steps, so that it does not itself bring
+// the pressure it would then have to give back.
+#define VTPC_ELASTIC_ROOM_STEPS 4
+#define VTPC_ELASTIC_CGROUP "/sys/fs/cgroup"
+#define VTPC_ELASTIC_PSI "/proc/pressure/memory"
+
+struct sizing {
+  uint64_t generation;
+  size_t min;
+  size_t max;
+  size_t block_size;
+  size_t high;
+  uint64_t period_ns;
+  char pressure[PATH_MAX];
+  // The cgroup directory holding memory.current and memory.max, or empty.
+  char group[PATH_MAX];
+};
+
+// A resizer thread runs while `generation` is the one it was started with,
+// like the flusher.
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  bool conds_ready;
+  bool running;
+  uint64_t generation;
+} elastic = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static ssize_t read_text(const char* path, char* buf, size_t size) {
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return -1;
+  }
+  const ssize_t n = read(fd, buf, size - 1);
+  close(fd);
+  if (n < 0) {
+    return -1;
+  }
+  buf[n] = '\0';
+  return n;
+}
+
+// The "some avg10" percentage of a PSI file, or 0 if it cannot be read.
+static double pressure_of(const struct sizing* sizing) {
+  char text[256];
+  if (read_text(sizing->pressure, text, sizeof(text)) == -1) {
+    return 0;
+  }
+  const char* some = strstr(text, "some avg10=");
+  return some == NULL ? 0 : strtod(some + strlen("some avg10="), NULL);
+}
+
+static uint64_t group_value(const struct sizing* sizing, const char* name) {
+  char path[PATH_MAX + 32];
+  char text[64];
+  snprintf(path, sizeof(path), "%s/%s", sizing->group, name);
+  if (read_text(path, text, sizeof(text)) == -1) {
+    return UINT64_MAX;
+  }
+  char* end = NULL;
+  const unsigned long long value = strtoull(text, &end, 10);
+  return end == text ? UINT64_MAX : (uint64_t)value;
+}
+
+// Bytes the process can still take: up to the cgroup limit if there is one,
+// otherwise what the kernel reports as available.
+static uint64_t room_of(const struct sizing* sizing) {
+  if (sizing->group[0] != '\0') {
+    const uint64_t max = group_value(sizing, "memory.max");
+    const uint64_t current = group_value(sizing, "memory.current");
+    if (max != UINT64_MAX && current != UINT64_MAX) {
+      return max > current ? max - current : 0;
+    }
+  }
+  char text[4096];
+  if (read_text("/proc/meminfo", text, sizeof(text)) == -1) {
+    return UINT64_MAX;
+  }
+  const char* available = strstr(text, "MemAvailable:");
+  if (available == NULL) {
+    return UINT64_MAX;
+  }
+  return strtoull(available + strlen("MemAvailable:"), NULL, 10) * 1024;
+}
+
+static size_t next_target(const struct sizing* sizing, size_t active) {
+  const double pressure = pressure_of(sizing);
+  const uint64_t room = room_of(sizing);
+  size_t step = sizing->max / VTPC_ELASTIC_GROW_STEPS;
+  if (step == 0) {
+    step = 1;
+  }
+  const uint64_t step_bytes = (uint64_t)step * sizing->block_size;
+  if (pressure >= (double)sizing->high || room < step_bytes) {
+    size_t cut = active / VTPC_ELASTIC_SHRINK_SHARE;
+    if (cut == 0) {
+      cut = 1;
+    }
+    return active - sizing->min > cut ? active - cut : sizing->min;
+  }
+  if (2 * pressure < (double)sizing->high &&
+      room >= VTPC_ELASTIC_ROOM_STEPS * step_bytes) {
+    return sizing->max - active > step ? active + step : sizing->max;
+  }
+  return active;
+}
+
+// The pool is resized under `vtpc_mutex`, which its replacement takes after
+// ending this thread's generation, so the cache is only looked at once the
+// generation is known to be current. Resizing to the same size retries the
+// memory that busy blocks kept the last time.
+static bool resize(const struct sizing* sizing, size_t* active) {
+  const size_t target = next_target(sizing, *active);
+  pthread_mutex_lock(&vtpc_mutex);
+  pthread_mutex_lock(&elastic.lock);
+  const bool current = elastic.generation == sizing->generation;
+  pthread_mutex_unlock(&elastic.lock);
+  if (current && (target != *active || !vtpc_cache_compacted())) {
+    *active = vtpc_cache_resize(target);
+    vtpc_writeback_resize(*active);
+  }
+  pthread_mutex_unlock(&vtpc_mutex);
+  return current;
+}
+
+static void* elastic_main(void* arg) {
+  struct sizing* sizing = arg;
+  size_t active = sizing->max;
+  pthread_mutex_lock(&elastic.lock);
+  while (elastic.generation == sizing->generation) {
+    const uint64_t wake_at = vtpc_now_ns() + sizing->period_ns;
+    const struct timespec deadline = {
+        .tv_sec = (time_t)(wake_at / VTPC_NS_PER_SEC),
+        .tv_nsec = (long)(wake_at % VTPC_NS_PER_SEC),
+    };
+    if (pthread_cond_timedwait(&elastic.wake, &elastic.lock, &deadline) !=
+        ETIMEDOUT) {
+      continue;
+    }
+    pthread_mutex_unlock(&elastic.lock);
+    const bool current = resize(sizing, &active);
+    pthread_mutex_lock(&elastic.lock);
+    if (!current) {
+      break;
+    }
+  }
+  pthread_mutex_unlock(&elastic.lock);
+  free(sizing);
+  return NULL;
+}
+
+// The cgroup of the process, from its "0::/path" line, or empty if there is
+// none or its path does not fit.
+static void find_group(char* group, size_t size) {
+  group[0] = '\0';
+  char text[PATH_MAX];
+  if (read_text("/proc/self/cgroup", text, sizeof(text)) == -1) {
+    return;
+  }
+  const char* line = strstr(text, "0::");
+  if (line == NULL || (line != text && line[-1] != '\n')) {
+    return;
+  }
+  line += strlen("0::");
+  const size_t length = strcspn(line, "\n");
+  const int n =
+      snprintf(group, size, "%s%.*s", VTPC_ELASTIC_CGROUP, (int)length, line);
+  if (n < 0 || (size_t)n >= size) {
+    group[0] = '\0';
+  }
+}
+
+// An explicit PSI file takes memory.current and memory.max from its own
+// directory, if they are there. Returns an errno value.
+static int find_sources(
+    const struct vtpc_config* config, struct sizing* sizing
+) {
+  char path[PATH_MAX];
+  int n = 0;
+  if (config->pressure != NULL) {
+    n = snprintf(
+        sizing->pressure, sizeof(sizing->pressure), "%s", config->pressure
+    );
+    if (n < 0 || (size_t)n >= sizeof(sizing->pressure)) {
+      return ENAMETOOLONG;
+    }
+    snprintf(sizing->group, sizeof(sizing->group), "%s", config->pressure);
+    char* slash = strrchr(sizing->group, '/');
+    if (slash != NULL) {
+      *slash = '\0';
+    } else {
+      snprintf(sizing->group, sizeof(sizing->group), ".");
+    }
+    n = snprintf(path, sizeof(path), "%s/memory.current", sizing->group);
+    if (n < 0 || (size_t)n >= sizeof(path) || access(path, R_OK) != 0) {
+      sizing->group[0] = '\0';
+    }
+    return 0;
+  }
+  // The system-wide file stands in for a cgroup whose path does not fit.
+  find_group(sizing->group, sizeof(sizing->group));
+  n = snprintf(path, sizeof(path), "%s/memory.pressure", sizing->group);
+  if (sizing->group[0] != '\0' && n >= 0 && (size_t)n < sizeof(path) &&
+      access(path, R_OK) == 0) {
+    snprintf(sizing->pressure, sizeof(sizing->pressure), "%s", path);
+    return 0;
+  }
+  sizing->group[0] = '\0';
+  snprintf(sizing->pressure, sizeof(sizing->pressure), VTPC_ELASTIC_PSI);
+  return 0;
+}
+
+static int conds_init(void) {
+  if (elastic.conds_ready) {
+    return 0;
+  }
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  const int err = pthread_cond_init(&elastic.wake, &attr);
+  pthread_condattr_destroy(&attr);
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+  elastic.conds_ready = true;
+  return 0;
+}
+
+static void stop(void) {
+  if (!elastic.running) {
+    return;
+  }
+  elastic.running = false;
+  elastic.generation++;
+  pthread_cond_broadcast(&elastic.wake);
+}
+
+// Called with `elastic.lock` held; returns an errno value.
+static int spawn(const struct vtpc_config* config) {
+  if (conds_init() == -1) {
+    return errno;
+  }
+  struct sizing* sizing = calloc(1, sizeof(*sizing));
+  if (sizing == NULL) {
+    return ENOMEM;
+  }
+  sizing->generation = elastic.generation;
+  sizing->min = config->min_capacity;
+  sizing->max = config->capacity;
+  sizing->block_size = config->block_size;
+  sizing->high = config->pressure_high;
+  sizing->period_ns = (uint64_t)config->pressure_period_ms * 1000 * 1000;
+  const int found = find_sources(config, sizing);
+  if (found != 0) {
+    free(sizing);
+    return found;
+  }
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_t thread;
+  const int err = pthread_create(&thread, &attr, elastic_main, sizing);
+  pthread_attr_destroy(&attr);
+  if (err != 0) {
+    free(sizing);
+    return err;
+  }
+  elastic.running = true;
+  return 0;
+}
+
+int vtpc_elastic_start(const struct vtpc_config* config) {
+  if (config->min_capacity > config->capacity ||
+      (config->min_capacity != 0 && config->pressure_period_ms == 0)) {
+    errno = EINVAL;
+    return -1;
+  }
+  pthread_mutex_lock(&elastic.lock);
+  stop();
+  int err = 0;
+  if (config->min_capacity != 0 && config->min_capacity < config->capacity) {
+    err = spawn(config);
+  }
+  pthread_mutex_unlock(&elastic.lock);
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+void vtpc_elastic_stop(void) {
+  pthread_mutex_lock(&elastic.lock);
+  stop();
+  pthread_mutex_unlock(&elastic.lock);
+}
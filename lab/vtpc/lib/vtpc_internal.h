@@ -0,0 +1,463 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "vtpc.h"
+
+struct stat;
+struct vtpc_file;
+struct vtpc_recent;
+
+// Locking, outermost first: `vtpc_mutex` (file table, init), the lock of a
+// descriptor, `write_lock` of a file, the lock of a shard, and finally
+// `blocks_lock` of a file, the write-back lock, the miss ratio curve lock,
+// the lock of a shard of the shared segment, the resizer lock or the
+// warm-start lock, which are never nested.
+enum {
+  // Loaded by readahead and not accessed yet; kept off the policy.
+  VTPC_BLOCK_PREFETCHED = 1U << 0U,
+  // Modified in the cache and not yet written back.
+  VTPC_BLOCK_DIRTY = 1U << 1U,
+  // Being written with the shard unlocked; the data must not change and the
+  // block is not evicted until it is done.
+  VTPC_BLOCK_WRITEBACK = 1U << 2U,
+  // Indexed but still being read from disk with the shard unlocked. Other
+  // threads missing the same block wait for it instead of reading it again.
+  VTPC_BLOCK_LOADING = 1U << 3U,
+  // Read by a one-shot scan and not accessed otherwise, or refused by the
+  // admission filter; kept off the policy.
+  VTPC_BLOCK_SCANNED = 1U << 4U,
+};
+
+// Guarded by the lock of its shard, except for the dirty and age links,
+// which belong to the write-back lock.
+struct vtpc_block {
+  struct vtpc_file* file;
+  uint64_t index;
+  // Its buffer in the pool. A shrinking pool moves idle blocks to others.
+  char* data;
+  uint32_t flags;
+  uint32_t shard;  // Fixed: the shard whose part of the pool holds it.
+  // Readers holding the data through vtpc_pin. A pinned block is neither
+  // evicted nor written to.
+  uint32_t pins;
+  struct vtpc_block* hash_next;
+  struct vtpc_block* file_prev;
+  struct vtpc_block* file_next;
+  // In the blocks of its file in its shard, in the order a partition limit
+  // replaces them; under the shard lock.
+  struct vtpc_block* recent_prev;
+  struct vtpc_block* recent_next;
+  struct vtpc_block* dirty_prev;
+  struct vtpc_block* dirty_next;
+  struct vtpc_block* age_prev;
+  struct vtpc_block* age_next;
+  uint64_t dirtied_at;
+  // Accesses since the block was read, and the clock of its shard at the
+  // last one, for warm-start manifests. Blocks read ahead start cold, those
+  // of a manifest with the heat it recorded.
+  uint32_t heat;
+  uint64_t touched;
+  // Version of the block in the shared segment when it was read, so that a
+  // write-back of another process makes it stale.
+  uint32_t version;
+
+  // Owned by the replacement policy while the block is resident.
+  struct vtpc_block* prev;
+  struct vtpc_block* next;
+  void* bucket;
+  uint32_t queue;
+  uint32_t freq;
+  uint64_t next_use;
+  size_t heap_pos;
+  bool referenced;
+};
+
+// Sequential stream detection state of a single vtpc descriptor.
+#define VTPC_STREAMS 4
+
+struct vtpc_stream {
+  uint64_t start;   // First block of the stream.
+  uint64_t next;    // Block expected to be read next.
+  uint64_t end;     // First block past the prefetched window.
+  uint64_t marker;  // Reading this block triggers the next window.
+  size_t window;
+  uint64_t used;
+};
+
+struct vtpc_readahead {
+  struct vtpc_stream streams[VTPC_STREAMS];
+  uint64_t clock;
+};
+
+// One per inode, shared by every vtpc descriptor opened on it.
+struct vtpc_file {
+  uint64_t id;
+  dev_t dev;
+  ino_t ino;
+  int fd;    // O_DIRECT descriptor used for all disk I/O.
+  int refs;  // Guarded by `vtpc_mutex`.
+  // Logical size, changed only under `write_lock`.
+  _Atomic off_t size;
+  // Serializes writers, flushes and truncation of the file.
+  pthread_mutex_t write_lock;
+
+  pthread_mutex_t blocks_lock;
+  struct vtpc_block* blocks;
+  struct vtpc_recent* recent;  // Per shard, allocated by vtpc_cache_file_init.
+  // Indexed blocks, and the partition set by vtpc_set_partition.
+  _Atomic size_t resident;
+  _Atomic size_t reserve;
+  _Atomic size_t limit;
+
+  // Guarded by the write-back lock.
+  _Atomic off_t disk_size;
+  struct vtpc_block* dirty;  // Oldest first.
+  struct vtpc_block* dirty_tail;
+  size_t dirty_count;
+  size_t writeback;  // Blocks being written with their shard unlocked.
+  int error;         // Background writeback error, reported by fsync.
+  bool closing;      // The flusher leaves the file alone.
+
+  // Guarded by the warm-start lock.
+  bool warming;      // Its manifest is being loaded.
+  bool warm_cancel;  // The loader stops at its next batch.
+
+  struct vtpc_file* next;
+};
+
+// Guards the file table and the (re)initialization of the cache.
+extern pthread_mutex_t vtpc_mutex;
+
+#define VTPC_NS_PER_SEC 1000000000ULL
+
+static inline uint64_t vtpc_hash_key(uint64_t file, uint64_t index) {
+  uint64_t h = (file * 0x9E3779B97F4A7C15ULL) ^ index;
+  h ^= h >> 33U;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33U;
+  return h;
+}
+
+int vtpc_cache_init(const struct vtpc_config* config);
+bool vtpc_cache_ready(void);
+size_t vtpc_cache_block_size(void);
+// Fills the pool_* fields of the statistics.
+void vtpc_cache_pool_stats(struct vtpc_stats* stats);
+// Keeps about `capacity` blocks in service, spread over the shards like the
+// pool, parking the rest and returning their memory. Blocks that are busy,
+// pinned or fail to write back stay in service. Returns how many are.
+size_t vtpc_cache_resize(size_t capacity);
+// Whether every run of the pool's memory that parked blocks could leave
+// wholly is released; busy blocks in the way are moved on the next resize.
+bool vtpc_cache_compacted(void);
+
+struct vtpc_arena {
+  void* base;
+  size_t size;
+  enum vtpc_pool_backing backing;
+  bool locked;
+  // The aligned runs its memory goes back to the kernel in, 0 if it keeps it.
+  size_t run;
+};
+
+// Parses `config->hugepages` into an enum vtpc_pool_backing, or fails with
+// EINVAL.
+int vtpc_arena_mode(const char* name);
+// Maps at least `size` zeroed bytes with the pages `config` asks for, or
+// the best ones available, and locks them if asked.
+int vtpc_arena_map(
+    struct vtpc_arena* arena, size_t size, const struct vtpc_config* config
+);
+void vtpc_arena_unmap(struct vtpc_arena* arena);
+// Gives the pages of `size` bytes at `addr`, a multiple of `arena->run`
+// aligned to it, back to the kernel, unlocking them first.
+int vtpc_arena_release(struct vtpc_arena* arena, void* addr, size_t size);
+// Takes released pages back into use: they fault in zeroed, and are locked
+// again if the arena is. A failure to lock them leaves it unlocked.
+void vtpc_arena_restore(struct vtpc_arena* arena, void* addr, size_t size);
+
+enum vtpc_access {
+  VTPC_ACCESS_READ,
+  VTPC_ACCESS_WRITE,
+  // The caller replaces the whole block, so a miss is not read from disk.
+  VTPC_ACCESS_OVERWRITE,
+  // A read by a one-shot scan: the block is not admitted to the policy.
+  VTPC_ACCESS_SCAN,
+};
+
+// Returns the resident block with its shard locked, loading it from disk if
+// needed; release it with vtpc_block_unlock. Writes wait for the writeback
+// of the block to finish and for its pins to be released. Sets errno on
+// failure: ENOBUFS when every block of the shard is pinned.
+struct vtpc_block* vtpc_cache_get(
+    struct vtpc_file* file, uint64_t index, enum vtpc_access access
+);
+void vtpc_block_lock(struct vtpc_block* block);
+void vtpc_block_unlock(struct vtpc_block* block);
+// Wakes the threads waiting for a block of the shard to finish loading or
+// writeback. Called with the shard locked.
+void vtpc_block_wake(struct vtpc_block* block);
+// Pinning is called with the shard locked, unpinning locks it.
+void vtpc_block_pin(struct vtpc_block* block);
+void vtpc_block_unpin(struct vtpc_block* block);
+// Evicts every block of the file, discarding dirty data, once it is done
+// loading, being written and pinned, like the one below.
+void vtpc_cache_drop_file(struct vtpc_file* file);
+// Sets up and frees the per-shard state of a file.
+int vtpc_cache_file_init(struct vtpc_file* file);
+void vtpc_cache_file_destroy(struct vtpc_file* file);
+// Sets the limit of a file, 0 for none, and evicts its blocks over it in
+// the order the limit replaces them, in proportion to what it holds in
+// every shard, down to about the limit.
+void vtpc_cache_limit(struct vtpc_file* file, size_t limit);
+// Evicts the resident blocks in [first, last], discarding dirty data.
+void vtpc_cache_drop_range(
+    struct vtpc_file* file, uint64_t first, uint64_t last
+);
+// Evicts the resident blocks in [first, last] that are clean and neither
+// busy nor pinned, leaving the rest.
+void vtpc_cache_evict_range(
+    struct vtpc_file* file, uint64_t first, uint64_t last
+);
+// Sets the next use time of the resident blocks in [first, last].
+void vtpc_cache_advise(
+    struct vtpc_file* file, uint64_t first, uint64_t last, uint64_t next_use
+);
+bool vtpc_cache_hints_enabled(void);
+
+// Loads the missing blocks of [first, first + count) without touching the
+// replacement policy. Best effort: stops quietly on I/O errors.
+void vtpc_cache_prefetch(struct vtpc_file* file, uint64_t first, size_t count);
+
+struct vtpc_heat {
+  uint64_t index;
+  uint32_t heat;
+  uint64_t touched;
+};
+
+// Reads ahead the blocks, sorted by index, into free blocks only, starting
+// them with the given heat. Returns how many were read.
+size_t vtpc_cache_prefetch_blocks(
+    struct vtpc_file* file, const struct vtpc_heat* blocks, size_t count
+);
+// Collects up to `max` resident blocks of the file with some heat, in no
+// particular order. Returns how many.
+size_t vtpc_cache_resident(
+    struct vtpc_file* file, struct vtpc_heat* out, size_t max
+);
+// Blocks in service, below the capacity while the pool is shrunk.
+size_t vtpc_cache_active(void);
+size_t vtpc_cache_readahead_max(void);
+// Sequential streams reaching this many blocks are scans, 0 if disabled.
+size_t vtpc_cache_scan_min(void);
+// Requests covering this many whole blocks bypass the cache, 0 if disabled.
+size_t vtpc_cache_bypass_min(void);
+
+// Updates the streams of a descriptor with a read of blocks [first, last]
+// and prefetches ahead of it when the read continues a stream or, if
+// `eager`, starts one, then with the largest window. Returns whether the
+// stream has grown into a one-shot scan.
+bool vtpc_readahead(
+    struct vtpc_readahead* ra,
+    struct vtpc_file* file,
+    uint64_t first,
+    uint64_t last,
+    bool eager
+);
+
+uint64_t vtpc_now_ns(void);
+
+enum vtpc_counter {
+  VTPC_STAT_HITS,
+  VTPC_STAT_MISSES,
+  VTPC_STAT_EVICTIONS,
+  VTPC_STAT_WRITEBACKS,
+  VTPC_STAT_FOREGROUND_WRITEBACKS,
+  VTPC_STAT_READAHEAD_BLOCKS,
+  VTPC_STAT_READAHEAD_HITS,
+  VTPC_STAT_READAHEAD_WASTED,
+  VTPC_STAT_DISK_READ_BYTES,
+  VTPC_STAT_DISK_WRITE_BYTES,
+  VTPC_STAT_SHARED_HITS,
+  VTPC_STAT_WARM_BLOCKS,
+  VTPC_STAT_COUNTERS,
+};
+
+// Count into the counters of the calling thread, without locks. The latency
+// is measured from `start`, taken with vtpc_now_ns.
+void vtpc_stat_add(enum vtpc_counter counter, uint64_t n);
+void vtpc_stat_latency(enum vtpc_op op, uint64_t start);
+// The bucket of `value` in the layout of the latency buckets, and the first
+// value of bucket `i`.
+size_t vtpc_stat_bucket(uint64_t value);
+uint64_t vtpc_stat_bucket_start(size_t i);
+
+// (Re)starts the miss ratio curve sampling, called with `vtpc_mutex` held.
+int vtpc_mrc_start(const struct vtpc_config* config);
+// Records an access of a block, with its shard locked.
+void vtpc_mrc_record(uint64_t file, uint64_t index);
+void vtpc_mrc_get(struct vtpc_mrc* mrc);
+void vtpc_mrc_reset(void);
+
+// (Re)opens the access trace, and flushes and closes it. Both are called
+// with `vtpc_mutex` held.
+int vtpc_trace_start(const struct vtpc_config* config);
+void vtpc_trace_stop(void);
+// Records a transfer or fsync. Called with no lock held; keeps errno.
+void vtpc_trace(
+    enum vtpc_trace_op op, int fd, uint64_t file, off_t offset, size_t length
+);
+
+// (Re)attaches the shared segment, creating it if needed, called with
+// `vtpc_mutex` held. The calls below do nothing while it is disabled.
+int vtpc_shared_start(const struct vtpc_config* config);
+// Copies the block from the shared segment if it is there. Otherwise sets
+// `*epoch` for publishing the block once it is read from disk.
+bool vtpc_shared_get(
+    const struct vtpc_file* file, uint64_t index, char* data, uint64_t* epoch
+);
+// Publishes the content of a block on disk, unless a write or drop of its
+// part of the segment came after `epoch` was taken.
+void vtpc_shared_put(
+    const struct vtpc_file* file,
+    uint64_t index,
+    const char* data,
+    uint64_t epoch
+);
+// Publishes a block written to disk like vtpc_shared_put and bumps its
+// version, returning the new one.
+uint32_t vtpc_shared_written(
+    const struct vtpc_file* file,
+    uint64_t index,
+    const char* data,
+    uint64_t epoch
+);
+// Drops the block before it is written to disk, returning the epoch for
+// publishing what was written.
+uint64_t vtpc_shared_forget(const struct vtpc_file* file, uint64_t index);
+// Drops the blocks once written or truncated, bumping their versions.
+void vtpc_shared_forget_range(
+    const struct vtpc_file* file, uint64_t first, uint64_t last
+);
+// The version a copy of the block read now would have; 0 while disabled.
+uint32_t vtpc_shared_version(const struct vtpc_file* file, uint64_t index);
+
+// Sets the dirty thresholds and (re)starts the background flusher if
+// enabled. Both are called with `vtpc_mutex` held.
+int vtpc_writeback_start(const struct vtpc_config* config);
+void vtpc_writeback_stop(void);
+// Scales the dirty thresholds to the blocks in service of a resized pool.
+void vtpc_writeback_resize(size_t capacity);
+
+// Both are called with the shard of the block locked.
+void vtpc_block_dirty(struct vtpc_block* block);
+void vtpc_block_clean(struct vtpc_block* block);
+// Writes a dirty victim back before it is evicted, with its shard locked.
+int vtpc_writeback_block(struct vtpc_block* block);
+// Waits for the writes of the file in flight to finish.
+void vtpc_writeback_wait(struct vtpc_file* file);
+// Keeps the flusher away from the file and waits for its writes in flight,
+// before the file is freed.
+void vtpc_writeback_detach(struct vtpc_file* file);
+// Writes every dirty block of the file back, merging runs of adjacent blocks
+// into one pwritev each, and trims the file to its logical size. Reports a
+// failed background writeback of the file once. Called with `write_lock` of
+// the file held.
+int vtpc_flush_file(struct vtpc_file* file);
+// Writes the dirty blocks of the file in [first, last] back and waits for
+// the writes of the file in flight, so the range on disk is current. Called
+// with `write_lock` of the file held.
+int vtpc_flush_range(struct vtpc_file* file, uint64_t first, uint64_t last);
+// Records that the file was written directly up to `end`.
+void vtpc_writeback_written(struct vtpc_file* file, off_t end);
+
+// Position in the buffers of a vectored call.
+struct vtpc_iter {
+  const struct iovec* iov;
+  size_t offset;  // Into `*iov`.
+};
+
+// Copies `count` bytes from `data` to the buffers, or back if not `out`,
+// advancing the iterator; the buffers must have room for them.
+void vtpc_iter_copy(
+    struct vtpc_iter* it, char* data, size_t count, bool out
+);
+
+// Move whole blocks [pos, pos + count) between the buffers and the disk,
+// keeping the cache coherent. Both fail, with the iterator at an unspecified
+// position, when the disk rejects the direct transfer. Writes are called with
+// `write_lock` of the file held; reads take it.
+int vtpc_bypass_read(
+    struct vtpc_file* file, struct vtpc_iter* it, size_t count, off_t pos
+);
+int vtpc_bypass_write(
+    struct vtpc_file* file, struct vtpc_iter* it, size_t count, off_t pos
+);
+
+// A transfer for vtpc_io_run. Writes are completed, reads stop short at the
+// end of the file. The buffers may be advanced while it runs.
+struct vtpc_io {
+  int fd;
+  bool write;
+  off_t offset;
+  struct iovec* iov;
+  int iovcnt;
+  ssize_t result;  // Bytes transferred, or -1 with `error` set.
+  int error;
+  bool done;
+};
+
+// Sets the manifest directory, called with `vtpc_mutex` held.
+int vtpc_warm_start(const struct vtpc_config* config);
+// Records the resident blocks of a file in its manifest, replacing or, with
+// none, removing it. Called with `write_lock` held after a flush, so that
+// the manifest matches the file on disk. Fails with EINVAL if disabled.
+int vtpc_warm_record(struct vtpc_file* file);
+// Starts loading the blocks of the manifest of a file just opened, if it
+// matches `st`, in the background. Best effort.
+void vtpc_warm_load(struct vtpc_file* file, const struct stat* st);
+// Stops the loading of the file, if any, and waits for it.
+void vtpc_warm_cancel(struct vtpc_file* file);
+
+// (Re)starts the thread resizing the pool under memory pressure, if the
+// configuration asks for it, and stops it. Both are called with
+// `vtpc_mutex` held, which the thread takes to resize.
+int vtpc_elastic_start(const struct vtpc_config* config);
+void vtpc_elastic_stop(void);
+
+// Sets the number of asynchronous workers, called with `vtpc_mutex` held.
+// Workers already running keep running; vtpc_async_stop finishes every
+// submitted request and joins them, and must not be called with
+// `vtpc_mutex` held, which callbacks may take.
+int vtpc_async_start(const struct vtpc_config* config);
+void vtpc_async_stop(void);
+// Submits a vtpc_file_prefetch of the range, like an asynchronous read,
+// which then drops the reference on the file the caller took for it.
+int vtpc_async_prefetch(struct vtpc_file* file, off_t offset, size_t count);
+// Reads the blocks covering [offset, offset + count) of the file into the
+// cache, up to its end and at most as many as the pool holds.
+int vtpc_file_prefetch(struct vtpc_file* file, off_t offset, size_t count);
+// Drops a reference taken on the file for a request and clears `*file`,
+// both under `vtpc_mutex`.
+void vtpc_file_release(struct vtpc_file** file);
+
+// Sets the queue depth and the pool to register, called by
+// vtpc_cache_init.
+int vtpc_io_start(const struct vtpc_config* config, void* pool, size_t size);
+// Stops registering the pool with the rings while part of its memory is
+// released to the kernel, called before the release and once it is back.
+void vtpc_io_released(bool released);
+// Runs the transfers, with up to the queue depth of them in flight through
+// an io_uring of the calling thread, and returns once all are done.
+void vtpc_io_run(struct vtpc_io* ops, size_t count);
+size_t vtpc_iov_length(const struct iovec* iov, int iovcnt);
+
+ssize_t vtpc_pread_full(int fd, void* buf, size_t count, off_t offset);
+ssize_t vtpc_pwrite_full(int fd, const void* buf, size_t count, off_t offset);
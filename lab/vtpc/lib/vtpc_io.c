@@ -0,0 +1,457 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "vtpc_internal.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define VTPC_HAVE_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+// Transfers go through an io_uring of the calling thread when a queue depth
+// is configured, so a batch keeps up to that many requests in flight with
+// a single system call per round and no extra threads. The pool is
+// registered with every ring, so transfers of a single block use it as a
+// fixed buffer and skip mapping the pages per request. Without io_uring, or
+// if the ring cannot be set up, transfers run one by one with synchronous
+// calls.
+
+// The largest buffer io_uring registers.
+#define VTPC_IO_CHUNK (1ULL << 30U)
+
+static struct {
+  _Atomic size_t depth;
+  // Bumped when the pool or the depth changes, so the rings catch up.
+  _Atomic uint64_t generation;
+  char* pool;
+  size_t pool_size;
+  // Registering a pool with memory released would pin it back, and a ring
+  // registered before the release would keep transferring to the pages
+  // the pool gave up.
+  atomic_bool released;
+  // Set once a ring fails to set up, so the others do not retry.
+  atomic_bool broken;
+#ifdef VTPC_HAVE_URING
+  pthread_once_t once;
+  pthread_key_t key;
+  int key_error;
+#endif
+} io
+#ifdef VTPC_HAVE_URING
+    = {.once = PTHREAD_ONCE_INIT}
+#endif
+;
+
+// Drops the first `n` bytes of the buffers.
+static void advance(struct vtpc_io* op, size_t n) {
+  while (n > 0 && op->iovcnt > 0) {
+    if (n < op->iov->iov_len) {
+      op->iov->iov_base = (char*)op->iov->iov_base + n;
+      op->iov->iov_len -= n;
+      return;
+    }
+    n -= op->iov->iov_len;
+    ++op->iov;
+    --op->iovcnt;
+  }
+}
+
+// Completes a transfer of which `done` bytes are through. A short read of a
+// regular file is the end of it, and O_DIRECT would reject the unaligned
+// offset of a retry anyway, so reads are not resumed.
+static void run_sync(struct vtpc_io* op, size_t done) {
+  if (!op->write) {
+    ssize_t n = 0;
+    if (done == 0) {
+      do {
+        n = preadv(op->fd, op->iov, op->iovcnt, op->offset);
+      } while (n < 0 && errno == EINTR);
+    }
+    op->error = n < 0 ? errno : 0;
+    op->result = n < 0 ? -1 : (ssize_t)done + n;
+    op->done = true;
+    return;
+  }
+  advance(op, done);
+  while (op->iovcnt > 0) {
+    const ssize_t n =
+        pwritev(op->fd, op->iov, op->iovcnt, op->offset + (off_t)done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      op->error = errno;
+      op->result = -1;
+      op->done = true;
+      return;
+    }
+    done += (size_t)n;
+    advance(op, (size_t)n);
+  }
+  op->error = 0;
+  op->result = (ssize_t)done;
+  op->done = true;
+}
+
+#ifdef VTPC_HAVE_URING
+
+struct ring {
+  int fd;
+  unsigned entries;
+  uint64_t generation;
+  bool fixed;  // The pool is registered.
+  void* sq_map;
+  size_t sq_map_size;
+  void* cq_map;
+  size_t cq_map_size;
+  struct io_uring_sqe* sqes;
+  size_t sqes_size;
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned* sq_mask;
+  unsigned* sq_array;
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned* cq_mask;
+  struct io_uring_cqe* cqes;
+};
+
+static _Thread_local struct ring* local;
+
+static void ring_destroy(struct ring* ring) {
+  if (ring->sqes != NULL) {
+    munmap(ring->sqes, ring->sqes_size);
+  }
+  if (ring->cq_map != NULL && ring->cq_map != ring->sq_map) {
+    munmap(ring->cq_map, ring->cq_map_size);
+  }
+  if (ring->sq_map != NULL) {
+    munmap(ring->sq_map, ring->sq_map_size);
+  }
+  close(ring->fd);
+  free(ring);
+}
+
+static void thread_exit(void* arg) {
+  ring_destroy(arg);
+  local = NULL;
+}
+
+// The child of a fork shares the rings of the parent, so the thread calling
+// fork, the only one in the child, leaves its ring alone and sets up its
+// own.
+static void after_fork(void) {
+  if (local != NULL) {
+    pthread_setspecific(io.key, NULL);
+    ring_destroy(local);
+    local = NULL;
+  }
+}
+
+static void key_init(void) {
+  io.key_error = pthread_key_create(&io.key, thread_exit);
+  if (io.key_error == 0) {
+    io.key_error = pthread_atfork(NULL, NULL, after_fork);
+  }
+}
+
+static void* map(int fd, size_t size, off_t offset) {
+  void* addr = mmap(
+      NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+      offset
+  );
+  return addr == MAP_FAILED ? NULL : addr;
+}
+
+static struct ring* ring_create(unsigned entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  const int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct ring* ring = calloc(1, sizeof(struct ring));
+  if (ring == NULL) {
+    close(fd);
+    return NULL;
+  }
+  ring->fd = fd;
+  ring->entries = params.sq_entries;
+  ring->sq_map_size =
+      params.sq_off.array + (params.sq_entries * sizeof(unsigned));
+  ring->cq_map_size =
+      params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+  const bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single && ring->cq_map_size > ring->sq_map_size) {
+    ring->sq_map_size = ring->cq_map_size;
+  }
+  ring->sq_map = map(fd, ring->sq_map_size, IORING_OFF_SQ_RING);
+  ring->cq_map =
+      single ? ring->sq_map : map(fd, ring->cq_map_size, IORING_OFF_CQ_RING);
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = map(fd, ring->sqes_size, IORING_OFF_SQES);
+  if (ring->sq_map == NULL || ring->cq_map == NULL || ring->sqes == NULL) {
+    ring_destroy(ring);
+    return NULL;
+  }
+  char* sq = ring->sq_map;
+  ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+  ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+  char* cq = ring->cq_map;
+  ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+  ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+  return ring;
+}
+
+// Registers the pool in chunks of the largest size allowed. Best effort:
+// a ring without it, say for lack of locked memory, uses plain buffers.
+static void ring_register(struct ring* ring) {
+  if (ring->fixed) {
+    (void)syscall(
+        __NR_io_uring_register, ring->fd, IORING_UNREGISTER_BUFFERS, NULL, 0
+    );
+    ring->fixed = false;
+  }
+  if (atomic_load(&io.released)) {
+    return;
+  }
+  const size_t chunks = (io.pool_size + VTPC_IO_CHUNK - 1) / VTPC_IO_CHUNK;
+  if (chunks == 0) {
+    return;
+  }
+  struct iovec* iov = calloc(chunks, sizeof(struct iovec));
+  if (iov == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < chunks; ++i) {
+    const size_t offset = i * VTPC_IO_CHUNK;
+    const size_t left = io.pool_size - offset;
+    iov[i].iov_base = io.pool + offset;
+    iov[i].iov_len = left < VTPC_IO_CHUNK ? left : VTPC_IO_CHUNK;
+  }
+  ring->fixed = syscall(
+                    __NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS,
+                    iov, (unsigned)chunks
+                ) == 0;
+  free(iov);
+}
+
+// The ring of the calling thread, set up for the current pool and depth,
+// or NULL to run synchronously.
+static struct ring* ring_local(size_t depth) {
+  const uint64_t generation = atomic_load(&io.generation);
+  if (local != NULL && local->generation == generation) {
+    return local;
+  }
+  if (local != NULL && local->entries < depth) {
+    pthread_setspecific(io.key, NULL);
+    ring_destroy(local);
+    local = NULL;
+  }
+  if (local == NULL) {
+    pthread_once(&io.once, key_init);
+    if (io.key_error != 0) {
+      return NULL;
+    }
+    local = ring_create((unsigned)depth);
+    if (local == NULL) {
+      atomic_store(&io.broken, true);
+      return NULL;
+    }
+    if (pthread_setspecific(io.key, local) != 0) {
+      ring_destroy(local);
+      local = NULL;
+      return NULL;
+    }
+  }
+  ring_register(local);
+  local->generation = generation;
+  return local;
+}
+
+static bool in_chunk(const struct vtpc_io* op, unsigned* index) {
+  const uintptr_t base = (uintptr_t)op->iov[0].iov_base;
+  const uintptr_t pool = (uintptr_t)io.pool;
+  const size_t len = op->iov[0].iov_len;
+  if (op->iovcnt != 1 || base < pool || base + len > pool + io.pool_size) {
+    return false;
+  }
+  const size_t offset = (size_t)(base - pool);
+  *index = (unsigned)(offset / VTPC_IO_CHUNK);
+  return *index == (offset + len - 1) / VTPC_IO_CHUNK;
+}
+
+static void prep(struct ring* ring, struct vtpc_io* op, size_t id) {
+  const unsigned tail = *ring->sq_tail;
+  const unsigned slot = tail & *ring->sq_mask;
+  struct io_uring_sqe* sqe = &ring->sqes[slot];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->fd = op->fd;
+  sqe->off = (uint64_t)op->offset;
+  sqe->user_data = id;
+  unsigned chunk = 0;
+  if (ring->fixed && in_chunk(op, &chunk)) {
+    sqe->opcode = op->write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    sqe->addr = (uint64_t)(uintptr_t)op->iov[0].iov_base;
+    sqe->len = (uint32_t)op->iov[0].iov_len;
+    sqe->buf_index = (uint16_t)chunk;
+  } else {
+    sqe->opcode = op->write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->addr = (uint64_t)(uintptr_t)op->iov;
+    sqe->len = (uint32_t)op->iovcnt;
+  }
+  ring->sq_array[slot] = slot;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// A failed request is retried synchronously, which also covers files and
+// kernels that reject some operation. A short write is completed the same
+// way.
+static void complete(struct vtpc_io* op, int res) {
+  if (res < 0) {
+    run_sync(op, 0);
+  } else if (op->write && (size_t)res < vtpc_iov_length(op->iov, op->iovcnt)) {
+    run_sync(op, (size_t)res);
+  } else {
+    op->error = 0;
+    op->result = res;
+    op->done = true;
+  }
+}
+
+// Returns the number of requests completed.
+static size_t reap(struct ring* ring, struct vtpc_io* ops) {
+  unsigned head = *ring->cq_head;
+  const unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  size_t reaped = 0;
+  for (; head != tail; ++head, ++reaped) {
+    const struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+    complete(&ops[cqe->user_data], cqe->res);
+  }
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+  return reaped;
+}
+
+// Takes back the requests the kernel has not consumed yet and waits for the
+// ones it has, so that their buffers are no longer in use and their
+// completions do not turn up in a later batch. A failing wait still runs
+// the task work that posts completions, so it spins until they are all in.
+static void drain(struct ring* ring, struct vtpc_io* ops, size_t next) {
+  const unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  const size_t submitted = next - (*ring->sq_tail - head);
+  __atomic_store_n(ring->sq_tail, head, __ATOMIC_RELEASE);
+  size_t completed = 0;
+  for (size_t i = 0; i < submitted; ++i) {
+    completed += ops[i].done ? 1 : 0;
+  }
+  while (completed < submitted) {
+    const int n = (int)syscall(
+        __NR_io_uring_enter, ring->fd, 0U, 1U, IORING_ENTER_GETEVENTS, NULL, 0
+    );
+    if (n < 0 && errno != EINTR) {
+      sched_yield();
+    }
+    completed += reap(ring, ops);
+  }
+}
+
+// Keeps up to `depth` requests queued or in flight until all are done.
+static bool run_ring(
+    struct ring* ring, size_t depth, struct vtpc_io* ops, size_t count
+) {
+  if (depth > ring->entries) {
+    depth = ring->entries;
+  }
+  size_t next = 0;
+  size_t completed = 0;
+  while (completed < count) {
+    while (next < count && next - completed < depth) {
+      prep(ring, &ops[next], next);
+      ++next;
+    }
+    const unsigned queued =
+        *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    const int n = (int)syscall(
+        __NR_io_uring_enter, ring->fd, queued, 1U, IORING_ENTER_GETEVENTS,
+        NULL, 0
+    );
+    if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      // Takes a broken ring: the rest of the transfers run synchronously.
+      atomic_store(&io.broken, true);
+      drain(ring, ops, next);
+      for (size_t i = 0; i < count; ++i) {
+        if (!ops[i].done) {
+          run_sync(&ops[i], 0);
+        }
+      }
+      return false;
+    }
+    completed += reap(ring, ops);
+  }
+  return true;
+}
+
+#endif
+
+int vtpc_io_start(const struct vtpc_config* config, void* pool, size_t size) {
+  io.pool = pool;
+  io.pool_size = size;
+  atomic_store(&io.depth, config->io_depth > 1 ? config->io_depth : 0);
+  atomic_store(&io.broken, false);
+  atomic_store(&io.released, false);
+  atomic_fetch_add(&io.generation, 1);
+  return 0;
+}
+
+void vtpc_io_released(bool released) {
+  if (atomic_exchange(&io.released, released) != released) {
+    atomic_fetch_add(&io.generation, 1);
+  }
+}
+
+size_t vtpc_iov_length(const struct iovec* iov, int iovcnt) {
+  size_t total = 0;
+  for (int i = 0; i < iovcnt; ++i) {
+    total += iov[i].iov_len;
+  }
+  return total;
+}
+
+void vtpc_io_run(struct vtpc_io* ops, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    ops[i].done = false;
+  }
+#ifdef VTPC_HAVE_URING
+  const size_t depth = atomic_load_explicit(&io.depth, memory_order_relaxed);
+  if (depth > 0 && !atomic_load_explicit(&io.broken, memory_order_relaxed)) {
+    const int err = errno;
+    struct ring* ring = ring_local(depth);
+    errno = err;
+    if (ring != NULL) {
+      (void)run_ring(ring, depth, ops, count);
+      return;
+    }
+  }
+#endif
+  for (size_t i = 0; i < count; ++i) {
+    run_sync(&ops[i], 0);
+  }
+}
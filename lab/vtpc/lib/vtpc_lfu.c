@@ -0,0 +1,143 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "vtpc_policy.h"
+
+// O(1) LFU (Shah, Mitra, Matani): blocks hang off a list of frequency
+// buckets ordered by frequency, each bucket keeping its blocks in LRU order,
+// so ties between equally frequent blocks are broken by recency.
+struct bucket {
+  uint32_t freq;
+  struct vtpc_list blocks;
+  struct bucket* prev;
+  struct bucket* next;
+};
+
+struct lfu {
+  struct vtpc_policy base;
+  struct bucket* buckets;
+  struct bucket* free;
+  struct bucket head;
+};
+
+static struct bucket* bucket_new(
+    struct lfu* lfu, struct bucket* after, uint32_t freq
+) {
+  struct bucket* bucket = lfu->free;
+  lfu->free = bucket->next;
+  bucket->freq = freq;
+  vtpc_list_init(&bucket->blocks);
+  bucket->prev = after;
+  bucket->next = after->next;
+  after->next->prev = bucket;
+  after->next = bucket;
+  return bucket;
+}
+
+static void bucket_put(struct lfu* lfu, struct bucket* bucket) {
+  if (bucket->blocks.size > 0) {
+    return;
+  }
+  bucket->prev->next = bucket->next;
+  bucket->next->prev = bucket->prev;
+  bucket->next = lfu->free;
+  lfu->free = bucket;
+}
+
+static struct vtpc_policy* lfu_create(
+    size_t capacity, const struct vtpc_config* config
+) {
+  (void)config;
+  struct lfu* lfu = calloc(1, sizeof(struct lfu));
+  if (lfu == NULL) {
+    return NULL;
+  }
+  // Every resident block is in one bucket, plus one spare for a promotion.
+  lfu->buckets = calloc(capacity + 1, sizeof(struct bucket));
+  if (lfu->buckets == NULL) {
+    free(lfu);
+    return NULL;
+  }
+  for (size_t i = 0; i <= capacity; ++i) {
+    lfu->buckets[i].next = lfu->free;
+    lfu->free = &lfu->buckets[i];
+  }
+  lfu->base.ops = &vtpc_policy_lfu;
+  lfu->head.prev = &lfu->head;
+  lfu->head.next = &lfu->head;
+  return &lfu->base;
+}
+
+static void lfu_destroy(struct vtpc_policy* policy) {
+  struct lfu* lfu = (struct lfu*)policy;
+  free(lfu->buckets);
+  free(lfu);
+}
+
+static void lfu_insert(struct vtpc_policy* policy, struct vtpc_block* block) {
+  struct lfu* lfu = (struct lfu*)policy;
+  struct bucket* bucket = lfu->head.next;
+  if (bucket == &lfu->head || bucket->freq != 1) {
+    bucket = bucket_new(lfu, &lfu->head, 1);
+  }
+  block->freq = 1;
+  block->bucket = bucket;
+  vtpc_list_push_front(&bucket->blocks, block);
+}
+
+static void lfu_access(struct vtpc_policy* policy, struct vtpc_block* block) {
+  struct lfu* lfu = (struct lfu*)policy;
+  struct bucket* bucket = block->bucket;
+  if (bucket->freq == UINT32_MAX) {
+    vtpc_list_remove(&bucket->blocks, block);
+    vtpc_list_push_front(&bucket->blocks, block);
+    return;
+  }
+
+  struct bucket* next = bucket->next;
+  if (next == &lfu->head || next->freq != bucket->freq + 1) {
+    next = bucket_new(lfu, bucket, bucket->freq + 1);
+  }
+  vtpc_list_remove(&bucket->blocks, block);
+  bucket_put(lfu, bucket);
+  block->freq = next->freq;
+  block->bucket = next;
+  vtpc_list_push_front(&next->blocks, block);
+}
+
+static void lfu_remove(struct vtpc_policy* policy, struct vtpc_block* block) {
+  struct lfu* lfu = (struct lfu*)policy;
+  struct bucket* bucket = block->bucket;
+  vtpc_list_remove(&bucket->blocks, block);
+  bucket_put(lfu, bucket);
+  block->bucket = NULL;
+}
+
+static struct vtpc_block* lfu_victim(struct vtpc_policy* policy) {
+  struct lfu* lfu = (struct lfu*)policy;
+  struct bucket* bucket = lfu->head.next;
+  if (bucket == &lfu->head) {
+    return NULL;
+  }
+  return vtpc_list_back(&bucket->blocks);
+}
+
+static struct vtpc_block* lfu_evict(struct vtpc_policy* policy) {
+  struct vtpc_block* victim = lfu_victim(policy);
+  if (victim != NULL) {
+    lfu_remove(policy, victim);
+  }
+  return victim;
+}
+
+const struct vtpc_policy_ops vtpc_policy_lfu = {
+    .name = "lfu",
+    .create = lfu_create,
+    .destroy = lfu_destroy,
+    .insert = lfu_insert,
+    .access = lfu_access,
+    .remove = lfu_remove,
+    .evict = lfu_evict,
+    .victim = lfu_victim,
+};
@@ -0,0 +1,68 @@
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "vtpc_policy.h"
+
+struct lru {
+  struct vtpc_policy base;
+  struct vtpc_list list;
+};
+
+static struct vtpc_policy* lru_create(
+    size_t capacity, const struct vtpc_config* config
+) {
+  (void)config;
+  (void)capacity;
+  struct lru* lru = calloc(1, sizeof(struct lru));
+  if (lru == NULL) {
+    return NULL;
+  }
+  lru->base.ops = &vtpc_policy_lru;
+  vtpc_list_init(&lru->list);
+  return &lru->base;
+}
+
+static void lru_destroy(struct vtpc_policy* policy) {
+  free(policy);
+}
+
+static void lru_insert(struct vtpc_policy* policy, struct vtpc_block* block) {
+  struct lru* lru = (struct lru*)policy;
+  vtpc_list_push_front(&lru->list, block);
+}
+
+static void lru_access(struct vtpc_policy* policy, struct vtpc_block* block) {
+  struct lru* lru = (struct lru*)policy;
+  vtpc_list_remove(&lru->list, block);
+  vtpc_list_push_front(&lru->list, block);
+}
+
+static void lru_remove(struct vtpc_policy* policy, struct vtpc_block* block) {
+  struct lru* lru = (struct lru*)policy;
+  vtpc_list_remove(&lru->list, block);
+}
+
+static struct vtpc_block* lru_victim(struct vtpc_policy* policy) {
+  struct lru* lru = (struct lru*)policy;
+  return vtpc_list_back(&lru->list);
+}
+
+static struct vtpc_block* lru_evict(struct vtpc_policy* policy) {
+  struct lru* lru = (struct lru*)policy;
+  struct vtpc_block* victim = vtpc_list_back(&lru->list);
+  if (victim != NULL) {
+    vtpc_list_remove(&lru->list, victim);
+  }
+  return victim;
+}
+
+const struct vtpc_policy_ops vtpc_policy_lru = {
+    .name = "lru",
+    .create = lru_create,
+    .destroy = lru_destroy,
+    .insert = lru_insert,
+    .access = lru_access,
+    .remove = lru_remove,
+    .evict = lru_evict,
+    .victim = lru_victim,
+};
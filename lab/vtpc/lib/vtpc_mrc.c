@@ -0,0 +1,283 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vtpc_internal.h"
+
+// SHARDS (Waldspurger et al.): a block is sampled when its hash falls below
+// `threshold` of `VTPC_MRC_MODULUS`, so about one in `rate` blocks is, and
+// every access of a sampled block measures its LRU reuse distance among the
+// sampled blocks, the number of other ones accessed since its last access.
+// Scaled by `rate` that estimates the distance among all blocks, and an
+// access hits an LRU pool of `c` blocks when it is below `c`.
+//
+// The sampled keys are kept in the order of their last access, each marked
+// at its access time in a Fenwick tree, so the distance is the number of
+// marks after the previous access. Times are renumbered along the list when
+// they run out. Past `VTPC_MRC_MAX_KEYS` the least recently accessed key is
+// forgotten, and its next access counts as a cold miss.
+#define VTPC_MRC_MODULUS (1U << 24U)
+#define VTPC_MRC_MAX_KEYS (1U << 16U)
+#define VTPC_MRC_MIN_TIMES 1024
+
+struct mrc_key {
+  uint64_t file;
+  uint64_t index;
+  size_t time;
+  struct mrc_key* hash_next;
+  struct mrc_key* prev;  // Accessed earlier.
+  struct mrc_key* next;
+};
+
+static struct {
+  // Innermost, like the write-back lock.
+  pthread_mutex_t lock;
+  _Atomic uint32_t threshold;  // 0 while disabled.
+  uint64_t rate;
+  size_t capacity;
+
+  struct mrc_key** buckets;
+  size_t bucket_mask;
+  struct mrc_key* oldest;
+  struct mrc_key* newest;
+  size_t keys;
+
+  uint32_t* tree;  // Fenwick tree over times 1..`times`.
+  size_t times;
+  size_t now;
+
+  uint64_t sampled;
+  uint64_t cold;
+  uint64_t distances[VTPC_LATENCY_BUCKETS];
+} mrc = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static void tree_add(size_t time, uint32_t delta) {
+  for (; time <= mrc.times; time += time & -time) {
+    mrc.tree[time] += delta;
+  }
+}
+
+static void tree_sub(size_t time) {
+  for (; time <= mrc.times; time += time & -time) {
+    mrc.tree[time]--;
+  }
+}
+
+// Marks at times up to `time`.
+static size_t tree_sum(size_t time) {
+  size_t sum = 0;
+  for (; time > 0; time -= time & -time) {
+    sum += mrc.tree[time];
+  }
+  return sum;
+}
+
+static void clear(void) {
+  struct mrc_key* key = mrc.oldest;
+  while (key != NULL) {
+    struct mrc_key* next = key->next;
+    free(key);
+    key = next;
+  }
+  free(mrc.buckets);
+  free(mrc.tree);
+  mrc.buckets = NULL;
+  mrc.tree = NULL;
+  mrc.oldest = NULL;
+  mrc.newest = NULL;
+  mrc.keys = 0;
+  mrc.times = 0;
+  mrc.now = 0;
+  mrc.sampled = 0;
+  mrc.cold = 0;
+  memset(mrc.distances, 0, sizeof(mrc.distances));
+}
+
+int vtpc_mrc_start(const struct vtpc_config* config) {
+  pthread_mutex_lock(&mrc.lock);
+  atomic_store(&mrc.threshold, 0);
+  clear();
+  mrc.capacity = config->capacity;
+  int result = 0;
+  if (config->mrc != 0) {
+    const size_t buckets = VTPC_MRC_MAX_KEYS;
+    mrc.buckets = calloc(buckets, sizeof(struct mrc_key*));
+    mrc.tree = calloc(VTPC_MRC_MIN_TIMES + 1, sizeof(uint32_t));
+    if (mrc.buckets == NULL || mrc.tree == NULL) {
+      clear();
+      errno = ENOMEM;
+      result = -1;
+    } else {
+      mrc.bucket_mask = buckets - 1;
+      mrc.times = VTPC_MRC_MIN_TIMES;
+      mrc.rate = config->mrc;
+      const uint64_t threshold = VTPC_MRC_MODULUS / config->mrc;
+      atomic_store(&mrc.threshold, threshold == 0 ? 1 : (uint32_t)threshold);
+    }
+  }
+  pthread_mutex_unlock(&mrc.lock);
+  return result;
+}
+
+static struct mrc_key** bucket_of(uint64_t file, uint64_t index) {
+  return &mrc.buckets[vtpc_hash_key(file, index) & mrc.bucket_mask];
+}
+
+static void list_remove(struct mrc_key* key) {
+  if (key->prev != NULL) {
+    key->prev->next = key->next;
+  } else {
+    mrc.oldest = key->next;
+  }
+  if (key->next != NULL) {
+    key->next->prev = key->prev;
+  } else {
+    mrc.newest = key->prev;
+  }
+}
+
+static void list_append(struct mrc_key* key) {
+  key->prev = mrc.newest;
+  key->next = NULL;
+  if (mrc.newest != NULL) {
+    mrc.newest->next = key;
+  } else {
+    mrc.oldest = key;
+  }
+  mrc.newest = key;
+}
+
+static void forget_oldest(void) {
+  struct mrc_key* key = mrc.oldest;
+  struct mrc_key** link = bucket_of(key->file, key->index);
+  while (*link != key) {
+    link = &(*link)->hash_next;
+  }
+  *link = key->hash_next;
+  list_remove(key);
+  tree_sub(key->time);
+  mrc.keys--;
+  free(key);
+}
+
+// Renumbers the keys 1..keys in access order, in a tree with room for at
+// least as many new accesses. Keeps the old numbering if that fails.
+static void compact(void) {
+  size_t times = VTPC_MRC_MIN_TIMES;
+  while (times < 2 * (mrc.keys + 1)) {
+    times <<= 1U;
+  }
+  uint32_t* tree = calloc(times + 1, sizeof(uint32_t));
+  if (tree == NULL) {
+    return;
+  }
+  free(mrc.tree);
+  mrc.tree = tree;
+  mrc.times = times;
+  mrc.now = 0;
+  for (struct mrc_key* key = mrc.oldest; key != NULL; key = key->next) {
+    key->time = ++mrc.now;
+    tree_add(key->time, 1);
+  }
+}
+
+static void access_key(uint64_t file, uint64_t index) {
+  if (mrc.now == mrc.times) {
+    compact();
+    if (mrc.now == mrc.times) {
+      return;
+    }
+  }
+  struct mrc_key** bucket = bucket_of(file, index);
+  struct mrc_key* key = *bucket;
+  while (key != NULL && (key->file != file || key->index != index)) {
+    key = key->hash_next;
+  }
+  mrc.sampled++;
+  if (key == NULL) {
+    mrc.cold++;
+    if (mrc.keys == VTPC_MRC_MAX_KEYS) {
+      forget_oldest();
+    }
+    key = calloc(1, sizeof(struct mrc_key));
+    if (key == NULL) {
+      return;
+    }
+    key->file = file;
+    key->index = index;
+    key->hash_next = *bucket;
+    *bucket = key;
+    mrc.keys++;
+  } else {
+    const uint64_t distance = tree_sum(mrc.times) - tree_sum(key->time);
+    mrc.distances[vtpc_stat_bucket(distance * mrc.rate)]++;
+    tree_sub(key->time);
+    list_remove(key);
+  }
+  key->time = ++mrc.now;
+  tree_add(key->time, 1);
+  list_append(key);
+}
+
+void vtpc_mrc_record(uint64_t file, uint64_t index) {
+  const uint32_t threshold =
+      atomic_load_explicit(&mrc.threshold, memory_order_relaxed);
+  if (threshold == 0 ||
+      (vtpc_hash_key(index, file) >> 40U) >= threshold) {
+    return;
+  }
+  pthread_mutex_lock(&mrc.lock);
+  if (mrc.tree != NULL) {
+    access_key(file, index);
+  }
+  pthread_mutex_unlock(&mrc.lock);
+}
+
+// The accesses at distances of at least `blocks`, interpolating linearly
+// within the bucket holding it.
+static uint64_t beyond(const uint64_t* distances, uint64_t blocks) {
+  const size_t first = vtpc_stat_bucket(blocks);
+  uint64_t count = 0;
+  for (size_t i = first + 1; i < VTPC_LATENCY_BUCKETS; ++i) {
+    count += distances[i];
+  }
+  const uint64_t start = vtpc_stat_bucket_start(first);
+  const uint64_t width = first + 1 < VTPC_LATENCY_BUCKETS
+                             ? vtpc_stat_bucket_start(first + 1) - start
+                             : 1;
+  count += distances[first] * (width - (blocks - start)) / width;
+  return count;
+}
+
+void vtpc_mrc_get(struct vtpc_mrc* out) {
+  pthread_mutex_lock(&mrc.lock);
+  out->rate = atomic_load(&mrc.threshold) == 0 ? 0 : mrc.rate;
+  out->sampled = mrc.sampled;
+  out->cold = mrc.cold;
+  memcpy(out->distances, mrc.distances, sizeof(out->distances));
+  const size_t capacity = mrc.capacity;
+  pthread_mutex_unlock(&mrc.lock);
+
+  for (size_t i = 0; i < VTPC_MRC_POINTS; ++i) {
+    // From an eighth of the capacity to eight times it.
+    const uint64_t blocks = ((uint64_t)capacity << i) >> 3U;
+    out->blocks[i] = blocks;
+    out->miss_permille[i] =
+        out->sampled == 0
+            ? 0
+            : (uint32_t)((out->cold + beyond(out->distances, blocks)) *
+                         1000 / out->sampled);
+  }
+}
+
+void vtpc_mrc_reset(void) {
+  pthread_mutex_lock(&mrc.lock);
+  mrc.sampled = 0;
+  mrc.cold = 0;
+  memset(mrc.distances, 0, sizeof(mrc.distances));
+  pthread_mutex_unlock(&mrc.lock);
+}
@@ -0,0 +1,187 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "vtpc_policy.h"
+
+// Belady's optimal replacement driven by vtpc_advice. Blocks with a known
+// next use are kept in a binary max-heap on `next_use`, so the one needed
+// furthest in the future is on top. Blocks without a hint are delegated to a
+// secondary policy; as far as the cache knows they are never needed again,
+// so they are evicted first. An access consumes the hint of the block.
+#define NOT_IN_HEAP SIZE_MAX
+
+struct opt {
+  struct vtpc_policy base;
+  struct vtpc_policy* fallback;
+  struct vtpc_block** heap;
+  size_t size;
+};
+
+static void place(struct opt* opt, size_t pos, struct vtpc_block* block) {
+  opt->heap[pos] = block;
+  block->heap_pos = pos;
+}
+
+static void sift_up(struct opt* opt, size_t pos) {
+  struct vtpc_block* block = opt->heap[pos];
+  while (pos > 0) {
+    const size_t parent = (pos - 1) / 2;
+    if (opt->heap[parent]->next_use >= block->next_use) {
+      break;
+    }
+    place(opt, pos, opt->heap[parent]);
+    pos = parent;
+  }
+  place(opt, pos, block);
+}
+
+static void sift_down(struct opt* opt, size_t pos) {
+  struct vtpc_block* block = opt->heap[pos];
+  for (;;) {
+    size_t child = (2 * pos) + 1;
+    if (child >= opt->size) {
+      break;
+    }
+    if (child + 1 < opt->size &&
+        opt->heap[child + 1]->next_use > opt->heap[child]->next_use) {
+      child++;
+    }
+    if (opt->heap[child]->next_use <= block->next_use) {
+      break;
+    }
+    place(opt, pos, opt->heap[child]);
+    pos = child;
+  }
+  place(opt, pos, block);
+}
+
+static void heap_push(struct opt* opt, struct vtpc_block* block) {
+  place(opt, opt->size++, block);
+  sift_up(opt, block->heap_pos);
+}
+
+static void heap_remove(struct opt* opt, struct vtpc_block* block) {
+  const size_t pos = block->heap_pos;
+  struct vtpc_block* last = opt->heap[--opt->size];
+  block->heap_pos = NOT_IN_HEAP;
+  if (last == block) {
+    return;
+  }
+  place(opt, pos, last);
+  sift_up(opt, pos);
+  sift_down(opt, last->heap_pos);
+}
+
+static struct vtpc_policy* opt_create(
+    size_t capacity, const struct vtpc_config* config
+) {
+  const struct vtpc_policy_ops* fallback =
+      vtpc_policy_find(config->opt_fallback);
+  if (fallback == NULL || fallback == &vtpc_policy_opt) {
+    return NULL;
+  }
+
+  struct opt* opt = calloc(1, sizeof(struct opt));
+  if (opt == NULL) {
+    return NULL;
+  }
+  opt->heap = calloc(capacity, sizeof(struct vtpc_block*));
+  opt->fallback = fallback->create(capacity, config);
+  if (opt->heap == NULL || opt->fallback == NULL) {
+    if (opt->fallback != NULL) {
+      opt->fallback->ops->destroy(opt->fallback);
+    }
+    free(opt->heap);
+    free(opt);
+    return NULL;
+  }
+  opt->base.ops = &vtpc_policy_opt;
+  return &opt->base;
+}
+
+static void opt_destroy(struct vtpc_policy* policy) {
+  struct opt* opt = (struct opt*)policy;
+  opt->fallback->ops->destroy(opt->fallback);
+  free(opt->heap);
+  free(opt);
+}
+
+static void opt_insert(struct vtpc_policy* policy, struct vtpc_block* block) {
+  struct opt* opt = (struct opt*)policy;
+  if (block->next_use == VTPC_NEVER) {
+    block->heap_pos = NOT_IN_HEAP;
+    opt->fallback->ops->insert(opt->fallback, block);
+  } else {
+    heap_push(opt, block);
+  }
+}
+
+static void opt_access(struct vtpc_policy* policy, struct vtpc_block* block) {
+  struct opt* opt = (struct opt*)policy;
+  if (block->heap_pos == NOT_IN_HEAP) {
+    opt->fallback->ops->access(opt->fallback, block);
+    return;
+  }
+  heap_remove(opt, block);
+  block->next_use = VTPC_NEVER;
+  opt->fallback->ops->insert(opt->fallback, block);
+}
+
+static void opt_remove(struct vtpc_policy* policy, struct vtpc_block* block) {
+  struct opt* opt = (struct opt*)policy;
+  if (block->heap_pos == NOT_IN_HEAP) {
+    opt->fallback->ops->remove(opt->fallback, block);
+  } else {
+    heap_remove(opt, block);
+  }
+}
+
+static struct vtpc_block* opt_evict(struct vtpc_policy* policy) {
+  struct opt* opt = (struct opt*)policy;
+  struct vtpc_block* victim = opt->fallback->ops->evict(opt->fallback);
+  if (victim == NULL && opt->size > 0) {
+    victim = opt->heap[0];
+    heap_remove(opt, victim);
+  }
+  return victim;
+}
+
+static struct vtpc_block* opt_victim(struct vtpc_policy* policy) {
+  struct opt* opt = (struct opt*)policy;
+  struct vtpc_block* victim = opt->fallback->ops->victim(opt->fallback);
+  if (victim == NULL && opt->size > 0) {
+    victim = opt->heap[0];
+  }
+  return victim;
+}
+
+static void opt_update(struct vtpc_policy* policy, struct vtpc_block* block) {
+  struct opt* opt = (struct opt*)policy;
+  if (block->heap_pos == NOT_IN_HEAP) {
+    if (block->next_use != VTPC_NEVER) {
+      opt->fallback->ops->remove(opt->fallback, block);
+      heap_push(opt, block);
+    }
+  } else if (block->next_use == VTPC_NEVER) {
+    heap_remove(opt, block);
+    opt->fallback->ops->insert(opt->fallback, block);
+  } else {
+    const size_t pos = block->heap_pos;
+    sift_up(opt, pos);
+    sift_down(opt, block->heap_pos);
+  }
+}
+
+const struct vtpc_policy_ops vtpc_policy_opt = {
+    .name = "opt",
+    .create = opt_create,
+    .destroy = opt_destroy,
+    .insert = opt_insert,
+    .access = opt_access,
+    .remove = opt_remove,
+    .evict = opt_evict,
+    .victim = opt_victim,
+    .update = opt_update,
+};
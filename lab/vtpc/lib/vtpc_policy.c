@@ -0,0 +1,152 @@
+#include "vtpc_policy.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const struct vtpc_policy_ops* const policies[] = {
+    &vtpc_policy_lru,
+    &vtpc_policy_clock,
+    &vtpc_policy_2q,
+    &vtpc_policy_arc,
+    &vtpc_policy_lfu,
+    &vtpc_policy_opt,
+};
+
+const struct vtpc_policy_ops* vtpc_policy_find(const char* name) {
+  for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); ++i) {
+    if (strcmp(policies[i]->name, name) == 0) {
+      return policies[i];
+    }
+  }
+  return NULL;
+}
+
+void vtpc_list_init(struct vtpc_list* list) {
+  list->head.prev = &list->head;
+  list->head.next = &list->head;
+  list->size = 0;
+}
+
+void vtpc_list_push_front(struct vtpc_list* list, struct vtpc_block* block) {
+  block->prev = &list->head;
+  block->next = list->head.next;
+  list->head.next->prev = block;
+  list->head.next = block;
+  list->size++;
+}
+
+void vtpc_list_push_back(struct vtpc_list* list, struct vtpc_block* block) {
+  block->next = &list->head;
+  block->prev = list->head.prev;
+  list->head.prev->next = block;
+  list->head.prev = block;
+  list->size++;
+}
+
+void vtpc_list_remove(struct vtpc_list* list, struct vtpc_block* block) {
+  block->prev->next = block->next;
+  block->next->prev = block->prev;
+  block->prev = NULL;
+  block->next = NULL;
+  list->size--;
+}
+
+struct vtpc_block* vtpc_list_back(struct vtpc_list* list) {
+  return list->size == 0 ? NULL : list->head.prev;
+}
+
+static struct vtpc_ghost_entry** ghost_bucket(
+    struct vtpc_ghost* ghost, uint64_t file, uint64_t index
+) {
+  return &ghost->buckets[vtpc_hash_key(file, index) & ghost->bucket_mask];
+}
+
+static void ghost_unlink(
+    struct vtpc_ghost* ghost, struct vtpc_ghost_entry* entry
+) {
+  struct vtpc_ghost_entry** link =
+      ghost_bucket(ghost, entry->file, entry->index);
+  while (*link != entry) {
+    link = &(*link)->hash_next;
+  }
+  *link = entry->hash_next;
+
+  entry->prev->next = entry->next;
+  entry->next->prev = entry->prev;
+  entry->next = ghost->free;
+  ghost->free = entry;
+  ghost->size--;
+}
+
+int vtpc_ghost_init(struct vtpc_ghost* ghost, size_t capacity) {
+  memset(ghost, 0, sizeof(*ghost));
+  if (capacity == 0) {
+    capacity = 1;
+  }
+  size_t buckets = 1;
+  while (buckets < 2 * capacity) {
+    buckets <<= 1U;
+  }
+  ghost->entries = calloc(capacity, sizeof(struct vtpc_ghost_entry));
+  ghost->buckets = calloc(buckets, sizeof(struct vtpc_ghost_entry*));
+  if (ghost->entries == NULL || ghost->buckets == NULL) {
+    vtpc_ghost_destroy(ghost);
+    return -1;
+  }
+  ghost->capacity = capacity;
+  ghost->bucket_mask = buckets - 1;
+  ghost->head.prev = &ghost->head;
+  ghost->head.next = &ghost->head;
+  for (size_t i = 0; i < capacity; ++i) {
+    ghost->entries[i].next = ghost->free;
+    ghost->free = &ghost->entries[i];
+  }
+  return 0;
+}
+
+void vtpc_ghost_destroy(struct vtpc_ghost* ghost) {
+  free(ghost->entries);
+  free(ghost->buckets);
+  memset(ghost, 0, sizeof(*ghost));
+}
+
+void vtpc_ghost_push(struct vtpc_ghost* ghost, uint64_t file, uint64_t index) {
+  if (ghost->size == ghost->capacity) {
+    vtpc_ghost_pop(ghost);
+  }
+  struct vtpc_ghost_entry* entry = ghost->free;
+  ghost->free = entry->next;
+  ghost->size++;
+
+  entry->file = file;
+  entry->index = index;
+  struct vtpc_ghost_entry** bucket = ghost_bucket(ghost, file, index);
+  entry->hash_next = *bucket;
+  *bucket = entry;
+
+  entry->prev = &ghost->head;
+  entry->next = ghost->head.next;
+  ghost->head.next->prev = entry;
+  ghost->head.next = entry;
+}
+
+void vtpc_ghost_pop(struct vtpc_ghost* ghost) {
+  if (ghost->size > 0) {
+    ghost_unlink(ghost, ghost->head.prev);
+  }
+}
+
+bool vtpc_ghost_take(struct vtpc_ghost* ghost, uint64_t file, uint64_t index) {
+  struct vtpc_ghost_entry* entry = *ghost_bucket(ghost, file, index);
+  while (entry != NULL && (entry->file != file || entry->index != index)) {
+    entry = entry->hash_next;
+  }
+  if (entry == NULL) {
+    return false;
+  }
+  ghost_unlink(ghost, entry);
+  return true;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vtpc_internal.h"
+
+struct vtpc_policy;
+
+// A replacement policy tracks the resident, evictable blocks. The cache calls
+// `insert` once a block becomes resident, `access` on every hit, `remove` when
+// a block leaves without being chosen as a victim (invalidation), and `evict`
+// to pick and detach the next victim; `victim` names the block `evict` would
+// pick next without detaching it. Every operation is O(1) amortized, except
+// for the hinted blocks of "opt", which live in an O(log n) heap.
+struct vtpc_policy_ops {
+  const char* name;
+  struct vtpc_policy* (*create)(
+      size_t capacity, const struct vtpc_config* config
+  );
+  void (*destroy)(struct vtpc_policy* policy);
+  void (*insert)(struct vtpc_policy* policy, struct vtpc_block* block);
+  void (*access)(struct vtpc_policy* policy, struct vtpc_block* block);
+  void (*remove)(struct vtpc_policy* policy, struct vtpc_block* block);
+  struct vtpc_block* (*evict)(struct vtpc_policy* policy);
+  struct vtpc_block* (*victim)(struct vtpc_policy* policy);
+  // Optional: called after `block->next_use` has been changed. Policies
+  // without it ignore access hints.
+  void (*update)(struct vtpc_policy* policy, struct vtpc_block* block);
+};
+
+struct vtpc_policy {
+  const struct vtpc_policy_ops* ops;
+};
+
+#define VTPC_NEVER UINT64_MAX
+
+extern const struct vtpc_policy_ops vtpc_policy_lru;
+extern const struct vtpc_policy_ops vtpc_policy_clock;
+extern const struct vtpc_policy_ops vtpc_policy_2q;
+extern const struct vtpc_policy_ops vtpc_policy_arc;
+extern const struct vtpc_policy_ops vtpc_policy_lfu;
+extern const struct vtpc_policy_ops vtpc_policy_opt;
+
+// Returns NULL when no policy has the given name.
+const struct vtpc_policy_ops* vtpc_policy_find(const char* name);
+
+// Intrusive doubly linked list of blocks threaded through `prev`/`next`.
+struct vtpc_list {
+  struct vtpc_block head;
+  size_t size;
+};
+
+void vtpc_list_init(struct vtpc_list* list);
+void vtpc_list_push_front(struct vtpc_list* list, struct vtpc_block* block);
+void vtpc_list_push_back(struct vtpc_list* list, struct vtpc_block* block);
+void vtpc_list_remove(struct vtpc_list* list, struct vtpc_block* block);
+struct vtpc_block* vtpc_list_back(struct vtpc_list* list);
+
+// TinyLFU admission filter: approximate access counts of recently seen keys
+// in a few bytes per block, to tell whether a new block is worth more than
+// the victim it would displace.
+struct vtpc_admission {
+  uint64_t* sketch;      // Count-min sketch of 4-bit counters.
+  uint64_t* doorkeeper;  // Bloom filter of the keys seen once.
+  size_t width;          // Counters per row, a power of two.
+  size_t bits;           // Of the doorkeeper, a power of two.
+  size_t samples;
+  size_t period;
+};
+
+int vtpc_admission_init(struct vtpc_admission* admission, size_t capacity);
+void vtpc_admission_destroy(struct vtpc_admission* admission);
+void vtpc_admission_record(
+    struct vtpc_admission* admission, uint64_t file, uint64_t index
+);
+// Roughly how many times the key was recorded lately, 0 if never.
+size_t vtpc_admission_estimate(
+    const struct vtpc_admission* admission, uint64_t file, uint64_t index
+);
+
+// Bounded FIFO of the keys of recently evicted blocks, used by 2Q and ARC.
+struct vtpc_ghost_entry {
+  uint64_t file;
+  uint64_t index;
+  struct vtpc_ghost_entry* hash_next;
+  struct vtpc_ghost_entry* prev;
+  struct vtpc_ghost_entry* next;
+};
+
+struct vtpc_ghost {
+  size_t capacity;
+  size_t size;
+  struct vtpc_ghost_entry* entries;
+  struct vtpc_ghost_entry* free;
+  struct vtpc_ghost_entry** buckets;
+  size_t bucket_mask;
+  struct vtpc_ghost_entry head;
+};
+
+int vtpc_ghost_init(struct vtpc_ghost* ghost, size_t capacity);
+void vtpc_ghost_destroy(struct vtpc_ghost* ghost);
+// Adds the key as the newest entry, dropping the oldest one when full.
+void vtpc_ghost_push(struct vtpc_ghost* ghost, uint64_t file, uint64_t index);
+void vtpc_ghost_pop(struct vtpc_ghost* ghost);
+// Removes the key and reports whether it was present.
+bool vtpc_ghost_take(struct vtpc_ghost* ghost, uint64_t file, uint64_t index);
@@ -0,0 +1,517 @@
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+
+// LD_PRELOAD interposer: files whose absolute path matches one of the
+// colon-separated fnmatch patterns in VTPC_PRELOAD are opened with vtpc_open,
+// and the calls on their descriptors go through the cache. Everything else,
+// and every call vtpc itself makes on this thread, goes to the next
+// definition, normally libc's. The cache reads and writes through O_DIRECT
+// descriptors of its own, which are never routed, so its flusher thread does
+// not come back here either.
+//
+// Descriptors duplicated with dup, dup2 or dup3 stay in the cache, with an
+// offset of their own. ftruncate, fallocate and posix_fallocate go through
+// it too, and fstat and fstatat of a descriptor report the size with the
+// cached blocks. Other calls do not see the cache: a descriptor duplicated
+// with fcntl, mapped with mmap or used through stdio reads and writes the
+// file directly, and stat and statx by path report the size on disk.
+#define VTPC_PRELOAD_FDS 65536
+
+typedef int open_fn(const char*, int, ...);
+typedef int openat_fn(int, const char*, int, ...);
+
+static struct {
+  pthread_once_t once;
+  char* patterns;  // NUL-separated, ends with an empty one.
+  open_fn* open;
+  open_fn* open64;
+  openat_fn* openat;
+  openat_fn* openat64;
+  int (*close)(int);
+  ssize_t (*read)(int, void*, size_t);
+  ssize_t (*write)(int, const void*, size_t);
+  ssize_t (*pread)(int, void*, size_t, off_t);
+  ssize_t (*pwrite)(int, const void*, size_t, off_t);
+  ssize_t (*readv)(int, const struct iovec*, int);
+  ssize_t (*writev)(int, const struct iovec*, int);
+  off_t (*lseek)(int, off_t, int);
+  int (*fsync)(int);
+  int (*fdatasync)(int);
+  int (*posix_fadvise)(int, off_t, off_t, int);
+  int (*ftruncate)(int, off_t);
+  int (*fallocate)(int, int, off_t, off_t);
+  int (*posix_fallocate)(int, off_t, off_t);
+  int (*fstat)(int, struct stat*);
+  int (*fstatat)(int, const char*, struct stat*, int);
+  int (*dup)(int);
+  int (*dup2)(int, int);
+  int (*dup3)(int, int, int);
+} next = {.once = PTHREAD_ONCE_INIT};
+
+static atomic_bool owned[VTPC_PRELOAD_FDS];
+
+// Inside vtpc on this thread: its own calls are not routed back to it.
+static _Thread_local unsigned depth;
+
+static void resolve(void) {
+  next.open = (open_fn*)dlsym(RTLD_NEXT, "open");
+  next.open64 = (open_fn*)dlsym(RTLD_NEXT, "open64");
+  next.openat = (openat_fn*)dlsym(RTLD_NEXT, "openat");
+  next.openat64 = (openat_fn*)dlsym(RTLD_NEXT, "openat64");
+  next.close = (int (*)(int))dlsym(RTLD_NEXT, "close");
+  next.read = (ssize_t (*)(int, void*, size_t))dlsym(RTLD_NEXT, "read");
+  next.write =
+      (ssize_t (*)(int, const void*, size_t))dlsym(RTLD_NEXT, "write");
+  next.pread =
+      (ssize_t (*)(int, void*, size_t, off_t))dlsym(RTLD_NEXT, "pread");
+  next.pwrite = (ssize_t (*)(int, const void*, size_t, off_t))dlsym(
+      RTLD_NEXT, "pwrite"
+  );
+  next.readv =
+      (ssize_t (*)(int, const struct iovec*, int))dlsym(RTLD_NEXT, "readv");
+  next.writev =
+      (ssize_t (*)(int, const struct iovec*, int))dlsym(RTLD_NEXT, "writev");
+  next.lseek = (off_t (*)(int, off_t, int))dlsym(RTLD_NEXT, "lseek");
+  next.fsync = (int (*)(int))dlsym(RTLD_NEXT, "fsync");
+  next.fdatasync = (int (*)(int))dlsym(RTLD_NEXT, "fdatasync");
+  next.posix_fadvise = (int (*)(int, off_t, off_t, int))dlsym(
+      RTLD_NEXT, "posix_fadvise"
+  );
+  next.ftruncate = (int (*)(int, off_t))dlsym(RTLD_NEXT, "ftruncate");
+  next.fallocate =
+      (int (*)(int, int, off_t, off_t))dlsym(RTLD_NEXT, "fallocate");
+  next.posix_fallocate =
+      (int (*)(int, off_t, off_t))dlsym(RTLD_NEXT, "posix_fallocate");
+  next.fstat = (int (*)(int, struct stat*))dlsym(RTLD_NEXT, "fstat");
+  next.fstatat = (int (*)(int, const char*, struct stat*, int))dlsym(
+      RTLD_NEXT, "fstatat"
+  );
+  next.dup = (int (*)(int))dlsym(RTLD_NEXT, "dup");
+  next.dup2 = (int (*)(int, int))dlsym(RTLD_NEXT, "dup2");
+  next.dup3 = (int (*)(int, int, int))dlsym(RTLD_NEXT, "dup3");
+
+  const char* value = getenv("VTPC_PRELOAD");  // NOLINT
+  if (value == NULL || *value == '\0') {
+    return;
+  }
+  const size_t len = strlen(value);
+  next.patterns = calloc(len + 2, 1);
+  if (next.patterns == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < len; ++i) {
+    next.patterns[i] = value[i] == ':' ? '\0' : value[i];
+  }
+}
+
+static void init(void) {
+  pthread_once(&next.once, resolve);
+}
+
+static bool is_owned(int fd) {
+  return depth == 0 && fd >= 0 && fd < VTPC_PRELOAD_FDS &&
+         atomic_load_explicit(&owned[fd], memory_order_relaxed);
+}
+
+static bool matches(const char* path) {
+  if (next.patterns == NULL) {
+    return false;
+  }
+  char absolute[PATH_MAX];
+  if (path[0] != '/') {
+    if (getcwd(absolute, sizeof(absolute)) == NULL) {
+      return false;
+    }
+    const size_t len = strlen(absolute);
+    if (snprintf(absolute + len, sizeof(absolute) - len, "/%s", path) >=
+        (int)(sizeof(absolute) - len)) {
+      return false;
+    }
+    path = absolute;
+  }
+  for (const char* pattern = next.patterns; *pattern != '\0';
+       pattern += strlen(pattern) + 1) {
+    if (fnmatch(pattern, path, 0) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Opens a matching regular file through vtpc. Returns -2 when the file is
+// not routed, so the caller opens it as usual; errors of vtpc_open also
+// fall back, so they are reported as without the cache.
+static int route_open(const char* path, int flags, mode_t mode) {
+  init();
+  if (depth > 0 || (flags & (O_DIRECTORY | O_PATH)) != 0 ||
+      (flags & O_TMPFILE) == O_TMPFILE || !matches(path)) {
+    return -2;
+  }
+  const int err = errno;
+  depth++;
+  int fd = vtpc_open(path, flags, (int)mode);
+  if (fd >= VTPC_PRELOAD_FDS) {
+    vtpc_close(fd);
+    fd = -1;
+  }
+  depth--;
+  if (fd == -1) {
+    errno = err;
+    return -2;
+  }
+  atomic_store(&owned[fd], true);
+  return fd;
+}
+
+static mode_t mode_of(int flags, va_list args) {
+  if ((flags & O_CREAT) != 0 || (flags & O_TMPFILE) == O_TMPFILE) {
+    return (mode_t)va_arg(args, int);
+  }
+  return 0;
+}
+
+int open(const char* path, int flags, ...) {
+  va_list args;
+  va_start(args, flags);
+  const mode_t mode = mode_of(flags, args);
+  va_end(args);
+  const int fd = route_open(path, flags, mode);
+  return fd != -2 ? fd : next.open(path, flags, mode);
+}
+
+int open64(const char* path, int flags, ...) {
+  va_list args;
+  va_start(args, flags);
+  const mode_t mode = mode_of(flags, args);
+  va_end(args);
+  const int fd = route_open(path, flags, mode);
+  return fd != -2 ? fd : next.open64(path, flags, mode);
+}
+
+// vtpc_open resolves relative paths against the working directory only.
+int openat(int dirfd, const char* path, int flags, ...) {
+  va_list args;
+  va_start(args, flags);
+  const mode_t mode = mode_of(flags, args);
+  va_end(args);
+  const int fd = dirfd == AT_FDCWD || path[0] == '/'
+                     ? route_open(path, flags, mode)
+                     : -2;
+  init();
+  return fd != -2 ? fd : next.openat(dirfd, path, flags, mode);
+}
+
+int openat64(int dirfd, const char* path, int flags, ...) {
+  va_list args;
+  va_start(args, flags);
+  const mode_t mode = mode_of(flags, args);
+  va_end(args);
+  const int fd = dirfd == AT_FDCWD || path[0] == '/'
+                     ? route_open(path, flags, mode)
+                     : -2;
+  init();
+  return fd != -2 ? fd : next.openat64(dirfd, path, flags, mode);
+}
+
+int close(int fd) {
+  init();
+  if (!is_owned(fd)) {
+    return next.close(fd);
+  }
+  atomic_store(&owned[fd], false);
+  depth++;
+  const int result = vtpc_close(fd);
+  depth--;
+  return result;
+}
+
+ssize_t read(int fd, void* buf, size_t count) {
+  init();
+  if (!is_owned(fd)) {
+    return next.read(fd, buf, count);
+  }
+  depth++;
+  const ssize_t n = vtpc_read(fd, buf, count);
+  depth--;
+  return n;
+}
+
+ssize_t write(int fd, const void* buf, size_t count) {
+  init();
+  if (!is_owned(fd)) {
+    return next.write(fd, buf, count);
+  }
+  depth++;
+  const ssize_t n = vtpc_write(fd, buf, count);
+  depth--;
+  return n;
+}
+
+ssize_t pread(int fd, void* buf, size_t count, off_t offset) {
+  init();
+  if (!is_owned(fd)) {
+    return next.pread(fd, buf, count, offset);
+  }
+  depth++;
+  const ssize_t n = vtpc_pread(fd, buf, count, offset);
+  depth--;
+  return n;
+}
+
+ssize_t pread64(int fd, void* buf, size_t count, off64_t offset) {
+  return pread(fd, buf, count, offset);
+}
+
+ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset) {
+  init();
+  if (!is_owned(fd)) {
+    return next.pwrite(fd, buf, count, offset);
+  }
+  depth++;
+  const ssize_t n = vtpc_pwrite(fd, buf, count, offset);
+  depth--;
+  return n;
+}
+
+ssize_t pwrite64(int fd, const void* buf, size_t count, off64_t offset) {
+  return pwrite(fd, buf, count, offset);
+}
+
+ssize_t readv(int fd, const struct iovec* iov, int iovcnt) {
+  init();
+  if (!is_owned(fd)) {
+    return next.readv(fd, iov, iovcnt);
+  }
+  depth++;
+  const ssize_t n = vtpc_readv(fd, iov, iovcnt);
+  depth--;
+  return n;
+}
+
+ssize_t writev(int fd, const struct iovec* iov, int iovcnt) {
+  init();
+  if (!is_owned(fd)) {
+    return next.writev(fd, iov, iovcnt);
+  }
+  depth++;
+  const ssize_t n = vtpc_writev(fd, iov, iovcnt);
+  depth--;
+  return n;
+}
+
+off_t lseek(int fd, off_t offset, int whence) {
+  init();
+  if (!is_owned(fd)) {
+    return next.lseek(fd, offset, whence);
+  }
+  depth++;
+  const off_t result = vtpc_lseek(fd, offset, whence);
+  depth--;
+  return result;
+}
+
+off64_t lseek64(int fd, off64_t offset, int whence) {
+  return lseek(fd, offset, whence);
+}
+
+int fsync(int fd) {
+  init();
+  if (!is_owned(fd)) {
+    return next.fsync(fd);
+  }
+  depth++;
+  const int result = vtpc_fsync(fd);
+  depth--;
+  return result;
+}
+
+int fdatasync(int fd) {
+  init();
+  if (!is_owned(fd)) {
+    return next.fdatasync(fd);
+  }
+  depth++;
+  const int result = vtpc_fsync(fd);
+  depth--;
+  return result;
+}
+
+// Returns the error number rather than setting errno, like libc.
+int posix_fadvise(int fd, off_t offset, off_t len, int advice) {
+  init();
+  if (!is_owned(fd)) {
+    return next.posix_fadvise(fd, offset, len, advice);
+  }
+  depth++;
+  const int result = vtpc_fadvise(fd, offset, len, advice) == -1 ? errno : 0;
+  depth--;
+  return result;
+}
+
+int posix_fadvise64(int fd, off64_t offset, off64_t len, int advice) {
+  return posix_fadvise(fd, offset, len, advice);
+}
+
+int ftruncate(int fd, off_t length) {
+  init();
+  if (!is_owned(fd)) {
+    return next.ftruncate(fd, length);
+  }
+  depth++;
+  const int result = vtpc_ftruncate(fd, length);
+  depth--;
+  return result;
+}
+
+int ftruncate64(int fd, off64_t length) {
+  return ftruncate(fd, length);
+}
+
+int fallocate(int fd, int mode, off_t offset, off_t len) {
+  init();
+  if (!is_owned(fd)) {
+    return next.fallocate(fd, mode, offset, len);
+  }
+  depth++;
+  const int result = vtpc_fallocate(fd, mode, offset, len);
+  depth--;
+  return result;
+}
+
+int fallocate64(int fd, int mode, off64_t offset, off64_t len) {
+  return fallocate(fd, mode, offset, len);
+}
+
+// Returns the error number rather than setting errno, like libc. Without
+// support for fallocate in the filesystem it fails rather than writing the
+// range with zeros.
+int posix_fallocate(int fd, off_t offset, off_t len) {
+  init();
+  if (!is_owned(fd)) {
+    return next.posix_fallocate(fd, offset, len);
+  }
+  depth++;
+  const int result = vtpc_fallocate(fd, 0, offset, len) == -1 ? errno : 0;
+  depth--;
+  return result;
+}
+
+int posix_fallocate64(int fd, off64_t offset, off64_t len) {
+  return posix_fallocate(fd, offset, len);
+}
+
+int fstat(int fd, struct stat* st) {
+  init();
+  if (!is_owned(fd)) {
+    return next.fstat(fd, st);
+  }
+  depth++;
+  const int result = vtpc_fstat(fd, st);
+  depth--;
+  return result;
+}
+
+int fstat64(int fd, struct stat64* st) {
+  return fstat(fd, (struct stat*)st);
+}
+
+// Only an empty path with AT_EMPTY_PATH names the descriptor itself.
+int fstatat(int dirfd, const char* path, struct stat* st, int flags) {
+  init();
+  if ((flags & AT_EMPTY_PATH) == 0 || path[0] != '\0' || !is_owned(dirfd)) {
+    return next.fstatat(dirfd, path, st, flags);
+  }
+  depth++;
+  const int result = vtpc_fstat(dirfd, st);
+  depth--;
+  return result;
+}
+
+int fstatat64(int dirfd, const char* path, struct stat64* st, int flags) {
+  return fstatat(dirfd, path, (struct stat*)st, flags);
+}
+
+// Makes `newfd` a cached duplicate of the owned `oldfd`.
+static int route_dup(int oldfd, int newfd) {
+  if (newfd < 0 || newfd >= VTPC_PRELOAD_FDS) {
+    errno = newfd < 0 ? EBADF : EMFILE;
+    return -1;
+  }
+  depth++;
+  const int fd = vtpc_dup2(oldfd, newfd);
+  depth--;
+  if (fd != -1) {
+    atomic_store(&owned[fd], true);
+  }
+  return fd;
+}
+
+// Replacing an owned descriptor closes it through vtpc first.
+static void release(int fd) {
+  if (is_owned(fd)) {
+    atomic_store(&owned[fd], false);
+    depth++;
+    (void)vtpc_close(fd);
+    depth--;
+  }
+}
+
+int dup(int oldfd) {
+  init();
+  const int fd = next.dup(oldfd);
+  if (fd == -1 || !is_owned(oldfd)) {
+    return fd;
+  }
+  if (route_dup(oldfd, fd) == -1) {
+    const int err = errno;
+    next.close(fd);
+    errno = err;
+    return -1;
+  }
+  return fd;
+}
+
+int dup2(int oldfd, int newfd) {
+  init();
+  if (!is_owned(oldfd)) {
+    if (oldfd != newfd && fcntl(oldfd, F_GETFD) != -1) {
+      release(newfd);
+    }
+    return next.dup2(oldfd, newfd);
+  }
+  return route_dup(oldfd, newfd);
+}
+
+int dup3(int oldfd, int newfd, int flags) {
+  init();
+  if (!is_owned(oldfd) || oldfd == newfd || (flags & ~O_CLOEXEC) != 0) {
+    if (oldfd != newfd && fcntl(oldfd, F_GETFD) != -1) {
+      release(newfd);
+    }
+    return next.dup3(oldfd, newfd, flags);
+  }
+  const int fd = route_dup(oldfd, newfd);
+  if (fd != -1 && (flags & O_CLOEXEC) != 0) {
+    (void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+  }
+  return fd;
+}
@@ -0,0 +1,97 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vtpc_internal.h"
+
+// On-demand readahead in the spirit of the kernel's: a read that continues
+// one of the streams of the descriptor starts a window of `VTPC_RA_INITIAL`
+// blocks, and every time the reader reaches the marker at the start of the
+// previous window the next one is issued, twice as large, up to the limit. A
+// read that continues no stream replaces the least recently used one, so the
+// window of a stream that turns random collapses. A stream is a one-shot
+// scan once it is `vtpc_cache_scan_min()` blocks long. A descriptor advised
+// to be sequential starts every stream with its first read, at the limit.
+#define VTPC_RA_INITIAL 4
+
+static struct vtpc_stream* stream_find(
+    struct vtpc_readahead* ra, uint64_t first
+) {
+  for (size_t i = 0; i < VTPC_STREAMS; ++i) {
+    struct vtpc_stream* stream = &ra->streams[i];
+    // Small reads stay in the block the previous one ended in.
+    if (stream->used != 0 &&
+        (stream->next == first || stream->next == first + 1)) {
+      return stream;
+    }
+  }
+  return NULL;
+}
+
+static struct vtpc_stream* stream_oldest(struct vtpc_readahead* ra) {
+  struct vtpc_stream* oldest = &ra->streams[0];
+  for (size_t i = 1; i < VTPC_STREAMS; ++i) {
+    if (ra->streams[i].used < oldest->used) {
+      oldest = &ra->streams[i];
+    }
+  }
+  return oldest;
+}
+
+// Issues the next window once the reader reaches the marker of the stream.
+static void advance(
+    struct vtpc_stream* stream,
+    struct vtpc_file* file,
+    uint64_t first,
+    uint64_t last,
+    bool eager
+) {
+  const size_t max = vtpc_cache_readahead_max();
+  if (max == 0) {
+    return;
+  }
+  if (stream->window == 0) {
+    stream->window = VTPC_RA_INITIAL < max && !eager ? VTPC_RA_INITIAL : max;
+  } else if (last >= stream->marker || first >= stream->end) {
+    stream->window = 2 * stream->window < max ? 2 * stream->window : max;
+  } else {
+    return;
+  }
+
+  const uint64_t start = stream->end > first ? stream->end : first;
+  const uint64_t ahead = start > last + 1 ? start : last + 1;
+  uint64_t end = ahead + stream->window;
+  if (end - start > max) {
+    end = start + max;
+  }
+  vtpc_cache_prefetch(file, start, (size_t)(end - start));
+  stream->marker = ahead;
+  stream->end = end;
+}
+
+bool vtpc_readahead(
+    struct vtpc_readahead* ra,
+    struct vtpc_file* file,
+    uint64_t first,
+    uint64_t last,
+    bool eager
+) {
+  struct vtpc_stream* stream = stream_find(ra, first);
+  if (stream == NULL) {
+    stream = stream_oldest(ra);
+    *stream = (struct vtpc_stream){
+        .start = first,
+        .next = last + 1,
+        .used = ++ra->clock,
+    };
+    if (!eager) {
+      return false;
+    }
+  }
+  stream->next = last + 1;
+  stream->used = ++ra->clock;
+  advance(stream, file, first, last, eager);
+
+  const size_t scan = vtpc_cache_scan_min();
+  return scan != 0 && last + 1 - stream->start >= scan;
+}
@@ -0,0 +1,496 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "vtpc_internal.h"
+
+// The shared tier is a second pool in a named POSIX shared memory segment,
+// mapped by every process configured with the same name. Clean blocks read
+// from disk or written back to it by any of them are published there, so
+// the miss of one process is served by the read of another. The segment
+// holds no pointers, only slot numbers, and keys blocks by device, inode and
+// index, as file ids are per process. Dirty blocks stay private until they
+// are written back.
+//
+// The segment is split into shards, each with a robust process-shared mutex,
+// a CLOCK hand and an epoch bumped by every write and drop of its blocks. A
+// block read from disk is published only if the epoch of its shard has not
+// moved since the read began, so a slow reader never replaces newer data.
+//
+// Each process still keeps the blocks it uses in its private pool. Beside
+// every hash bucket the segment holds a version, bumped once a block of the
+// bucket is written back or truncated by anyone, which a private copy
+// records when it is read: a clean copy whose version moved is read again.
+// Buckets share versions, so a write may also refresh innocent blocks.
+#define VTPC_SHARED_MAGIC 0x32686d7363707476ULL  // "vtpcshm2"
+#define VTPC_SHARED_SHARDS_MAX 64
+#define VTPC_SHARED_SHARD_MIN_BLOCKS 64
+#define VTPC_CACHE_LINE 64
+
+// Fixed by the process creating the segment; the others adopt it.
+struct shared_header {
+  _Atomic uint64_t magic;  // Stored last, once the segment is set up.
+  uint64_t block_size;
+  uint64_t capacity;
+  uint64_t shards;
+  uint64_t buckets;  // Per shard.
+};
+
+struct shared_shard {
+  alignas(VTPC_CACHE_LINE) pthread_mutex_t lock;
+  uint64_t epoch;
+  uint32_t first;  // The slots of the shard follow this one.
+  uint32_t capacity;
+  uint32_t filled;  // Taken in order until the shard is full.
+  uint32_t hand;
+};
+
+// Links are slot numbers plus one, 0 ending a chain.
+struct shared_slot {
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t index;
+  uint32_t hash_next;
+  bool used;
+  bool referenced;
+};
+
+struct shared_layout {
+  size_t shards;
+  size_t buckets;
+  size_t versions;
+  size_t slots;
+  size_t data;
+  size_t size;
+};
+
+static struct {
+  void* base;
+  size_t size;
+  size_t block_size;
+  size_t capacity;
+  uint64_t shard_mask;
+  uint64_t bucket_mask;
+  struct shared_shard* shards;
+  uint32_t* buckets;
+  _Atomic uint32_t* versions;  // Indexed like the buckets.
+  struct shared_slot* slots;
+  char* data;
+} shared;
+
+static size_t align_up(size_t n, size_t align) {
+  return (n + align - 1) / align * align;
+}
+
+static struct shared_layout layout_of(const struct shared_header* header) {
+  struct shared_layout layout;
+  layout.shards = align_up(sizeof(struct shared_header), VTPC_CACHE_LINE);
+  layout.buckets =
+      layout.shards + (header->shards * sizeof(struct shared_shard));
+  layout.versions =
+      layout.buckets + (header->shards * header->buckets * sizeof(uint32_t));
+  layout.slots = align_up(
+      layout.versions + (header->shards * header->buckets * sizeof(uint32_t)),
+      alignof(struct shared_slot)
+  );
+  layout.data = align_up(
+      layout.slots + (header->capacity * sizeof(struct shared_slot)),
+      header->block_size
+  );
+  layout.size = layout.data + (header->capacity * header->block_size);
+  return layout;
+}
+
+static void geometry(
+    struct shared_header* header, size_t block_size, size_t capacity
+) {
+  size_t shards = 1;
+  while (shards < VTPC_SHARED_SHARDS_MAX &&
+         2 * shards * VTPC_SHARED_SHARD_MIN_BLOCKS <= capacity) {
+    shards <<= 1U;
+  }
+  size_t buckets = 1;
+  while (buckets < 2 * ((capacity + shards - 1) / shards)) {
+    buckets <<= 1U;
+  }
+  header->block_size = block_size;
+  header->capacity = capacity;
+  header->shards = shards;
+  header->buckets = buckets;
+}
+
+static void unmap(void) {
+  if (shared.base != NULL) {
+    munmap(shared.base, shared.size);
+  }
+  memset(&shared, 0, sizeof(shared));
+}
+
+static uint32_t* buckets_of(struct shared_shard* shard) {
+  return shared.buckets +
+         ((size_t)(shard - shared.shards) * (shared.bucket_mask + 1));
+}
+
+// Forgets every block of the shard.
+static void shard_clear(struct shared_shard* shard) {
+  memset(buckets_of(shard), 0, (shared.bucket_mask + 1) * sizeof(uint32_t));
+  for (uint32_t i = 0; i < shard->capacity; ++i) {
+    shared.slots[shard->first + i].used = false;
+  }
+  shard->filled = 0;
+  shard->hand = 0;
+  shard->epoch++;
+}
+
+static int shard_init(struct shared_shard* shard) {
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  const int err = pthread_mutex_init(&shard->lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+// A process that died holding the lock may have left the shard half
+// changed, so its blocks are forgotten.
+static void shard_lock(struct shared_shard* shard) {
+  if (pthread_mutex_lock(&shard->lock) == EOWNERDEAD) {
+    shard_clear(shard);
+    pthread_mutex_consistent(&shard->lock);
+  }
+}
+
+static void shard_unlock(struct shared_shard* shard) {
+  pthread_mutex_unlock(&shard->lock);
+}
+
+// Called with the segment locked with flock, so that a single process sets
+// it up. A segment left without its magic by a process that died setting it
+// up is set up again.
+static int attach(int fd, const struct vtpc_config* config) {
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    return -1;
+  }
+  struct shared_header header;
+  memset(&header, 0, sizeof(header));
+  if ((size_t)st.st_size >= sizeof(header) &&
+      pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+    return -1;
+  }
+  const bool create = atomic_load(&header.magic) != VTPC_SHARED_MAGIC;
+  if (create) {
+    const size_t capacity = config->shared_capacity == 0
+                                ? config->capacity
+                                : config->shared_capacity;
+    if (capacity >= UINT32_MAX) {
+      errno = EINVAL;
+      return -1;
+    }
+    geometry(&header, config->block_size, capacity);
+    if (ftruncate(fd, 0) == -1 ||
+        ftruncate(fd, (off_t)layout_of(&header).size) == -1) {
+      return -1;
+    }
+  } else if (header.block_size != config->block_size ||
+             (off_t)layout_of(&header).size != st.st_size) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  const struct shared_layout layout = layout_of(&header);
+  void* base = mmap(
+      NULL, layout.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0
+  );
+  if (base == MAP_FAILED) {
+    return -1;
+  }
+  shared.base = base;
+  shared.size = layout.size;
+  shared.block_size = header.block_size;
+  shared.capacity = header.capacity;
+  shared.shard_mask = header.shards - 1;
+  shared.bucket_mask = header.buckets - 1;
+  shared.shards = (struct shared_shard*)((char*)base + layout.shards);
+  shared.buckets = (uint32_t*)((char*)base + layout.buckets);
+  shared.versions = (_Atomic uint32_t*)((char*)base + layout.versions);
+  shared.slots = (struct shared_slot*)((char*)base + layout.slots);
+  shared.data = (char*)base + layout.data;
+  if (!create) {
+    return 0;
+  }
+
+  // The segment was truncated to zeros, so the index starts empty.
+  uint32_t first = 0;
+  for (size_t i = 0; i < header.shards; ++i) {
+    struct shared_shard* shard = &shared.shards[i];
+    shard->first = first;
+    shard->capacity = (uint32_t)((header.capacity / header.shards) +
+                                 (i < header.capacity % header.shards ? 1 : 0));
+    first += shard->capacity;
+    if (shard_init(shard) == -1) {
+      const int err = errno;
+      unmap();
+      errno = err;
+      return -1;
+    }
+  }
+  struct shared_header* mapped = base;
+  mapped->block_size = header.block_size;
+  mapped->capacity = header.capacity;
+  mapped->shards = header.shards;
+  mapped->buckets = header.buckets;
+  atomic_store(&mapped->magic, VTPC_SHARED_MAGIC);
+  return 0;
+}
+
+int vtpc_shared_start(const struct vtpc_config* config) {
+  unmap();
+  if (config->shared == NULL) {
+    return 0;
+  }
+  const int fd =
+      shm_open(config->shared, O_RDWR | O_CREAT | O_CLOEXEC, 0600);  // NOLINT
+  if (fd == -1) {
+    return -1;
+  }
+  int result = -1;
+  while ((result = flock(fd, LOCK_EX)) == -1 && errno == EINTR) {
+  }
+  if (result == 0) {
+    result = attach(fd, config);
+  }
+  const int err = errno;
+  // The mapping holds the open file, so closing it alone would not unlock it.
+  (void)flock(fd, LOCK_UN);
+  close(fd);
+  errno = err;
+  return result;
+}
+
+static uint64_t hash_of(uint64_t dev, uint64_t ino, uint64_t index) {
+  return vtpc_hash_key(vtpc_hash_key(dev, ino), index);
+}
+
+static uint64_t key_hash(const struct vtpc_file* file, uint64_t index) {
+  return hash_of((uint64_t)file->dev, (uint64_t)file->ino, index);
+}
+
+static struct shared_shard* shard_of(uint64_t hash) {
+  return &shared.shards[(hash >> 32U) & shared.shard_mask];
+}
+
+static uint32_t* bucket_of(struct shared_shard* shard, uint64_t hash) {
+  return &buckets_of(shard)[hash & shared.bucket_mask];
+}
+
+static _Atomic uint32_t* version_of(uint64_t hash) {
+  const size_t shard = (size_t)((hash >> 32U) & shared.shard_mask);
+  const size_t bucket = (size_t)(hash & shared.bucket_mask);
+  return &shared.versions[(shard * (shared.bucket_mask + 1)) + bucket];
+}
+
+static char* data_of(const struct shared_slot* slot) {
+  return shared.data + ((size_t)(slot - shared.slots) * shared.block_size);
+}
+
+static struct shared_slot* find(
+    uint32_t* bucket, const struct vtpc_file* file, uint64_t index
+) {
+  for (uint32_t link = *bucket; link != 0;) {
+    struct shared_slot* slot = &shared.slots[link - 1];
+    if (slot->dev == (uint64_t)file->dev && slot->ino == (uint64_t)file->ino &&
+        slot->index == index) {
+      return slot;
+    }
+    link = slot->hash_next;
+  }
+  return NULL;
+}
+
+static void forget(struct shared_shard* shard, struct shared_slot* slot) {
+  uint32_t* link =
+      bucket_of(shard, hash_of(slot->dev, slot->ino, slot->index));
+  const uint32_t self = (uint32_t)(slot - shared.slots) + 1;
+  while (*link != self) {
+    link = &shared.slots[*link - 1].hash_next;
+  }
+  *link = slot->hash_next;
+  slot->used = false;
+}
+
+// Takes a slot of the shard, reclaiming one with CLOCK once every slot was
+// used.
+static struct shared_slot* take(struct shared_shard* shard) {
+  if (shard->filled < shard->capacity) {
+    return &shared.slots[shard->first + shard->filled++];
+  }
+  for (;;) {
+    struct shared_slot* slot = &shared.slots[shard->first + shard->hand];
+    shard->hand = (shard->hand + 1) % shard->capacity;
+    if (!slot->used) {
+      return slot;
+    }
+    if (slot->referenced) {
+      slot->referenced = false;
+      continue;
+    }
+    forget(shard, slot);
+    return slot;
+  }
+}
+
+bool vtpc_shared_get(
+    const struct vtpc_file* file, uint64_t index, char* data, uint64_t* epoch
+) {
+  if (shared.base == NULL) {
+    *epoch = 0;
+    return false;
+  }
+  const uint64_t hash = key_hash(file, index);
+  struct shared_shard* shard = shard_of(hash);
+  shard_lock(shard);
+  struct shared_slot* slot = find(bucket_of(shard, hash), file, index);
+  if (slot != NULL) {
+    memcpy(data, data_of(slot), shared.block_size);
+    slot->referenced = true;
+  } else {
+    *epoch = shard->epoch;
+  }
+  shard_unlock(shard);
+  return slot != NULL;
+}
+
+static void put(
+    struct shared_shard* shard,
+    uint64_t hash,
+    const struct vtpc_file* file,
+    uint64_t index,
+    const char* data,
+    uint64_t epoch
+) {
+  if (shard->epoch == epoch) {
+    uint32_t* bucket = bucket_of(shard, hash);
+    struct shared_slot* slot = find(bucket, file, index);
+    if (slot == NULL) {
+      slot = take(shard);
+      slot->dev = (uint64_t)file->dev;
+      slot->ino = (uint64_t)file->ino;
+      slot->index = index;
+      slot->used = true;
+      slot->referenced = false;
+      slot->hash_next = *bucket;
+      *bucket = (uint32_t)(slot - shared.slots) + 1;
+    }
+    memcpy(data_of(slot), data, shared.block_size);
+  }
+}
+
+void vtpc_shared_put(
+    const struct vtpc_file* file,
+    uint64_t index,
+    const char* data,
+    uint64_t epoch
+) {
+  if (shared.base == NULL) {
+    return;
+  }
+  const uint64_t hash = key_hash(file, index);
+  struct shared_shard* shard = shard_of(hash);
+  shard_lock(shard);
+  put(shard, hash, file, index, data, epoch);
+  shard_unlock(shard);
+}
+
+uint32_t vtpc_shared_written(
+    const struct vtpc_file* file,
+    uint64_t index,
+    const char* data,
+    uint64_t epoch
+) {
+  if (shared.base == NULL) {
+    return 0;
+  }
+  const uint64_t hash = key_hash(file, index);
+  struct shared_shard* shard = shard_of(hash);
+  shard_lock(shard);
+  put(shard, hash, file, index, data, epoch);
+  const uint32_t version = atomic_fetch_add(version_of(hash), 1) + 1;
+  shard_unlock(shard);
+  return version;
+}
+
+uint32_t vtpc_shared_version(const struct vtpc_file* file, uint64_t index) {
+  if (shared.base == NULL) {
+    return 0;
+  }
+  return atomic_load(version_of(key_hash(file, index)));
+}
+
+uint64_t vtpc_shared_forget(const struct vtpc_file* file, uint64_t index) {
+  if (shared.base == NULL) {
+    return 0;
+  }
+  const uint64_t hash = key_hash(file, index);
+  struct shared_shard* shard = shard_of(hash);
+  shard_lock(shard);
+  struct shared_slot* slot = find(bucket_of(shard, hash), file, index);
+  if (slot != NULL) {
+    forget(shard, slot);
+  }
+  const uint64_t epoch = ++shard->epoch;
+  shard_unlock(shard);
+  return epoch;
+}
+
+void vtpc_shared_forget_range(
+    const struct vtpc_file* file, uint64_t first, uint64_t last
+) {
+  if (shared.base == NULL || first > last) {
+    return;
+  }
+  if (last - first >= shared.capacity) {
+    for (size_t i = 0; i <= shared.shard_mask; ++i) {
+      struct shared_shard* shard = &shared.shards[i];
+      shard_lock(shard);
+      for (uint32_t j = 0; j < shard->filled; ++j) {
+        struct shared_slot* slot = &shared.slots[shard->first + j];
+        if (slot->used && slot->dev == (uint64_t)file->dev &&
+            slot->ino == (uint64_t)file->ino && slot->index >= first &&
+            slot->index <= last) {
+          forget(shard, slot);
+        }
+      }
+      shard->epoch++;
+      _Atomic uint32_t* versions =
+          shared.versions + (i * (shared.bucket_mask + 1));
+      for (size_t j = 0; j <= shared.bucket_mask; ++j) {
+        atomic_fetch_add(&versions[j], 1);
+      }
+      shard_unlock(shard);
+    }
+    return;
+  }
+  for (uint64_t index = first; index <= last; ++index) {
+    (void)vtpc_shared_forget(file, index);
+    atomic_fetch_add(version_of(key_hash(file, index)), 1);
+  }
+}
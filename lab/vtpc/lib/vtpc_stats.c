@@ -0,0 +1,354 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "vtpc_internal.h"
+
+// Every thread counts into its own block, so counting takes no lock and no
+// atomic read-modify-write: only the owner writes the counters, with a
+// relaxed load and store, and readers sum the blocks of all threads. The
+// block of an exiting thread is folded into `retired`.
+struct vtpc_counters {
+  _Atomic uint64_t values[VTPC_STAT_COUNTERS];
+  struct {
+    _Atomic uint64_t total_ns;
+    _Atomic uint64_t max_ns;
+    _Atomic uint64_t buckets[VTPC_LATENCY_BUCKETS];
+  } latency[VTPC_OPS];
+  struct vtpc_counters* prev;
+  struct vtpc_counters* next;
+};
+
+static struct {
+  // Guards the list of threads and `retired`.
+  pthread_mutex_t lock;
+  struct vtpc_counters* threads;
+  struct vtpc_counters retired;
+  pthread_once_t once;
+  pthread_key_t key;
+  int key_error;
+} stats = {.lock = PTHREAD_MUTEX_INITIALIZER, .once = PTHREAD_ONCE_INIT};
+
+static _Thread_local struct vtpc_counters* local;
+
+static void bump(_Atomic uint64_t* counter, uint64_t n) {
+  atomic_store_explicit(
+      counter,
+      atomic_load_explicit(counter, memory_order_relaxed) + n,
+      memory_order_relaxed
+  );
+}
+
+static uint64_t get(_Atomic uint64_t* counter) {
+  return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+static void set(_Atomic uint64_t* counter, uint64_t value) {
+  atomic_store_explicit(counter, value, memory_order_relaxed);
+}
+
+// Called with `stats.lock` held.
+static void fold(struct vtpc_counters* into, struct vtpc_counters* from) {
+  for (size_t i = 0; i < VTPC_STAT_COUNTERS; ++i) {
+    bump(&into->values[i], get(&from->values[i]));
+  }
+  for (size_t op = 0; op < VTPC_OPS; ++op) {
+    bump(&into->latency[op].total_ns, get(&from->latency[op].total_ns));
+    const uint64_t max = get(&from->latency[op].max_ns);
+    if (max > get(&into->latency[op].max_ns)) {
+      set(&into->latency[op].max_ns, max);
+    }
+    for (size_t i = 0; i < VTPC_LATENCY_BUCKETS; ++i) {
+      bump(
+          &into->latency[op].buckets[i], get(&from->latency[op].buckets[i])
+      );
+    }
+  }
+}
+
+static void thread_exit(void* arg) {
+  struct vtpc_counters* counters = arg;
+  pthread_mutex_lock(&stats.lock);
+  fold(&stats.retired, counters);
+  if (counters->prev != NULL) {
+    counters->prev->next = counters->next;
+  } else {
+    stats.threads = counters->next;
+  }
+  if (counters->next != NULL) {
+    counters->next->prev = counters->prev;
+  }
+  pthread_mutex_unlock(&stats.lock);
+  free(counters);
+  local = NULL;
+}
+
+static void key_init(void) {
+  stats.key_error = pthread_key_create(&stats.key, thread_exit);
+}
+
+static struct vtpc_counters* counters_create(void) {
+  pthread_once(&stats.once, key_init);
+  if (stats.key_error != 0) {
+    return NULL;
+  }
+  struct vtpc_counters* counters = calloc(1, sizeof(struct vtpc_counters));
+  if (counters == NULL) {
+    return NULL;
+  }
+  if (pthread_setspecific(stats.key, counters) != 0) {
+    free(counters);
+    return NULL;
+  }
+  pthread_mutex_lock(&stats.lock);
+  counters->next = stats.threads;
+  if (stats.threads != NULL) {
+    stats.threads->prev = counters;
+  }
+  stats.threads = counters;
+  pthread_mutex_unlock(&stats.lock);
+  return counters;
+}
+
+// Returns the counters of the calling thread, or NULL when they cannot be
+// allocated, in which case its events go uncounted. Keeps errno, as failed
+// calls are counted too.
+static struct vtpc_counters* counters_local(void) {
+  if (local == NULL) {
+    const int err = errno;
+    local = counters_create();
+    errno = err;
+  }
+  return local;
+}
+
+void vtpc_stat_add(enum vtpc_counter counter, uint64_t n) {
+  struct vtpc_counters* counters = counters_local();
+  if (counters != NULL) {
+    bump(&counters->values[counter], n);
+  }
+}
+
+// Four buckets per power of two: below 4 a bucket per value, then the two
+// bits after the leading one pick the quarter of the octave.
+size_t vtpc_stat_bucket(uint64_t value) {
+  if (value < 4) {
+    return (size_t)value;
+  }
+  const unsigned exp = 63U - (unsigned)__builtin_clzll(value);
+  return (4 * (exp - 1)) + (size_t)((value >> (exp - 2)) & 3U);
+}
+
+uint64_t vtpc_stat_bucket_start(size_t i) {
+  if (i < 4) {
+    return i;
+  }
+  return (uint64_t)(4 + (i % 4)) << ((i / 4) - 1);
+}
+
+void vtpc_stat_latency(enum vtpc_op op, uint64_t start) {
+  struct vtpc_counters* counters = counters_local();
+  if (counters == NULL) {
+    return;
+  }
+  const uint64_t now = vtpc_now_ns();
+  const uint64_t ns = now > start ? now - start : 0;
+  bump(&counters->latency[op].total_ns, ns);
+  if (ns > get(&counters->latency[op].max_ns)) {
+    set(&counters->latency[op].max_ns, ns);
+  }
+  bump(&counters->latency[op].buckets[vtpc_stat_bucket(ns)], 1);
+}
+
+// The last latency of the bucket holding the `rank`-th smallest one,
+// bounded by the largest seen.
+static uint64_t percentile(const struct vtpc_latency* latency, uint64_t rank) {
+  uint64_t seen = 0;
+  for (size_t i = 0; i < VTPC_LATENCY_BUCKETS; ++i) {
+    seen += latency->buckets[i];
+    if (seen > rank) {
+      const uint64_t last = i + 1 < VTPC_LATENCY_BUCKETS
+                                ? vtpc_stat_bucket_start(i + 1) - 1
+                                : UINT64_MAX;
+      return last < latency->max_ns ? last : latency->max_ns;
+    }
+  }
+  return latency->max_ns;
+}
+
+static void latency_summarize(struct vtpc_latency* latency) {
+  latency->count = 0;
+  for (size_t i = 0; i < VTPC_LATENCY_BUCKETS; ++i) {
+    latency->count += latency->buckets[i];
+  }
+  if (latency->count == 0) {
+    return;
+  }
+  latency->p50_ns = percentile(latency, latency->count / 2);
+  latency->p99_ns = percentile(latency, latency->count * 99 / 100);
+  latency->p999_ns = percentile(latency, latency->count * 999 / 1000);
+}
+
+void vtpc_stats(struct vtpc_stats* out) {
+  struct vtpc_counters sum;
+  memset(&sum, 0, sizeof(sum));
+  pthread_mutex_lock(&stats.lock);
+  fold(&sum, &stats.retired);
+  for (struct vtpc_counters* counters = stats.threads; counters != NULL;
+       counters = counters->next) {
+    fold(&sum, counters);
+  }
+  pthread_mutex_unlock(&stats.lock);
+
+  memset(out, 0, sizeof(*out));
+  out->hits = get(&sum.values[VTPC_STAT_HITS]);
+  out->misses = get(&sum.values[VTPC_STAT_MISSES]);
+  out->evictions = get(&sum.values[VTPC_STAT_EVICTIONS]);
+  out->writebacks = get(&sum.values[VTPC_STAT_WRITEBACKS]);
+  out->foreground_writebacks =
+      get(&sum.values[VTPC_STAT_FOREGROUND_WRITEBACKS]);
+  out->readahead_blocks = get(&sum.values[VTPC_STAT_READAHEAD_BLOCKS]);
+  out->readahead_hits = get(&sum.values[VTPC_STAT_READAHEAD_HITS]);
+  out->readahead_wasted = get(&sum.values[VTPC_STAT_READAHEAD_WASTED]);
+  out->disk_read_bytes = get(&sum.values[VTPC_STAT_DISK_READ_BYTES]);
+  out->disk_write_bytes = get(&sum.values[VTPC_STAT_DISK_WRITE_BYTES]);
+  out->shared_hits = get(&sum.values[VTPC_STAT_SHARED_HITS]);
+  out->warm_blocks = get(&sum.values[VTPC_STAT_WARM_BLOCKS]);
+  for (size_t op = 0; op < VTPC_OPS; ++op) {
+    struct vtpc_latency* latency = &out->latency[op];
+    latency->total_ns = get(&sum.latency[op].total_ns);
+    latency->max_ns = get(&sum.latency[op].max_ns);
+    for (size_t i = 0; i < VTPC_LATENCY_BUCKETS; ++i) {
+      latency->buckets[i] = get(&sum.latency[op].buckets[i]);
+    }
+    latency_summarize(latency);
+  }
+  vtpc_mrc_get(&out->mrc);
+  vtpc_cache_pool_stats(out);
+}
+
+static void zero(struct vtpc_counters* counters) {
+  for (size_t i = 0; i < VTPC_STAT_COUNTERS; ++i) {
+    set(&counters->values[i], 0);
+  }
+  for (size_t op = 0; op < VTPC_OPS; ++op) {
+    set(&counters->latency[op].total_ns, 0);
+    set(&counters->latency[op].max_ns, 0);
+    for (size_t i = 0; i < VTPC_LATENCY_BUCKETS; ++i) {
+      set(&counters->latency[op].buckets[i], 0);
+    }
+  }
+}
+
+void vtpc_stats_reset(void) {
+  pthread_mutex_lock(&stats.lock);
+  zero(&stats.retired);
+  for (struct vtpc_counters* counters = stats.threads; counters != NULL;
+       counters = counters->next) {
+    zero(counters);
+  }
+  pthread_mutex_unlock(&stats.lock);
+  vtpc_mrc_reset();
+}
+
+static int write_all(int fd, const char* buf, size_t count) {
+  while (count > 0) {
+    const ssize_t n = write(fd, buf, count);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return -1;
+    }
+    buf += n;
+    count -= (size_t)n;
+  }
+  return 0;
+}
+
+int vtpc_stats_dump(int fd) {
+  static const char* const names[VTPC_OPS] = {"read", "write", "fsync", "miss"};
+  static const char* const backings[] = {"pages", "thp", "hugetlb"};
+
+  struct vtpc_stats all;
+  vtpc_stats(&all);
+  const struct vtpc_stats* s = &all;
+
+  char text[2048];
+  int len = snprintf(
+      text,
+      sizeof(text),
+      "vtpc: hits=%llu misses=%llu evictions=%llu writebacks=%llu "
+      "foreground_writebacks=%llu\n"
+      "vtpc: readahead_blocks=%llu readahead_hits=%llu "
+      "readahead_wasted=%llu\n"
+      "vtpc: disk_read_bytes=%llu disk_write_bytes=%llu shared_hits=%llu "
+      "warm_blocks=%llu\n"
+      "vtpc: pool_blocks=%llu pool_bytes=%llu pool_retained_bytes=%llu "
+      "pool_backing=%s pool_locked=%u\n",
+      (unsigned long long)s->hits,
+      (unsigned long long)s->misses,
+      (unsigned long long)s->evictions,
+      (unsigned long long)s->writebacks,
+      (unsigned long long)s->foreground_writebacks,
+      (unsigned long long)s->readahead_blocks,
+      (unsigned long long)s->readahead_hits,
+      (unsigned long long)s->readahead_wasted,
+      (unsigned long long)s->disk_read_bytes,
+      (unsigned long long)s->disk_write_bytes,
+      (unsigned long long)s->shared_hits,
+      (unsigned long long)s->warm_blocks,
+      (unsigned long long)s->pool_blocks,
+      (unsigned long long)s->pool_bytes,
+      (unsigned long long)s->pool_retained_bytes,
+      backings[s->pool_backing],
+      s->pool_locked
+  );
+  for (size_t op = 0; op < VTPC_OPS; ++op) {
+    const struct vtpc_latency* latency = &s->latency[op];
+    const uint64_t avg =
+        latency->count == 0 ? 0 : latency->total_ns / latency->count;
+    len += snprintf(
+        text + len,
+        sizeof(text) - (size_t)len,
+        "vtpc: %s count=%llu avg_ns=%llu p50_ns=%llu p99_ns=%llu "
+        "p999_ns=%llu max_ns=%llu\n",
+        names[op],
+        (unsigned long long)latency->count,
+        (unsigned long long)avg,
+        (unsigned long long)latency->p50_ns,
+        (unsigned long long)latency->p99_ns,
+        (unsigned long long)latency->p999_ns,
+        (unsigned long long)latency->max_ns
+    );
+  }
+  const struct vtpc_mrc* mrc = &s->mrc;
+  if (mrc->rate != 0) {
+    len += snprintf(
+        text + len,
+        sizeof(text) - (size_t)len,
+        "vtpc: mrc rate=1/%llu sampled=%llu cold=%llu\n",
+        (unsigned long long)mrc->rate,
+        (unsigned long long)mrc->sampled,
+        (unsigned long long)mrc->cold
+    );
+    for (size_t i = 0; i < VTPC_MRC_POINTS; ++i) {
+      len += snprintf(
+          text + len,
+          sizeof(text) - (size_t)len,
+          "vtpc: mrc blocks=%llu miss_ratio=%u.%03u\n",
+          (unsigned long long)mrc->blocks[i],
+          mrc->miss_permille[i] / 1000,
+          mrc->miss_permille[i] % 1000
+      );
+    }
+  }
+  return write_all(fd, text, (size_t)len);
+}
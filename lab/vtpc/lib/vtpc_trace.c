@@ -0,0 +1,110 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "vtpc_internal.h"
+
+// Records are buffered under one lock, which keeps them in time order, and
+// written out whenever the buffer fills up. Tracing is best effort: it stops
+// at the first failed write.
+#define VTPC_TRACE_BUFFER 1024
+
+static struct {
+  pthread_mutex_t lock;
+  atomic_bool active;
+  int fd;
+  off_t written;
+  size_t count;
+  struct vtpc_trace_record records[VTPC_TRACE_BUFFER];
+} trace = {.lock = PTHREAD_MUTEX_INITIALIZER, .fd = -1};
+
+// Called with `trace.lock` held.
+static void flush(void) {
+  if (trace.fd == -1 || trace.count == 0) {
+    return;
+  }
+  const size_t bytes = trace.count * sizeof(struct vtpc_trace_record);
+  if (vtpc_pwrite_full(trace.fd, trace.records, bytes, trace.written) ==
+      -1) {
+    atomic_store(&trace.active, false);
+    close(trace.fd);
+    trace.fd = -1;
+  } else {
+    trace.written += (off_t)bytes;
+  }
+  trace.count = 0;
+}
+
+// Called with `trace.lock` held.
+static void stop(void) {
+  atomic_store(&trace.active, false);
+  flush();
+  if (trace.fd != -1) {
+    close(trace.fd);
+    trace.fd = -1;
+  }
+}
+
+int vtpc_trace_start(const struct vtpc_config* config) {
+  pthread_mutex_lock(&trace.lock);
+  stop();
+  int result = 0;
+  if (config->trace != NULL) {
+    trace.fd = open(
+        config->trace, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644
+    );  // NOLINT
+    if (trace.fd == -1) {
+      result = -1;
+    } else {
+      trace.written = 0;
+      atomic_store(&trace.active, true);
+    }
+  }
+  pthread_mutex_unlock(&trace.lock);
+  return result;
+}
+
+void vtpc_trace_stop(void) {
+  pthread_mutex_lock(&trace.lock);
+  stop();
+  pthread_mutex_unlock(&trace.lock);
+}
+
+void vtpc_trace(
+    enum vtpc_trace_op op, int fd, uint64_t file, off_t offset, size_t length
+) {
+  if (!atomic_load_explicit(&trace.active, memory_order_relaxed)) {
+    return;
+  }
+  const int err = errno;
+  const uint64_t now = vtpc_now_ns();
+  pthread_mutex_lock(&trace.lock);
+  // Lengths past 32 bits take several records.
+  do {
+    if (trace.fd == -1) {
+      break;
+    }
+    const uint32_t part = length > UINT32_MAX ? UINT32_MAX : (uint32_t)length;
+    trace.records[trace.count++] = (struct vtpc_trace_record){
+        .time_ns = now,
+        .offset = (uint64_t)offset,
+        .length = part,
+        .fd = fd,
+        .file = (uint32_t)file,
+        .op = (uint32_t)op,
+    };
+    if (trace.count == VTPC_TRACE_BUFFER) {
+      flush();
+    }
+    offset += (off_t)part;
+    length -= part;
+  } while (length > 0);
+  pthread_mutex_unlock(&trace.lock);
+  errno = err;
+}
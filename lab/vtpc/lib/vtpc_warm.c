@@ -0,0 +1,324 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "vtpc_internal.h"
+
+// A warm-start manifest lists the resident blocks of a file, hottest first,
+// as of its last close. It is keyed by device and inode, and only used while
+// the size and mtime of the file are those it was recorded with, as the
+// cache was flushed then. Its blocks are loaded by a thread of their own in
+// batches of the next hottest, each read in index order, and only into free
+// blocks, so that they never push out what the program already uses. Heat
+// halves with every run, so blocks left cold fade out of the manifests.
+#define VTPC_WARM_MAGIC 0x6D72617763707476ULL  // "vtpcwarm"
+#define VTPC_WARM_VERSION 1
+#define VTPC_WARM_BATCH 64
+
+struct manifest {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t block_size;
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t size;
+  uint64_t mtime_ns;
+  uint64_t count;
+};
+
+struct entry {
+  uint64_t index;
+  uint32_t heat;
+  uint32_t reserved;
+};
+
+struct loader {
+  struct vtpc_file* file;
+  struct vtpc_heat* blocks;
+  size_t count;
+};
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t done;  // Broadcast when a loader finishes.
+  char dir[PATH_MAX];   // Empty if disabled.
+  size_t block_size;
+} warm = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+static uint64_t mtime_of(const struct stat* st) {
+  return (uint64_t)st->st_mtim.tv_sec * VTPC_NS_PER_SEC +
+         (uint64_t)st->st_mtim.tv_nsec;
+}
+
+// Fails with EINVAL if disabled, and with ENAMETOOLONG if the path does not
+// fit.
+static bool path_of(const struct vtpc_file* file, char* path, size_t size) {
+  pthread_mutex_lock(&warm.lock);
+  const bool enabled = warm.dir[0] != '\0';
+  int n = 0;
+  if (enabled) {
+    n = snprintf(
+        path, size, "%s/%llx-%llx.warm", warm.dir,
+        (unsigned long long)file->dev, (unsigned long long)file->ino
+    );
+  }
+  pthread_mutex_unlock(&warm.lock);
+  if (!enabled) {
+    errno = EINVAL;
+    return false;
+  }
+  if (n < 0 || (size_t)n >= size) {
+    errno = ENAMETOOLONG;
+    return false;
+  }
+  return true;
+}
+
+int vtpc_warm_start(const struct vtpc_config* config) {
+  if (config->warm != NULL && strlen(config->warm) + 64 > PATH_MAX) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  if (config->warm != NULL && mkdir(config->warm, 0700) == -1 &&
+      errno != EEXIST) {
+    return -1;
+  }
+  pthread_mutex_lock(&warm.lock);
+  snprintf(
+      warm.dir, sizeof(warm.dir), "%s",
+      config->warm == NULL ? "" : config->warm
+  );
+  warm.block_size = config->block_size;
+  pthread_mutex_unlock(&warm.lock);
+  return 0;
+}
+
+// Hottest first, and the most recent first among equally hot ones.
+static int by_heat(const void* a, const void* b) {
+  const struct vtpc_heat* x = a;
+  const struct vtpc_heat* y = b;
+  if (x->heat != y->heat) {
+    return x->heat < y->heat ? 1 : -1;
+  }
+  return (x->touched < y->touched) - (x->touched > y->touched);
+}
+
+static int by_index(const void* a, const void* b) {
+  const struct vtpc_heat* x = a;
+  const struct vtpc_heat* y = b;
+  return (x->index > y->index) - (x->index < y->index);
+}
+
+static int write_manifest(
+    const char* path,
+    const struct manifest* header,
+    const struct vtpc_heat* blocks
+) {
+  char tmp[PATH_MAX + 32];
+  snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+  const int fd =
+      open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);  // NOLINT
+  if (fd == -1) {
+    return -1;
+  }
+  const size_t bytes = header->count * sizeof(struct entry);
+  struct entry* entries = malloc(bytes == 0 ? 1 : bytes);
+  int result = -1;
+  if (entries == NULL) {
+    errno = ENOMEM;
+  } else {
+    for (size_t i = 0; i < header->count; ++i) {
+      entries[i] = (struct entry){
+          .index = blocks[i].index,
+          .heat = blocks[i].heat,
+      };
+    }
+    if (vtpc_pwrite_full(fd, header, sizeof(*header), 0) != -1 &&
+        vtpc_pwrite_full(fd, entries, bytes, sizeof(*header)) != -1) {
+      result = 0;
+    }
+    free(entries);
+  }
+  const int err = errno;
+  if (close(fd) == -1 && result == 0) {
+    result = -1;
+  }
+  if (result == 0 && rename(tmp, path) == -1) {
+    result = -1;
+  }
+  if (result == -1) {
+    (void)unlink(tmp);
+    errno = err;
+  }
+  return result;
+}
+
+int vtpc_warm_record(struct vtpc_file* file) {
+  char path[PATH_MAX];
+  if (!path_of(file, path, sizeof(path))) {
+    return -1;
+  }
+  struct stat st;
+  if (fstat(file->fd, &st) == -1) {
+    return -1;
+  }
+  const size_t max = vtpc_cache_active();
+  struct vtpc_heat* blocks = calloc(max == 0 ? 1 : max, sizeof(*blocks));
+  if (blocks == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+  const size_t count = vtpc_cache_resident(file, blocks, max);
+  int result = 0;
+  if (count == 0) {
+    if (unlink(path) == -1 && errno != ENOENT) {
+      result = -1;
+    }
+  } else {
+    qsort(blocks, count, sizeof(*blocks), by_heat);
+    const struct manifest header = {
+        .magic = VTPC_WARM_MAGIC,
+        .version = VTPC_WARM_VERSION,
+        .block_size = warm.block_size,
+        .dev = (uint64_t)st.st_dev,
+        .ino = (uint64_t)st.st_ino,
+        .size = (uint64_t)st.st_size,
+        .mtime_ns = mtime_of(&st),
+        .count = count,
+    };
+    result = write_manifest(path, &header, blocks);
+  }
+  free(blocks);
+  return result;
+}
+
+static void* loader_main(void* arg) {
+  struct loader* loader = arg;
+  struct vtpc_file* file = loader->file;
+  for (size_t first = 0; first < loader->count; first += VTPC_WARM_BATCH) {
+    pthread_mutex_lock(&warm.lock);
+    const bool cancelled = file->warm_cancel;
+    pthread_mutex_unlock(&warm.lock);
+    if (cancelled) {
+      break;
+    }
+    size_t count = loader->count - first;
+    if (count > VTPC_WARM_BATCH) {
+      count = VTPC_WARM_BATCH;
+    }
+    struct vtpc_heat* batch = &loader->blocks[first];
+    qsort(batch, count, sizeof(*batch), by_index);
+    const size_t taken = vtpc_cache_prefetch_blocks(file, batch, count);
+    vtpc_stat_add(VTPC_STAT_WARM_BLOCKS, taken);
+  }
+  pthread_mutex_lock(&warm.lock);
+  file->warming = false;
+  pthread_cond_broadcast(&warm.done);
+  pthread_mutex_unlock(&warm.lock);
+  free(loader->blocks);
+  free(loader);
+  return NULL;
+}
+
+// Reads the blocks of a manifest matching the file, at most `max` of them.
+// Returns NULL if there is none; a stale one is removed.
+static struct vtpc_heat* read_manifest(
+    const char* path, const struct stat* st, size_t max, size_t* count
+) {
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return NULL;
+  }
+  struct manifest header;
+  struct vtpc_heat* blocks = NULL;
+  if (vtpc_pread_full(fd, &header, sizeof(header), 0) !=
+          (ssize_t)sizeof(header) ||
+      header.magic != VTPC_WARM_MAGIC || header.version != VTPC_WARM_VERSION ||
+      header.block_size != warm.block_size ||
+      header.dev != (uint64_t)st->st_dev ||
+      header.ino != (uint64_t)st->st_ino ||
+      header.size != (uint64_t)st->st_size ||
+      header.mtime_ns != mtime_of(st)) {
+    close(fd);
+    (void)unlink(path);
+    return NULL;
+  }
+  *count = header.count < max ? (size_t)header.count : max;
+  struct entry* entries = calloc(*count == 0 ? 1 : *count, sizeof(*entries));
+  blocks = calloc(*count == 0 ? 1 : *count, sizeof(*blocks));
+  const size_t bytes = *count * sizeof(*entries);
+  if (entries == NULL || blocks == NULL ||
+      vtpc_pread_full(fd, entries, bytes, sizeof(header)) != (ssize_t)bytes) {
+    free(blocks);
+    blocks = NULL;
+  } else {
+    for (size_t i = 0; i < *count; ++i) {
+      blocks[i] = (struct vtpc_heat){
+          .index = entries[i].index,
+          .heat = entries[i].heat / 2,
+      };
+    }
+  }
+  free(entries);
+  close(fd);
+  return blocks;
+}
+
+void vtpc_warm_load(struct vtpc_file* file, const struct stat* st) {
+  char path[PATH_MAX];
+  if (!path_of(file, path, sizeof(path))) {
+    return;
+  }
+  size_t count = 0;
+  struct vtpc_heat* blocks =
+      read_manifest(path, st, vtpc_cache_active(), &count);
+  struct loader* loader = malloc(sizeof(*loader));
+  if (blocks == NULL || count == 0 || loader == NULL) {
+    free(blocks);
+    free(loader);
+    return;
+  }
+  *loader = (struct loader){.file = file, .blocks = blocks, .count = count};
+
+  pthread_mutex_lock(&warm.lock);
+  file->warming = true;
+  file->warm_cancel = false;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_t thread;
+  if (pthread_create(&thread, &attr, loader_main, loader) != 0) {
+    file->warming = false;
+    free(blocks);
+    free(loader);
+  }
+  pthread_attr_destroy(&attr);
+  pthread_mutex_unlock(&warm.lock);
+}
+
+void vtpc_warm_cancel(struct vtpc_file* file) {
+  pthread_mutex_lock(&warm.lock);
+  if (file->warming) {
+    file->warm_cancel = true;
+  }
+  while (file->warming) {
+    pthread_cond_wait(&warm.done, &warm.lock);
+  }
+  pthread_mutex_unlock(&warm.lock);
+}
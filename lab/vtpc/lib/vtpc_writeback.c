@@ -0,0 +1,579 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vtpc_internal.h"
+
+// UIO_MAXIOV, the iovec limit of a single pwritev on Linux.
+#define VTPC_FLUSH_BATCH 1024
+#define VTPC_FLUSHER_TICK_NS (100 * 1000 * 1000ULL)
+
+static struct {
+  // Guards the dirty lists and the write-back state of the files.
+  pthread_mutex_t lock;
+
+  // Every dirty block, oldest first.
+  struct vtpc_block* oldest;
+  struct vtpc_block* newest;
+  size_t dirty;
+
+  size_t high;
+  size_t low;
+  size_t high_percent;
+  size_t low_percent;
+  uint64_t expire_ns;
+  size_t batch;
+  bool active;
+
+  // A flusher thread runs while `generation` is the one it was started
+  // with, so restarting never has to join it under the lock.
+  bool running;
+  uint64_t generation;
+  pthread_cond_t wake;
+  pthread_cond_t idle;
+  bool conds_ready;
+} wb = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// A dirty block cannot be reused before it is cleaned, which takes the
+// write-back lock, so its key is stable while it is on the lists.
+static void link_dirty(struct vtpc_block* block) {
+  struct vtpc_file* file = block->file;
+  block->dirtied_at = vtpc_now_ns();
+
+  block->dirty_next = NULL;
+  block->dirty_prev = file->dirty_tail;
+  if (file->dirty_tail != NULL) {
+    file->dirty_tail->dirty_next = block;
+  } else {
+    file->dirty = block;
+  }
+  file->dirty_tail = block;
+  file->dirty_count++;
+
+  block->age_next = NULL;
+  block->age_prev = wb.newest;
+  if (wb.newest != NULL) {
+    wb.newest->age_next = block;
+  } else {
+    wb.oldest = block;
+  }
+  wb.newest = block;
+  wb.dirty++;
+
+  if (wb.running && !wb.active && wb.dirty >= wb.high) {
+    pthread_cond_signal(&wb.wake);
+  }
+}
+
+static void unlink_dirty(struct vtpc_block* block) {
+  struct vtpc_file* file = block->file;
+  if (block->dirty_prev != NULL) {
+    block->dirty_prev->dirty_next = block->dirty_next;
+  } else {
+    file->dirty = block->dirty_next;
+  }
+  if (block->dirty_next != NULL) {
+    block->dirty_next->dirty_prev = block->dirty_prev;
+  } else {
+    file->dirty_tail = block->dirty_prev;
+  }
+  file->dirty_count--;
+
+  if (block->age_prev != NULL) {
+    block->age_prev->age_next = block->age_next;
+  } else {
+    wb.oldest = block->age_next;
+  }
+  if (block->age_next != NULL) {
+    block->age_next->age_prev = block->age_prev;
+  } else {
+    wb.newest = block->age_prev;
+  }
+  wb.dirty--;
+
+  block->dirty_prev = NULL;
+  block->dirty_next = NULL;
+  block->age_prev = NULL;
+  block->age_next = NULL;
+}
+
+void vtpc_block_dirty(struct vtpc_block* block) {
+  if ((block->flags & VTPC_BLOCK_DIRTY) != 0) {
+    return;
+  }
+  block->flags |= VTPC_BLOCK_DIRTY;
+  pthread_mutex_lock(&wb.lock);
+  link_dirty(block);
+  pthread_mutex_unlock(&wb.lock);
+}
+
+void vtpc_block_clean(struct vtpc_block* block) {
+  pthread_mutex_lock(&wb.lock);
+  unlink_dirty(block);
+  pthread_mutex_unlock(&wb.lock);
+  block->flags &= ~(uint32_t)VTPC_BLOCK_DIRTY;
+}
+
+// Called with the write-back lock held.
+static void written(struct vtpc_file* file, off_t end) {
+  if (end > atomic_load(&file->disk_size)) {
+    atomic_store(&file->disk_size, end);
+  }
+}
+
+static void done(struct vtpc_file* file) {
+  file->writeback--;
+  pthread_cond_broadcast(&wb.idle);
+}
+
+// Whole blocks are written, so the last one may leave the file longer than
+// its logical size. Evictions do not trim, as they run without `write_lock`;
+// the next flush does.
+static int trim(struct vtpc_file* file) {
+  const off_t size = atomic_load(&file->size);
+  if (atomic_load(&file->disk_size) <= size) {
+    return 0;
+  }
+  if (ftruncate(file->fd, size) == -1) {
+    return -1;
+  }
+  const size_t block_size = vtpc_cache_block_size();
+  vtpc_shared_forget_range(
+      file,
+      ((uint64_t)size + block_size - 1) / block_size,
+      ((uint64_t)atomic_load(&file->disk_size) - 1) / block_size
+  );
+  pthread_mutex_lock(&wb.lock);
+  atomic_store(&file->disk_size, size);
+  pthread_mutex_unlock(&wb.lock);
+  return 0;
+}
+
+int vtpc_writeback_block(struct vtpc_block* block) {
+  struct vtpc_file* file = block->file;
+  const size_t block_size = vtpc_cache_block_size();
+  const off_t offset = (off_t)(block->index * block_size);
+
+  pthread_mutex_lock(&wb.lock);
+  unlink_dirty(block);
+  file->writeback++;
+  pthread_mutex_unlock(&wb.lock);
+  block->flags &= ~(uint32_t)VTPC_BLOCK_DIRTY;
+
+  const uint64_t epoch = vtpc_shared_forget(file, block->index);
+  struct iovec iov = {.iov_base = block->data, .iov_len = block_size};
+  struct vtpc_io op = {
+      .fd = file->fd, .write = true, .offset = offset, .iov = &iov, .iovcnt = 1
+  };
+  vtpc_io_run(&op, 1);
+  const ssize_t n = op.result;
+  const int err = op.error;
+  if (n >= 0) {
+    block->version =
+        vtpc_shared_written(file, block->index, block->data, epoch);
+  }
+
+  pthread_mutex_lock(&wb.lock);
+  if (n < 0) {
+    block->flags |= VTPC_BLOCK_DIRTY;
+    link_dirty(block);
+  } else {
+    written(file, offset + (off_t)block_size);
+    vtpc_stat_add(VTPC_STAT_WRITEBACKS, 1);
+    vtpc_stat_add(VTPC_STAT_FOREGROUND_WRITEBACKS, 1);
+    vtpc_stat_add(VTPC_STAT_DISK_WRITE_BYTES, block_size);
+  }
+  done(file);
+  pthread_mutex_unlock(&wb.lock);
+  errno = err;
+  return n < 0 ? -1 : 0;
+}
+
+struct claim {
+  struct vtpc_block* block;
+  uint64_t index;
+  uint64_t epoch;  // Of the shared segment, taken before the write.
+  uint32_t version;  // In the shared segment, once written.
+  bool failed;
+};
+
+static int by_index(const void* lhs, const void* rhs) {
+  const struct claim* a = lhs;
+  const struct claim* b = rhs;
+  return (a->index > b->index) - (a->index < b->index);
+}
+
+static size_t run_length(const struct claim* claims, size_t count) {
+  size_t end = 1;
+  while (end < count && end < VTPC_FLUSH_BATCH &&
+         claims[end].index == claims[end - 1].index + 1) {
+    end++;
+  }
+  return end;
+}
+
+// Records up to `limit` dirty blocks of the file in [first, last], oldest
+// first. Called with the write-back lock held.
+static struct claim* snapshot(
+    struct vtpc_file* file,
+    size_t limit,
+    uint64_t first,
+    uint64_t last,
+    size_t* count
+) {
+  if (limit > file->dirty_count) {
+    limit = file->dirty_count;
+  }
+  struct claim* claims = malloc((limit + 1) * sizeof(struct claim));
+  if (claims == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  *count = 0;
+  for (struct vtpc_block* block = file->dirty; block != NULL && *count < limit;
+       block = block->dirty_next) {
+    if (block->index >= first && block->index <= last) {
+      claims[(*count)++] =
+          (struct claim){.block = block, .index = block->index};
+    }
+  }
+  return claims;
+}
+
+// Keeps the recorded blocks that are still dirty, checked under their shard
+// locks: cleans them and marks them under writeback. Sorts them by index.
+static void claim(struct vtpc_file* file, struct claim* claims, size_t* count) {
+  size_t taken = 0;
+  for (size_t i = 0; i < *count; ++i) {
+    struct vtpc_block* block = claims[i].block;
+    vtpc_block_lock(block);
+    if (block->file == file && block->index == claims[i].index &&
+        (block->flags & VTPC_BLOCK_DIRTY) != 0) {
+      vtpc_block_clean(block);
+      block->flags |= VTPC_BLOCK_WRITEBACK;
+      claims[taken++] = claims[i];
+    }
+    vtpc_block_unlock(block);
+  }
+  *count = taken;
+  qsort(claims, taken, sizeof(struct claim), by_index);
+}
+
+// Writes the claimed blocks in runs of adjacent ones, one pwritev each and
+// all of them in flight at once, and ends their writeback; the failed ones
+// are dirtied again. Runs with no lock held while writing: the blocks are
+// under writeback, so nobody modifies or evicts them. Returns the error of
+// the last failed run, or 0.
+static int write_claimed(
+    struct vtpc_file* file, struct claim* claims, size_t count
+) {
+  const size_t block_size = vtpc_cache_block_size();
+  int error = 0;
+  struct iovec* iov = malloc((count + 1) * sizeof(struct iovec));
+  struct vtpc_io* ops = malloc((count + 1) * sizeof(struct vtpc_io));
+  if (iov == NULL || ops == NULL) {
+    error = ENOMEM;
+    for (size_t i = 0; i < count; ++i) {
+      claims[i].failed = true;
+    }
+  } else {
+    size_t runs = 0;
+    for (size_t start = 0; start < count;) {
+      const size_t len = run_length(claims + start, count - start);
+      for (size_t i = start; i < start + len; ++i) {
+        iov[i].iov_base = claims[i].block->data;
+        iov[i].iov_len = block_size;
+        claims[i].epoch = vtpc_shared_forget(file, claims[i].index);
+      }
+      ops[runs++] = (struct vtpc_io){
+          .fd = file->fd,
+          .write = true,
+          .offset = (off_t)(claims[start].index * block_size),
+          .iov = &iov[start],
+          .iovcnt = (int)len,
+      };
+      start += len;
+    }
+    vtpc_io_run(ops, runs);
+
+    for (size_t start = 0, run = 0; start < count; ++run) {
+      const size_t len = run_length(claims + start, count - start);
+      for (size_t i = start; i < start + len; ++i) {
+        if (ops[run].result < 0) {
+          claims[i].failed = true;
+        } else {
+          claims[i].version = vtpc_shared_written(
+              file, claims[i].index, claims[i].block->data, claims[i].epoch
+          );
+        }
+      }
+      if (ops[run].result < 0) {
+        error = ops[run].error;
+      } else {
+        vtpc_stat_add(VTPC_STAT_WRITEBACKS, len);
+        vtpc_stat_add(VTPC_STAT_DISK_WRITE_BYTES, len * block_size);
+      }
+      start += len;
+    }
+  }
+  free(iov);
+  free(ops);
+
+  off_t end = 0;
+  for (size_t i = 0; i < count; ++i) {
+    struct vtpc_block* block = claims[i].block;
+    vtpc_block_lock(block);
+    block->flags &= ~(uint32_t)VTPC_BLOCK_WRITEBACK;
+    if (claims[i].failed) {
+      vtpc_block_dirty(block);
+    } else {
+      block->version = claims[i].version;
+      end = (off_t)((claims[i].index + 1) * block_size);
+    }
+    vtpc_block_wake(block);
+    vtpc_block_unlock(block);
+  }
+  pthread_mutex_lock(&wb.lock);
+  written(file, end);
+  pthread_mutex_unlock(&wb.lock);
+  return error;
+}
+
+void vtpc_writeback_wait(struct vtpc_file* file) {
+  pthread_mutex_lock(&wb.lock);
+  while (file->writeback > 0) {
+    pthread_cond_wait(&wb.idle, &wb.lock);
+  }
+  pthread_mutex_unlock(&wb.lock);
+}
+
+void vtpc_writeback_detach(struct vtpc_file* file) {
+  pthread_mutex_lock(&wb.lock);
+  file->closing = true;
+  while (file->writeback > 0) {
+    pthread_cond_wait(&wb.idle, &wb.lock);
+  }
+  pthread_mutex_unlock(&wb.lock);
+}
+
+void vtpc_writeback_written(struct vtpc_file* file, off_t end) {
+  pthread_mutex_lock(&wb.lock);
+  written(file, end);
+  pthread_mutex_unlock(&wb.lock);
+}
+
+int vtpc_flush_range(struct vtpc_file* file, uint64_t first, uint64_t last) {
+  pthread_mutex_lock(&wb.lock);
+  size_t count = 0;
+  struct claim* claims =
+      snapshot(file, file->dirty_count, first, last, &count);
+  pthread_mutex_unlock(&wb.lock);
+  if (claims == NULL) {
+    return -1;
+  }
+  claim(file, claims, &count);
+  const int error = write_claimed(file, claims, count);
+  free(claims);
+  vtpc_writeback_wait(file);
+  if (error != 0) {
+    errno = error;
+    return -1;
+  }
+  return 0;
+}
+
+int vtpc_flush_file(struct vtpc_file* file) {
+  pthread_mutex_lock(&wb.lock);
+  size_t count = 0;
+  struct claim* claims =
+      snapshot(file, file->dirty_count, 0, UINT64_MAX, &count);
+  pthread_mutex_unlock(&wb.lock);
+  if (claims == NULL) {
+    return -1;
+  }
+  claim(file, claims, &count);
+  int error = write_claimed(file, claims, count);
+  free(claims);
+
+  // Blocks claimed by the flusher or an eviction before this flush.
+  vtpc_writeback_wait(file);
+  pthread_mutex_lock(&wb.lock);
+  // The blocks of a failed background writeback were dirtied again, so
+  // they were retried above, but the error is still reported.
+  if (error == 0) {
+    error = file->error;
+  }
+  file->error = 0;
+  pthread_mutex_unlock(&wb.lock);
+
+  if (error != 0) {
+    errno = error;
+    return -1;
+  }
+  return trim(file);
+}
+
+static bool has_work(uint64_t now) {
+  if (wb.dirty >= wb.high) {
+    wb.active = true;
+  }
+  if (wb.dirty <= wb.low) {
+    wb.active = false;
+  }
+  return wb.active ||
+         (wb.oldest != NULL && now - wb.oldest->dirtied_at >= wb.expire_ns);
+}
+
+// The file of the oldest dirty block, skipping files being closed, which
+// flush themselves.
+static struct vtpc_file* oldest_file(void) {
+  for (struct vtpc_block* block = wb.oldest; block != NULL;
+       block = block->age_next) {
+    if (!block->file->closing) {
+      return block->file;
+    }
+  }
+  return NULL;
+}
+
+// Writes back a batch of dirty blocks of the file owning the oldest one with
+// the write-back lock released. Returns false when there is nothing to do.
+static bool flush_oldest(void) {
+  struct vtpc_file* file = oldest_file();
+  if (file == NULL) {
+    return false;
+  }
+  size_t count = 0;
+  struct claim* claims = snapshot(file, wb.batch, 0, UINT64_MAX, &count);
+  if (claims == NULL) {
+    return false;
+  }
+  // Keeps the file alive: closing it waits for this to drop to zero.
+  file->writeback++;
+  pthread_mutex_unlock(&wb.lock);
+
+  claim(file, claims, &count);
+  const int error = write_claimed(file, claims, count);
+  free(claims);
+
+  pthread_mutex_lock(&wb.lock);
+  if (error != 0) {
+    file->error = error;
+  }
+  done(file);
+  return true;
+}
+
+static void* flusher_main(void* arg) {
+  const uint64_t generation = (uint64_t)(uintptr_t)arg;
+  pthread_mutex_lock(&wb.lock);
+  while (wb.generation == generation) {
+    const uint64_t now = vtpc_now_ns();
+    if (has_work(now) && flush_oldest()) {
+      continue;
+    }
+    const uint64_t wake_at = now + VTPC_FLUSHER_TICK_NS;
+    const struct timespec deadline = {
+        .tv_sec = (time_t)(wake_at / VTPC_NS_PER_SEC),
+        .tv_nsec = (long)(wake_at % VTPC_NS_PER_SEC),
+    };
+    pthread_cond_timedwait(&wb.wake, &wb.lock, &deadline);
+  }
+  pthread_mutex_unlock(&wb.lock);
+  return NULL;
+}
+
+static int conds_init(void) {
+  if (wb.conds_ready) {
+    return 0;
+  }
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  const int err = pthread_cond_init(&wb.wake, &attr);
+  pthread_condattr_destroy(&attr);
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+  pthread_cond_init(&wb.idle, NULL);
+  wb.conds_ready = true;
+  return 0;
+}
+
+static void stop(void) {
+  if (!wb.running) {
+    return;
+  }
+  wb.running = false;
+  wb.generation++;
+  pthread_cond_broadcast(&wb.wake);
+}
+
+// Called with `wb.lock` held.
+static void thresholds(size_t capacity) {
+  wb.high = (capacity * wb.high_percent) / 100;
+  wb.low = (capacity * wb.low_percent) / 100;
+  wb.batch = capacity / 4 == 0 ? 1 : capacity / 4;
+}
+
+int vtpc_writeback_start(const struct vtpc_config* config) {
+  if (config->dirty_low > config->dirty_high || config->dirty_high > 100) {
+    errno = EINVAL;
+    return -1;
+  }
+  pthread_mutex_lock(&wb.lock);
+  if (conds_init() == -1) {
+    pthread_mutex_unlock(&wb.lock);
+    return -1;
+  }
+  stop();
+
+  wb.high_percent = config->dirty_high;
+  wb.low_percent = config->dirty_low;
+  thresholds(config->capacity);
+  wb.expire_ns = (uint64_t)config->dirty_expire_ms * 1000 * 1000;
+  wb.active = false;
+
+  int err = 0;
+  if (config->flusher) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    err = pthread_create(
+        &thread, &attr, flusher_main, (void*)(uintptr_t)wb.generation
+    );
+    pthread_attr_destroy(&attr);
+    wb.running = err == 0;
+  }
+  pthread_mutex_unlock(&wb.lock);
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+void vtpc_writeback_resize(size_t capacity) {
+  pthread_mutex_lock(&wb.lock);
+  thresholds(capacity);
+  if (wb.running && !wb.active && wb.dirty >= wb.high) {
+    pthread_cond_signal(&wb.wake);
+  }
+  pthread_mutex_unlock(&wb.lock);
+}
+
+void vtpc_writeback_stop(void) {
+  pthread_mutex_lock(&wb.lock);
+  stop();
+  pthread_mutex_unlock(&wb.lock);
+}
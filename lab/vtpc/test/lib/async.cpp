@@ -0,0 +1,89 @@
+#include "async.hpp"
+
+#include <cerrno>
+#include <coroutine>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+
+#include "exception.hpp"
+#include "file.hpp"
+
+extern "C" {
+#include <sys/types.h>
+
+#include "vtpc.h"
+}
+
+namespace vt {
+
+void task::promise_type::final_awaiter::await_suspend(
+    std::coroutine_handle<promise_type> handle
+) noexcept {
+  const std::shared_ptr<state> state = std::move(handle.promise().state_);
+  handle.destroy();
+  const std::lock_guard lock(state->mutex);
+  state->done = true;
+  state->cv.notify_all();
+}
+
+auto task::wait() -> void {
+  std::unique_lock lock(state_->mutex);
+  state_->cv.wait(lock, [this] { return state_->done; });
+  if (state_->error) {
+    std::rethrow_exception(state_->error);
+  }
+}
+
+async_io::async_io(int fd, char* buffer, size_t count, off_t offset, bool write)
+    : write_(write) {
+  aio_.fd = fd;
+  aio_.buf = buffer;
+  aio_.count = count;
+  aio_.offset = offset;
+  aio_.callback = complete;
+  aio_.data = this;
+}
+
+auto async_io::await_suspend(std::coroutine_handle<> handle) -> bool {
+  handle_ = handle;
+  const int result = write_ ? vtpc_write_async(&aio_) : vtpc_read_async(&aio_);
+  if (result == -1) {
+    aio_.result = -1;
+    aio_.error = errno;
+    return false;
+  }
+  return !raced_.exchange(true);
+}
+
+void async_io::complete(struct vtpc_aio* aio) {
+  auto* self = static_cast<async_io*>(aio->data);
+  if (self->raced_.exchange(true)) {
+    self->handle_.resume();
+  }
+}
+
+auto async_io::await_resume() const -> size_t {
+  if (aio_.result < 0) {
+    throw vt::file_exception(aio_.result)
+        << "failed to " << (write_ ? "write " : "read ") << aio_.count
+        << " bytes at offset " << aio_.offset << " of file with fd "
+        << aio_.fd << ": "
+        << strerror(aio_.error);  // NOLINT(concurrency-mt-unsafe)
+  }
+  return static_cast<size_t>(aio_.result);
+}
+
+auto async_read(int fd, char* buffer, size_t count, off_t offset) -> async_io {
+  return {fd, buffer, count, offset, false};
+}
+
+auto async_write(int fd, const char* buffer, size_t count, off_t offset)
+    -> async_io {
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+  return {fd, const_cast<char*>(buffer), count, offset, true};
+}
+
+}  // namespace vt
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+
+extern "C" {
+#include "vtpc.h"
+}
+
+namespace vt {
+
+// A coroutine that starts right away and runs on whichever thread resumes
+// it. wait() blocks until it finishes and rethrows what escaped it.
+class task {
+public:
+  struct state {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool done = false;
+    std::exception_ptr error;
+  };
+
+  struct promise_type {
+    auto get_return_object() -> task {
+      return task(state_);
+    }
+    static auto initial_suspend() noexcept -> std::suspend_never {
+      return {};
+    }
+    // Destroys the frame before waking the waiter, which may then free
+    // whatever the coroutine refers to.
+    struct final_awaiter {
+      static auto await_ready() noexcept -> bool {
+        return false;
+      }
+      static void await_suspend(std::coroutine_handle<promise_type> handle
+      ) noexcept;
+      static void await_resume() noexcept {
+      }
+    };
+    static auto final_suspend() noexcept -> final_awaiter {
+      return {};
+    }
+    static void return_void() {
+    }
+    void unhandled_exception() {
+      state_->error = std::current_exception();
+    }
+
+    std::shared_ptr<state> state_ = std::make_shared<state>();
+  };
+
+  auto wait() -> void;
+
+private:
+  explicit task(std::shared_ptr<state> state) : state_(std::move(state)) {
+  }
+
+  std::shared_ptr<state> state_;
+};
+
+// co_await runs vtpc_pread or vtpc_pwrite through vtpc_read_async or
+// vtpc_write_async, resumes on the vtpc thread that completed it and gives
+// the bytes transferred, or throws a file_exception.
+class async_io {
+public:
+  async_io(int fd, char* buffer, size_t count, off_t offset, bool write);
+
+  async_io(const async_io&) = delete;
+  auto operator=(const async_io&) -> async_io& = delete;
+
+  static auto await_ready() noexcept -> bool {
+    return false;
+  }
+  auto await_suspend(std::coroutine_handle<> handle) -> bool;
+  auto await_resume() const -> size_t;
+
+private:
+  static void complete(struct vtpc_aio* aio);
+
+  struct vtpc_aio aio_ {};
+  bool write_;
+  std::coroutine_handle<> handle_;
+  // Set by whichever of the submission and the completion comes second,
+  // which then resumes the coroutine, so an inline completion does not
+  // nest it.
+  std::atomic<bool> raced_ = false;
+};
+
+auto async_read(int fd, char* buffer, size_t count, off_t offset) -> async_io;
+auto async_write(int fd, const char* buffer, size_t count, off_t offset)
+    -> async_io;
+
+}  // namespace vt
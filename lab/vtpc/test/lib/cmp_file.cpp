@@ -6,7 +6,7 @@
 #include <cstring>
 #include <memory>
 #include <optional>
-#include <string>
+#include <string_view>
 #include <utility>
 
 #include "exception.hpp"
@@ -52,17 +52,21 @@ cmp_file::cmp_file(std::unique_ptr<file> lhs, std::unique_ptr<file> rhs)
     : lhs_(std::move(lhs)), file_(std::move(rhs)) {
 }
 
+// The left file reads straight into the buffer and the right one into the
+// scratch memory, which only grows, so reads allocate nothing.
 auto cmp_file::read(char* buffer, size_t count) -> void {
-  std::string lhs(count, ' ');
-  std::string rhs(count, ' ');
+  if (scratch_.size() < count) {
+    scratch_.resize(count);
+  }
   Compare(
-      [&] { lhs_->read(lhs.data(), count); },
-      [&] { file_->read(rhs.data(), count); }
+      [&] { lhs_->read(buffer, count); },
+      [&] { file_->read(scratch_.data(), count); }
   );
-  if (lhs != rhs) {
-    throw vt::cmp_file_exception() << "'" << lhs << "' != '" << rhs << "'";
+  if (memcmp(buffer, scratch_.data(), count) != 0) {
+    throw vt::cmp_file_exception()
+        << "'" << std::string_view(buffer, count) << "' != '"
+        << std::string_view(scratch_.data(), count) << "'";
   }
-  memcpy(buffer, lhs.data(), count);
 }
 
 auto cmp_file::write(const char* buffer, size_t count) -> void {
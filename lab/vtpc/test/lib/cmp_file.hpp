@@ -4,6 +4,7 @@
 
 #include <cstddef>
 #include <memory>
+#include <vector>
 
 #include "exception.hpp"
 #include "file.hpp"
@@ -28,6 +29,7 @@ public:
 private:
   std::unique_ptr<file> lhs_;
   std::unique_ptr<file> file_;
+  std::vector<char> scratch_;
 };
 
 }  // namespace vt
@@ -1,13 +1,16 @@
 #include "file.hpp"
 
 #include <cerrno>
+#include <chrono>
 #include <cstddef>
 #include <cstdio>
 #include <cstring>
 #include <functional>
 #include <memory>
+#include <string>
 #include <string_view>
-#include <utility>
+#include <thread>
+#include <type_traits>
 
 #include "exception.hpp"
 
@@ -31,13 +34,48 @@ auto file_exception::code() const -> ssize_t {
   return code_;
 }
 
-struct io {
-  std::function<int(const char* path, int mode, int access)> open;
-  std::function<int(int fd)> close;
-  std::function<ssize_t(int fd, void* buf, size_t count)> read;
-  std::function<ssize_t(int fd, const void* buf, size_t count)> write;
-  std::function<off_t(int fd, off_t offset, int whence)> lseek;
-  std::function<int(int fd)> fsync;
+// The backends are bound at compile time, so every call of an io_file is a
+// direct call of the backend function.
+struct libc_io {
+  static auto open(const char* path, int mode, int access) -> int {
+    return ::open(path, mode, access);  // NOLINT
+  }
+  static auto close(int fd) -> int {
+    return ::close(fd);
+  }
+  static auto read(int fd, void* buf, size_t count) -> ssize_t {
+    return ::read(fd, buf, count);
+  }
+  static auto write(int fd, const void* buf, size_t count) -> ssize_t {
+    return ::write(fd, buf, count);
+  }
+  static auto lseek(int fd, off_t offset, int whence) -> off_t {
+    return ::lseek(fd, offset, whence);
+  }
+  static auto fsync(int fd) -> int {
+    return ::fsync(fd);
+  }
+};
+
+struct vtpc_io {
+  static auto open(const char* path, int mode, int access) -> int {
+    return ::vtpc_open(path, mode, access);
+  }
+  static auto close(int fd) -> int {
+    return ::vtpc_close(fd);
+  }
+  static auto read(int fd, void* buf, size_t count) -> ssize_t {
+    return ::vtpc_read(fd, buf, count);
+  }
+  static auto write(int fd, const void* buf, size_t count) -> ssize_t {
+    return ::vtpc_write(fd, buf, count);
+  }
+  static auto lseek(int fd, off_t offset, int whence) -> off_t {
+    return ::vtpc_lseek(fd, offset, whence);
+  }
+  static auto fsync(int fd) -> int {
+    return ::vtpc_fsync(fd);
+  }
 };
 
 template <class A, class T>
@@ -67,10 +105,11 @@ void robust_do(A action, int fd, T* buf, size_t count) {
   }
 }
 
+template <class IO>
 class io_file final : public file {
 public:
-  explicit io_file(std::string_view path, io io)
-      : fd_(io.open(path.data(), flags, access)), io_(std::move(io)) {
+  explicit io_file(std::string_view path)
+      : fd_(IO::open(std::string(path).c_str(), flags, access)) {
     if (fd_ < 0) {
       throw vt::file_exception(fd_)
           << "failed to open file '" << path << "'" << ": "
@@ -79,19 +118,19 @@ public:
   }
 
   ~io_file() override {
-    (void)io_.close(fd_);
+    (void)IO::close(fd_);
   }
 
   void read(char* buffer, size_t count) override {
-    robust_do(io_.read, fd_, buffer, count);
+    robust_do(IO::read, fd_, buffer, count);
   }
 
   void write(const char* buffer, size_t count) override {
-    robust_do(io_.write, fd_, buffer, count);
+    robust_do(IO::write, fd_, buffer, count);
   }
 
   void seek(off_t offset) override {
-    if (io_.lseek(fd_, offset, SEEK_SET) == -1) {
+    if (IO::lseek(fd_, offset, SEEK_SET) == -1) {
       throw vt::file_exception(-1)
           << "failed to seek to offset " << offset << "file with fd " << fd_
           << ": " << strerror(errno);  // NOLINT(concurrency-mt-unsafe)
@@ -99,7 +138,7 @@ public:
   }
 
   void sync() override {
-    if (io_.fsync(fd_) == -1) {
+    if (IO::fsync(fd_) == -1) {
       throw vt::file_exception(-1)
           << "failed to fsync file with fd " << fd_ << ": "
           << strerror(errno);  // NOLINT(concurrency-mt-unsafe)
@@ -108,33 +147,54 @@ public:
 
 private:
   int fd_;
-  io io_;
 };
 
 auto file::open_libc(std::string_view path) -> std::unique_ptr<file> {
-  io io = {
-      .open = ::open,
-      .close = ::close,
-      .read = ::read,
-      .write = ::write,
-      .lseek = ::lseek,
-      .fsync = ::fsync,
-  };
-
-  return std::make_unique<io_file>(path, std::move(io));
+  return std::make_unique<io_file<libc_io>>(path);
 }
 
 auto file::open_vtpc(std::string_view path) -> std::unique_ptr<file> {
-  io io = {
-      .open = ::vtpc_open,
-      .close = ::vtpc_close,
-      .read = ::vtpc_read,
-      .write = ::vtpc_write,
-      .lseek = ::vtpc_lseek,
-      .fsync = ::vtpc_fsync,
-  };
-
-  return std::make_unique<io_file>(path, std::move(io));
+  return std::make_unique<io_file<vtpc_io>>(path);
+}
+
+auto init_vtpc(const std::function<void(vtpc_config&)>& tune) -> void {
+  if (!try_init_vtpc(tune)) {
+    throw vt::exception() << "failed to init: " << strerror(errno);  // NOLINT
+  }
+}
+
+auto try_init_vtpc(const std::function<void(vtpc_config&)>& tune) -> bool {
+  struct vtpc_config config;
+  vtpc_config_default(&config);
+  tune(config);
+  return vtpc_init(&config) == 0;
+}
+
+auto open_or_throw(const std::string& path, int flags) -> int {
+  const int fd = vtpc_open(path.c_str(), flags, access);  // NOLINT
+  if (fd == -1) {
+    throw vt::exception() << "failed to open " << path << ": "
+                          << strerror(errno);  // NOLINT
+  }
+  return fd;
+}
+
+auto close_or_throw(int fd) -> void {
+  if (vtpc_close(fd) == -1) {
+    throw vt::exception() << "failed to close: " << strerror(errno);  // NOLINT
+  }
+}
+
+auto wait_until(const std::function<bool()>& done) -> bool {
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (!done()) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return true;
 }
 
 }  // namespace vt
@@ -3,12 +3,15 @@
 #include <sys/types.h>
 
 #include <cstddef>
+#include <functional>
 #include <memory>
 #include <string>
 #include <string_view>
 
 #include "exception.hpp"
 
+struct vtpc_config;
+
 namespace vt {
 
 class file_exception : public vt::exception {
@@ -43,4 +46,17 @@ public:
   static auto open_vtpc(std::string_view path) -> std::unique_ptr<file>;
 };
 
+// The vtpc calls of tests driving it directly, throwing vt::exception with
+// the error. init_vtpc starts from the default config, which `tune` changes;
+// try_init_vtpc returns whether that config was accepted instead, with errno
+// set if not.
+auto init_vtpc(const std::function<void(vtpc_config&)>& tune) -> void;
+auto try_init_vtpc(const std::function<void(vtpc_config&)>& tune) -> bool;
+auto open_or_throw(const std::string& path, int flags) -> int;
+auto close_or_throw(int fd) -> void;
+
+// Polls `done` for what background threads of vtpc get to eventually, for
+// up to 10 seconds. Returns whether it held in time.
+auto wait_until(const std::function<bool()>& done) -> bool;
+
 }  // namespace vt
@@ -2,36 +2,133 @@
 
 #include <sys/types.h>
 
+#include <cerrno>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <memory>
+#include <string>
+#include <string_view>
 #include <utility>
 
+#include "exception.hpp"
 #include "file.hpp"
 
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
 namespace vt {
 
+constexpr size_t trace_batch = 1024 * sizeof(vtpc_trace_record);
+
 log_file::log_file(std::unique_ptr<file> file) : file_(std::move(file)) {
 }
 
+log_file::log_file(std::unique_ptr<file> file, std::string_view trace_path)
+    : file_(std::move(file)) {
+  const std::string path(trace_path);
+  trace_fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);  // NOLINT
+  if (trace_fd_ == -1) {
+    throw vt::exception() << "failed to open trace '" << path << "': "
+                          << strerror(errno);  // NOLINT
+  }
+  records_.reserve(trace_batch);
+}
+
+log_file::~log_file() {
+  if (trace_fd_ == -1) {
+    return;
+  }
+  try {
+    flush();
+  } catch (const vt::exception& e) {
+    std::cerr << "[vt] " << e.what() << '\n';
+  }
+  (void)::close(trace_fd_);
+}
+
 auto log_file::read(char* buffer, size_t count) -> void {
-  std::cerr << "[vt] read count " << count << "\n";
+  if (trace_fd_ == -1) {
+    std::cerr << "[vt] read count " << count << "\n";
+  }
   file_->read(buffer, count);
+  record(VTPC_TRACE_READ, count);
 }
 
 auto log_file::write(const char* buffer, size_t count) -> void {
-  std::cerr << "[vt] write count " << count << "\n";
+  if (trace_fd_ == -1) {
+    std::cerr << "[vt] write count " << count << "\n";
+  }
   file_->write(buffer, count);
+  record(VTPC_TRACE_WRITE, count);
 }
 
 auto log_file::seek(off_t offset) -> void {
-  std::cerr << "[vt] seek offset " << offset << "\n";
+  if (trace_fd_ == -1) {
+    std::cerr << "[vt] seek offset " << offset << "\n";
+  }
   file_->seek(offset);
+  pos_ = offset;
 }
 
 auto log_file::sync() -> void {
-  std::cerr << "[vt] sync\n";
+  if (trace_fd_ == -1) {
+    std::cerr << "[vt] sync\n";
+  }
   file_->sync();
+  record(VTPC_TRACE_FSYNC, 0);
+}
+
+// The file behind is not a vtpc descriptor: records carry fd -1 and file 0,
+// and the offset is tracked here.
+auto log_file::record(uint32_t op, size_t count) -> void {
+  const off_t offset = op == VTPC_TRACE_FSYNC ? 0 : pos_;
+  pos_ += static_cast<off_t>(count);
+  if (trace_fd_ == -1) {
+    return;
+  }
+  const auto now = std::chrono::steady_clock::now().time_since_epoch();
+  const vtpc_trace_record record = {
+      .time_ns = static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(now).count()
+      ),
+      .offset = static_cast<uint64_t>(offset),
+      .length = static_cast<uint32_t>(count),
+      .fd = -1,
+      .file = 0,
+      .op = op,
+  };
+  records_.append(
+      reinterpret_cast<const char*>(&record), sizeof(record)  // NOLINT
+  );
+  if (records_.size() >= trace_batch) {
+    flush();
+  }
+}
+
+auto log_file::flush() -> void {
+  // Cleared rather than moved out, so the buffer keeps its capacity.
+  const char* data = records_.data();
+  size_t left = records_.size();
+  while (left > 0) {
+    const ssize_t n = ::write(trace_fd_, data, left);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      throw vt::exception() << "failed to write trace: "
+                            << strerror(errno);  // NOLINT
+    }
+    data += n;  // NOLINT
+    left -= static_cast<size_t>(n);
+  }
+  records_.clear();
 }
 
 }  // namespace vt
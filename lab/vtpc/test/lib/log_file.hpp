@@ -3,7 +3,10 @@
 #include <sys/types.h>
 
 #include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <string>
+#include <string_view>
 
 #include "file.hpp"
 
@@ -14,8 +17,15 @@ public:
   using file::read;
   using file::write;
 
+  // Logs every operation as a text line to std::cerr.
   explicit log_file(std::unique_ptr<file> file);
-  ~log_file() override = default;
+  // Writes a binary trace of vtpc_trace_record entries to `trace_path`
+  // instead, readable by vtpc_sim.
+  log_file(std::unique_ptr<file> file, std::string_view trace_path);
+  ~log_file() override;
+
+  log_file(const log_file&) = delete;
+  auto operator=(const log_file&) -> log_file& = delete;
 
   auto read(char* buffer, size_t count) -> void override;
   auto write(const char* buffer, size_t count) -> void override;
@@ -23,7 +33,13 @@ public:
   auto sync() -> void override;
 
 private:
+  auto record(uint32_t op, size_t count) -> void;
+  auto flush() -> void;
+
   std::unique_ptr<file> file_;
+  int trace_fd_ = -1;
+  off_t pos_ = 0;
+  std::string records_;
 };
 
 }  // namespace vt
@@ -0,0 +1,116 @@
+#include <sys/types.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include "exception.hpp"
+#include "file.hpp"
+
+extern "C" {
+#include <fcntl.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t block_size = 4096;
+constexpr size_t capacity = 64;
+constexpr size_t hot = 32;
+constexpr size_t cold = 512;
+constexpr size_t rounds = 4;
+constexpr size_t lookup_every = 4;
+constexpr const char* path = "/tmp/t";
+
+void init(const char* policy, bool admission) {
+  vt::init_vtpc([&](vtpc_config& config) {
+    config.block_size = block_size;
+    config.capacity = capacity;
+    config.shards = 1;
+    config.policy = policy;
+    config.readahead = 0;
+    config.scan = 0;
+    config.bypass = 0;
+    config.admission = admission;
+  });
+}
+
+void read_block(int fd, size_t index) {
+  std::string buffer(block_size, '\0');
+  const auto offset = static_cast<off_t>(index * block_size);
+  if (vtpc_pread(fd, buffer.data(), block_size, offset) !=
+      static_cast<ssize_t>(block_size)) {
+    throw vt::exception() << "failed to read block " << index << ": "
+                          << strerror(errno);  // NOLINT
+  }
+}
+
+void create() {
+  init("lru", false);
+  const int fd = vt::open_or_throw(path, O_RDWR | O_CREAT | O_TRUNC);
+  const std::string text(block_size, 'x');
+  for (size_t i = 0; i < hot + cold; ++i) {
+    if (vtpc_write(fd, text.data(), block_size) !=
+        static_cast<ssize_t>(block_size)) {
+      throw vt::exception() << "failed to write block " << i;
+    }
+  }
+  vt::close_or_throw(fd);
+}
+
+// Warms the hot set up, then scans the rest of the file once while the hot
+// set keeps being looked up, and returns the share of those lookups that
+// hit, in percent. Every block of the scan misses.
+auto hot_hits_during_scan(const char* policy, bool admission) -> uint64_t {
+  init(policy, admission);
+  const int fd = vt::open_or_throw(path, O_RDONLY);
+  for (size_t round = 0; round < rounds; ++round) {
+    for (size_t i = 0; i < hot; ++i) {
+      read_block(fd, i);
+    }
+  }
+
+  struct vtpc_stats before;
+  vtpc_stats(&before);
+  size_t lookups = 0;
+  for (size_t i = 0; i < cold; ++i) {
+    read_block(fd, hot + i);
+    if (i % lookup_every == 0) {
+      read_block(fd, lookups++ % hot);
+    }
+  }
+  struct vtpc_stats after;
+  vtpc_stats(&after);
+  vt::close_or_throw(fd);
+  return (after.hits - before.hits) * 100 / lookups;
+}
+
+}  // namespace
+
+auto main() -> int try {
+  create();
+
+  // Without the filter the scan pushes the hot set out of an LRU pool.
+  const uint64_t unfiltered = hot_hits_during_scan("lru", false);
+  if (unfiltered > 10) {
+    throw vt::exception() << "lru hit " << unfiltered
+                          << "% of the lookups without admission";
+  }
+
+  for (const char* policy : {"lru", "clock", "2q", "arc", "lfu"}) {
+    const uint64_t hits = hot_hits_during_scan(policy, true);
+    if (hits < 90) {
+      throw vt::exception() << policy << " hit " << hits
+                            << "% of the lookups with admission";
+    }
+  }
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,146 @@
+#include <sys/types.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "exception.hpp"
+#include "file.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t block_size = 4096;
+constexpr size_t huge_page = 2U << 20U;
+constexpr size_t blocks = 256;
+constexpr const char* path = "/tmp/h";
+
+void init(const char* hugepages, size_t capacity, bool lock = false) {
+  vt::init_vtpc([&](vtpc_config& config) {
+    config.block_size = block_size;
+    config.capacity = capacity;
+    config.hugepages = hugepages;
+    config.mlock = lock;
+  });
+}
+
+// Writes and reads back `blocks` blocks through the pool.
+auto round_trip() -> struct vtpc_stats {
+  const int fd = vt::open_or_throw(path, O_RDWR | O_CREAT | O_TRUNC);
+  for (size_t i = 0; i < blocks; ++i) {
+    const std::string text(block_size, static_cast<char>('a' + (i % 26)));
+    if (vtpc_write(fd, text.data(), block_size) !=
+        static_cast<ssize_t>(block_size)) {
+      throw vt::exception() << "failed to write block " << i;
+    }
+  }
+  std::string buffer(block_size, '\0');
+  for (size_t i = 0; i < blocks; ++i) {
+    const auto offset = static_cast<off_t>(i * block_size);
+    if (vtpc_pread(fd, buffer.data(), block_size, offset) !=
+            static_cast<ssize_t>(block_size) ||
+        buffer != std::string(block_size, static_cast<char>('a' + (i % 26)))) {
+      throw vt::exception() << "block " << i << " is wrong";
+    }
+  }
+  vt::close_or_throw(fd);
+  struct vtpc_stats stats;
+  vtpc_stats(&stats);
+  return stats;
+}
+
+auto thp_enabled() -> bool {
+  std::ifstream in("/sys/kernel/mm/transparent_hugepage/enabled");
+  std::string line;
+  return std::getline(in, line) && line.find("[never]") == std::string::npos;
+}
+
+// Reserved huge pages not in use.
+auto hugetlb_free() -> size_t {
+  std::ifstream in("/proc/meminfo");
+  std::string key;
+  size_t value = 0;
+  while (in >> key >> value) {
+    if (key == "HugePages_Free:") {
+      return value;
+    }
+    in.ignore(256, '\n');
+  }
+  return 0;
+}
+
+void expect_backing(
+    const struct vtpc_stats& stats, uint32_t expected, const char* what
+) {
+  if (stats.pool_backing != expected) {
+    throw vt::exception() << what << ": backing " << stats.pool_backing
+                          << ", expected " << expected;
+  }
+}
+
+}  // namespace
+
+auto main() -> int try {
+  if (vt::try_init_vtpc([](vtpc_config& config) {
+        config.hugepages = "giant";
+      }) ||
+      errno != EINVAL) {
+    throw vt::exception() << "accepted an unknown kind of pages";
+  }
+
+  // Pool and block array share the mapping.
+  init("none", blocks * 2);
+  struct vtpc_stats stats = round_trip();
+  expect_backing(stats, VTPC_POOL_PAGES, "none");
+  if (stats.pool_bytes < 2 * blocks * block_size + 2 * blocks) {
+    throw vt::exception() << "mapped only " << stats.pool_bytes << " bytes";
+  }
+
+  // A pool smaller than a huge page does not round up to one.
+  init("thp", blocks / 4);
+  expect_backing(round_trip(), VTPC_POOL_PAGES, "small thp");
+
+  const uint32_t thp = thp_enabled() ? VTPC_POOL_THP : VTPC_POOL_PAGES;
+  init("thp", blocks * 2);
+  stats = round_trip();
+  expect_backing(stats, thp, "thp");
+  if (stats.pool_bytes % huge_page != 0) {
+    throw vt::exception() << "thp pool of " << stats.pool_bytes << " bytes";
+  }
+
+  // Without reserved pages, explicit huge pages fall back to transparent.
+  init("hugetlb", blocks * 2);
+  stats = round_trip();
+  if (hugetlb_free() * huge_page < stats.pool_bytes) {
+    expect_backing(stats, thp, "hugetlb");
+  }
+
+  init("none", blocks / 4, true);
+  stats = round_trip();
+  struct rlimit limit;
+  const bool allowed = ::getrlimit(RLIMIT_MEMLOCK, &limit) == 0 &&
+                       (limit.rlim_cur == RLIM_INFINITY ||
+                        limit.rlim_cur >= stats.pool_bytes);
+  if (allowed && stats.pool_locked == 0) {
+    throw vt::exception() << "pool not locked within the limit";
+  }
+  init("none", blocks / 4);
+  if (round_trip().pool_locked != 0) {
+    throw vt::exception() << "pool locked without asking";
+  }
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
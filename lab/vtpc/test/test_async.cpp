@@ -0,0 +1,218 @@
+#include <sys/types.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "async.hpp"
+#include "exception.hpp"
+#include "file.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t block_size = 4096;
+constexpr size_t capacity = 64;
+constexpr size_t blocks = 512;
+constexpr size_t tasks = 32;
+constexpr const char* path = "/tmp/q";
+
+void init(size_t threads) {
+  vt::init_vtpc([&](vtpc_config& config) {
+    config.block_size = block_size;
+    config.capacity = capacity;
+    config.async_threads = threads;
+  });
+}
+
+// Block `i`, stamped so a misplaced block shows.
+auto content(size_t i) -> std::string {
+  std::string text(block_size, static_cast<char>('a' + (i % 26)));
+  const std::string stamp = std::to_string(i);
+  text.replace(0, stamp.size(), stamp);
+  return text;
+}
+
+auto offset_of(size_t i) -> off_t {
+  return static_cast<off_t>(i * block_size);
+}
+
+// Writes every block as a coroutine of its own, all in flight at once.
+void write_all(int fd) {
+  std::vector<std::string> texts;
+  std::vector<vt::task> writes;
+  texts.reserve(blocks);
+  writes.reserve(blocks);
+  for (size_t i = 0; i < blocks; ++i) {
+    texts.push_back(content(i));
+    writes.push_back([](int fd, const std::string& text, off_t offset)
+                         -> vt::task {
+      if (co_await vt::async_write(fd, text.data(), text.size(), offset) !=
+          text.size()) {
+        throw vt::exception() << "short write at " << offset;
+      }
+    }(fd, texts.back(), offset_of(i)));
+  }
+  for (auto& write : writes) {
+    write.wait();
+  }
+}
+
+// Each task reads its share of the blocks one after the other.
+auto read_share(int fd, size_t first) -> vt::task {
+  std::string buffer(block_size, '\0');
+  for (size_t i = first; i < blocks; i += tasks) {
+    const size_t n =
+        co_await vt::async_read(fd, buffer.data(), block_size, offset_of(i));
+    if (n != block_size || buffer != content(i)) {
+      throw vt::exception() << "block " << i << " is wrong";
+    }
+  }
+}
+
+void read_all(int fd) {
+  std::vector<vt::task> reads;
+  reads.reserve(tasks);
+  for (size_t i = 0; i < tasks; ++i) {
+    reads.push_back(read_share(fd, i));
+  }
+  for (auto& read : reads) {
+    read.wait();
+  }
+}
+
+// Requests without a callback complete into the queue, polled through its
+// descriptor.
+void queue(int fd) {
+  const int event = vtpc_aio_fd();
+  if (event == -1) {
+    throw vt::exception() << "no completion descriptor: "
+                          << strerror(errno);  // NOLINT
+  }
+  std::vector<std::string> buffers(blocks, std::string(block_size, '\0'));
+  std::vector<struct vtpc_aio> aios(blocks);
+  for (size_t i = 0; i < blocks; ++i) {
+    aios[i].fd = fd;
+    aios[i].buf = buffers[i].data();
+    aios[i].count = block_size;
+    aios[i].offset = offset_of(i);
+    aios[i].callback = nullptr;
+    if (vtpc_read_async(&aios[i]) == -1) {
+      throw vt::exception()
+          << "failed to submit: " << strerror(errno);  // NOLINT
+    }
+  }
+  size_t reaped = 0;
+  while (reaped < blocks) {
+    struct pollfd pfd = {.fd = event, .events = POLLIN, .revents = 0};
+    if (::poll(&pfd, 1, 10000) != 1) {
+      throw vt::exception() << "no completion after " << reaped;
+    }
+    struct vtpc_aio* done[16];
+    const size_t n = vtpc_aio_reap(done, 16, false);
+    for (size_t j = 0; j < n; ++j) {
+      const auto i = static_cast<size_t>(done[j] - aios.data());
+      if (done[j]->result != static_cast<ssize_t>(block_size) ||
+          buffers[i] != content(i)) {
+        throw vt::exception() << "queued read of block " << i << " is wrong";
+      }
+    }
+    reaped += n;
+  }
+  struct pollfd pfd = {.fd = event, .events = POLLIN, .revents = 0};
+  struct vtpc_aio* done = nullptr;
+  if (::poll(&pfd, 1, 0) != 0 || vtpc_aio_reap(&done, 1, true) != 0) {
+    throw vt::exception() << "completions left after reaping all";
+  }
+}
+
+// A failed request reports its errno through the callback.
+void failure() {
+  std::atomic<int> error = 0;
+  char byte = 0;
+  struct vtpc_aio aio = {};
+  aio.fd = 1 << 20;
+  aio.buf = &byte;
+  aio.count = 1;
+  aio.data = &error;
+  aio.callback = [](struct vtpc_aio* aio) {
+    static_cast<std::atomic<int>*>(aio->data)->store(aio->error);
+  };
+  if (vtpc_read_async(&aio) == -1) {
+    throw vt::exception() << "failed to submit: " << strerror(errno);  // NOLINT
+  }
+  while (error.load() == 0) {
+    ::usleep(100);
+  }
+  if (error.load() != EBADF) {
+    throw vt::exception() << "bad descriptor reported "
+                          << strerror(error.load());  // NOLINT
+  }
+}
+
+// A child forked once the workers run starts workers of its own for its
+// requests, and exits without joining those of the parent. The alarm turns
+// a hang into a failure.
+void forked(int fd) {
+  const pid_t pid = ::fork();
+  if (pid == -1) {
+    throw vt::exception() << "failed to fork: " << strerror(errno);  // NOLINT
+  }
+  if (pid == 0) {
+    ::alarm(10);
+    std::string buffer(block_size, '\0');
+    struct vtpc_aio aio = {};
+    aio.fd = fd;
+    aio.buf = buffer.data();
+    aio.count = block_size;
+    aio.offset = offset_of(1);
+    struct vtpc_aio* done = nullptr;
+    const bool read = vtpc_read_async(&aio) == 0 &&
+                      vtpc_aio_reap(&done, 1, true) == 1 && done == &aio &&
+                      aio.result == static_cast<ssize_t>(block_size) &&
+                      buffer == content(1);
+    std::exit(read ? 0 : 1);  // NOLINT(concurrency-mt-unsafe)
+  }
+  int status = 0;
+  if (::waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    throw vt::exception() << "forked child failed, status " << status;
+  }
+}
+
+void run(size_t threads) {
+  init(threads);
+  const int fd = vt::open_or_throw(path, O_RDWR | O_CREAT | O_TRUNC);
+  write_all(fd);
+  read_all(fd);
+  queue(fd);
+  failure();
+  forked(fd);
+  vt::close_or_throw(fd);
+}
+
+}  // namespace
+
+auto main() -> int try {
+  run(0);
+  run(4);
+  run(16);
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
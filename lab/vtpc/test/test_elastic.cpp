@@ -0,0 +1,187 @@
+#include <sys/types.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "exception.hpp"
+#include "file.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t block_size = 4096;
+constexpr size_t capacity = 1024;
+constexpr size_t min_capacity = 128;
+constexpr const char* path = "/tmp/e";
+
+const std::filesystem::path group =
+    "/tmp/vtpc_elastic_" + std::to_string(::getpid());
+
+void put(const char* name, const std::string& text) {
+  std::ofstream(group / name) << text;
+}
+
+void set_pressure(const char* avg10) {
+  put(
+      "memory.pressure",
+      std::string("some avg10=") + avg10 +
+          " avg60=0.00 avg300=0.00 total=0\n"
+          "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n"
+  );
+}
+
+auto pool_blocks() -> size_t {
+  struct vtpc_stats stats;
+  vtpc_stats(&stats);
+  return stats.pool_blocks;
+}
+
+auto resident_bytes() -> size_t {
+  std::ifstream in("/proc/self/statm");
+  size_t size = 0;
+  size_t resident = 0;
+  in >> size >> resident;
+  return resident * static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+}
+
+void wait_for(size_t blocks, const char* what) {
+  if (!vt::wait_until([&] { return pool_blocks() == blocks; })) {
+    throw vt::exception() << what << ": " << pool_blocks()
+                          << " blocks in service, expected " << blocks;
+  }
+}
+
+auto fill(size_t i) -> char {
+  return static_cast<char>('a' + (i % 26));
+}
+
+void check(int fd) {
+  std::string buffer(block_size, '\0');
+  for (size_t i = 0; i < capacity; ++i) {
+    const auto offset = static_cast<off_t>(i * block_size);
+    if (vtpc_pread(fd, buffer.data(), block_size, offset) !=
+            static_cast<ssize_t>(block_size) ||
+        buffer != std::string(block_size, fill(i))) {
+      throw vt::exception() << "block " << i << " is wrong";
+    }
+  }
+}
+
+auto stats() -> struct vtpc_stats {
+  struct vtpc_stats stats;
+  vtpc_stats(&stats);
+  return stats;
+}
+
+void run(const char* hugepages, bool lock) {
+  set_pressure("0.00");
+  put("memory.max", "max\n");
+  put("memory.current", "0\n");
+  const std::string pressure = (group / "memory.pressure").string();
+  const auto tune = [&](vtpc_config& config) {
+    config.block_size = block_size;
+    config.capacity = capacity;
+    config.min_capacity = min_capacity;
+    config.pressure = pressure.c_str();
+    config.pressure_high = 10;
+    config.pressure_period_ms = 10;
+    config.hugepages = hugepages;
+    config.mlock = lock;
+  };
+  vt::init_vtpc(tune);
+  const bool locked = stats().pool_locked != 0;
+
+  // Fill the whole pool, leaving it dirty.
+  const int fd = vt::open_or_throw(path, O_RDWR | O_CREAT | O_TRUNC);
+  for (size_t i = 0; i < capacity; ++i) {
+    const std::string text(block_size, fill(i));
+    if (vtpc_write(fd, text.data(), block_size) !=
+        static_cast<ssize_t>(block_size)) {
+      throw vt::exception() << "failed to write block " << i;
+    }
+  }
+  if (pool_blocks() != capacity) {
+    throw vt::exception() << "started with " << pool_blocks() << " blocks";
+  }
+
+  // Under pressure the pool gives its memory back, writing back the dirty
+  // blocks it parks, in huge pages if it has them and unlocked if locked.
+  const size_t before = resident_bytes();
+  set_pressure("42.50");
+  wait_for(min_capacity, "under pressure");
+  const size_t parked = (capacity - min_capacity) * block_size;
+  const size_t after = resident_bytes();
+  if (after + (parked / 2) > before) {
+    throw vt::exception() << hugepages << (lock ? " locked" : "")
+                          << ": resident " << before << " -> " << after;
+  }
+  if (stats().pool_retained_bytes > parked / 2) {
+    throw vt::exception() << hugepages << (lock ? " locked" : "")
+                          << ": retained " << stats().pool_retained_bytes
+                          << " of " << parked << " bytes";
+  }
+  check(fd);
+
+  // Once it eases, the pool takes the spare memory again, locked as before.
+  set_pressure("0.00");
+  wait_for(capacity, "without pressure");
+  check(fd);
+  if (stats().pool_retained_bytes != 0 ||
+      (stats().pool_locked != 0) != locked) {
+    throw vt::exception() << "regrown with " << stats().pool_retained_bytes
+                          << " bytes retained, locked "
+                          << stats().pool_locked;
+  }
+
+  // A cgroup about to hit its limit shrinks the pool without pressure.
+  put("memory.max", "1000000\n");
+  put("memory.current", "999000\n");
+  wait_for(min_capacity, "at the cgroup limit");
+  put("memory.max", "max\n");
+  wait_for(capacity, "without a limit");
+
+  vt::close_or_throw(fd);
+  vt::init_vtpc([&](vtpc_config& config) {
+    tune(config);
+    config.min_capacity = 0;
+  });
+}
+
+void run() {
+  if (vt::try_init_vtpc([](vtpc_config& config) {
+        config.block_size = block_size;
+        config.capacity = capacity;
+        config.min_capacity = capacity + 1;
+      }) ||
+      errno != EINVAL) {
+    throw vt::exception() << "accepted a minimum above the capacity";
+  }
+
+  std::filesystem::create_directory(group);
+  run("none", false);
+  run("thp", false);
+  run("none", true);
+}
+
+}  // namespace
+
+auto main() -> int try {
+  run();
+  std::filesystem::remove_all(group);
+  return 0;
+} catch (const std::exception& e) {
+  std::filesystem::remove_all(group);
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
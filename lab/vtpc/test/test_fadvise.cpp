@@ -0,0 +1,232 @@
+#include <sys/types.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include "exception.hpp"
+#include "file.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t block_size = 4096;
+constexpr size_t capacity = 256;
+constexpr size_t readahead = 64;
+constexpr size_t hot_blocks = 64;
+constexpr size_t big_blocks = 1024;
+constexpr const char* hot_path = "/tmp/v";
+constexpr const char* big_path = "/tmp/f";
+
+void init() {
+  vt::init_vtpc([&](vtpc_config& config) {
+    config.block_size = block_size;
+    config.capacity = capacity;
+    config.readahead = readahead;
+    config.hugepages = "none";
+  });
+  vtpc_stats_reset();
+}
+
+void advise(int fd, size_t first, size_t count, int advice) {
+  if (vtpc_fadvise(
+          fd, static_cast<off_t>(first * block_size),
+          static_cast<off_t>(count * block_size), advice
+      ) == -1) {
+    throw vt::exception() << "failed to advise " << advice << ": "
+                          << strerror(errno);  // NOLINT
+  }
+}
+
+auto content(size_t i) -> std::string {
+  return std::string(block_size, static_cast<char>('a' + (i % 26)));
+}
+
+void fill(const char* path, size_t blocks) {
+  const int fd = vt::open_or_throw(path, O_RDWR | O_CREAT | O_TRUNC);
+  for (size_t i = 0; i < blocks; ++i) {
+    if (vtpc_write(fd, content(i).data(), block_size) !=
+        static_cast<ssize_t>(block_size)) {
+      throw vt::exception() << "failed to write block " << i;
+    }
+  }
+  vt::close_or_throw(fd);
+}
+
+void read_block(int fd, size_t i) {
+  std::string buffer(block_size, '\0');
+  if (vtpc_pread(fd, buffer.data(), block_size,
+                 static_cast<off_t>(i * block_size)) !=
+          static_cast<ssize_t>(block_size) ||
+      buffer != content(i)) {
+    throw vt::exception() << "block " << i << " is wrong";
+  }
+}
+
+auto stats() -> struct vtpc_stats {
+  struct vtpc_stats stats;
+  vtpc_stats(&stats);
+  return stats;
+}
+
+// Misses of rereading the hot file after `pass` read the big one.
+template <typename Pass>
+auto hot_misses(int hot, Pass pass) -> uint64_t {
+  for (size_t round = 0; round < 2; ++round) {
+    for (size_t i = 0; i < hot_blocks; ++i) {
+      read_block(hot, i);
+    }
+  }
+  pass();
+  const uint64_t before = stats().misses;
+  for (size_t i = 0; i < hot_blocks; ++i) {
+    read_block(hot, i);
+  }
+  return stats().misses - before;
+}
+
+void patterns() {
+  init();
+  const int hot = vt::open_or_throw(hot_path, O_RDONLY);
+  int big = vt::open_or_throw(big_path, O_RDONLY);
+
+  // Random reads go without readahead.
+  advise(big, 0, 0, POSIX_FADV_RANDOM);
+  for (size_t i = 0; i < 16; ++i) {
+    read_block(big, i);
+  }
+  if (stats().readahead_blocks != 0) {
+    throw vt::exception() << "read " << stats().readahead_blocks
+                          << " blocks ahead of random reads";
+  }
+
+  // Sequential ones read a whole window ahead from the first read, and
+  // leave the hot file alone.
+  advise(big, 0, 0, POSIX_FADV_SEQUENTIAL);
+  read_block(big, 16);
+  if (stats().readahead_blocks < readahead) {
+    throw vt::exception() << "read " << stats().readahead_blocks
+                          << " blocks ahead of the first sequential read";
+  }
+  const uint64_t sequential = hot_misses(hot, [&] {
+    for (size_t i = 0; i < big_blocks; ++i) {
+      read_block(big, i);
+    }
+  });
+  if (sequential != 0) {
+    throw vt::exception() << "the hot file missed " << sequential
+                          << " times after a sequential read";
+  }
+
+  // The advice belongs to the descriptor.
+  vt::close_or_throw(big);
+  big = vt::open_or_throw(big_path, O_RDONLY);
+  advise(big, 0, 0, POSIX_FADV_NOREUSE);
+  const uint64_t noreuse = hot_misses(hot, [&] {
+    for (size_t i = 0; i < big_blocks; ++i) {
+      read_block(big, (i * 7) % big_blocks);
+    }
+  });
+  if (noreuse != 0) {
+    throw vt::exception() << "the hot file missed " << noreuse
+                          << " times after reads not to be reused";
+  }
+  advise(big, 0, 0, POSIX_FADV_NORMAL);
+  const uint64_t normal = hot_misses(hot, [&] {
+    for (size_t i = 0; i < big_blocks; ++i) {
+      read_block(big, (i * 7) % big_blocks);
+    }
+  });
+  if (normal == 0) {
+    throw vt::exception() << "the hot file survived without advice";
+  }
+  vt::close_or_throw(big);
+  vt::close_or_throw(hot);
+}
+
+void ranges() {
+  init();
+  const int fd = vt::open_or_throw(big_path, O_RDWR);
+
+  // A range needed soon is read in the background.
+  advise(fd, 0, hot_blocks, POSIX_FADV_WILLNEED);
+  if (!vt::wait_until([] { return stats().readahead_blocks >= hot_blocks; })) {
+    throw vt::exception() << "read " << stats().readahead_blocks
+                          << " blocks of the needed range";
+  }
+  for (size_t i = 0; i < hot_blocks; ++i) {
+    read_block(fd, i);
+  }
+  if (stats().misses != 0) {
+    throw vt::exception() << stats().misses << " misses in the needed range";
+  }
+
+  // A range not needed is written back and dropped.
+  for (size_t i = 0; i < 16; ++i) {
+    if (vtpc_pwrite(fd, content(i).data(), block_size,
+                    static_cast<off_t>(i * block_size)) !=
+        static_cast<ssize_t>(block_size)) {
+      throw vt::exception() << "failed to rewrite block " << i;
+    }
+  }
+  advise(fd, 0, 32, POSIX_FADV_DONTNEED);
+  if (stats().writebacks < 16) {
+    throw vt::exception() << "wrote back " << stats().writebacks
+                          << " dropped blocks";
+  }
+  advise(fd, 0, 0, POSIX_FADV_RANDOM);
+  const uint64_t before = stats().misses;
+  for (size_t i = 0; i < hot_blocks; ++i) {
+    read_block(fd, i);
+  }
+  if (stats().misses - before != 32) {
+    throw vt::exception() << stats().misses - before
+                          << " misses after dropping 32 blocks";
+  }
+
+  if (vtpc_fadvise(fd, 0, -1, POSIX_FADV_DONTNEED) != -1 || errno != EINVAL ||
+      vtpc_fadvise(fd, 0, 0, 42) != -1 || errno != EINVAL) {
+    throw vt::exception() << "accepted wrong advice";
+  }
+  vt::close_or_throw(fd);
+  if (vtpc_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED) != -1 || errno != EBADF) {
+    throw vt::exception() << "advised a closed descriptor";
+  }
+}
+
+// A range needed soon is read even if the descriptor is closed right after.
+void closed() {
+  init();
+  const int fd = vt::open_or_throw(big_path, O_RDWR);
+  advise(fd, 0, hot_blocks, POSIX_FADV_WILLNEED);
+  vt::close_or_throw(fd);
+  if (!vt::wait_until([] { return stats().readahead_blocks >= hot_blocks; })) {
+    throw vt::exception() << "read " << stats().readahead_blocks
+                          << " blocks of a range needed after closing";
+  }
+}
+
+}  // namespace
+
+auto main() -> int try {
+  init();
+  fill(hot_path, hot_blocks);
+  fill(big_path, big_blocks);
+  patterns();
+  ranges();
+  closed();
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,144 @@
+#include <sys/types.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+#include "exception.hpp"
+#include "file.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t block_size = 4096;
+constexpr size_t capacity = 256;
+constexpr size_t blocks = 1024;
+constexpr const char* path = "/tmp/u";
+
+void init(size_t depth) {
+  vt::init_vtpc([&](vtpc_config& config) {
+    config.block_size = block_size;
+    config.capacity = capacity;
+    config.bypass = 0;
+    config.io_depth = depth;
+  });
+}
+
+// Block `i` of generation `round`, stamped so a misplaced block shows.
+auto content(size_t i, size_t round) -> std::string {
+  std::string text(block_size, static_cast<char>('a' + ((i + round) % 26)));
+  const std::string stamp = std::to_string(i) + "/" + std::to_string(round);
+  text.replace(0, stamp.size(), stamp);
+  return text;
+}
+
+void write_block(int fd, size_t i, size_t round) {
+  const std::string text = content(i, round);
+  const auto offset = static_cast<off_t>(i * block_size);
+  if (vtpc_pwrite(fd, text.data(), block_size, offset) !=
+      static_cast<ssize_t>(block_size)) {
+    throw vt::exception() << "failed to write block " << i << ": "
+                          << strerror(errno);  // NOLINT
+  }
+}
+
+// Block `i` holds generation `rounds[i]`, both on disk and through vtpc.
+template <class Rounds>
+void verify(const Rounds& rounds) {
+  const int disk = ::open(path, O_RDONLY);  // NOLINT
+  if (disk == -1) {
+    throw vt::exception() << "failed to open: " << strerror(errno);  // NOLINT
+  }
+  const int fd = vt::open_or_throw(path, O_RDONLY);
+  std::string buffer(block_size, '\0');
+  for (size_t i = 0; i < blocks; ++i) {
+    const std::string expected = content(i, rounds(i));
+    const auto offset = static_cast<off_t>(i * block_size);
+    if (::pread(disk, buffer.data(), block_size, offset) !=
+            static_cast<ssize_t>(block_size) ||
+        buffer != expected) {
+      throw vt::exception() << "block " << i << " on disk is wrong";
+    }
+    if (vtpc_read(fd, buffer.data(), block_size) !=
+            static_cast<ssize_t>(block_size) ||
+        buffer != expected) {
+      throw vt::exception() << "block " << i << " through vtpc is wrong";
+    }
+  }
+  vt::close_or_throw(fd);
+  ::close(disk);
+}
+
+auto ring_open() -> bool {
+  for (const auto& entry :
+       std::filesystem::directory_iterator("/proc/self/fd")) {
+    std::error_code error;
+    const auto target = std::filesystem::read_symlink(entry.path(), error);
+    if (!error && target.string().find("io_uring") != std::string::npos) {
+      return true;
+    }
+  }
+  return false;
+}
+
+auto uring_supported() -> bool {
+  struct io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  const int fd = static_cast<int>(::syscall(__NR_io_uring_setup, 1, &params));
+  if (fd == -1) {
+    return false;
+  }
+  ::close(fd);
+  return true;
+}
+
+// Writes the file four times the pool through evictions, then rewrites
+// every third block and syncs them in one flush, in runs of one block.
+void run(size_t depth) {
+  init(depth);
+  const int fd = vt::open_or_throw(path, O_RDWR | O_CREAT | O_TRUNC);
+  for (size_t i = 0; i < blocks; ++i) {
+    write_block(fd, i, 0);
+  }
+  if (vtpc_fsync(fd) == -1) {
+    throw vt::exception() << "failed to sync: " << strerror(errno);  // NOLINT
+  }
+  for (size_t i = 0; i < blocks; i += 3) {
+    write_block(fd, i, 1);
+  }
+  if (vtpc_fsync(fd) == -1) {
+    throw vt::exception() << "failed to sync: " << strerror(errno);  // NOLINT
+  }
+  vt::close_or_throw(fd);
+  verify([](size_t i) { return i % 3 == 0 ? 1 : 0; });
+}
+
+}  // namespace
+
+auto main() -> int try {
+  run(0);
+  if (ring_open()) {
+    throw vt::exception() << "a ring is open with synchronous I/O";
+  }
+  run(16);
+  if (uring_supported() && !ring_open()) {
+    throw vt::exception() << "no ring was set up";
+  }
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
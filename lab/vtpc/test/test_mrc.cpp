@@ -0,0 +1,144 @@
+#include <sys/types.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include "exception.hpp"
+#include "file.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t block_size = 4096;
+constexpr size_t capacity = 64;
+constexpr size_t loop = 256;
+constexpr size_t rounds = 16;
+constexpr const char* path = "/tmp/m";
+
+void init(size_t mrc) {
+  vt::init_vtpc([&](vtpc_config& config) {
+    config.block_size = block_size;
+    config.capacity = capacity;
+    config.shards = 1;
+    config.readahead = 0;
+    config.scan = 0;
+    config.bypass = 0;
+    config.mrc = mrc;
+  });
+}
+
+void create() {
+  init(0);
+  const int fd = vt::open_or_throw(path, O_RDWR | O_CREAT | O_TRUNC);
+  const std::string text(block_size, 'x');
+  for (size_t i = 0; i < loop; ++i) {
+    if (vtpc_write(fd, text.data(), block_size) !=
+        static_cast<ssize_t>(block_size)) {
+      throw vt::exception() << "failed to write block " << i;
+    }
+  }
+  vt::close_or_throw(fd);
+}
+
+// Reads the file in a loop four times the pool: an LRU pool misses every
+// access unless it holds the whole loop.
+auto loop_curve(size_t rate) -> struct vtpc_stats {
+  init(rate);
+  vtpc_stats_reset();
+  const int fd = vt::open_or_throw(path, O_RDONLY);
+  std::string buffer(block_size, '\0');
+  for (size_t round = 0; round < rounds; ++round) {
+    for (size_t i = 0; i < loop; ++i) {
+      const auto offset = static_cast<off_t>(i * block_size);
+      if (vtpc_pread(fd, buffer.data(), block_size, offset) !=
+          static_cast<ssize_t>(block_size)) {
+        throw vt::exception() << "failed to read block " << i << ": "
+                              << strerror(errno);  // NOLINT
+      }
+    }
+  }
+  struct vtpc_stats stats;
+  vtpc_stats(&stats);
+  vt::close_or_throw(fd);
+  return stats;
+}
+
+void expect_between(
+    const char* what, size_t point, uint64_t actual, uint64_t low,
+    uint64_t high
+) {
+  if (actual < low || actual > high) {
+    throw vt::exception() << what << " at " << point << ": " << actual
+                          << ", expected " << low << ".." << high;
+  }
+}
+
+// Below the loop every access misses, from it on only the first round.
+void check(const char* what, const struct vtpc_stats& stats, uint64_t slack) {
+  const struct vtpc_mrc& mrc = stats.mrc;
+  const uint64_t cold = 1000 / rounds;
+  for (size_t i = 0; i < VTPC_MRC_POINTS; ++i) {
+    if (mrc.blocks[i] < loop) {
+      expect_between(what, mrc.blocks[i], mrc.miss_permille[i], 1000, 1000);
+    } else {
+      expect_between(
+          what, mrc.blocks[i], mrc.miss_permille[i], cold - slack,
+          cold + slack
+      );
+    }
+  }
+}
+
+}  // namespace
+
+auto main() -> int try {
+  create();
+
+  // Sampling every block gives the exact curve, and its point at the
+  // capacity matches the pool.
+  const struct vtpc_stats all = loop_curve(1);
+  if (all.mrc.rate != 1 || all.mrc.sampled != loop * rounds ||
+      all.mrc.cold != loop) {
+    throw vt::exception() << "sampled " << all.mrc.sampled << " accesses, "
+                          << all.mrc.cold << " cold";
+  }
+  if (all.mrc.blocks[3] != capacity ||
+      all.mrc.miss_permille[3] != all.misses * 1000 / (loop * rounds)) {
+    throw vt::exception() << "miss ratio at the capacity "
+                          << all.mrc.miss_permille[3] << ", pool "
+                          << all.misses * 1000 / (loop * rounds);
+  }
+  check("every block", all, 1);
+
+  // A sample of one block in four estimates it.
+  const struct vtpc_stats sample = loop_curve(4);
+  if (sample.mrc.sampled == 0 || sample.mrc.sampled >= loop * rounds / 2) {
+    throw vt::exception() << "sampled " << sample.mrc.sampled << " accesses";
+  }
+  check("one in four", sample, 1);
+
+  if (vtpc_stats_dump(STDOUT_FILENO) == -1) {
+    throw vt::exception() << "failed to dump: " << strerror(errno);  // NOLINT
+  }
+
+  const struct vtpc_stats off = loop_curve(0);
+  if (off.mrc.rate != 0 || off.mrc.sampled != 0) {
+    throw vt::exception() << "sampled " << off.mrc.sampled
+                          << " accesses while disabled";
+  }
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,159 @@
+#include <sys/types.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include "exception.hpp"
+#include "file.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t block_size = 4096;
+constexpr size_t capacity = 256;
+constexpr size_t shards = 4;
+constexpr size_t hot_blocks = 64;
+constexpr size_t big_blocks = 1024;
+constexpr size_t big_reads = 4096;
+constexpr const char* hot_path = "/tmp/p";
+constexpr const char* big_path = "/tmp/g";
+
+void init() {
+  vt::init_vtpc([&](vtpc_config& config) {
+    config.block_size = block_size;
+    config.capacity = capacity;
+    config.shards = shards;
+    config.readahead = 0;
+    config.hugepages = "none";
+  });
+}
+
+void fill(int fd, size_t blocks) {
+  for (size_t i = 0; i < blocks; ++i) {
+    const std::string text(block_size, static_cast<char>('a' + (i % 26)));
+    if (vtpc_write(fd, text.data(), block_size) !=
+        static_cast<ssize_t>(block_size)) {
+      throw vt::exception() << "failed to write block " << i;
+    }
+  }
+}
+
+void read_block(int fd, size_t i) {
+  std::string buffer(block_size, '\0');
+  if (vtpc_pread(fd, buffer.data(), block_size,
+                 static_cast<off_t>(i * block_size)) !=
+          static_cast<ssize_t>(block_size) ||
+      buffer != std::string(block_size, static_cast<char>('a' + (i % 26)))) {
+    throw vt::exception() << "block " << i << " is wrong";
+  }
+}
+
+// Misses of rereading the hot file after reading the big one at random,
+// so that neither readahead nor scan detection keeps it out of the pool.
+auto hot_misses(int hot, int big) -> uint64_t {
+  for (size_t i = 0; i < hot_blocks; ++i) {
+    read_block(hot, i);
+  }
+  uint64_t x = 1;
+  for (size_t i = 0; i < big_reads; ++i) {
+    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    read_block(big, (x >> 33U) % big_blocks);
+  }
+  struct vtpc_stats stats;
+  vtpc_stats(&stats);
+  const uint64_t before = stats.misses;
+  for (size_t i = 0; i < hot_blocks; ++i) {
+    read_block(hot, i);
+  }
+  vtpc_stats(&stats);
+  return stats.misses - before;
+}
+
+auto partition_of(int fd) -> struct vtpc_partition {
+  struct vtpc_partition partition;
+  if (vtpc_get_partition(fd, &partition) == -1) {
+    throw vt::exception() << "failed to get the partition: "
+                          << strerror(errno);  // NOLINT
+  }
+  return partition;
+}
+
+void set_partition(int fd, size_t reserve, size_t limit) {
+  const struct vtpc_partition partition = {
+      .reserve = reserve, .limit = limit, .blocks = 0
+  };
+  if (vtpc_set_partition(fd, &partition) == -1) {
+    throw vt::exception() << "failed to set the partition: "
+                          << strerror(errno);  // NOLINT
+  }
+}
+
+void run() {
+  init();
+  const int hot = vt::open_or_throw(hot_path, O_RDWR | O_CREAT | O_TRUNC);
+  const int big = vt::open_or_throw(big_path, O_RDWR | O_CREAT | O_TRUNC);
+  fill(hot, hot_blocks);
+  fill(big, big_blocks);
+
+  // Shared freely, the big file pushes the hot one out.
+  if (hot_misses(hot, big) == 0) {
+    throw vt::exception() << "the hot file survived without a partition";
+  }
+
+  // Capped, it replaces its own blocks.
+  set_partition(big, 0, hot_blocks);
+  if (hot_misses(hot, big) != 0) {
+    throw vt::exception() << "the hot file missed with the big one capped";
+  }
+  const size_t blocks = partition_of(big).blocks;
+  if (blocks > hot_blocks + shards) {
+    throw vt::exception() << "the big file holds " << blocks << " blocks";
+  }
+
+  // A reservation keeps the hot file in against an uncapped one.
+  set_partition(big, 0, 0);
+  set_partition(hot, hot_blocks, 0);
+  if (hot_misses(hot, big) != 0) {
+    throw vt::exception() << "the hot file missed with its reservation";
+  }
+  const struct vtpc_partition partition = partition_of(hot);
+  if (partition.reserve != hot_blocks || partition.limit != 0 ||
+      partition.blocks != hot_blocks) {
+    throw vt::exception() << "the hot partition is " << partition.reserve
+                          << "/" << partition.limit << " with "
+                          << partition.blocks << " blocks";
+  }
+
+  // Reservations beyond the pool give way rather than fail.
+  set_partition(big, capacity, 0);
+  set_partition(hot, capacity, 0);
+  hot_misses(hot, big);
+
+  const struct vtpc_partition wrong = {.reserve = 2, .limit = 1, .blocks = 0};
+  if (vtpc_set_partition(hot, &wrong) != -1 || errno != EINVAL) {
+    throw vt::exception() << "accepted a reservation above the limit";
+  }
+  vt::close_or_throw(big);
+  vt::close_or_throw(hot);
+}
+
+}  // namespace
+
+auto main() -> int try {
+  run();
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,153 @@
+#include <sys/types.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "exception.hpp"
+#include "file.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t block_size = 4096;
+constexpr size_t capacity = 4;
+constexpr size_t blocks = 16;
+constexpr size_t record = 20;
+
+const std::string path = "/tmp/vtpc_pin_" + std::to_string(::getpid());
+
+auto record_text(size_t i) -> std::string {
+  std::string text = std::to_string(i);
+  text.resize(record, '.');
+  return text;
+}
+
+auto pinned(const vtpc_pin_t& pin) -> std::string_view {
+  return {static_cast<const char*>(pin.data), pin.len};
+}
+
+void pin_or_throw(int fd, off_t offset, size_t len, vtpc_pin_t* pin) {
+  if (vtpc_pin(fd, offset, len, pin) == -1) {
+    throw vt::exception() << "failed to pin offset " << offset << ": "
+                          << strerror(errno);  // NOLINT
+  }
+}
+
+// Records are parsed in place, also while the rest of the file streams
+// through a pool too small to hold it.
+void records(int fd) {
+  constexpr size_t count = blocks * block_size / record;
+  for (size_t i = 0; i < count; ++i) {
+    if (vtpc_write(fd, record_text(i).data(), record) !=
+        static_cast<ssize_t>(record)) {
+      throw vt::exception() << "failed to write record " << i;
+    }
+  }
+
+  vtpc_pin_t first;
+  pin_or_throw(fd, 0, record, &first);
+  for (size_t i = 0; i < count; ++i) {
+    const auto offset = static_cast<off_t>(i * record);
+    vtpc_pin_t pin;
+    pin_or_throw(fd, offset, record, &pin);
+    const size_t expected =
+        std::min(record, block_size - (i * record % block_size));
+    if (pinned(pin) != record_text(i).substr(0, expected)) {
+      throw vt::exception() << "record " << i << ": '" << pinned(pin) << "'";
+    }
+    vtpc_unpin(&pin);
+  }
+  if (pinned(first) != record_text(0)) {
+    throw vt::exception() << "pinned block was evicted";
+  }
+  vtpc_unpin(&first);
+
+  vtpc_pin_t end;
+  pin_or_throw(fd, static_cast<off_t>(count * record), record, &end);
+  if (end.data != nullptr || end.len != 0) {
+    throw vt::exception() << "pinned past the end of the file";
+  }
+}
+
+// With every block pinned there is nothing to evict.
+void exhaust(int fd) {
+  vtpc_pin_t pins[capacity];
+  for (size_t i = 0; i < capacity; ++i) {
+    pin_or_throw(fd, static_cast<off_t>(i * block_size), 1, &pins[i]);
+  }
+  vtpc_pin_t pin;
+  const auto next = static_cast<off_t>(capacity * block_size);
+  if (vtpc_pin(fd, next, 1, &pin) != -1 || errno != ENOBUFS) {
+    throw vt::exception() << "pinned more blocks than the pool has";
+  }
+  for (vtpc_pin_t& held : pins) {
+    vtpc_unpin(&held);
+  }
+  pin_or_throw(fd, next, 1, &pin);
+  vtpc_unpin(&pin);
+}
+
+// A write to a pinned block waits for the pin to be released.
+void write_waits(int fd) {
+  vtpc_pin_t pin;
+  pin_or_throw(fd, 0, record, &pin);
+  const std::string before(pinned(pin));
+
+  std::atomic<bool> written = false;
+  std::jthread writer([fd, &written] {
+    const std::string text(record, '#');
+    (void)vtpc_pwrite(fd, text.data(), record, 0);
+    written = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));  // NOLINT
+  if (written || pinned(pin) != before) {
+    throw vt::exception() << "a pinned block was written";
+  }
+  vtpc_unpin(&pin);
+  writer.join();
+
+  pin_or_throw(fd, 0, record, &pin);
+  if (pinned(pin) != std::string(record, '#')) {
+    throw vt::exception() << "write after unpin lost: '" << pinned(pin)
+                          << "'";
+  }
+  vtpc_unpin(&pin);
+}
+
+}  // namespace
+
+auto main() -> int try {
+  vt::init_vtpc([](vtpc_config& config) {
+    config.block_size = block_size;
+    config.capacity = capacity;
+    config.shards = 1;
+    config.readahead = 0;
+    config.bypass = 0;
+  });
+
+  const int fd = vt::open_or_throw(path, O_RDWR | O_CREAT | O_TRUNC);
+  records(fd);
+  exhaust(fd);
+  write_waits(fd);
+  vt::close_or_throw(fd);
+  ::unlink(path.c_str());
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,109 @@
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+#include "exception.hpp"
+
+// Runs unmodified coreutils under the interposer built next to this test.
+
+namespace {
+
+constexpr const char* input = "/tmp/vtpc_preload_in";
+constexpr const char* output = "/tmp/vtpc_preload_out";
+constexpr const char* outside = "/tmp/vtpc_outside";
+constexpr const char* errors = "/tmp/vtpc_preload_err";
+
+auto slurp(const char* path) -> std::string {
+  std::ifstream in(path, std::ios::binary);
+  return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+}
+
+void spill(const char* path, const std::string& text) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out << text;
+}
+
+// Runs the command with its stderr in `errors` and returns its stdout.
+auto run(const std::string& command) -> std::string {
+  const std::string line = command + " 2>" + errors;
+  FILE* pipe = popen(line.c_str(), "r");  // NOLINT
+  if (pipe == nullptr) {
+    throw vt::exception() << "failed to run '" << command
+                          << "': " << strerror(errno);  // NOLINT
+  }
+  std::string out;
+  char chunk[4096];
+  size_t n = 0;
+  while ((n = fread(chunk, 1, sizeof(chunk), pipe)) > 0) {  // NOLINT
+    out.append(chunk, n);  // NOLINT
+  }
+  if (pclose(pipe) != 0) {
+    throw vt::exception() << "'" << command << "' failed: " << slurp(errors);
+  }
+  return out;
+}
+
+}  // namespace
+
+auto main() -> int try {
+  std::string text;
+  for (size_t i = 0; text.size() < 100000; ++i) {  // NOLINT
+    text += std::to_string(i) + '\n';
+  }
+  spill(input, text);
+  spill(outside, text);
+
+  setenv("LD_PRELOAD", VTPC_PRELOAD_LIB, 1);      // NOLINT
+  setenv("VTPC_PRELOAD", "/tmp/vtpc_preload_*", 1);  // NOLINT
+  setenv("VTPC_STATS", "1", 1);                    // NOLINT
+
+  // Reads through the cache, which reports its statistics at exit.
+  if (run(std::string("cat ") + input) != text) {
+    throw vt::exception() << "cat read different data through vtpc";
+  }
+  const std::string stats = slurp(errors);
+  if (stats.find("vtpc: hits=") == std::string::npos ||
+      stats.find("disk_read_bytes=0 ") != std::string::npos) {
+    throw vt::exception() << "cat did not read through vtpc: " << stats;
+  }
+
+  // dd reopens both files onto its stdin and stdout with dup2, and they stay
+  // in the cache.
+  run(std::string("dd status=none bs=1000 if=") + input + " of=" + output);
+  if (slurp(output) != text) {
+    throw vt::exception() << "dd wrote different data through vtpc";
+  }
+  const std::string dd_stats = slurp(errors);
+  if (dd_stats.find("vtpc: read count=") == std::string::npos ||
+      dd_stats.find("read count=0 ") != std::string::npos ||
+      dd_stats.find("write count=0 ") != std::string::npos) {
+    throw vt::exception() << "dd did not go through vtpc: " << dd_stats;
+  }
+
+  // dd truncates its output to where it starts writing, through the cache.
+  run(std::string("dd status=none bs=1000 count=1 seek=2 if=") + input +
+      " of=" + output);
+  if (slurp(output) != text.substr(0, 2000) + text.substr(0, 1000)) {
+    throw vt::exception() << "dd truncated differently through vtpc";
+  }
+
+  // Files not matching the pattern are left alone.
+  if (run(std::string("cat ") + outside) != text) {
+    throw vt::exception() << "cat read different data around vtpc";
+  }
+  if (slurp(errors).find("vtpc:") != std::string::npos) {
+    throw vt::exception() << "cat read a file outside of the pattern through "
+                             "vtpc";
+  }
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -34,12 +34,12 @@ auto main() -> int try {
   std::uniform_int_distribution<size_t> batch_dist(0, size / 4);
   std::uniform_int_distribution<uint8_t> char_dist(0);
 
-  const auto random_string = [&](size_t size) {
-    std::string string(size, ' ');
-    for (char& c : string) {
-      c = static_cast<char>(char_dist(random));
+  // Reused by every read and write, so steps allocate nothing.
+  std::string buffer(size / 4, ' ');
+  const auto random_fill = [&](size_t size) {
+    for (size_t j = 0; j < size; ++j) {
+      buffer[j] = static_cast<char>(char_dist(random));
     }
-    return string;
   };
 
   file->seek(0);
@@ -55,10 +55,11 @@ auto main() -> int try {
       size_t point = action_dist(random);
       if (point < 40) {  // NOLINT
         size_t batch = batch_dist(random);
-        file->read(batch);
+        file->read(buffer.data(), batch);
       } else if (point < 75) {  // NOLINT
         size_t batch = batch_dist(random);
-        file->write(random_string(batch));
+        random_fill(batch);
+        file->write(buffer.data(), batch);
       } else if (point < 95) {  // NOLINT
         file->seek(offset_dist(random));
       } else {
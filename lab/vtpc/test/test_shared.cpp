@@ -0,0 +1,219 @@
+#include <sys/types.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include "exception.hpp"
+#include "file.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t block_size = 4096;
+constexpr size_t capacity = 64;
+constexpr size_t shared_capacity = 1024;
+constexpr size_t blocks = 256;
+
+const std::string path = "/tmp/vtpc_shared_" + std::to_string(::getpid());
+const std::string name = "/vtpc_test_" + std::to_string(::getpid());
+
+void init(const char* shared, size_t size = block_size) {
+  vt::init_vtpc([&](vtpc_config& config) {
+    config.block_size = size;
+    config.capacity = capacity;
+    config.shared = shared;
+    config.shared_capacity = shared_capacity;
+  });
+  vtpc_stats_reset();
+}
+
+auto fill(size_t i) -> char {
+  return static_cast<char>('a' + (i % 26));
+}
+
+void create() {
+  init(nullptr);
+  const int fd = vt::open_or_throw(path, O_RDWR | O_CREAT | O_TRUNC);
+  for (size_t i = 0; i < blocks; ++i) {
+    const std::string text(block_size, fill(i));
+    if (vtpc_write(fd, text.data(), block_size) !=
+        static_cast<ssize_t>(block_size)) {
+      throw vt::exception() << "failed to write block " << i;
+    }
+  }
+  vt::close_or_throw(fd);
+}
+
+// Reads the file front to back and checks that block 0 is filled with
+// `first` and the rest with their own letters.
+auto read_all(char first) -> struct vtpc_stats {
+  const int fd = vt::open_or_throw(path, O_RDONLY);
+  std::string buffer(block_size, '\0');
+  for (size_t i = 0; i < blocks; ++i) {
+    if (vtpc_read(fd, buffer.data(), block_size) !=
+        static_cast<ssize_t>(block_size)) {
+      throw vt::exception() << "failed to read block " << i << ": "
+                            << strerror(errno);  // NOLINT
+    }
+    const char expected = i == 0 ? first : fill(i);
+    if (buffer != std::string(block_size, expected)) {
+      throw vt::exception() << "block " << i << " holds '" << buffer[0]
+                            << "', expected '" << expected << "'";
+    }
+  }
+  vt::close_or_throw(fd);
+  struct vtpc_stats stats;
+  vtpc_stats(&stats);
+  return stats;
+}
+
+// Another process attaches to the segment the parent filled: it reads
+// nothing from disk, and publishes the block it writes back.
+void child() {
+  init(name.c_str());
+  const struct vtpc_stats stats = read_all(fill(0));
+  if (stats.disk_read_bytes != 0 || stats.shared_hits < blocks) {
+    throw vt::exception() << "child read " << stats.disk_read_bytes
+                          << " bytes from disk, " << stats.shared_hits
+                          << " shared hits";
+  }
+  const int fd = vt::open_or_throw(path, O_WRONLY);
+  const std::string text(block_size, 'Z');
+  if (vtpc_write(fd, text.data(), block_size) !=
+      static_cast<ssize_t>(block_size)) {
+    throw vt::exception() << "failed to write: " << strerror(errno);  // NOLINT
+  }
+  vt::close_or_throw(fd);
+}
+
+template <typename Body>
+auto spawn(Body body) -> pid_t {
+  const pid_t pid = ::fork();
+  if (pid == -1) {
+    throw vt::exception() << "failed to fork: " << strerror(errno);  // NOLINT
+  }
+  if (pid == 0) {
+    try {
+      body();
+    } catch (const std::exception& e) {
+      std::cerr << "child: exception: " << e.what() << '\n';
+      ::_exit(1);
+    }
+    ::_exit(0);
+  }
+  return pid;
+}
+
+void join(pid_t pid) {
+  int status = 0;
+  if (::waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    throw vt::exception() << "child failed";
+  }
+}
+
+auto read_block(int fd) -> std::string {
+  std::string buffer(block_size, '\0');
+  if (vtpc_pread(fd, buffer.data(), block_size, 0) !=
+      static_cast<ssize_t>(block_size)) {
+    throw vt::exception() << "failed to read: " << strerror(errno);  // NOLINT
+  }
+  return buffer;
+}
+
+// A block cached by this process and written back by another one is read
+// again instead of served from the stale private copy.
+void stale_copy() {
+  int ready[2];
+  if (::pipe(ready) == -1) {
+    throw vt::exception() << "failed to pipe: " << strerror(errno);  // NOLINT
+  }
+  // Forked before the file is open here, so that the child can init.
+  const pid_t pid = spawn([&] {
+    char go = 0;
+    if (::read(ready[0], &go, 1) != 1) {
+      throw vt::exception() << "parent went away";
+    }
+    init(name.c_str());
+    const int fd = vt::open_or_throw(path, O_WRONLY);
+    const std::string text(block_size, 'Y');
+    if (vtpc_write(fd, text.data(), block_size) !=
+        static_cast<ssize_t>(block_size)) {
+      throw vt::exception()
+          << "failed to write: " << strerror(errno);  // NOLINT
+    }
+    vt::close_or_throw(fd);
+  });
+  const int fd = vt::open_or_throw(path, O_RDONLY);
+  const std::string before = read_block(fd);
+  if (::write(ready[1], "x", 1) != 1) {
+    throw vt::exception() << "failed to wake the child";
+  }
+  ::close(ready[0]);
+  ::close(ready[1]);
+  join(pid);
+  const std::string after = read_block(fd);
+  vt::close_or_throw(fd);
+  if (before != std::string(block_size, 'Z') ||
+      after != std::string(block_size, 'Y')) {
+    throw vt::exception() << "read '" << before[0] << "' then '" << after[0]
+                          << "', expected 'Z' then 'Y'";
+  }
+}
+
+}  // namespace
+
+auto main() -> int try {
+  (void)::shm_unlink(name.c_str());
+  create();
+
+  init(name.c_str());
+  const struct vtpc_stats first = read_all(fill(0));
+  if (first.shared_hits != 0 || first.disk_read_bytes < blocks * block_size) {
+    throw vt::exception() << "first reader: " << first.disk_read_bytes
+                          << " bytes from disk, " << first.shared_hits
+                          << " shared hits";
+  }
+
+  join(spawn(child));
+
+  // The block the child wrote is served from the segment, like the rest.
+  init(name.c_str());
+  const struct vtpc_stats again = read_all('Z');
+  if (again.disk_read_bytes != 0) {
+    throw vt::exception() << "second pass read " << again.disk_read_bytes
+                          << " bytes from disk";
+  }
+  stale_copy();
+
+  // The segment keeps the block size it was created with.
+  if (vt::try_init_vtpc([](vtpc_config& config) {
+        config.block_size = 2 * block_size;
+        config.shared = name.c_str();
+      }) ||
+      errno != EINVAL) {
+    throw vt::exception() << "attached with another block size";
+  }
+
+  init(nullptr);
+  (void)::shm_unlink(name.c_str());
+  ::unlink(path.c_str());
+  return 0;
+} catch (const std::exception& e) {
+  (void)::shm_unlink(name.c_str());
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,167 @@
+#include <sys/types.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "exception.hpp"
+#include "file.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t block_size = 4096;
+constexpr size_t capacity = 8;
+constexpr size_t blocks = 16;
+constexpr size_t threads = 4;
+constexpr size_t reads = 100;
+
+const std::string path = "/tmp/vtpc_stats_" + std::to_string(::getpid());
+
+void expect(const char* what, uint64_t actual, uint64_t expected) {
+  if (actual != expected) {
+    throw vt::exception() << what << ": " << actual << ", expected "
+                          << expected;
+  }
+}
+
+auto snapshot() -> struct vtpc_stats {
+  struct vtpc_stats stats;
+  vtpc_stats(&stats);
+  return stats;
+}
+
+void read_block(int fd, size_t index) {
+  std::string buffer(block_size, '\0');
+  const auto offset = static_cast<off_t>(index * block_size);
+  if (vtpc_pread(fd, buffer.data(), block_size, offset) !=
+      static_cast<ssize_t>(block_size)) {
+    throw vt::exception() << "failed to read block " << index << ": "
+                          << strerror(errno);  // NOLINT
+  }
+}
+
+void check_latency(const char* what, const vtpc_latency& latency) {
+  uint64_t count = 0;
+  for (const uint64_t bucket : latency.buckets) {
+    count += bucket;
+  }
+  expect(what, count, latency.count);
+  if (latency.p50_ns > latency.p99_ns || latency.p99_ns > latency.p999_ns ||
+      latency.p999_ns > latency.max_ns || latency.max_ns > latency.total_ns) {
+    throw vt::exception() << what << ": p50 " << latency.p50_ns << ", p99 "
+                          << latency.p99_ns << ", p999 " << latency.p999_ns
+                          << ", max " << latency.max_ns << ", total "
+                          << latency.total_ns;
+  }
+}
+
+// Writing twice the pool evicts and writes back its first half, fsync the
+// rest. Without the flusher, the evicting writes write the first half.
+void writes(int fd) {
+  const std::string text(block_size, 'x');
+  for (size_t i = 0; i < blocks; ++i) {
+    if (vtpc_write(fd, text.data(), block_size) !=
+        static_cast<ssize_t>(block_size)) {
+      throw vt::exception() << "failed to write block " << i;
+    }
+  }
+  if (vtpc_fsync(fd) == -1) {
+    throw vt::exception() << "failed to fsync: " << strerror(errno);  // NOLINT
+  }
+
+  const struct vtpc_stats s = snapshot();
+  expect("write misses", s.misses, blocks);
+  expect("write hits", s.hits, 0);
+  expect("write evictions", s.evictions, blocks - capacity);
+  expect("writebacks", s.writebacks, blocks);
+  expect("foreground writebacks", s.foreground_writebacks, blocks - capacity);
+  expect("bytes written", s.disk_write_bytes, blocks * block_size);
+  expect("bytes read", s.disk_read_bytes, 0);
+  expect("writes", s.latency[VTPC_OP_WRITE].count, blocks);
+  expect("fsyncs", s.latency[VTPC_OP_FSYNC].count, 1);
+  expect("miss services", s.latency[VTPC_OP_MISS].count, blocks);
+  check_latency("write", s.latency[VTPC_OP_WRITE]);
+}
+
+// The second half of the file is resident, the first is read from disk.
+void reads_after_reset(int fd) {
+  vtpc_stats_reset();
+  read_block(fd, blocks - 1);
+  read_block(fd, 0);
+  read_block(fd, 0);
+
+  const struct vtpc_stats s = snapshot();
+  expect("read hits", s.hits, 2);
+  expect("read misses", s.misses, 1);
+  expect("read evictions", s.evictions, 1);
+  expect("bytes read", s.disk_read_bytes, block_size);
+  expect("reads", s.latency[VTPC_OP_READ].count, 3);
+  expect("writes after reset", s.latency[VTPC_OP_WRITE].count, 0);
+  check_latency("read", s.latency[VTPC_OP_READ]);
+  check_latency("miss", s.latency[VTPC_OP_MISS]);
+}
+
+// The counters of threads that have exited are kept.
+void exited_threads(int fd) {
+  const struct vtpc_stats before = snapshot();
+  {
+    std::vector<std::jthread> workers;
+    for (size_t i = 0; i < threads; ++i) {
+      workers.emplace_back([fd] {
+        for (size_t j = 0; j < reads; ++j) {
+          read_block(fd, 0);
+        }
+      });
+    }
+  }
+  const struct vtpc_stats after = snapshot();
+  expect("thread hits", after.hits - before.hits, threads * reads);
+  expect(
+      "thread reads",
+      after.latency[VTPC_OP_READ].count - before.latency[VTPC_OP_READ].count,
+      threads * reads
+  );
+  check_latency("thread read", after.latency[VTPC_OP_READ]);
+}
+
+}  // namespace
+
+auto main() -> int try {
+  vt::init_vtpc([](vtpc_config& config) {
+    config.block_size = block_size;
+    config.capacity = capacity;
+    config.shards = 1;
+    config.readahead = 0;
+    config.scan = 0;
+    config.bypass = 0;
+    config.flusher = false;
+  });
+  vtpc_stats_reset();
+
+  const int fd = vt::open_or_throw(path, O_RDWR | O_CREAT | O_TRUNC);
+  writes(fd);
+  reads_after_reset(fd);
+  exited_threads(fd);
+  if (vtpc_stats_dump(STDOUT_FILENO) == -1) {
+    throw vt::exception() << "failed to dump: " << strerror(errno);  // NOLINT
+  }
+  vt::close_or_throw(fd);
+  ::unlink(path.c_str());
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,127 @@
+#include <sys/types.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "exception.hpp"
+#include "file.hpp"
+
+extern "C" {
+#include <unistd.h>
+}
+
+namespace {
+
+constexpr size_t threads = 8;
+constexpr size_t stripe = (1U << 16U);
+constexpr size_t rounds = 4;
+constexpr size_t reads = 2000;
+
+const std::string path = "/tmp/vtpc_threads_" + std::to_string(::getpid());
+
+auto pattern(size_t round, size_t offset) -> char {
+  return static_cast<char>('a' + ((round * 7 + offset / 97) % 26));
+}
+
+auto stripe_text(size_t round, size_t thread) -> std::string {
+  std::string text(stripe, ' ');
+  for (size_t i = 0; i < stripe; ++i) {
+    text[i] = pattern(round, (thread * stripe) + i);
+  }
+  return text;
+}
+
+// Every thread owns a stripe of the file and rewrites it each round, then
+// all of them read random ranges of the whole file through their own
+// descriptors and check them against the round.
+void worker(size_t id, std::atomic<size_t>& ready, std::atomic<bool>& failed) {
+  auto file = vt::file::open_vtpc(path);
+  std::default_random_engine random(id);  // NOLINT
+  std::uniform_int_distribution<size_t> offset_dist(0, (threads * stripe) - 1);
+
+  for (size_t round = 0; round < rounds; ++round) {
+    file->seek(static_cast<off_t>(id * stripe));
+    file->write(stripe_text(round, id));
+    file->sync();
+
+    ready.fetch_add(1);
+    while (ready.load() < ((2 * round) + 1) * threads) {
+      std::this_thread::yield();
+    }
+
+    for (size_t i = 0; i < reads; ++i) {
+      const size_t offset = offset_dist(random);
+      const size_t count = std::min<size_t>(
+          (threads * stripe) - offset, 1 + (offset_dist(random) % 9000)
+      );
+      file->seek(static_cast<off_t>(offset));
+      const std::string text = file->read(count);
+      for (size_t j = 0; j < count; ++j) {
+        if (text[j] != pattern(round, offset + j)) {
+          throw vt::exception() << "thread " << id << " round " << round
+                                << " offset " << offset + j << ": '"
+                                << text[j] << "'";
+        }
+      }
+    }
+
+    ready.fetch_add(1);
+    while (ready.load() < ((2 * round) + 2) * threads) {
+      std::this_thread::yield();
+    }
+    if (failed.load()) {
+      return;
+    }
+  }
+}
+
+}  // namespace
+
+auto main() -> int try {
+  {
+    auto file = vt::file::open_libc(path);
+    file->write(std::string(threads * stripe, ' '));
+  }
+
+  std::atomic<size_t> ready = 0;
+  std::atomic<bool> failed = false;
+  {
+    std::vector<std::jthread> workers;
+    for (size_t id = 0; id < threads; ++id) {
+      workers.emplace_back([id, &ready, &failed] {
+        try {
+          worker(id, ready, failed);
+        } catch (const std::exception& e) {
+          std::cerr << "exception: " << e.what() << '\n';
+          failed = true;
+          // Let the others pass the barriers.
+          ready.fetch_add(2 * rounds * threads);
+        }
+      });
+    }
+  }
+  if (failed) {
+    return 1;
+  }
+
+  auto file = vt::file::open_libc(path);
+  for (size_t id = 0; id < threads; ++id) {
+    if (file->read(stripe) != stripe_text(rounds - 1, id)) {
+      throw vt::exception() << "stripe " << id << " differs on disk";
+    }
+  }
+  ::unlink(path.c_str());
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,151 @@
+#include <sys/types.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "exception.hpp"
+#include "file.hpp"
+#include "log_file.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t block_size = 4096;
+constexpr size_t blocks = 4;
+constexpr const char* path = "/tmp/r";
+constexpr const char* trace_path = "/tmp/r.trace";
+constexpr const char* log_path = "/tmp/l.trace";
+
+void init(const char* trace) {
+  vt::init_vtpc([&](vtpc_config& config) {
+    config.block_size = block_size;
+    config.trace = trace;
+  });
+}
+
+auto read_trace(const char* path) -> std::vector<vtpc_trace_record> {
+  const int fd = ::open(path, O_RDONLY);  // NOLINT
+  if (fd == -1) {
+    throw vt::exception() << "failed to open " << path << ": "
+                          << strerror(errno);  // NOLINT
+  }
+  std::vector<vtpc_trace_record> records(64);
+  const ssize_t n = ::read(
+      fd, records.data(), records.size() * sizeof(vtpc_trace_record)
+  );
+  ::close(fd);
+  if (n < 0 || n % sizeof(vtpc_trace_record) != 0) {
+    throw vt::exception() << "bad trace " << path << " of " << n << " bytes";
+  }
+  records.resize(static_cast<size_t>(n) / sizeof(vtpc_trace_record));
+  return records;
+}
+
+struct expected {
+  uint32_t op;
+  uint64_t offset;
+  uint32_t length;
+};
+
+void check(
+    const char* what, const std::vector<vtpc_trace_record>& records,
+    const std::vector<expected>& expected
+) {
+  if (records.size() != expected.size()) {
+    throw vt::exception() << what << ": " << records.size()
+                          << " records, expected " << expected.size();
+  }
+  for (size_t i = 0; i < records.size(); ++i) {
+    const vtpc_trace_record& r = records[i];
+    const auto& e = expected[i];
+    if (r.op != e.op || r.offset != e.offset || r.length != e.length ||
+        r.file != records[0].file || r.fd != records[0].fd ||
+        r.time_ns < records[i == 0 ? 0 : i - 1].time_ns) {
+      throw vt::exception() << what << ": record " << i << " is op " << r.op
+                            << " at " << r.offset << " of " << r.length;
+    }
+  }
+}
+
+// Whole writes, a positional read, a read past the end which transfers
+// nothing and is not recorded, and fsync.
+void vtpc_trace() {
+  init(trace_path);
+  const int fd = vt::open_or_throw(path, O_RDWR | O_CREAT | O_TRUNC);
+  std::string buffer(block_size, 'x');
+  for (size_t i = 0; i < blocks; ++i) {
+    if (vtpc_write(fd, buffer.data(), block_size) !=
+        static_cast<ssize_t>(block_size)) {
+      throw vt::exception() << "failed to write block " << i;
+    }
+  }
+  if (vtpc_pread(fd, buffer.data(), 100, block_size + 10) != 100 ||
+      vtpc_read(fd, buffer.data(), block_size) != 0 || vtpc_fsync(fd) == -1 ||
+      vtpc_close(fd) == -1) {
+    throw vt::exception() << "failed to access: " << strerror(errno);  // NOLINT
+  }
+  // Restarting without a trace flushes and closes the old one.
+  init(nullptr);
+
+  std::vector<expected> expected;
+  for (size_t i = 0; i < blocks; ++i) {
+    expected.push_back({VTPC_TRACE_WRITE, i * block_size, block_size});
+  }
+  expected.push_back({VTPC_TRACE_READ, block_size + 10, 100});
+  expected.push_back({VTPC_TRACE_FSYNC, 0, 0});
+  const auto records = read_trace(trace_path);
+  check("vtpc", records, expected);
+  if (records[0].fd != fd) {
+    throw vt::exception() << "traced fd " << records[0].fd << ", opened "
+                          << fd;
+  }
+}
+
+// The binary mode of log_file follows the offset of the file it wraps.
+void log_trace() {
+  {
+    const auto file = std::make_unique<vt::log_file>(
+        vt::file::open_libc(path), log_path
+    );
+    file->seek(0);
+    file->write(std::string(300, 'y'));
+    file->seek(100);
+    (void)file->read(50);
+    (void)file->read(20);
+    file->sync();
+  }
+  check(
+      "log_file",
+      read_trace(log_path),
+      {
+          {VTPC_TRACE_WRITE, 0, 300},
+          {VTPC_TRACE_READ, 100, 50},
+          {VTPC_TRACE_READ, 150, 20},
+          {VTPC_TRACE_FSYNC, 0, 0},
+      }
+  );
+}
+
+}  // namespace
+
+auto main() -> int try {
+  vtpc_trace();
+  log_trace();
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
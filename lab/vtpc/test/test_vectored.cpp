@@ -0,0 +1,298 @@
+#include <sys/types.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "exception.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t size = (1U << 14U);
+constexpr size_t steps = (1U << 14U);
+constexpr size_t max_iov = 6;
+constexpr size_t align = 4096;
+
+struct io {
+  int fd;
+  ssize_t (*pread)(int fd, void* buf, size_t count, off_t offset);
+  ssize_t (*pwrite)(int fd, const void* buf, size_t count, off_t offset);
+  ssize_t (*readv)(int fd, const struct iovec* iov, int iovcnt);
+  ssize_t (*writev)(int fd, const struct iovec* iov, int iovcnt);
+  off_t (*lseek)(int fd, off_t offset, int whence);
+  int (*fsync)(int fd);
+};
+
+constexpr int flags = O_RDWR | O_CREAT | O_TRUNC;
+constexpr int mode = 0777;
+
+const std::string prefix = "/tmp/vtpc_vectored_" + std::to_string(::getpid());
+const std::string libc_path = prefix + "_libc";
+const std::string vtpc_path = prefix + "_vtpc";
+const std::string shared_path = prefix + "_shared";
+
+auto checked_fd(int fd, const char* path) -> int {
+  if (fd == -1) {
+    throw vt::exception() << "failed to open '" << path
+                          << "': " << strerror(errno);  // NOLINT
+  }
+  return fd;
+}
+
+// Splits `buffer` into up to `max_iov` buffers, some of them empty.
+auto split(std::default_random_engine& random, char* buffer, size_t count)
+    -> std::vector<iovec> {
+  std::uniform_int_distribution<size_t> parts_dist(1, max_iov);
+  std::vector<iovec> iov(parts_dist(random));
+  for (size_t i = 0; i < iov.size(); ++i) {
+    std::uniform_int_distribution<size_t> len_dist(0, count);
+    const size_t len = i + 1 == iov.size() ? count : len_dist(random);
+    iov[i] = {.iov_base = buffer, .iov_len = len};
+    buffer += len;  // NOLINT
+    count -= len;
+  }
+  return iov;
+}
+
+void check(const char* what, size_t step, ssize_t libc, ssize_t vtpc) {
+  if (libc != vtpc) {
+    throw vt::exception() << what << " at step " << step << ": libc " << libc
+                          << ", vtpc " << vtpc;
+  }
+}
+
+// Runs the same random positional and vectored calls against libc and vtpc
+// and compares every result.
+void compare(const io& libc, const io& vtpc) {
+  std::default_random_engine random(1);  // NOLINT
+  std::uniform_int_distribution<size_t> action_dist(0, 100);  // NOLINT
+  std::uniform_int_distribution<off_t> offset_dist(0, size);
+  std::uniform_int_distribution<size_t> batch_dist(0, size / 2);
+  std::uniform_int_distribution<uint8_t> char_dist(0);
+
+  // Aligned, so that requests at aligned offsets can bypass the cache
+  // without a bounce buffer.
+  const std::unique_ptr<char, decltype(&std::free)> b_buffer(
+      static_cast<char*>(std::aligned_alloc(align, size)), &std::free
+  );
+  std::string a(size, ' ');
+  std::span<char> b(b_buffer.get(), size);
+  std::ranges::copy(a, b.begin());
+  check(
+      "write",
+      0,
+      libc.pwrite(libc.fd, a.data(), size, 0),
+      vtpc.pwrite(vtpc.fd, b.data(), size, 0)
+  );
+
+  for (size_t step = 0; step < steps; ++step) {
+    const size_t point = action_dist(random);
+    const size_t count = batch_dist(random);
+    off_t offset = offset_dist(random);
+    if (point % 2 == 0) {
+      offset -= offset % static_cast<off_t>(align);
+    }
+    a.assign(count, ' ');
+    for (char& c : a) {
+      c = static_cast<char>(char_dist(random));
+    }
+    b = std::span<char>(b_buffer.get(), count);
+    std::ranges::copy(a, b.begin());
+
+    if (point < 25) {  // NOLINT
+      check(
+          "pread",
+          step,
+          libc.pread(libc.fd, a.data(), count, offset),
+          vtpc.pread(vtpc.fd, b.data(), count, offset)
+      );
+    } else if (point < 45) {  // NOLINT
+      check(
+          "pwrite",
+          step,
+          libc.pwrite(libc.fd, a.data(), count, offset),
+          vtpc.pwrite(vtpc.fd, b.data(), count, offset)
+      );
+    } else if (point < 65) {  // NOLINT
+      const auto seed = random();
+      std::default_random_engine split_random(seed);
+      auto a_iov = split(split_random, a.data(), count);
+      split_random.seed(seed);
+      auto b_iov = split(split_random, b.data(), count);
+      check(
+          "readv",
+          step,
+          libc.readv(libc.fd, a_iov.data(), static_cast<int>(a_iov.size())),
+          vtpc.readv(vtpc.fd, b_iov.data(), static_cast<int>(b_iov.size()))
+      );
+    } else if (point < 85) {  // NOLINT
+      const auto seed = random();
+      std::default_random_engine split_random(seed);
+      auto a_iov = split(split_random, a.data(), count);
+      split_random.seed(seed);
+      auto b_iov = split(split_random, b.data(), count);
+      check(
+          "writev",
+          step,
+          libc.writev(libc.fd, a_iov.data(), static_cast<int>(a_iov.size())),
+          vtpc.writev(vtpc.fd, b_iov.data(), static_cast<int>(b_iov.size()))
+      );
+    } else if (point < 98) {  // NOLINT
+      check(
+          "lseek",
+          step,
+          libc.lseek(libc.fd, offset, SEEK_SET),
+          vtpc.lseek(vtpc.fd, offset, SEEK_SET)
+      );
+    } else {
+      check("fsync", step, libc.fsync(libc.fd), vtpc.fsync(vtpc.fd));
+    }
+    if (!std::ranges::equal(a, b)) {
+      throw vt::exception() << "data differs at step " << step;
+    }
+  }
+
+  check(
+      "lseek",
+      steps,
+      libc.lseek(libc.fd, 0, SEEK_CUR),
+      vtpc.lseek(vtpc.fd, 0, SEEK_CUR)
+  );
+}
+
+// Cuts both files inside a block, extends them past the cut and compares
+// what is read back, the cut tail reading as zeros.
+void truncated(const io& libc, const io& vtpc) {
+  constexpr off_t cut = (size / 2) + 100;
+  check(
+      "ftruncate", 0, ::ftruncate(libc.fd, cut), ::vtpc_ftruncate(vtpc.fd, cut)
+  );
+  struct stat st = {};
+  if (::vtpc_fstat(vtpc.fd, &st) == -1 || st.st_size != cut) {
+    throw vt::exception() << "size " << st.st_size << " after truncating";
+  }
+  const std::string tail(align, 'x');
+  check(
+      "pwrite",
+      0,
+      libc.pwrite(libc.fd, tail.data(), align, size),
+      vtpc.pwrite(vtpc.fd, tail.data(), align, size)
+  );
+  std::string a(size + align, ' ');
+  std::string b(size + align, ' ');
+  check(
+      "pread",
+      0,
+      libc.pread(libc.fd, a.data(), a.size(), 0),
+      vtpc.pread(vtpc.fd, b.data(), b.size(), 0)
+  );
+  if (a != b) {
+    throw vt::exception() << "data differs after truncating";
+  }
+}
+
+// Threads write and read their own stripes through one shared descriptor.
+void shared(const char* path) {
+  const int fd = checked_fd(::vtpc_open(path, flags, mode), path);
+  constexpr size_t threads = 4;
+  constexpr size_t stripe = size / threads;
+  constexpr size_t rounds = 64;
+
+  std::vector<std::jthread> workers;
+  std::vector<std::string> errors(threads);
+  for (size_t id = 0; id < threads; ++id) {
+    workers.emplace_back([fd, id, &errors] {
+      const auto offset = static_cast<off_t>(id * stripe);
+      for (size_t round = 0; round < rounds && errors[id].empty(); ++round) {
+        const std::string text(stripe, static_cast<char>('a' + id + round));
+        std::string back(stripe, ' ');
+        if (vtpc_pwrite(fd, text.data(), stripe, offset) !=
+                static_cast<ssize_t>(stripe) ||
+            vtpc_pread(fd, back.data(), stripe, offset) !=
+                static_cast<ssize_t>(stripe) ||
+            back != text) {
+          errors[id] = "stripe " + std::to_string(id) + " round " +
+                       std::to_string(round);
+        }
+      }
+    });
+  }
+  workers.clear();
+  for (const std::string& error : errors) {
+    if (!error.empty()) {
+      throw vt::exception() << "shared descriptor: " << error;
+    }
+  }
+  (void)::vtpc_close(fd);
+}
+
+}  // namespace
+
+auto main() -> int try {
+  const io libc = {
+      .fd = checked_fd(
+          ::open(libc_path.c_str(), flags, mode), libc_path.c_str()
+      ),
+      .pread = ::pread,
+      .pwrite = ::pwrite,
+      .readv = ::readv,
+      .writev = ::writev,
+      .lseek = ::lseek,
+      .fsync = ::fsync,
+  };
+  const io vtpc = {
+      .fd = checked_fd(
+          ::vtpc_open(vtpc_path.c_str(), flags, mode), vtpc_path.c_str()
+      ),
+      .pread = ::vtpc_pread,
+      .pwrite = ::vtpc_pwrite,
+      .readv = ::vtpc_readv,
+      .writev = ::vtpc_writev,
+      .lseek = ::vtpc_lseek,
+      .fsync = ::vtpc_fsync,
+  };
+
+  compare(libc, vtpc);
+  truncated(libc, vtpc);
+  // A seek past the largest offset fails and keeps the position.
+  const off_t pos = ::vtpc_lseek(vtpc.fd, 0, SEEK_CUR);
+  if (::vtpc_lseek(vtpc.fd, std::numeric_limits<off_t>::max(), SEEK_END) !=
+          -1 ||
+      errno != EOVERFLOW || ::vtpc_lseek(vtpc.fd, 0, SEEK_CUR) != pos) {
+    throw vt::exception() << "seek past the largest offset";
+  }
+  (void)::close(libc.fd);
+  if (::vtpc_close(vtpc.fd) == -1) {
+    throw vt::exception() << "failed to close: " << strerror(errno);  // NOLINT
+  }
+
+  shared(shared_path.c_str());
+  for (const std::string& path : {libc_path, vtpc_path, shared_path}) {
+    ::unlink(path.c_str());
+  }
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,160 @@
+#include <sys/types.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+#include "exception.hpp"
+#include "file.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t block_size = 4096;
+constexpr size_t blocks = 128;
+constexpr size_t hot = 64;
+constexpr const char* path = "/tmp/w";
+
+const std::filesystem::path dir =
+    "/tmp/vtpc_warm_" + std::to_string(::getpid());
+
+void init(size_t capacity, const char* warm) {
+  vt::init_vtpc([&](vtpc_config& config) {
+    config.block_size = block_size;
+    config.capacity = capacity;
+    config.hugepages = "none";
+    config.warm = warm;
+  });
+  vtpc_stats_reset();
+}
+
+auto stats() -> struct vtpc_stats {
+  struct vtpc_stats stats;
+  vtpc_stats(&stats);
+  return stats;
+}
+
+auto manifests() -> size_t {
+  size_t count = 0;
+  for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+    count += entry.path().extension() == ".warm" ? 1 : 0;
+  }
+  return count;
+}
+
+void wait_warm(size_t expected, const char* what) {
+  if (!vt::wait_until([&] { return stats().warm_blocks >= expected; })) {
+    throw vt::exception() << what << ": " << stats().warm_blocks
+                          << " blocks loaded, expected " << expected;
+  }
+  if (stats().warm_blocks != expected) {
+    throw vt::exception() << what << ": loaded " << stats().warm_blocks
+                          << " blocks, expected " << expected;
+  }
+}
+
+void read_blocks(int fd, size_t count) {
+  std::string buffer(block_size, '\0');
+  for (size_t i = 0; i < count; ++i) {
+    const auto offset = static_cast<off_t>(i * block_size);
+    if (vtpc_pread(fd, buffer.data(), block_size, offset) !=
+            static_cast<ssize_t>(block_size) ||
+        buffer != std::string(block_size, static_cast<char>('a' + (i % 26)))) {
+      throw vt::exception() << "block " << i << " is wrong";
+    }
+  }
+}
+
+void expect_no_misses(const char* what) {
+  if (stats().misses != 0) {
+    throw vt::exception() << what << ": " << stats().misses << " misses";
+  }
+}
+
+void run() {
+  const std::string warm = dir.string();
+
+  // A run writes the file and keeps rereading the first half.
+  init(blocks * 2, warm.c_str());
+  int fd = vt::open_or_throw(path, O_RDWR | O_CREAT | O_TRUNC);
+  for (size_t i = 0; i < blocks; ++i) {
+    const std::string text(block_size, static_cast<char>('a' + (i % 26)));
+    if (vtpc_write(fd, text.data(), block_size) !=
+        static_cast<ssize_t>(block_size)) {
+      throw vt::exception() << "failed to write block " << i;
+    }
+  }
+  for (size_t pass = 0; pass < 8; ++pass) {
+    read_blocks(fd, hot);
+  }
+  vt::close_or_throw(fd);
+  if (manifests() != 1) {
+    throw vt::exception() << manifests() << " manifests after closing";
+  }
+
+  // The next one finds all of it resident.
+  init(blocks * 2, warm.c_str());
+  fd = vt::open_or_throw(path, O_RDWR);
+  wait_warm(blocks, "restart");
+  read_blocks(fd, blocks);
+  expect_no_misses("restart");
+  vt::close_or_throw(fd);
+
+  // A smaller pool takes the hottest blocks only.
+  init(hot, warm.c_str());
+  fd = vt::open_or_throw(path, O_RDWR);
+  wait_warm(hot, "small pool");
+  read_blocks(fd, hot);
+  expect_no_misses("small pool");
+  if (vtpc_warm_save(fd) == -1) {
+    throw vt::exception() << "failed to save: " << strerror(errno);  // NOLINT
+  }
+  vt::close_or_throw(fd);
+
+  // A file changed behind the cache drops its manifest.
+  struct timespec times[2] = {{0, UTIME_OMIT}, {1, 0}};
+  if (::utimensat(AT_FDCWD, path, times, 0) == -1) {
+    throw vt::exception() << "failed to touch: " << strerror(errno);  // NOLINT
+  }
+  init(blocks * 2, warm.c_str());
+  fd = vt::open_or_throw(path, O_RDWR);
+  if (manifests() != 0 || stats().warm_blocks != 0) {
+    throw vt::exception() << "used the manifest of a changed file";
+  }
+  vt::close_or_throw(fd);
+
+  // A file closed without any block accessed leaves none.
+  if (manifests() != 0) {
+    throw vt::exception() << "recorded an untouched file";
+  }
+
+  init(blocks, nullptr);
+  fd = vt::open_or_throw(path, O_RDWR);
+  if (vtpc_warm_save(fd) != -1 || errno != EINVAL) {
+    throw vt::exception() << "saved without a manifest directory";
+  }
+  vt::close_or_throw(fd);
+}
+
+}  // namespace
+
+auto main() -> int try {
+  run();
+  std::filesystem::remove_all(dir);
+  return 0;
+} catch (const std::exception& e) {
+  std::filesystem::remove_all(dir);
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
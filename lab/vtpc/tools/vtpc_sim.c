@@ -0,0 +1,534 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+#include "vtpc_policy.h"
+
+// Replays an access trace, written by vtpc with VTPC_TRACE or by the binary
+// mode of vt::log_file, against every replacement policy at a range of pool
+// sizes, and prints the hit ratio and the disk traffic each would cause.
+//
+// Only the policy is simulated: one shard, no readahead, scans, bypass or
+// admission. A miss reads the block unless a write replaces all of it, a
+// dirty block is written back when evicted, at fsync of its file or at the
+// end. "opt" knows the whole trace, so it is Belady's bound.
+
+#define DEFAULT_BLOCK_SIZE 4096
+#define MIN_BLOCK_SIZE 512  // As vtpc_cache_init requires.
+#define MIN_CAPACITY 16
+#define MAX_CAPACITIES 64
+
+enum access_kind {
+  ACCESS_READ,
+  ACCESS_WRITE,  // Of part of the block.
+  ACCESS_OVERWRITE,
+  ACCESS_FSYNC,
+};
+
+struct access {
+  uint64_t index;
+  uint64_t next;  // Position of the next access of the block, or VTPC_NEVER.
+  uint32_t file;  // Dense, from 0.
+  uint32_t kind;
+};
+
+struct trace {
+  struct access* accesses;
+  size_t count;
+  size_t files;
+  size_t blocks;  // Distinct blocks accessed.
+};
+
+// Open addressing from (file, index) to a value, for the passes over the
+// trace; entries are never removed.
+struct table_entry {
+  uint64_t file;
+  uint64_t index;
+  uint64_t value;
+  bool used;
+};
+
+struct table {
+  struct table_entry* entries;
+  size_t mask;
+  size_t size;
+};
+
+static int table_init(struct table* table) {
+  table->mask = 1023;
+  table->size = 0;
+  table->entries = calloc(table->mask + 1, sizeof(struct table_entry));
+  return table->entries == NULL ? -1 : 0;
+}
+
+static struct table_entry* table_slot(
+    struct table_entry* entries, size_t mask, uint64_t file, uint64_t index
+) {
+  size_t i = vtpc_hash_key(file, index) & mask;
+  while (entries[i].used &&
+         (entries[i].file != file || entries[i].index != index)) {
+    i = (i + 1) & mask;
+  }
+  return &entries[i];
+}
+
+static int table_grow(struct table* table) {
+  const size_t mask = (2 * (table->mask + 1)) - 1;
+  struct table_entry* entries = calloc(mask + 1, sizeof(struct table_entry));
+  if (entries == NULL) {
+    return -1;
+  }
+  for (size_t i = 0; i <= table->mask; ++i) {
+    if (table->entries[i].used) {
+      const struct table_entry* old = &table->entries[i];
+      *table_slot(entries, mask, old->file, old->index) = *old;
+    }
+  }
+  free(table->entries);
+  table->entries = entries;
+  table->mask = mask;
+  return 0;
+}
+
+// Returns the entry of the key, adding it with `value` if missing.
+static struct table_entry* table_get(
+    struct table* table, uint64_t file, uint64_t index, uint64_t value
+) {
+  if (2 * (table->size + 1) > table->mask + 1 && table_grow(table) == -1) {
+    return NULL;
+  }
+  struct table_entry* entry =
+      table_slot(table->entries, table->mask, file, index);
+  if (!entry->used) {
+    *entry = (struct table_entry){
+        .file = file, .index = index, .value = value, .used = true
+    };
+    table->size++;
+  }
+  return entry;
+}
+
+static struct vtpc_trace_record* read_records(const char* path, size_t* count) {
+  const int fd = open(path, O_RDONLY);  // NOLINT
+  if (fd == -1) {
+    return NULL;
+  }
+  size_t size = 0;
+  size_t cap = 1U << 16U;
+  char* data = malloc(cap);
+  while (data != NULL) {
+    if (size == cap) {
+      cap *= 2;
+      char* grown = realloc(data, cap);
+      if (grown == NULL) {
+        free(data);
+        data = NULL;
+        break;
+      }
+      data = grown;
+    }
+    const ssize_t n = read(fd, data + size, cap - size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      free(data);
+      data = NULL;
+    } else if (n == 0) {
+      break;
+    } else {
+      size += (size_t)n;
+    }
+  }
+  close(fd);
+  if (data != NULL && size % sizeof(struct vtpc_trace_record) != 0) {
+    free(data);
+    errno = EINVAL;
+    return NULL;
+  }
+  *count = size / sizeof(struct vtpc_trace_record);
+  return (struct vtpc_trace_record*)data;
+}
+
+static int push(struct trace* trace, size_t* cap, struct access access) {
+  if (trace->count == *cap) {
+    *cap = *cap == 0 ? 1024 : *cap * 2;
+    struct access* grown =
+        realloc(trace->accesses, *cap * sizeof(struct access));
+    if (grown == NULL) {
+      return -1;
+    }
+    trace->accesses = grown;
+  }
+  trace->accesses[trace->count++] = access;
+  return 0;
+}
+
+// Splits the records into block accesses, numbers the files densely and
+// links every access to the next one of its block.
+static int load(
+    struct trace* trace, const struct vtpc_trace_record* records,
+    size_t count, size_t block_size
+) {
+  memset(trace, 0, sizeof(*trace));
+  struct table files;
+  struct table blocks;
+  if (table_init(&files) == -1) {
+    return -1;
+  }
+  if (table_init(&blocks) == -1) {
+    free(files.entries);
+    return -1;
+  }
+  int result = 0;
+  size_t cap = 0;
+  for (size_t i = 0; i < count && result == 0; ++i) {
+    const struct vtpc_trace_record* record = &records[i];
+    struct table_entry* file =
+        table_get(&files, record->file, 0, files.size);
+    if (file == NULL) {
+      result = -1;
+      break;
+    }
+    struct access access = {.file = (uint32_t)file->value};
+    if (record->op == VTPC_TRACE_FSYNC) {
+      access.kind = ACCESS_FSYNC;
+      result = push(trace, &cap, access);
+      continue;
+    }
+    if (record->length == 0 || record->op > VTPC_TRACE_FSYNC) {
+      continue;
+    }
+    const uint64_t end = record->offset + record->length;
+    const uint64_t first = record->offset / block_size;
+    const uint64_t last = (end - 1) / block_size;
+    for (uint64_t index = first; index <= last && result == 0; ++index) {
+      access.index = index;
+      if (record->op == VTPC_TRACE_READ) {
+        access.kind = ACCESS_READ;
+      } else {
+        const bool whole = record->offset <= index * block_size &&
+                           end >= (index + 1) * block_size;
+        access.kind = whole ? ACCESS_OVERWRITE : ACCESS_WRITE;
+      }
+      result = push(trace, &cap, access);
+    }
+  }
+  trace->files = files.size;
+
+  for (size_t i = trace->count; i-- > 0 && result == 0;) {
+    struct access* access = &trace->accesses[i];
+    if (access->kind == ACCESS_FSYNC) {
+      continue;
+    }
+    struct table_entry* entry =
+        table_get(&blocks, access->file, access->index, VTPC_NEVER);
+    if (entry == NULL) {
+      result = -1;
+      break;
+    }
+    access->next = entry->value;
+    entry->value = i;
+  }
+  trace->blocks = blocks.size;
+  free(files.entries);
+  free(blocks.entries);
+  return result;
+}
+
+struct result {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t disk_reads;   // Blocks.
+  uint64_t disk_writes;  // Blocks.
+};
+
+struct pool {
+  struct vtpc_policy* policy;
+  struct vtpc_block* blocks;
+  struct vtpc_block* free;
+  struct vtpc_block** buckets;
+  size_t bucket_mask;
+  struct vtpc_file* files;
+};
+
+static struct vtpc_block** bucket_of(
+    struct pool* pool, const struct vtpc_file* file, uint64_t index
+) {
+  return &pool->buckets[vtpc_hash_key(file->id, index) & pool->bucket_mask];
+}
+
+static struct vtpc_block* find(
+    struct pool* pool, const struct vtpc_file* file, uint64_t index
+) {
+  struct vtpc_block* block = *bucket_of(pool, file, index);
+  while (block != NULL && (block->file != file || block->index != index)) {
+    block = block->hash_next;
+  }
+  return block;
+}
+
+static void unindex(struct pool* pool, struct vtpc_block* block) {
+  struct vtpc_block** link = bucket_of(pool, block->file, block->index);
+  while (*link != block) {
+    link = &(*link)->hash_next;
+  }
+  *link = block->hash_next;
+}
+
+static struct vtpc_block* take(struct pool* pool, struct result* result) {
+  struct vtpc_block* block = pool->free;
+  if (block != NULL) {
+    pool->free = block->next;
+    return block;
+  }
+  block = pool->policy->ops->evict(pool->policy);
+  unindex(pool, block);
+  if ((block->flags & VTPC_BLOCK_DIRTY) != 0) {
+    result->disk_writes++;
+  }
+  return block;
+}
+
+static void access_block(
+    struct pool* pool, const struct access* access, bool hinted,
+    struct result* result
+) {
+  const struct vtpc_policy_ops* ops = pool->policy->ops;
+  struct vtpc_file* file = &pool->files[access->file];
+  struct vtpc_block* block = find(pool, file, access->index);
+  if (block != NULL) {
+    result->hits++;
+    ops->access(pool->policy, block);
+    if (hinted && access->next != VTPC_NEVER) {
+      block->next_use = access->next;
+      ops->update(pool->policy, block);
+    }
+  } else {
+    result->misses++;
+    if (access->kind != ACCESS_OVERWRITE) {
+      result->disk_reads++;
+    }
+    block = take(pool, result);
+    block->file = file;
+    block->index = access->index;
+    block->flags = 0;
+    block->next_use = hinted ? access->next : VTPC_NEVER;
+    struct vtpc_block** bucket = bucket_of(pool, file, access->index);
+    block->hash_next = *bucket;
+    *bucket = block;
+    ops->insert(pool->policy, block);
+  }
+  if (access->kind != ACCESS_READ) {
+    block->flags |= VTPC_BLOCK_DIRTY;
+  }
+}
+
+static void clean(
+    struct pool* pool, size_t capacity, const struct vtpc_file* file,
+    struct result* result
+) {
+  for (size_t i = 0; i < capacity; ++i) {
+    struct vtpc_block* block = &pool->blocks[i];
+    if ((file == NULL || block->file == file) &&
+        (block->flags & VTPC_BLOCK_DIRTY) != 0) {
+      block->flags &= ~(uint32_t)VTPC_BLOCK_DIRTY;
+      result->disk_writes++;
+    }
+  }
+}
+
+static int simulate(
+    const struct trace* trace, const struct vtpc_policy_ops* ops,
+    size_t capacity, struct result* result
+) {
+  memset(result, 0, sizeof(*result));
+  struct vtpc_config config;
+  vtpc_config_default(&config);
+  config.capacity = capacity;
+
+  struct pool pool = {0};
+  size_t buckets = 1;
+  while (buckets < capacity) {
+    buckets <<= 1U;
+  }
+  pool.bucket_mask = buckets - 1;
+  pool.blocks = calloc(capacity, sizeof(struct vtpc_block));
+  pool.buckets = calloc(buckets, sizeof(struct vtpc_block*));
+  pool.files = calloc(trace->files, sizeof(struct vtpc_file));
+  pool.policy = ops->create(capacity, &config);
+  int status = -1;
+  if (pool.blocks != NULL && pool.buckets != NULL && pool.files != NULL &&
+      pool.policy != NULL) {
+    for (size_t i = 0; i < trace->files; ++i) {
+      pool.files[i].id = i + 1;
+    }
+    for (size_t i = capacity; i-- > 0;) {
+      pool.blocks[i].next = pool.free;
+      pool.free = &pool.blocks[i];
+    }
+    const bool hinted = ops->update != NULL;
+    for (size_t i = 0; i < trace->count; ++i) {
+      const struct access* access = &trace->accesses[i];
+      if (access->kind == ACCESS_FSYNC) {
+        clean(&pool, capacity, &pool.files[access->file], result);
+      } else {
+        access_block(&pool, access, hinted, result);
+      }
+    }
+    clean(&pool, capacity, NULL, result);
+    status = 0;
+  }
+  if (pool.policy != NULL) {
+    ops->destroy(pool.policy);
+  }
+  free(pool.blocks);
+  free(pool.buckets);
+  free(pool.files);
+  return status;
+}
+
+// Parses a comma separated list of sizes; returns how many, 0 on error.
+static size_t parse_capacities(const char* text, size_t* capacities) {
+  size_t count = 0;
+  while (*text != '\0' && count < MAX_CAPACITIES) {
+    char* end = NULL;
+    const unsigned long long value = strtoull(text, &end, 0);
+    if (end == text || value == 0 || (*end != ',' && *end != '\0')) {
+      return 0;
+    }
+    capacities[count++] = (size_t)value;
+    text = *end == ',' ? end + 1 : end;
+  }
+  return *text == '\0' ? count : 0;
+}
+
+static void usage(const char* name) {
+  fprintf(
+      stderr,
+      "usage: %s [-b block_size] [-c capacity,...] [-p policy,...] trace\n",
+      name
+  );
+}
+
+int main(int argc, char** argv) {
+  size_t block_size = DEFAULT_BLOCK_SIZE;
+  size_t capacities[MAX_CAPACITIES];
+  size_t capacity_count = 0;
+  char* policies = NULL;
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "b:c:p:")) != -1) {
+    switch (opt) {
+      case 'b':
+        block_size = (size_t)strtoull(optarg, NULL, 0);
+        break;
+      case 'c':
+        capacity_count = parse_capacities(optarg, capacities);
+        if (capacity_count == 0) {
+          usage(argv[0]);
+          return 2;
+        }
+        break;
+      case 'p':
+        policies = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+  if (optind + 1 != argc || block_size < MIN_BLOCK_SIZE ||
+      (block_size & (block_size - 1)) != 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  size_t count = 0;
+  struct vtpc_trace_record* records = read_records(argv[optind], &count);
+  if (records == NULL) {
+    fprintf(stderr, "%s: %s: %s\n", argv[0], argv[optind], strerror(errno));
+    return 1;
+  }
+  struct trace trace;
+  const int loaded = load(&trace, records, count, block_size);
+  free(records);
+  if (loaded == -1) {
+    fprintf(stderr, "%s: out of memory\n", argv[0]);
+    free(trace.accesses);
+    return 1;
+  }
+
+  // By default from MIN_CAPACITY doubling up to the whole working set.
+  if (capacity_count == 0) {
+    size_t capacity = MIN_CAPACITY;
+    do {
+      capacities[capacity_count++] = capacity;
+      capacity *= 2;
+    } while (capacities[capacity_count - 1] < trace.blocks &&
+             capacity_count < MAX_CAPACITIES);
+  }
+
+  printf(
+      "trace: %zu records, %zu block accesses, %zu blocks, %zu files\n",
+      count,
+      trace.count,
+      trace.blocks,
+      trace.files
+  );
+  printf(
+      "%-6s %10s %12s %12s %9s %14s %14s\n",
+      "policy",
+      "capacity",
+      "hits",
+      "misses",
+      "hit_ratio",
+      "disk_read",
+      "disk_write"
+  );
+  static const char* const all = "lru,clock,2q,arc,lfu,opt";
+  char names[256];
+  snprintf(names, sizeof(names), "%s", policies != NULL ? policies : all);
+  int status = 0;
+  char* save = NULL;
+  for (char* name = strtok_r(names, ",", &save); name != NULL;
+       name = strtok_r(NULL, ",", &save)) {
+    const struct vtpc_policy_ops* ops = vtpc_policy_find(name);
+    if (ops == NULL) {
+      fprintf(stderr, "%s: unknown policy '%s'\n", argv[0], name);
+      status = 1;
+      continue;
+    }
+    for (size_t i = 0; i < capacity_count; ++i) {
+      struct result result;
+      if (simulate(&trace, ops, capacities[i], &result) == -1) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        free(trace.accesses);
+        return 1;
+      }
+      const uint64_t accesses = result.hits + result.misses;
+      const uint64_t permille =
+          accesses == 0 ? 0 : result.hits * 1000 / accesses;
+      printf(
+          "%-6s %10zu %12llu %12llu %5llu.%03llu %14llu %14llu\n",
+          name,
+          capacities[i],
+          (unsigned long long)result.hits,
+          (unsigned long long)result.misses,
+          (unsigned long long)(permille / 1000),
+          (unsigned long long)(permille % 1000),
+          (unsigned long long)(result.disk_reads * block_size),
+          (unsigned long long)(result.disk_writes * block_size)
+      );
+    }
+  }
+  free(trace.accesses);
+  return status;
+}